@@ -22,6 +22,14 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <string.h>
+
+#ifndef CMP_NO_FLOAT
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#endif /* CMP_NO_FLOAT */
+
 #include "cmp.h"
 
 static const uint32_t cmp_version_ = 20;
@@ -92,6 +100,22 @@ typedef enum cmp_error_e {
   CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED,
   CMP_ERROR_INTERNAL,
   CMP_ERROR_DISABLED_FLOATING_POINT,
+  CMP_ERROR_ACQUIRE_UNSUPPORTED,
+  CMP_ERROR_MEMORY_CONTEXT_REQUIRED,
+  CMP_ERROR_TAPE_FULL,
+  CMP_ERROR_INVALID_FIELD_TYPE,
+  CMP_ERROR_NO_CHUNKS,
+  CMP_ERROR_INVALID_INDEX,
+  CMP_ERROR_JSON_DEPTH_LIMIT_EXCEEDED,
+  CMP_ERROR_INVALID_JSON,
+  CMP_ERROR_JSON_SIZES_FULL,
+  CMP_ERROR_MAP_ENTRIES_FULL,
+  CMP_ERROR_DUPLICATE_MAP_KEY,
+  CMP_ERROR_DEPTH_LIMIT_EXCEEDED,
+  CMP_ERROR_INVALID_STRING_REF,
+  CMP_ERROR_INVALID_TIMESTAMP,
+  CMP_ERROR_BUFFER_TOO_LARGE,
+  CMP_ERROR_JSON_NUMBER_OUT_OF_RANGE,
   CMP_ERROR_MAX
 } cmp_error_t;
 
@@ -116,6 +140,22 @@ static const char *cmp_error_message(cmp_error_t error) {
     case CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED: return "Depth limit exceeded while skipping";
     case CMP_ERROR_INTERNAL:                  return "Internal error";
     case CMP_ERROR_DISABLED_FLOATING_POINT:   return "Floating point operations disabled";
+    case CMP_ERROR_ACQUIRE_UNSUPPORTED:       return "Backend does not support zero-copy reads";
+    case CMP_ERROR_MEMORY_CONTEXT_REQUIRED:   return "Operation requires a memory context";
+    case CMP_ERROR_TAPE_FULL:                 return "Tape is too small";
+    case CMP_ERROR_INVALID_FIELD_TYPE:        return "Invalid struct field type";
+    case CMP_ERROR_NO_CHUNKS:                 return "No room for any chunks";
+    case CMP_ERROR_INVALID_INDEX:             return "Invalid record index";
+    case CMP_ERROR_JSON_DEPTH_LIMIT_EXCEEDED: return "JSON nested too deeply";
+    case CMP_ERROR_INVALID_JSON:              return "Invalid JSON";
+    case CMP_ERROR_JSON_SIZES_FULL:           return "Too many JSON containers for the sizes given";
+    case CMP_ERROR_MAP_ENTRIES_FULL:          return "Too many map entries for the entries given";
+    case CMP_ERROR_DUPLICATE_MAP_KEY:         return "Duplicate map key";
+    case CMP_ERROR_DEPTH_LIMIT_EXCEEDED:      return "Depth limit exceeded";
+    case CMP_ERROR_INVALID_STRING_REF:        return "Invalid string table reference";
+    case CMP_ERROR_INVALID_TIMESTAMP:         return "Invalid timestamp";
+    case CMP_ERROR_BUFFER_TOO_LARGE:          return "Buffer too large (> 4 GiB)";
+    case CMP_ERROR_JSON_NUMBER_OUT_OF_RANGE:  return "JSON number out of range";
     case CMP_ERROR_MAX:                       return "Max Error";
   }
   return "";
@@ -139,10 +179,6 @@ static uint16_t be16(uint16_t x) {
   return x;
 }
 
-static int16_t sbe16(int16_t x) {
-  return (int16_t)be16((uint16_t)x);
-}
-
 static uint32_t be32(uint32_t x) {
   if (!is_bigendian())
     return ((uint32_t)be16((uint16_t)(x >> 16)))
@@ -151,10 +187,6 @@ static uint32_t be32(uint32_t x) {
   return x;
 }
 
-static int32_t sbe32(int32_t x) {
-  return (int32_t)be32((uint32_t)x);
-}
-
 static uint64_t be64(uint64_t x) {
   if (!is_bigendian())
     return ((uint64_t)be32((uint32_t)(x >> 32)))
@@ -163,10 +195,6 @@ static uint64_t be64(uint64_t x) {
   return x;
 }
 
-static int64_t sbe64(int64_t x) {
-  return (int64_t)be64((uint64_t)x);
-}
-
 #ifndef CMP_NO_FLOAT
 static float decode_befloat(const char *b) {
   float f = 0.;
@@ -217,16 +245,454 @@ static double decode_bedouble(const char *b) {
 }
 #endif /* CMP_NO_FLOAT */
 
+static bool mem_reader(cmp_ctx_t *ctx, void *data, size_t limit) {
+  if (limit > (ctx->buf_size - ctx->buf_pos))
+    return false;
+
+  if (limit) {
+    memcpy(data, (const uint8_t *)ctx->buf + ctx->buf_pos, limit);
+    ctx->buf_pos += limit;
+  }
+
+  return true;
+}
+
+static bool mem_skipper(cmp_ctx_t *ctx, size_t count) {
+  if (count > (ctx->buf_size - ctx->buf_pos))
+    return false;
+
+  ctx->buf_pos += count;
+  return true;
+}
+
+static bool mem_acquirer(cmp_ctx_t *ctx, const void **data, size_t count) {
+  if (count > (ctx->buf_size - ctx->buf_pos))
+    return false;
+
+  *data = (const uint8_t *)ctx->buf + ctx->buf_pos;
+  ctx->buf_pos += count;
+  return true;
+}
+
+static size_t mem_writer(cmp_ctx_t *ctx, const void *data, size_t count) {
+  if (count > (ctx->buf_size - ctx->buf_pos))
+    return 0;
+
+  if (count) {
+    memcpy((uint8_t *)ctx->buf + ctx->buf_pos, data, count);
+    ctx->buf_pos += count;
+  }
+
+  return count;
+}
+
+static size_t mem_readonly_writer(cmp_ctx_t *ctx, const void *data,
+                                                  size_t count) {
+  (void)ctx;
+  (void)data;
+  (void)count;
+
+  return 0;
+}
+
+/*
+ * Makes sure at least `count` bytes (which must not exceed the capacity) are
+ * waiting in a buffered reader's window, moving what's left of it to the front
+ * and refilling the rest.
+ */
+static bool buffered_fill(cmp_buffered_t *buffered, size_t count) {
+  size_t filled;
+
+  if ((buffered->end - buffered->pos) >= count)
+    return true;
+
+  if (buffered->pos) {
+    memmove(
+      buffered->data,
+      buffered->data + buffered->pos,
+      buffered->end - buffered->pos
+    );
+    buffered->end -= buffered->pos;
+    buffered->pos = 0;
+  }
+
+  while (buffered->end < count) {
+    filled = buffered->fill(
+      &buffered->backend,
+      buffered->data + buffered->end,
+      buffered->capacity - buffered->end
+    );
+
+    if (!filled)
+      return false;
+
+    buffered->end += filled;
+  }
+
+  return true;
+}
+
+static bool buffered_reader(cmp_ctx_t *ctx, void *data, size_t limit) {
+  cmp_buffered_t *buffered = (cmp_buffered_t *)ctx->buf;
+  uint8_t *out = (uint8_t *)data;
+  size_t available = buffered->end - buffered->pos;
+  size_t filled;
+
+  if (limit <= available) {
+    if (limit) {
+      memcpy(out, buffered->data + buffered->pos, limit);
+      buffered->pos += limit;
+    }
+    return true;
+  }
+
+  if (available) {
+    memcpy(out, buffered->data + buffered->pos, available);
+    out += available;
+    limit -= available;
+  }
+
+  buffered->pos = 0;
+  buffered->end = 0;
+
+  /* Reads that wouldn't fit in the window skip it entirely */
+  if (limit >= buffered->capacity) {
+    while (limit) {
+      filled = buffered->fill(&buffered->backend, out, limit);
+
+      if (!filled)
+        return false;
+
+      out += filled;
+      limit -= filled;
+    }
+
+    return true;
+  }
+
+  if (!buffered_fill(buffered, limit))
+    return false;
+
+  memcpy(out, buffered->data, limit);
+  buffered->pos = limit;
+  return true;
+}
+
+static bool buffered_skipper(cmp_ctx_t *ctx, size_t count) {
+  cmp_buffered_t *buffered = (cmp_buffered_t *)ctx->buf;
+  size_t available = buffered->end - buffered->pos;
+  size_t filled;
+
+  if (count <= available) {
+    buffered->pos += count;
+    return true;
+  }
+
+  count -= available;
+  buffered->pos = 0;
+  buffered->end = 0;
+
+  if (buffered->backend.skip)
+    return buffered->backend.skip(&buffered->backend, count);
+
+  while (count) {
+    filled = buffered->fill(
+      &buffered->backend,
+      buffered->data,
+      count < buffered->capacity ? count : buffered->capacity
+    );
+
+    if (!filled)
+      return false;
+
+    count -= filled;
+  }
+
+  return true;
+}
+
+static bool buffered_acquirer(cmp_ctx_t *ctx, const void **data,
+                                              size_t count) {
+  cmp_buffered_t *buffered = (cmp_buffered_t *)ctx->buf;
+
+  if (count > buffered->capacity)
+    return false;
+
+  if (!buffered_fill(buffered, count))
+    return false;
+
+  *data = buffered->data + buffered->pos;
+  buffered->pos += count;
+  return true;
+}
+
+static bool buffered_flush(cmp_buffered_t *buffered) {
+  cmp_ctx_t *backend = &buffered->backend;
+  size_t count = buffered->pos;
+
+  if (!count)
+    return true;
+
+  if (backend->write(backend, buffered->data, count) != count)
+    return false;
+
+  buffered->pos = 0;
+  return true;
+}
+
+static size_t buffered_writer(cmp_ctx_t *ctx, const void *data, size_t count) {
+  cmp_buffered_t *buffered = (cmp_buffered_t *)ctx->buf;
+
+  if (count > (buffered->capacity - buffered->pos)) {
+    if (!buffered_flush(buffered))
+      return 0;
+
+    /* Writes that wouldn't fit in the buffer go straight through */
+    if (count >= buffered->capacity)
+      return buffered->backend.write(&buffered->backend, data, count);
+  }
+
+  if (count) {
+    memcpy(buffered->data + buffered->pos, data, count);
+    buffered->pos += count;
+  }
+
+  return count;
+}
+
+static size_t encoder_pending(const cmp_encoder_t *encoder) {
+  return (encoder->staged_end - encoder->staged_pos) + encoder->payload_size;
+}
+
+/* Moves whatever is staged to the front of the staging area */
+static size_t encoder_compact(cmp_encoder_t *encoder) {
+  size_t staged = encoder->staged_end - encoder->staged_pos;
+
+  if (encoder->staged_pos) {
+    memmove(encoder->staged, encoder->staged + encoder->staged_pos, staged);
+    encoder->staged_pos = 0;
+    encoder->staged_end = staged;
+  }
+
+  return staged;
+}
+
+/*
+ * Holds on to the part of a plain write the backend didn't take.  Plain writes
+ * CMP builds on the stack are never more than a fixstr's worth, and those are
+ * copied; larger ones can only be the caller's own payloads, so those are
+ * referenced.  Blocks, which are larger and also on the stack, never come
+ * through here (see `encoder_write_block`).
+ */
+static bool encoder_stash(cmp_encoder_t *encoder, const uint8_t *data,
+                                                  size_t count,
+                                                  size_t total) {
+  size_t staged;
+
+  if (encoder->payload_size)
+    return false;
+
+  staged = encoder_compact(encoder);
+
+  if (staged <= CMP_ENCODER_STASH_SIZE &&
+      count <= (CMP_ENCODER_STASH_SIZE - staged)) {
+    memcpy(encoder->staged + staged, data, count);
+    encoder->staged_end += count;
+    return true;
+  }
+
+  if (total <= (1 + FIXSTR_SIZE))
+    return false;
+
+  encoder->payload = data;
+  encoder->payload_size = count;
+  return true;
+}
+
+/* Passes as much pending data to the backend as it will take */
+static size_t encoder_resume(cmp_encoder_t *encoder) {
+  size_t written;
+
+  if (encoder->staged_pos < encoder->staged_end) {
+    written = encoder->backend.write(
+      &encoder->backend,
+      encoder->staged + encoder->staged_pos,
+      encoder->staged_end - encoder->staged_pos
+    );
+    encoder->staged_pos += written;
+
+    if (encoder->staged_pos < encoder->staged_end)
+      return encoder_pending(encoder);
+
+    encoder->staged_pos = 0;
+    encoder->staged_end = 0;
+  }
+
+  if (encoder->payload_size) {
+    written = encoder->backend.write(
+      &encoder->backend, encoder->payload, encoder->payload_size
+    );
+    encoder->payload += written;
+    encoder->payload_size -= written;
+
+    if (!encoder->payload_size)
+      encoder->payload = NULL;
+  }
+
+  return encoder_pending(encoder);
+}
+
+/*
+ * Writes a block from one of the bulk writers.  Blocks live on the writer's
+ * stack, so unlike plain writes, none of a block can be left referenced: the
+ * backend is given everything it will take for as long as it keeps taking
+ * some, and only then is the rest copied into the encoder.
+ */
+static bool encoder_write_block(cmp_encoder_t *encoder, const uint8_t *data,
+                                                        size_t count) {
+  size_t pending = encoder_pending(encoder);
+  size_t written;
+  size_t staged;
+
+  while (pending) {
+    written = pending;
+    pending = encoder_resume(encoder);
+
+    if (pending == written)
+      break;
+  }
+
+  while (count && !pending) {
+    written = encoder->backend.write(&encoder->backend, data, count);
+
+    if (!written)
+      break;
+
+    data += written;
+    count -= written;
+  }
+
+  if (!count)
+    return true;
+
+  /* Staged data goes out first, so none can be queued behind a payload */
+  if (encoder->payload_size)
+    return false;
+
+  staged = encoder_compact(encoder);
+
+  if (count > (sizeof(encoder->staged) - staged))
+    return false;
+
+  memcpy(encoder->staged + staged, data, count);
+  encoder->staged_end += count;
+  return true;
+}
+
+static size_t encoder_writer(cmp_ctx_t *ctx, const void *data, size_t count) {
+  cmp_encoder_t *encoder = (cmp_encoder_t *)ctx->buf;
+  size_t written = 0;
+
+  if (!encoder_pending(encoder)) {
+    written = encoder->backend.write(&encoder->backend, data, count);
+
+    if (written >= count)
+      return count;
+  }
+
+  if (!encoder_stash(encoder, (const uint8_t *)data + written,
+                              count - written,
+                              count)) {
+    return 0;
+  }
+
+  return count;
+}
+
+/*
+ * All backend I/O goes through these helpers.  When the built-in memory
+ * backend is installed they call it directly (and the compiler can inline
+ * it), so the common case of working on a memory buffer never pays for an
+ * indirect call.
+ */
+static bool read_bytes(cmp_ctx_t *ctx, void *data, size_t count) {
+  if (ctx->read == mem_reader)
+    return mem_reader(ctx, data, count);
+
+  return ctx->read(ctx, data, count);
+}
+
+static bool acquire_bytes(cmp_ctx_t *ctx, const void **data, size_t count) {
+  if (ctx->acquire == mem_acquirer) {
+    if (mem_acquirer(ctx, data, count))
+      return true;
+  }
+  else if (!ctx->acquire) {
+    ctx->error = CMP_ERROR_ACQUIRE_UNSUPPORTED;
+    return false;
+  }
+  else if (ctx->acquire(ctx, data, count)) {
+    return true;
+  }
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+static bool write_bytes(cmp_ctx_t *ctx, const void *data, size_t count) {
+  if (ctx->write == mem_writer)
+    return mem_writer(ctx, data, count) == count;
+
+  return ctx->write(ctx, data, count) == count;
+}
+
 static bool read_byte(cmp_ctx_t *ctx, uint8_t *x) {
+  if (ctx->read == mem_reader) {
+    if (ctx->buf_pos >= ctx->buf_size)
+      return false;
+
+    *x = ((const uint8_t *)ctx->buf)[ctx->buf_pos++];
+    return true;
+  }
+
+  if (ctx->read == buffered_reader) {
+    cmp_buffered_t *buffered = (cmp_buffered_t *)ctx->buf;
+
+    if (buffered->pos < buffered->end) {
+      *x = buffered->data[buffered->pos++];
+      return true;
+    }
+  }
+
   return ctx->read(ctx, x, sizeof(uint8_t));
 }
 
 static bool write_byte(cmp_ctx_t *ctx, uint8_t x) {
+  if (ctx->write == mem_writer) {
+    if (ctx->buf_pos >= ctx->buf_size)
+      return false;
+
+    ((uint8_t *)ctx->buf)[ctx->buf_pos++] = x;
+    return true;
+  }
+
+  if (ctx->write == buffered_writer) {
+    cmp_buffered_t *buffered = (cmp_buffered_t *)ctx->buf;
+
+    if (buffered->pos < buffered->capacity) {
+      buffered->data[buffered->pos++] = x;
+      return true;
+    }
+  }
+
   return ctx->write(ctx, &x, sizeof(uint8_t)) == sizeof(uint8_t);
 }
 
 static bool skip_bytes(cmp_ctx_t *ctx, size_t count) {
-  if (ctx->skip) {
+  if (ctx->skip == mem_skipper) {
+    return mem_skipper(ctx, count);
+  }
+  else if (ctx->skip) {
     return ctx->skip(ctx, count);
   }
   else {
@@ -234,7 +700,7 @@ static bool skip_bytes(cmp_ctx_t *ctx, size_t count) {
 
     for (i = 0; i < count; ++i) {
       uint8_t floor;
-      if (!ctx->read(ctx, &floor, sizeof(uint8_t))) {
+      if (!read_byte(ctx, &floor)) {
         return false;
       }
     }
@@ -268,498 +734,748 @@ static bool write_fixed_value(cmp_ctx_t *ctx, uint8_t value) {
   return false;
 }
 
-static bool type_marker_to_cmp_type(uint8_t type_marker, uint8_t *cmp_type) {
-  if (type_marker <= 0x7F) {
-    *cmp_type = CMP_TYPE_POSITIVE_FIXNUM;
-    return true;
-  }
+static void store_be16(uint8_t *b, uint16_t x) {
+  b[0] = (uint8_t)(x >> 8);
+  b[1] = (uint8_t)x;
+}
 
-  if (type_marker <= 0x8F) {
-    *cmp_type = CMP_TYPE_FIXMAP;
-    return true;
-  }
+static void store_be32(uint8_t *b, uint32_t x) {
+  b[0] = (uint8_t)(x >> 24);
+  b[1] = (uint8_t)(x >> 16);
+  b[2] = (uint8_t)(x >> 8);
+  b[3] = (uint8_t)x;
+}
+
+static void store_be64(uint8_t *b, uint64_t x) {
+  store_be32(b, (uint32_t)(x >> 32));
+  store_be32(b + 4, (uint32_t)x);
+}
+
+static uint16_t load_be16(const uint8_t *b) {
+  return (uint16_t)((b[0] << 8) | b[1]);
+}
+
+static uint32_t load_be32(const uint8_t *b) {
+  return ((uint32_t)b[0] << 24)
+       | ((uint32_t)b[1] << 16)
+       | ((uint32_t)b[2] << 8)
+       | ((uint32_t)b[3]);
+}
+
+static uint64_t load_be64(const uint8_t *b) {
+  return ((uint64_t)load_be32(b) << 32) | (uint64_t)load_be32(b + 4);
+}
 
-  if (type_marker <= 0x9F) {
-    *cmp_type = CMP_TYPE_FIXARRAY;
+/*
+ * Writers assemble a marker and whatever follows it in a small buffer, and
+ * then hand the whole thing to the backend in a single write.  Backends that
+ * lock or make a system call per write pay that cost once per value instead of
+ * two or three times.
+ */
+static bool write_encoded(cmp_ctx_t *ctx, const uint8_t *data, size_t count,
+                                                                uint8_t error) {
+  if (write_bytes(ctx, data, count))
     return true;
+
+  ctx->error = error;
+  return false;
+}
+
+static bool write_marker_u8(cmp_ctx_t *ctx, uint8_t marker, uint8_t x,
+                                                            uint8_t error) {
+  uint8_t buf[1 + sizeof(uint8_t)];
+
+  buf[0] = marker;
+  buf[1] = x;
+
+  return write_encoded(ctx, buf, sizeof(buf), error);
+}
+
+static bool write_marker_u16(cmp_ctx_t *ctx, uint8_t marker, uint16_t x,
+                                                             uint8_t error) {
+  uint8_t buf[1 + sizeof(uint16_t)];
+
+  buf[0] = marker;
+  store_be16(buf + 1, x);
+
+  return write_encoded(ctx, buf, sizeof(buf), error);
+}
+
+static bool write_marker_u32(cmp_ctx_t *ctx, uint8_t marker, uint32_t x,
+                                                             uint8_t error) {
+  uint8_t buf[1 + sizeof(uint32_t)];
+
+  buf[0] = marker;
+  store_be32(buf + 1, x);
+
+  return write_encoded(ctx, buf, sizeof(buf), error);
+}
+
+static bool write_marker_u64(cmp_ctx_t *ctx, uint8_t marker, uint64_t x,
+                                                             uint8_t error) {
+  uint8_t buf[1 + sizeof(uint64_t)];
+
+  buf[0] = marker;
+  store_be64(buf + 1, x);
+
+  return write_encoded(ctx, buf, sizeof(buf), error);
+}
+
+/* Writes a fixext marker, its type and its 1 to 16 bytes of data at once */
+static bool write_fixext(cmp_ctx_t *ctx, uint8_t marker, int8_t type,
+                                                         const void *data,
+                                                         size_t size) {
+  uint8_t buf[2 + 16];
+
+  buf[0] = marker;
+  buf[1] = (uint8_t)type;
+  memcpy(buf + 2, data, size);
+
+  return write_encoded(ctx, buf, 2 + size, CMP_ERROR_DATA_WRITING);
+}
+
+/* Writes an ext8, ext16 or ext32 marker with its size and type */
+static bool write_ext_header(cmp_ctx_t *ctx, uint8_t marker, int8_t type,
+                                                             uint32_t size) {
+  uint8_t buf[1 + sizeof(uint32_t) + 1];
+  size_t width;
+
+  buf[0] = marker;
+
+  switch (marker) {
+    case EXT8_MARKER:
+      buf[1] = (uint8_t)size;
+      width = sizeof(uint8_t);
+      break;
+    case EXT16_MARKER:
+      store_be16(buf + 1, (uint16_t)size);
+      width = sizeof(uint16_t);
+      break;
+    default:
+      store_be32(buf + 1, size);
+      width = sizeof(uint32_t);
+      break;
   }
 
-  if (type_marker <= 0xBF) {
-    *cmp_type = CMP_TYPE_FIXSTR;
+  buf[1 + width] = (uint8_t)type;
+
+  return write_encoded(ctx, buf, 2 + width, CMP_ERROR_LENGTH_WRITING);
+}
+
+/*
+ * Writes the payload of a str, bin or ext after its header, which has already
+ * been written.
+ */
+static bool write_payload(cmp_ctx_t *ctx, const void *data, size_t size) {
+  if (size == 0)
     return true;
-  }
 
-  if (type_marker >= 0xE0) {
-    *cmp_type = CMP_TYPE_NEGATIVE_FIXNUM;
+  if (write_bytes(ctx, data, size))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_WRITING;
+  return false;
+}
+
+/*
+ * Everything CMP needs to know about a type marker in order to decode or skip
+ * the object it begins, so that readers and skippers can classify a marker
+ * with a single lookup:
+ *
+ * - type:  the CMP type, or INVALID_CMP_TYPE for the unused marker (0xC1)
+ * - width: the width of the big-endian length field following the marker, or
+ *          0 if there isn't one
+ * - size:  for types without a length field, the size of the data following
+ *          the marker (not counting an ext's type), or the element count of a
+ *          fixarray or fixmap
+ * - flags: MARKER_EXT for extended types, MARKER_ARRAY and MARKER_MAP for
+ *          containers
+ */
+typedef struct marker_info_s {
+  uint8_t type;
+  uint8_t width;
+  uint8_t size;
+  uint8_t flags;
+} marker_info_t;
+
+enum {
+  INVALID_CMP_TYPE = 0xFF
+};
+
+enum {
+  MARKER_EXT   = 0x01,
+  MARKER_ARRAY = 0x02,
+  MARKER_MAP   = 0x04
+};
+
+static const marker_info_t marker_info[256] = {
+  /* 0x00 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x01 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x02 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x03 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x04 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x05 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x06 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x07 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x08 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x09 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x0A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x0B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x0C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x0D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x0E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x0F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x10 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x11 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x12 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x13 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x14 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x15 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x16 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x17 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x18 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x19 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x1A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x1B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x1C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x1D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x1E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x1F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x20 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x21 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x22 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x23 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x24 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x25 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x26 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x27 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x28 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x29 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x2A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x2B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x2C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x2D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x2E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x2F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x30 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x31 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x32 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x33 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x34 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x35 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x36 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x37 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x38 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x39 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x3A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x3B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x3C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x3D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x3E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x3F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x40 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x41 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x42 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x43 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x44 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x45 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x46 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x47 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x48 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x49 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x4A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x4B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x4C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x4D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x4E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x4F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x50 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x51 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x52 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x53 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x54 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x55 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x56 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x57 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x58 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x59 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x5A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x5B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x5C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x5D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x5E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x5F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x60 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x61 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x62 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x63 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x64 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x65 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x66 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x67 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x68 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x69 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x6A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x6B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x6C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x6D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x6E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x6F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x70 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x71 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x72 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x73 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x74 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x75 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x76 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x77 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x78 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x79 */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x7A */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x7B */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x7C */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x7D */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x7E */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x7F */ { CMP_TYPE_POSITIVE_FIXNUM, 0,  0, 0 },
+  /* 0x80 */ { CMP_TYPE_FIXMAP,          0,  0, MARKER_MAP },
+  /* 0x81 */ { CMP_TYPE_FIXMAP,          0,  1, MARKER_MAP },
+  /* 0x82 */ { CMP_TYPE_FIXMAP,          0,  2, MARKER_MAP },
+  /* 0x83 */ { CMP_TYPE_FIXMAP,          0,  3, MARKER_MAP },
+  /* 0x84 */ { CMP_TYPE_FIXMAP,          0,  4, MARKER_MAP },
+  /* 0x85 */ { CMP_TYPE_FIXMAP,          0,  5, MARKER_MAP },
+  /* 0x86 */ { CMP_TYPE_FIXMAP,          0,  6, MARKER_MAP },
+  /* 0x87 */ { CMP_TYPE_FIXMAP,          0,  7, MARKER_MAP },
+  /* 0x88 */ { CMP_TYPE_FIXMAP,          0,  8, MARKER_MAP },
+  /* 0x89 */ { CMP_TYPE_FIXMAP,          0,  9, MARKER_MAP },
+  /* 0x8A */ { CMP_TYPE_FIXMAP,          0, 10, MARKER_MAP },
+  /* 0x8B */ { CMP_TYPE_FIXMAP,          0, 11, MARKER_MAP },
+  /* 0x8C */ { CMP_TYPE_FIXMAP,          0, 12, MARKER_MAP },
+  /* 0x8D */ { CMP_TYPE_FIXMAP,          0, 13, MARKER_MAP },
+  /* 0x8E */ { CMP_TYPE_FIXMAP,          0, 14, MARKER_MAP },
+  /* 0x8F */ { CMP_TYPE_FIXMAP,          0, 15, MARKER_MAP },
+  /* 0x90 */ { CMP_TYPE_FIXARRAY,        0,  0, MARKER_ARRAY },
+  /* 0x91 */ { CMP_TYPE_FIXARRAY,        0,  1, MARKER_ARRAY },
+  /* 0x92 */ { CMP_TYPE_FIXARRAY,        0,  2, MARKER_ARRAY },
+  /* 0x93 */ { CMP_TYPE_FIXARRAY,        0,  3, MARKER_ARRAY },
+  /* 0x94 */ { CMP_TYPE_FIXARRAY,        0,  4, MARKER_ARRAY },
+  /* 0x95 */ { CMP_TYPE_FIXARRAY,        0,  5, MARKER_ARRAY },
+  /* 0x96 */ { CMP_TYPE_FIXARRAY,        0,  6, MARKER_ARRAY },
+  /* 0x97 */ { CMP_TYPE_FIXARRAY,        0,  7, MARKER_ARRAY },
+  /* 0x98 */ { CMP_TYPE_FIXARRAY,        0,  8, MARKER_ARRAY },
+  /* 0x99 */ { CMP_TYPE_FIXARRAY,        0,  9, MARKER_ARRAY },
+  /* 0x9A */ { CMP_TYPE_FIXARRAY,        0, 10, MARKER_ARRAY },
+  /* 0x9B */ { CMP_TYPE_FIXARRAY,        0, 11, MARKER_ARRAY },
+  /* 0x9C */ { CMP_TYPE_FIXARRAY,        0, 12, MARKER_ARRAY },
+  /* 0x9D */ { CMP_TYPE_FIXARRAY,        0, 13, MARKER_ARRAY },
+  /* 0x9E */ { CMP_TYPE_FIXARRAY,        0, 14, MARKER_ARRAY },
+  /* 0x9F */ { CMP_TYPE_FIXARRAY,        0, 15, MARKER_ARRAY },
+  /* 0xA0 */ { CMP_TYPE_FIXSTR,          0,  0, 0 },
+  /* 0xA1 */ { CMP_TYPE_FIXSTR,          0,  1, 0 },
+  /* 0xA2 */ { CMP_TYPE_FIXSTR,          0,  2, 0 },
+  /* 0xA3 */ { CMP_TYPE_FIXSTR,          0,  3, 0 },
+  /* 0xA4 */ { CMP_TYPE_FIXSTR,          0,  4, 0 },
+  /* 0xA5 */ { CMP_TYPE_FIXSTR,          0,  5, 0 },
+  /* 0xA6 */ { CMP_TYPE_FIXSTR,          0,  6, 0 },
+  /* 0xA7 */ { CMP_TYPE_FIXSTR,          0,  7, 0 },
+  /* 0xA8 */ { CMP_TYPE_FIXSTR,          0,  8, 0 },
+  /* 0xA9 */ { CMP_TYPE_FIXSTR,          0,  9, 0 },
+  /* 0xAA */ { CMP_TYPE_FIXSTR,          0, 10, 0 },
+  /* 0xAB */ { CMP_TYPE_FIXSTR,          0, 11, 0 },
+  /* 0xAC */ { CMP_TYPE_FIXSTR,          0, 12, 0 },
+  /* 0xAD */ { CMP_TYPE_FIXSTR,          0, 13, 0 },
+  /* 0xAE */ { CMP_TYPE_FIXSTR,          0, 14, 0 },
+  /* 0xAF */ { CMP_TYPE_FIXSTR,          0, 15, 0 },
+  /* 0xB0 */ { CMP_TYPE_FIXSTR,          0, 16, 0 },
+  /* 0xB1 */ { CMP_TYPE_FIXSTR,          0, 17, 0 },
+  /* 0xB2 */ { CMP_TYPE_FIXSTR,          0, 18, 0 },
+  /* 0xB3 */ { CMP_TYPE_FIXSTR,          0, 19, 0 },
+  /* 0xB4 */ { CMP_TYPE_FIXSTR,          0, 20, 0 },
+  /* 0xB5 */ { CMP_TYPE_FIXSTR,          0, 21, 0 },
+  /* 0xB6 */ { CMP_TYPE_FIXSTR,          0, 22, 0 },
+  /* 0xB7 */ { CMP_TYPE_FIXSTR,          0, 23, 0 },
+  /* 0xB8 */ { CMP_TYPE_FIXSTR,          0, 24, 0 },
+  /* 0xB9 */ { CMP_TYPE_FIXSTR,          0, 25, 0 },
+  /* 0xBA */ { CMP_TYPE_FIXSTR,          0, 26, 0 },
+  /* 0xBB */ { CMP_TYPE_FIXSTR,          0, 27, 0 },
+  /* 0xBC */ { CMP_TYPE_FIXSTR,          0, 28, 0 },
+  /* 0xBD */ { CMP_TYPE_FIXSTR,          0, 29, 0 },
+  /* 0xBE */ { CMP_TYPE_FIXSTR,          0, 30, 0 },
+  /* 0xBF */ { CMP_TYPE_FIXSTR,          0, 31, 0 },
+  /* 0xC0 */ { CMP_TYPE_NIL,             0,  0, 0 },
+  /* 0xC1 */ { INVALID_CMP_TYPE,         0,  0, 0 },
+  /* 0xC2 */ { CMP_TYPE_BOOLEAN,         0,  0, 0 },
+  /* 0xC3 */ { CMP_TYPE_BOOLEAN,         0,  0, 0 },
+  /* 0xC4 */ { CMP_TYPE_BIN8,            1,  0, 0 },
+  /* 0xC5 */ { CMP_TYPE_BIN16,           2,  0, 0 },
+  /* 0xC6 */ { CMP_TYPE_BIN32,           4,  0, 0 },
+  /* 0xC7 */ { CMP_TYPE_EXT8,            1,  0, MARKER_EXT },
+  /* 0xC8 */ { CMP_TYPE_EXT16,           2,  0, MARKER_EXT },
+  /* 0xC9 */ { CMP_TYPE_EXT32,           4,  0, MARKER_EXT },
+  /* 0xCA */ { CMP_TYPE_FLOAT,           0,  4, 0 },
+  /* 0xCB */ { CMP_TYPE_DOUBLE,          0,  8, 0 },
+  /* 0xCC */ { CMP_TYPE_UINT8,           0,  1, 0 },
+  /* 0xCD */ { CMP_TYPE_UINT16,          0,  2, 0 },
+  /* 0xCE */ { CMP_TYPE_UINT32,          0,  4, 0 },
+  /* 0xCF */ { CMP_TYPE_UINT64,          0,  8, 0 },
+  /* 0xD0 */ { CMP_TYPE_SINT8,           0,  1, 0 },
+  /* 0xD1 */ { CMP_TYPE_SINT16,          0,  2, 0 },
+  /* 0xD2 */ { CMP_TYPE_SINT32,          0,  4, 0 },
+  /* 0xD3 */ { CMP_TYPE_SINT64,          0,  8, 0 },
+  /* 0xD4 */ { CMP_TYPE_FIXEXT1,         0,  1, MARKER_EXT },
+  /* 0xD5 */ { CMP_TYPE_FIXEXT2,         0,  2, MARKER_EXT },
+  /* 0xD6 */ { CMP_TYPE_FIXEXT4,         0,  4, MARKER_EXT },
+  /* 0xD7 */ { CMP_TYPE_FIXEXT8,         0,  8, MARKER_EXT },
+  /* 0xD8 */ { CMP_TYPE_FIXEXT16,        0, 16, MARKER_EXT },
+  /* 0xD9 */ { CMP_TYPE_STR8,            1,  0, 0 },
+  /* 0xDA */ { CMP_TYPE_STR16,           2,  0, 0 },
+  /* 0xDB */ { CMP_TYPE_STR32,           4,  0, 0 },
+  /* 0xDC */ { CMP_TYPE_ARRAY16,         2,  0, MARKER_ARRAY },
+  /* 0xDD */ { CMP_TYPE_ARRAY32,         4,  0, MARKER_ARRAY },
+  /* 0xDE */ { CMP_TYPE_MAP16,           2,  0, MARKER_MAP },
+  /* 0xDF */ { CMP_TYPE_MAP32,           4,  0, MARKER_MAP },
+  /* 0xE0 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE1 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE2 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE3 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE4 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE5 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE6 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE7 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE8 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xE9 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xEA */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xEB */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xEC */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xED */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xEE */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xEF */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF0 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF1 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF2 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF3 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF4 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF5 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF6 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF7 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF8 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xF9 */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xFA */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xFB */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xFC */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xFD */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xFE */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 },
+  /* 0xFF */ { CMP_TYPE_NEGATIVE_FIXNUM, 0,  0, 0 }
+};
+
+static bool read_u8_value(cmp_ctx_t *ctx, uint8_t *x) {
+  if (read_byte(ctx, x))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+static bool read_u16_value(cmp_ctx_t *ctx, uint16_t *x) {
+  if (read_bytes(ctx, x, sizeof(uint16_t))) {
+    *x = be16(*x);
     return true;
   }
 
-  switch (type_marker) {
-    case NIL_MARKER:
-      *cmp_type = CMP_TYPE_NIL;
-      return true;
-    case FALSE_MARKER:
-      *cmp_type = CMP_TYPE_BOOLEAN;
-      return true;
-    case TRUE_MARKER:
-      *cmp_type = CMP_TYPE_BOOLEAN;
-      return true;
-    case BIN8_MARKER:
-      *cmp_type = CMP_TYPE_BIN8;
-      return true;
-    case BIN16_MARKER:
-      *cmp_type = CMP_TYPE_BIN16;
-      return true;
-    case BIN32_MARKER:
-      *cmp_type = CMP_TYPE_BIN32;
-      return true;
-    case EXT8_MARKER:
-      *cmp_type = CMP_TYPE_EXT8;
-      return true;
-    case EXT16_MARKER:
-      *cmp_type = CMP_TYPE_EXT16;
-      return true;
-    case EXT32_MARKER:
-      *cmp_type = CMP_TYPE_EXT32;
-      return true;
-    case FLOAT_MARKER:
-      *cmp_type = CMP_TYPE_FLOAT;
-      return true;
-    case DOUBLE_MARKER:
-      *cmp_type = CMP_TYPE_DOUBLE;
-      return true;
-    case U8_MARKER:
-      *cmp_type = CMP_TYPE_UINT8;
-      return true;
-    case U16_MARKER:
-      *cmp_type = CMP_TYPE_UINT16;
-      return true;
-    case U32_MARKER:
-      *cmp_type = CMP_TYPE_UINT32;
-      return true;
-    case U64_MARKER:
-      *cmp_type = CMP_TYPE_UINT64;
-      return true;
-    case S8_MARKER:
-      *cmp_type = CMP_TYPE_SINT8;
-      return true;
-    case S16_MARKER:
-      *cmp_type = CMP_TYPE_SINT16;
-      return true;
-    case S32_MARKER:
-      *cmp_type = CMP_TYPE_SINT32;
-      return true;
-    case S64_MARKER:
-      *cmp_type = CMP_TYPE_SINT64;
-      return true;
-    case FIXEXT1_MARKER:
-      *cmp_type = CMP_TYPE_FIXEXT1;
-      return true;
-    case FIXEXT2_MARKER:
-      *cmp_type = CMP_TYPE_FIXEXT2;
-      return true;
-    case FIXEXT4_MARKER:
-      *cmp_type = CMP_TYPE_FIXEXT4;
-      return true;
-    case FIXEXT8_MARKER:
-      *cmp_type = CMP_TYPE_FIXEXT8;
-      return true;
-    case FIXEXT16_MARKER:
-      *cmp_type = CMP_TYPE_FIXEXT16;
-      return true;
-    case STR8_MARKER:
-      *cmp_type = CMP_TYPE_STR8;
-      return true;
-    case STR16_MARKER:
-      *cmp_type = CMP_TYPE_STR16;
-      return true;
-    case STR32_MARKER:
-      *cmp_type = CMP_TYPE_STR32;
-      return true;
-    case ARRAY16_MARKER:
-      *cmp_type = CMP_TYPE_ARRAY16;
-      return true;
-    case ARRAY32_MARKER:
-      *cmp_type = CMP_TYPE_ARRAY32;
-      return true;
-    case MAP16_MARKER:
-      *cmp_type = CMP_TYPE_MAP16;
-      return true;
-    case MAP32_MARKER:
-      *cmp_type = CMP_TYPE_MAP32;
-      return true;
-    default:
-      return false;
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+static bool read_u32_value(cmp_ctx_t *ctx, uint32_t *x) {
+  if (read_bytes(ctx, x, sizeof(uint32_t))) {
+    *x = be32(*x);
+    return true;
   }
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
 }
 
-static bool read_type_size(cmp_ctx_t *ctx, uint8_t type_marker,
-                                           uint8_t cmp_type,
-                                           uint32_t *size) {
+static bool read_u64_value(cmp_ctx_t *ctx, uint64_t *x) {
+  if (read_bytes(ctx, x, sizeof(uint64_t))) {
+    *x = be64(*x);
+    return true;
+  }
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+static bool read_s8_value(cmp_ctx_t *ctx, int8_t *x) {
   uint8_t u8temp = 0;
+
+  if (!read_u8_value(ctx, &u8temp))
+    return false;
+
+  *x = (int8_t)u8temp;
+  return true;
+}
+
+static bool read_s16_value(cmp_ctx_t *ctx, int16_t *x) {
   uint16_t u16temp = 0;
+
+  if (!read_u16_value(ctx, &u16temp))
+    return false;
+
+  *x = (int16_t)u16temp;
+  return true;
+}
+
+static bool read_s32_value(cmp_ctx_t *ctx, int32_t *x) {
   uint32_t u32temp = 0;
 
-  switch (cmp_type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-      *size = 0;
-      return true;
-    case CMP_TYPE_FIXMAP:
-      *size = (type_marker & FIXMAP_SIZE);
-      return true;
-    case CMP_TYPE_FIXARRAY:
-      *size = (type_marker & FIXARRAY_SIZE);
-      return true;
-    case CMP_TYPE_FIXSTR:
-      *size = (type_marker & FIXSTR_SIZE);
-      return true;
-    case CMP_TYPE_NIL:
-      *size = 0;
-      return true;
-    case CMP_TYPE_BOOLEAN:
-      *size = 0;
-      return true;
-    case CMP_TYPE_BIN8:
-      if (!ctx->read(ctx, &u8temp, sizeof(uint8_t))) {
-        ctx->error = CMP_ERROR_LENGTH_READING;
+  if (!read_u32_value(ctx, &u32temp))
+    return false;
+
+  *x = (int32_t)u32temp;
+  return true;
+}
+
+static bool read_s64_value(cmp_ctx_t *ctx, int64_t *x) {
+  uint64_t u64temp = 0;
+
+  if (!read_u64_value(ctx, &u64temp))
+    return false;
+
+  *x = (int64_t)u64temp;
+  return true;
+}
+
+#ifndef CMP_NO_FLOAT
+static bool read_float_value(cmp_ctx_t *ctx, float *f) {
+  char bytes[4];
+
+  if (read_bytes(ctx, bytes, 4)) {
+    *f = decode_befloat(bytes);
+    return true;
+  }
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+static bool read_double_value(cmp_ctx_t *ctx, double *d) {
+  char bytes[8];
+
+  if (read_bytes(ctx, bytes, 8)) {
+    *d = decode_bedouble(bytes);
+    return true;
+  }
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+#endif /* CMP_NO_FLOAT */
+
+static bool read_length(cmp_ctx_t *ctx, uint8_t width, uint32_t *size) {
+  uint8_t u8temp = 0;
+  uint16_t u16temp = 0;
+
+  switch (width) {
+    case sizeof(uint8_t):
+      if (!read_byte(ctx, &u8temp))
         return false;
-      }
       *size = u8temp;
       return true;
-    case CMP_TYPE_BIN16:
-      if (!ctx->read(ctx, &u16temp, sizeof(uint16_t))) {
-        ctx->error = CMP_ERROR_LENGTH_READING;
+    case sizeof(uint16_t):
+      if (!read_bytes(ctx, &u16temp, sizeof(uint16_t)))
         return false;
-      }
       *size = be16(u16temp);
       return true;
-    case CMP_TYPE_BIN32:
-      if (!ctx->read(ctx, &u32temp, sizeof(uint32_t))) {
-        ctx->error = CMP_ERROR_LENGTH_READING;
-        return false;
-      }
-      *size = be32(u32temp);
-      return true;
-    case CMP_TYPE_EXT8:
-      if (!ctx->read(ctx, &u8temp, sizeof(uint8_t))) {
-        ctx->error = CMP_ERROR_LENGTH_READING;
+    case sizeof(uint32_t):
+      if (!read_bytes(ctx, size, sizeof(uint32_t)))
         return false;
-      }
-      *size = u8temp;
+      *size = be32(*size);
       return true;
-    case CMP_TYPE_EXT16:
-      if (!ctx->read(ctx, &u16temp, sizeof(uint16_t))) {
-        ctx->error = CMP_ERROR_LENGTH_READING;
-        return false;
-      }
-      *size = be16(u16temp);
+    default:
+      return false;
+  }
+}
+
+/*
+ * Reads the size of the object whose type marker has just been read: the
+ * length of a str, bin or ext, the element count of an array or map, or the
+ * size of a scalar's data.
+ */
+static bool read_type_size(cmp_ctx_t *ctx, uint8_t type_marker,
+                                           uint32_t *size) {
+  const marker_info_t *info = &marker_info[type_marker];
+
+  if (!info->width) {
+    *size = info->size;
+    return true;
+  }
+
+  if (read_length(ctx, info->width, size))
+    return true;
+
+  /* bin and ext lengths have always reported a different error */
+  if (info->type >= CMP_TYPE_BIN8 && info->type <= CMP_TYPE_EXT32)
+    ctx->error = CMP_ERROR_LENGTH_READING;
+  else
+    ctx->error = CMP_ERROR_DATA_READING;
+
+  return false;
+}
+
+static bool read_ext_type(cmp_ctx_t *ctx, int8_t *type) {
+  uint8_t u8temp = 0;
+
+  if (read_byte(ctx, &u8temp)) {
+    *type = (int8_t)u8temp;
+    return true;
+  }
+
+  ctx->error = CMP_ERROR_EXT_TYPE_READING;
+  return false;
+}
+
+static bool read_ext_marker_of(cmp_ctx_t *ctx, uint8_t marker, int8_t *type,
+                                                               uint32_t *size) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != marker) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  if (!read_type_size(ctx, type_marker, size))
+    return false;
+
+  return read_ext_type(ctx, type);
+}
+
+static bool read_obj_data(cmp_ctx_t *ctx, uint8_t type_marker,
+                                          cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+      obj->as.u8 = type_marker;
       return true;
-    case CMP_TYPE_EXT32:
-      if (!ctx->read(ctx, &u32temp, sizeof(uint32_t))) {
-        ctx->error = CMP_ERROR_LENGTH_READING;
-        return false;
-      }
-      *size = be32(u32temp);
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+      obj->as.s8 = (int8_t)type_marker;
       return true;
-    case CMP_TYPE_FLOAT:
-      *size = 4;
+    case CMP_TYPE_NIL:
+      obj->as.u8 = 0;
       return true;
-    case CMP_TYPE_DOUBLE:
-      *size = 8;
+    case CMP_TYPE_BOOLEAN:
+      obj->as.boolean = type_marker == TRUE_MARKER;
       return true;
     case CMP_TYPE_UINT8:
-      *size = 1;
-      return true;
+      return read_u8_value(ctx, &obj->as.u8);
     case CMP_TYPE_UINT16:
-      *size = 2;
-      return true;
+      return read_u16_value(ctx, &obj->as.u16);
     case CMP_TYPE_UINT32:
-      *size = 4;
-      return true;
+      return read_u32_value(ctx, &obj->as.u32);
     case CMP_TYPE_UINT64:
-      *size = 8;
-      return true;
+      return read_u64_value(ctx, &obj->as.u64);
     case CMP_TYPE_SINT8:
-      *size = 1;
-      return true;
+      return read_s8_value(ctx, &obj->as.s8);
     case CMP_TYPE_SINT16:
-      *size = 2;
-      return true;
+      return read_s16_value(ctx, &obj->as.s16);
     case CMP_TYPE_SINT32:
-      *size = 4;
-      return true;
+      return read_s32_value(ctx, &obj->as.s32);
     case CMP_TYPE_SINT64:
-      *size = 8;
-      return true;
+      return read_s64_value(ctx, &obj->as.s64);
+    case CMP_TYPE_FLOAT:
+#ifndef CMP_NO_FLOAT
+      return read_float_value(ctx, &obj->as.flt);
+#else /* CMP_NO_FLOAT */
+      ctx->error = CMP_ERROR_DISABLED_FLOATING_POINT;
+      return false;
+#endif /* CMP_NO_FLOAT */
+    case CMP_TYPE_DOUBLE:
+#ifndef CMP_NO_FLOAT
+      return read_double_value(ctx, &obj->as.dbl);
+#else /* CMP_NO_FLOAT */
+      ctx->error = CMP_ERROR_DISABLED_FLOATING_POINT;
+      return false;
+#endif /* CMP_NO_FLOAT */
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return read_type_size(ctx, type_marker, &obj->as.bin_size);
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      return read_type_size(ctx, type_marker, &obj->as.str_size);
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_ARRAY32:
+      return read_type_size(ctx, type_marker, &obj->as.array_size);
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_MAP32:
+      return read_type_size(ctx, type_marker, &obj->as.map_size);
     case CMP_TYPE_FIXEXT1:
-      *size = 1;
-      return true;
     case CMP_TYPE_FIXEXT2:
-      *size = 2;
-      return true;
     case CMP_TYPE_FIXEXT4:
-      *size = 4;
-      return true;
     case CMP_TYPE_FIXEXT8:
-      *size = 8;
-      return true;
     case CMP_TYPE_FIXEXT16:
-      *size = 16;
-      return true;
-    case CMP_TYPE_STR8:
-      if (!ctx->read(ctx, &u8temp, sizeof(uint8_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      *size = u8temp;
-      return true;
-    case CMP_TYPE_STR16:
-      if (!ctx->read(ctx, &u16temp, sizeof(uint16_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      *size = be16(u16temp);
-      return true;
-    case CMP_TYPE_STR32:
-      if (!ctx->read(ctx, &u32temp, sizeof(uint32_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      *size = be32(u32temp);
-      return true;
-    case CMP_TYPE_ARRAY16:
-      if (!ctx->read(ctx, &u16temp, sizeof(uint16_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      *size = be16(u16temp);
-      return true;
-    case CMP_TYPE_ARRAY32:
-      if (!ctx->read(ctx, &u32temp, sizeof(uint32_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      *size = be32(u32temp);
-      return true;
-    case CMP_TYPE_MAP16:
-      if (!ctx->read(ctx, &u16temp, sizeof(uint16_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      *size = be16(u16temp);
-      return true;
-    case CMP_TYPE_MAP32:
-      if (!ctx->read(ctx, &u32temp, sizeof(uint32_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
+    case CMP_TYPE_EXT8:
+    case CMP_TYPE_EXT16:
+    case CMP_TYPE_EXT32:
+      if (!read_type_size(ctx, type_marker, &obj->as.ext.size))
         return false;
-      }
-      *size = be32(u32temp);
-      return true;
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-      *size = 0;
-      return true;
+      return read_ext_type(ctx, &obj->as.ext.type);
     default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
-      return false;
+      break;
   }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
 }
 
-static bool read_obj_data(cmp_ctx_t *ctx, uint8_t type_marker,
-                                          cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-      obj->as.u8 = type_marker;
-      return true;
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-      obj->as.s8 = (int8_t)type_marker;
-      return true;
-    case CMP_TYPE_NIL:
-      obj->as.u8 = 0;
-      return true;
-    case CMP_TYPE_BOOLEAN:
-      switch (type_marker) {
-        case TRUE_MARKER:
-          obj->as.boolean = true;
-          return true;
-        case FALSE_MARKER:
-          obj->as.boolean = false;
-          return true;
-        default:
-          break;
-      }
-      ctx->error = CMP_ERROR_INTERNAL;
-      return false;
-    case CMP_TYPE_UINT8:
-      if (!ctx->read(ctx, &obj->as.u8, sizeof(uint8_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      return true;
-    case CMP_TYPE_UINT16:
-      if (!ctx->read(ctx, &obj->as.u16, sizeof(uint16_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.u16 = be16(obj->as.u16);
-      return true;
-    case CMP_TYPE_UINT32:
-      if (!ctx->read(ctx, &obj->as.u32, sizeof(uint32_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.u32 = be32(obj->as.u32);
-      return true;
-    case CMP_TYPE_UINT64:
-      if (!ctx->read(ctx, &obj->as.u64, sizeof(uint64_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.u64 = be64(obj->as.u64);
-      return true;
-    case CMP_TYPE_SINT8:
-      if (!ctx->read(ctx, &obj->as.s8, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      return true;
-    case CMP_TYPE_SINT16:
-      if (!ctx->read(ctx, &obj->as.s16, sizeof(int16_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.s16 = sbe16(obj->as.s16);
-      return true;
-    case CMP_TYPE_SINT32:
-      if (!ctx->read(ctx, &obj->as.s32, sizeof(int32_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.s32 = sbe32(obj->as.s32);
-      return true;
-    case CMP_TYPE_SINT64:
-      if (!ctx->read(ctx, &obj->as.s64, sizeof(int64_t))) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.s64 = sbe64(obj->as.s64);
-      return true;
-    case CMP_TYPE_FLOAT:
-    {
-#ifndef CMP_NO_FLOAT
-      char bytes[4];
+/*
+ * Skips the data of the object whose type marker has just been read.  Arrays
+ * and maps are handled by the caller, since skipping them means skipping
+ * their elements.
+ */
+static bool skip_obj_data(cmp_ctx_t *ctx, uint8_t type_marker) {
+  uint32_t size = 0;
 
-      if (!ctx->read(ctx, bytes, 4)) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.flt = decode_befloat(bytes);
-      return true;
-#else /* CMP_NO_FLOAT */
-      ctx->error = CMP_ERROR_DISABLED_FLOATING_POINT;
-      return false;
-#endif /* CMP_NO_FLOAT */
-    }
-    case CMP_TYPE_DOUBLE:
-    {
-#ifndef CMP_NO_FLOAT
-      char bytes[8];
+  if (!read_type_size(ctx, type_marker, &size))
+    return false;
 
-      if (!ctx->read(ctx, bytes, 8)) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      obj->as.dbl = decode_bedouble(bytes);
-      return true;
-#else /* CMP_NO_FLOAT */
-      ctx->error = CMP_ERROR_DISABLED_FLOATING_POINT;
+  if (marker_info[type_marker].flags & MARKER_EXT) {
+    if (!skip_bytes(ctx, 1)) {
+      ctx->error = CMP_ERROR_EXT_TYPE_READING;
       return false;
-#endif /* CMP_NO_FLOAT */
     }
-    case CMP_TYPE_BIN8:
-    case CMP_TYPE_BIN16:
-    case CMP_TYPE_BIN32:
-      return read_type_size(ctx, type_marker, obj->type, &obj->as.bin_size);
-    case CMP_TYPE_FIXSTR:
-    case CMP_TYPE_STR8:
-    case CMP_TYPE_STR16:
-    case CMP_TYPE_STR32:
-      return read_type_size(ctx, type_marker, obj->type, &obj->as.str_size);
-    case CMP_TYPE_FIXARRAY:
-    case CMP_TYPE_ARRAY16:
-    case CMP_TYPE_ARRAY32:
-      return read_type_size(ctx, type_marker, obj->type, &obj->as.array_size);
-    case CMP_TYPE_FIXMAP:
-    case CMP_TYPE_MAP16:
-    case CMP_TYPE_MAP32:
-      return read_type_size(ctx, type_marker, obj->type, &obj->as.map_size);
-    case CMP_TYPE_FIXEXT1:
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      obj->as.ext.size = 1;
-      return true;
-    case CMP_TYPE_FIXEXT2:
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      obj->as.ext.size = 2;
-      return true;
-    case CMP_TYPE_FIXEXT4:
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      obj->as.ext.size = 4;
-      return true;
-    case CMP_TYPE_FIXEXT8:
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      obj->as.ext.size = 8;
-      return true;
-    case CMP_TYPE_FIXEXT16:
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      obj->as.ext.size = 16;
-      return true;
-    case CMP_TYPE_EXT8:
-      if (!read_type_size(ctx, type_marker, obj->type, &obj->as.ext.size)) {
-        return false;
-      }
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      return true;
-    case CMP_TYPE_EXT16:
-      if (!read_type_size(ctx, type_marker, obj->type, &obj->as.ext.size)) {
-        return false;
-      }
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      return true;
-    case CMP_TYPE_EXT32:
-      if (!read_type_size(ctx, type_marker, obj->type, &obj->as.ext.size)) {
-        return false;
-      }
-      if (!ctx->read(ctx, &obj->as.ext.type, sizeof(int8_t))) {
-        ctx->error = CMP_ERROR_EXT_TYPE_READING;
-        return false;
-      }
-      return true;
-    default:
-      break;
   }
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
+  if (size && !skip_bytes(ctx, size)) {
+    ctx->error = CMP_ERROR_DATA_READING;
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Reads the size of the array or map whose type marker has just been read, and
+ * adds the number of objects it contains to `*element_count`.
+ */
+static bool read_element_count(cmp_ctx_t *ctx, uint8_t type_marker,
+                                               size_t *element_count) {
+  uint32_t size = 0;
+
+  if (!read_type_size(ctx, type_marker, &size))
+    return false;
+
+  if (marker_info[type_marker].flags & MARKER_MAP)
+    *element_count += ((size_t)size) * 2;
+  else
+    *element_count += size;
+
+  return true;
 }
 
 void cmp_init(cmp_ctx_t *ctx, void *buf, cmp_reader read,
@@ -770,6 +1486,101 @@ void cmp_init(cmp_ctx_t *ctx, void *buf, cmp_reader read,
   ctx->read = read;
   ctx->skip = skip;
   ctx->write = write;
+  ctx->acquire = NULL;
+  ctx->buf_size = 0;
+  ctx->buf_pos = 0;
+}
+
+void cmp_init_mem(cmp_ctx_t *ctx, void *buf, size_t size) {
+  cmp_init(ctx, buf, mem_reader, mem_skipper, mem_writer);
+  ctx->acquire = mem_acquirer;
+  ctx->buf_size = size;
+}
+
+void cmp_init_mem_reader(cmp_ctx_t *ctx, const void *buf, size_t size) {
+  cmp_init(ctx, (void *)buf, mem_reader, mem_skipper, mem_readonly_writer);
+  ctx->acquire = mem_acquirer;
+  ctx->buf_size = size;
+}
+
+size_t cmp_mem_tell(const cmp_ctx_t *ctx) {
+  return ctx->buf_pos;
+}
+
+bool cmp_mem_seek(cmp_ctx_t *ctx, size_t pos) {
+  if (pos > ctx->buf_size)
+    return false;
+
+  ctx->buf_pos = pos;
+  return true;
+}
+
+void cmp_init_buffered_reader(cmp_ctx_t *ctx, cmp_buffered_t *buffered,
+                                              void *buf,
+                                              cmp_filler fill,
+                                              cmp_skipper skip,
+                                              void *data,
+                                              size_t capacity) {
+  cmp_init(&buffered->backend, buf, NULL, skip, NULL);
+  buffered->fill = fill;
+  buffered->data = (uint8_t *)data;
+  buffered->capacity = capacity;
+  buffered->pos = 0;
+  buffered->end = 0;
+
+  cmp_init(ctx, buffered, buffered_reader, buffered_skipper, NULL);
+  ctx->acquire = buffered_acquirer;
+}
+
+void cmp_init_buffered_writer(cmp_ctx_t *ctx, cmp_buffered_t *buffered,
+                                              void *buf,
+                                              cmp_writer write,
+                                              void *data,
+                                              size_t capacity) {
+  cmp_init(&buffered->backend, buf, NULL, NULL, write);
+  buffered->fill = NULL;
+  buffered->data = (uint8_t *)data;
+  buffered->capacity = capacity;
+  buffered->pos = 0;
+  buffered->end = 0;
+
+  cmp_init(ctx, buffered, NULL, NULL, buffered_writer);
+}
+
+bool cmp_buffered_flush(cmp_ctx_t *ctx) {
+  if (ctx->write != buffered_writer)
+    return true;
+
+  if (buffered_flush((cmp_buffered_t *)ctx->buf))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_WRITING;
+  return false;
+}
+
+void cmp_init_encoder(cmp_ctx_t *ctx, cmp_encoder_t *encoder, void *buf,
+                                                            cmp_writer write) {
+  cmp_init(&encoder->backend, buf, NULL, NULL, write);
+  encoder->staged_pos = 0;
+  encoder->staged_end = 0;
+  encoder->payload = NULL;
+  encoder->payload_size = 0;
+
+  cmp_init(ctx, encoder, NULL, NULL, encoder_writer);
+}
+
+size_t cmp_encoder_pending(const cmp_ctx_t *ctx) {
+  if (ctx->write != encoder_writer)
+    return 0;
+
+  return encoder_pending((const cmp_encoder_t *)ctx->buf);
+}
+
+size_t cmp_encoder_resume(cmp_ctx_t *ctx) {
+  if (ctx->write != encoder_writer)
+    return 0;
+
+  return encoder_resume((cmp_encoder_t *)ctx->buf);
 }
 
 uint32_t cmp_version(void) {
@@ -814,37 +1625,19 @@ bool cmp_write_sfix(cmp_ctx_t *ctx, int8_t c) {
 }
 
 bool cmp_write_s8(cmp_ctx_t *ctx, int8_t c) {
-  if (!write_type_marker(ctx, S8_MARKER))
-    return false;
-
-  return ctx->write(ctx, &c, sizeof(int8_t)) == sizeof(int8_t);
+  return write_marker_u8(ctx, S8_MARKER, (uint8_t)c, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_s16(cmp_ctx_t *ctx, int16_t s) {
-  if (!write_type_marker(ctx, S16_MARKER))
-    return false;
-
-  s = sbe16(s);
-
-  return ctx->write(ctx, &s, sizeof(int16_t)) == sizeof(int16_t);
+  return write_marker_u16(ctx, S16_MARKER, (uint16_t)s, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_s32(cmp_ctx_t *ctx, int32_t i) {
-  if (!write_type_marker(ctx, S32_MARKER))
-    return false;
-
-  i = sbe32(i);
-
-  return ctx->write(ctx, &i, sizeof(int32_t)) == sizeof(int32_t);
+  return write_marker_u32(ctx, S32_MARKER, (uint32_t)i, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_s64(cmp_ctx_t *ctx, int64_t l) {
-  if (!write_type_marker(ctx, S64_MARKER))
-    return false;
-
-  l = sbe64(l);
-
-  return ctx->write(ctx, &l, sizeof(int64_t)) == sizeof(int64_t);
+  return write_marker_u64(ctx, S64_MARKER, (uint64_t)l, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_integer(cmp_ctx_t *ctx, int64_t d) {
@@ -867,37 +1660,19 @@ bool cmp_write_ufix(cmp_ctx_t *ctx, uint8_t c) {
 }
 
 bool cmp_write_u8(cmp_ctx_t *ctx, uint8_t c) {
-  if (!write_type_marker(ctx, U8_MARKER))
-    return false;
-
-  return ctx->write(ctx, &c, sizeof(uint8_t)) == sizeof(uint8_t);
+  return write_marker_u8(ctx, U8_MARKER, c, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_u16(cmp_ctx_t *ctx, uint16_t s) {
-  if (!write_type_marker(ctx, U16_MARKER))
-    return false;
-
-  s = be16(s);
-
-  return ctx->write(ctx, &s, sizeof(uint16_t)) == sizeof(uint16_t);
+  return write_marker_u16(ctx, U16_MARKER, s, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_u32(cmp_ctx_t *ctx, uint32_t i) {
-  if (!write_type_marker(ctx, U32_MARKER))
-    return false;
-
-  i = be32(i);
-
-  return ctx->write(ctx, &i, sizeof(uint32_t)) == sizeof(uint32_t);
+  return write_marker_u32(ctx, U32_MARKER, i, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_u64(cmp_ctx_t *ctx, uint64_t l) {
-  if (!write_type_marker(ctx, U64_MARKER))
-    return false;
-
-  l = be64(l);
-
-  return ctx->write(ctx, &l, sizeof(uint64_t)) == sizeof(uint64_t);
+  return write_marker_u64(ctx, U64_MARKER, l, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_uinteger(cmp_ctx_t *ctx, uint64_t u) {
@@ -915,46 +1690,26 @@ bool cmp_write_uinteger(cmp_ctx_t *ctx, uint64_t u) {
 
 #ifndef CMP_NO_FLOAT
 bool cmp_write_float(cmp_ctx_t *ctx, float f) {
-  if (!write_type_marker(ctx, FLOAT_MARKER))
-    return false;
+  uint32_t u32temp = 0;
 
   /*
    * We may need to swap the float's bytes, but we can't just swap them inside
    * the float because the swapped bytes may not constitute a valid float.
-   * Therefore, we have to create a buffer and swap the bytes there.
+   * Therefore, we copy its bits into an integer and encode that.
    */
-  if (!is_bigendian()) {
-    char swapped[sizeof(float)];
-    char *fbuf = (char *)&f;
-    size_t i;
+  memcpy(&u32temp, &f, sizeof(float));
 
-    for (i = 0; i < sizeof(float); ++i)
-      swapped[i] = fbuf[sizeof(float) - i - 1];
-
-    return ctx->write(ctx, swapped, sizeof(float)) == sizeof(float);
-  }
-
-  return ctx->write(ctx, &f, sizeof(float)) == sizeof(float);
+  return write_marker_u32(ctx, FLOAT_MARKER, u32temp, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_double(cmp_ctx_t *ctx, double d) {
-  if (!write_type_marker(ctx, DOUBLE_MARKER))
-    return false;
+  uint64_t u64temp = 0;
 
   /* Same deal for doubles */
-  if (!is_bigendian()) {
-    char swapped[sizeof(double)];
-    char *dbuf = (char *)&d;
-    size_t i;
+  memcpy(&u64temp, &d, sizeof(double));
 
-    for (i = 0; i < sizeof(double); ++i)
-      swapped[i] = dbuf[sizeof(double) - i - 1];
-
-    return ctx->write(ctx, swapped, sizeof(double)) == sizeof(double);
-  }
-
-  return ctx->write(ctx, &d, sizeof(double)) == sizeof(double);
-}
+  return write_marker_u64(ctx, DOUBLE_MARKER, u64temp, CMP_ERROR_DATA_WRITING);
+}
 
 bool cmp_write_decimal(cmp_ctx_t *ctx, double d) {
   float f = (float)d;
@@ -1002,96 +1757,48 @@ bool cmp_write_fixstr_marker(cmp_ctx_t *ctx, uint8_t size) {
 }
 
 bool cmp_write_fixstr(cmp_ctx_t *ctx, const char *data, uint8_t size) {
-  if (!cmp_write_fixstr_marker(ctx, size))
-    return false;
+  uint8_t buf[1 + FIXSTR_SIZE];
 
-  if (size == 0)
-    return true;
+  if (size == 0 || size > FIXSTR_SIZE)
+    return cmp_write_fixstr_marker(ctx, size);
 
-  if (ctx->write(ctx, data, size) == size)
-    return true;
+  buf[0] = FIXSTR_MARKER | size;
+  memcpy(buf + 1, data, size);
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return write_encoded(ctx, buf, 1 + (size_t)size, CMP_ERROR_DATA_WRITING);
 }
 
 bool cmp_write_str8_marker(cmp_ctx_t *ctx, uint8_t size) {
-  if (!write_type_marker(ctx, STR8_MARKER))
-    return false;
-
-  if (ctx->write(ctx, &size, sizeof(uint8_t)) == sizeof(uint8_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u8(ctx, STR8_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_str8(cmp_ctx_t *ctx, const char *data, uint8_t size) {
   if (!cmp_write_str8_marker(ctx, size))
     return false;
 
-  if (size == 0)
-    return true;
-
-  if (ctx->write(ctx, data, size) == size)
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return write_payload(ctx, data, size);
 }
 
 bool cmp_write_str16_marker(cmp_ctx_t *ctx, uint16_t size) {
-  if (!write_type_marker(ctx, STR16_MARKER))
-    return false;
-
-  size = be16(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint16_t)) == sizeof(uint16_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u16(ctx, STR16_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_str16(cmp_ctx_t *ctx, const char *data, uint16_t size) {
   if (!cmp_write_str16_marker(ctx, size))
     return false;
 
-  if (size == 0)
-    return true;
-
-  if (ctx->write(ctx, data, size) == size)
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return write_payload(ctx, data, size);
 }
 
 bool cmp_write_str32_marker(cmp_ctx_t *ctx, uint32_t size) {
-  if (!write_type_marker(ctx, STR32_MARKER))
-    return false;
-
-  size = be32(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint32_t)) == sizeof(uint32_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u32(ctx, STR32_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_str32(cmp_ctx_t *ctx, const char *data, uint32_t size) {
   if (!cmp_write_str32_marker(ctx, size))
     return false;
 
-  if (size == 0)
-    return true;
-
-  if (ctx->write(ctx, data, size) == size)
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return write_payload(ctx, data, size);
 }
 
 bool cmp_write_str_marker(cmp_ctx_t *ctx, uint32_t size) {
@@ -1135,82 +1842,36 @@ bool cmp_write_str_v4(cmp_ctx_t *ctx, const char *data, uint32_t size) {
 }
 
 bool cmp_write_bin8_marker(cmp_ctx_t *ctx, uint8_t size) {
-  if (!write_type_marker(ctx, BIN8_MARKER))
-    return false;
-
-  if (ctx->write(ctx, &size, sizeof(uint8_t)) == sizeof(uint8_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u8(ctx, BIN8_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_bin8(cmp_ctx_t *ctx, const void *data, uint8_t size) {
   if (!cmp_write_bin8_marker(ctx, size))
     return false;
 
-  if (size == 0)
-    return true;
-
-  if (ctx->write(ctx, data, size) == size)
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return write_payload(ctx, data, size);
 }
 
 bool cmp_write_bin16_marker(cmp_ctx_t *ctx, uint16_t size) {
-  if (!write_type_marker(ctx, BIN16_MARKER))
-    return false;
-
-  size = be16(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint16_t)) == sizeof(uint16_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u16(ctx, BIN16_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_bin16(cmp_ctx_t *ctx, const void *data, uint16_t size) {
   if (!cmp_write_bin16_marker(ctx, size))
     return false;
 
-  if (size == 0)
-    return true;
-
-  if (ctx->write(ctx, data, size) == size)
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return write_payload(ctx, data, size);
 }
 
 bool cmp_write_bin32_marker(cmp_ctx_t *ctx, uint32_t size) {
-  if (!write_type_marker(ctx, BIN32_MARKER))
-    return false;
-
-  size = be32(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint32_t)) == sizeof(uint32_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u32(ctx, BIN32_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_bin32(cmp_ctx_t *ctx, const void *data, uint32_t size) {
   if (!cmp_write_bin32_marker(ctx, size))
     return false;
 
-  if (size == 0)
-    return true;
-
-  if (ctx->write(ctx, data, size) == size)
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return write_payload(ctx, data, size);
 }
 
 bool cmp_write_bin_marker(cmp_ctx_t *ctx, uint32_t size) {
@@ -1240,29 +1901,11 @@ bool cmp_write_fixarray(cmp_ctx_t *ctx, uint8_t size) {
 }
 
 bool cmp_write_array16(cmp_ctx_t *ctx, uint16_t size) {
-  if (!write_type_marker(ctx, ARRAY16_MARKER))
-    return false;
-
-  size = be16(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint16_t)) == sizeof(uint16_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u16(ctx, ARRAY16_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_array32(cmp_ctx_t *ctx, uint32_t size) {
-  if (!write_type_marker(ctx, ARRAY32_MARKER))
-    return false;
-
-  size = be32(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint32_t)) == sizeof(uint32_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u32(ctx, ARRAY32_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_array(cmp_ctx_t *ctx, uint32_t size) {
@@ -1283,29 +1926,11 @@ bool cmp_write_fixmap(cmp_ctx_t *ctx, uint8_t size) {
 }
 
 bool cmp_write_map16(cmp_ctx_t *ctx, uint16_t size) {
-  if (!write_type_marker(ctx, MAP16_MARKER))
-    return false;
-
-  size = be16(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint16_t)) == sizeof(uint16_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u16(ctx, MAP16_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_map32(cmp_ctx_t *ctx, uint32_t size) {
-  if (!write_type_marker(ctx, MAP32_MARKER))
-    return false;
-
-  size = be32(size);
-
-  if (ctx->write(ctx, &size, sizeof(uint32_t)) == sizeof(uint32_t))
-    return true;
-
-  ctx->error = CMP_ERROR_LENGTH_WRITING;
-  return false;
+  return write_marker_u32(ctx, MAP32_MARKER, size, CMP_ERROR_LENGTH_WRITING);
 }
 
 bool cmp_write_map(cmp_ctx_t *ctx, uint32_t size) {
@@ -1317,203 +1942,372 @@ bool cmp_write_map(cmp_ctx_t *ctx, uint32_t size) {
   return cmp_write_map32(ctx, size);
 }
 
-bool cmp_write_fixext1_marker(cmp_ctx_t *ctx, int8_t type) {
-  if (!write_type_marker(ctx, FIXEXT1_MARKER))
-    return false;
-
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
+/*
+ * Array writers encode their elements into a block on the stack and write it
+ * out whenever it fills up, so a whole array takes a handful of writes.
+ */
+typedef struct write_block_s {
+  uint8_t data[CMP_ENCODER_BLOCK_SIZE];
+  size_t  pos;
+} write_block_t;
+
+static bool flush_block(cmp_ctx_t *ctx, write_block_t *block) {
+  if (!block->pos)
     return true;
 
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
-}
-
-bool cmp_write_fixext1(cmp_ctx_t *ctx, int8_t type, const void *data) {
-  if (!cmp_write_fixext1_marker(ctx, type))
+  if (ctx->write == encoder_writer) {
+    if (!encoder_write_block((cmp_encoder_t *)ctx->buf, block->data,
+                                                        block->pos)) {
+      ctx->error = CMP_ERROR_DATA_WRITING;
+      return false;
+    }
+  }
+  else if (!write_encoded(ctx, block->data, block->pos,
+                                            CMP_ERROR_DATA_WRITING)) {
     return false;
+  }
 
-  if (ctx->write(ctx, data, 1) == 1)
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  block->pos = 0;
+  return true;
 }
 
-bool cmp_write_fixext2_marker(cmp_ctx_t *ctx, int8_t type) {
-  if (!write_type_marker(ctx, FIXEXT2_MARKER))
+/*
+ * Adds `x` to the block, encoded with `marker`.  Integers are passed as their
+ * two's complement bits, floats and doubles as theirs; a marker of 0 means `x`
+ * fits in a positive or negative fixnum.
+ */
+static bool put_block_value(cmp_ctx_t *ctx, write_block_t *block,
+                                            uint8_t marker,
+                                            uint64_t x) {
+  uint8_t *b;
+
+  if (block->pos > (sizeof(block->data) - 9) && !flush_block(ctx, block))
     return false;
 
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
-    return true;
-
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
-}
+  b = block->data + block->pos;
 
-bool cmp_write_fixext2(cmp_ctx_t *ctx, int8_t type, const void *data) {
-  if (!cmp_write_fixext2_marker(ctx, type))
-    return false;
-
-  if (ctx->write(ctx, data, 2) == 2)
-    return true;
+  switch (marker) {
+    case U8_MARKER:
+    case S8_MARKER:
+      b[0] = marker;
+      b[1] = (uint8_t)x;
+      block->pos += 2;
+      break;
+    case U16_MARKER:
+    case S16_MARKER:
+      b[0] = marker;
+      store_be16(b + 1, (uint16_t)x);
+      block->pos += 3;
+      break;
+    case U32_MARKER:
+    case S32_MARKER:
+    case FLOAT_MARKER:
+      b[0] = marker;
+      store_be32(b + 1, (uint32_t)x);
+      block->pos += 5;
+      break;
+    case U64_MARKER:
+    case S64_MARKER:
+    case DOUBLE_MARKER:
+      b[0] = marker;
+      store_be64(b + 1, x);
+      block->pos += 9;
+      break;
+    default:
+      b[0] = (uint8_t)x;
+      block->pos += 1;
+      break;
+  }
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  return true;
 }
 
-bool cmp_write_fixext4_marker(cmp_ctx_t *ctx, int8_t type) {
-  if (!write_type_marker(ctx, FIXEXT4_MARKER))
-    return false;
+/*
+ * Picks the narrowest marker that fits every integer between `min` (which is
+ * never positive) and `max`, or 0 if they all fit in fixnums.
+ */
+static uint8_t integer_array_marker(int64_t min, uint64_t max) {
+  if (min >= 0) {
+    if (max <= 0x7F)
+      return 0;
+    if (max <= 0xFF)
+      return U8_MARKER;
+    if (max <= 0xFFFF)
+      return U16_MARKER;
+    if (max <= 0xFFFFFFFF)
+      return U32_MARKER;
+    return U64_MARKER;
+  }
 
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
-    return true;
+  if (min >= -0x20 && max <= 0x7F)
+    return 0;
+  if (min >= -0x80 && max <= 0x7F)
+    return S8_MARKER;
+  if (min >= -0x8000 && max <= 0x7FFF)
+    return S16_MARKER;
+  if (min >= -INT64_C(0x80000000) && max <= 0x7FFFFFFF)
+    return S32_MARKER;
+
+  return S64_MARKER;
+}
+
+bool cmp_write_int_array(cmp_ctx_t *ctx, const int32_t *data, uint32_t size) {
+  write_block_t block;
+  int32_t min = 0;
+  int32_t max = 0;
+  uint8_t marker;
+  uint32_t i;
+
+  for (i = 0; i < size; i++) {
+    if (data[i] < min)
+      min = data[i];
+    if (data[i] > max)
+      max = data[i];
+  }
 
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
-}
+  marker = integer_array_marker(min, (uint64_t)max);
 
-bool cmp_write_fixext4(cmp_ctx_t *ctx, int8_t type, const void *data) {
-  if (!cmp_write_fixext4_marker(ctx, type))
+  if (!cmp_write_array(ctx, size))
     return false;
 
-  if (ctx->write(ctx, data, 4) == 4)
-    return true;
+  block.pos = 0;
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  for (i = 0; i < size; i++) {
+    if (!put_block_value(ctx, &block, marker, (uint64_t)(int64_t)data[i]))
+      return false;
+  }
+
+  return flush_block(ctx, &block);
 }
 
-bool cmp_write_fixext8_marker(cmp_ctx_t *ctx, int8_t type) {
-  if (!write_type_marker(ctx, FIXEXT8_MARKER))
-    return false;
+bool cmp_write_long_array(cmp_ctx_t *ctx, const int64_t *data, uint32_t size) {
+  write_block_t block;
+  int64_t min = 0;
+  int64_t max = 0;
+  uint8_t marker;
+  uint32_t i;
 
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
-    return true;
+  for (i = 0; i < size; i++) {
+    if (data[i] < min)
+      min = data[i];
+    if (data[i] > max)
+      max = data[i];
+  }
 
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
-}
+  marker = integer_array_marker(min, (uint64_t)max);
 
-bool cmp_write_fixext8(cmp_ctx_t *ctx, int8_t type, const void *data) {
-  if (!cmp_write_fixext8_marker(ctx, type))
+  if (!cmp_write_array(ctx, size))
     return false;
 
-  if (ctx->write(ctx, data, 8) == 8)
-    return true;
+  block.pos = 0;
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  for (i = 0; i < size; i++) {
+    if (!put_block_value(ctx, &block, marker, (uint64_t)data[i]))
+      return false;
+  }
+
+  return flush_block(ctx, &block);
 }
 
-bool cmp_write_fixext16_marker(cmp_ctx_t *ctx, int8_t type) {
-  if (!write_type_marker(ctx, FIXEXT16_MARKER))
-    return false;
+bool cmp_write_uint_array(cmp_ctx_t *ctx, const uint32_t *data,
+                                          uint32_t size) {
+  write_block_t block;
+  uint32_t max = 0;
+  uint8_t marker;
+  uint32_t i;
 
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
-    return true;
+  for (i = 0; i < size; i++) {
+    if (data[i] > max)
+      max = data[i];
+  }
 
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
-}
+  marker = integer_array_marker(0, max);
 
-bool cmp_write_fixext16(cmp_ctx_t *ctx, int8_t type, const void *data) {
-  if (!cmp_write_fixext16_marker(ctx, type))
+  if (!cmp_write_array(ctx, size))
     return false;
 
-  if (ctx->write(ctx, data, 16) == 16)
-    return true;
+  block.pos = 0;
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  for (i = 0; i < size; i++) {
+    if (!put_block_value(ctx, &block, marker, data[i]))
+      return false;
+  }
+
+  return flush_block(ctx, &block);
 }
 
-bool cmp_write_ext8_marker(cmp_ctx_t *ctx, int8_t type, uint8_t size) {
-  if (!write_type_marker(ctx, EXT8_MARKER))
-    return false;
+bool cmp_write_ulong_array(cmp_ctx_t *ctx, const uint64_t *data,
+                                           uint32_t size) {
+  write_block_t block;
+  uint64_t max = 0;
+  uint8_t marker;
+  uint32_t i;
 
-  if (ctx->write(ctx, &size, sizeof(uint8_t)) != sizeof(uint8_t)) {
-    ctx->error = CMP_ERROR_LENGTH_WRITING;
-    return false;
+  for (i = 0; i < size; i++) {
+    if (data[i] > max)
+      max = data[i];
   }
 
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
-    return true;
-
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
-}
+  marker = integer_array_marker(0, max);
 
-bool cmp_write_ext8(cmp_ctx_t *ctx, int8_t type, uint8_t size, const void *data) {
-  if (!cmp_write_ext8_marker(ctx, type, size))
+  if (!cmp_write_array(ctx, size))
     return false;
 
-  if (ctx->write(ctx, data, size) == size)
-    return true;
+  block.pos = 0;
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+  for (i = 0; i < size; i++) {
+    if (!put_block_value(ctx, &block, marker, data[i]))
+      return false;
+  }
+
+  return flush_block(ctx, &block);
 }
 
-bool cmp_write_ext16_marker(cmp_ctx_t *ctx, int8_t type, uint16_t size) {
-  if (!write_type_marker(ctx, EXT16_MARKER))
+#ifndef CMP_NO_FLOAT
+bool cmp_write_float_array(cmp_ctx_t *ctx, const float *data, uint32_t size) {
+  write_block_t block;
+  uint32_t u32temp;
+  uint32_t i;
+
+  if (!cmp_write_array(ctx, size))
     return false;
 
-  size = be16(size);
+  block.pos = 0;
 
-  if (ctx->write(ctx, &size, sizeof(uint16_t)) != sizeof(uint16_t)) {
-    ctx->error = CMP_ERROR_LENGTH_WRITING;
-    return false;
-  }
+  for (i = 0; i < size; i++) {
+    memcpy(&u32temp, &data[i], sizeof(float));
 
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
-    return true;
+    if (!put_block_value(ctx, &block, FLOAT_MARKER, u32temp))
+      return false;
+  }
 
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
+  return flush_block(ctx, &block);
 }
 
-bool cmp_write_ext16(cmp_ctx_t *ctx, int8_t type, uint16_t size, const void *data) {
-  if (!cmp_write_ext16_marker(ctx, type, size))
-    return false;
-
-  if (ctx->write(ctx, data, size) == size)
-    return true;
+bool cmp_write_double_array(cmp_ctx_t *ctx, const double *data,
+                                            uint32_t size) {
+  write_block_t block;
+  bool all_floats = true;
+  uint32_t u32temp;
+  uint64_t u64temp;
+  float f;
+  uint32_t i;
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
-}
+  for (i = 0; i < size && all_floats; i++) {
+    f = (float)data[i];
+    all_floats = (double)f == data[i];
+  }
 
-bool cmp_write_ext32_marker(cmp_ctx_t *ctx, int8_t type, uint32_t size) {
-  if (!write_type_marker(ctx, EXT32_MARKER))
+  if (!cmp_write_array(ctx, size))
     return false;
 
-  size = be32(size);
+  block.pos = 0;
 
-  if (ctx->write(ctx, &size, sizeof(uint32_t)) != sizeof(uint32_t)) {
-    ctx->error = CMP_ERROR_LENGTH_WRITING;
-    return false;
+  for (i = 0; i < size; i++) {
+    if (all_floats) {
+      f = (float)data[i];
+      memcpy(&u32temp, &f, sizeof(float));
+
+      if (!put_block_value(ctx, &block, FLOAT_MARKER, u32temp))
+        return false;
+    }
+    else {
+      memcpy(&u64temp, &data[i], sizeof(double));
+
+      if (!put_block_value(ctx, &block, DOUBLE_MARKER, u64temp))
+        return false;
+    }
   }
 
-  if (ctx->write(ctx, &type, sizeof(int8_t)) == sizeof(int8_t))
-    return true;
+  return flush_block(ctx, &block);
+}
+#endif /* CMP_NO_FLOAT */
 
-  ctx->error = CMP_ERROR_EXT_TYPE_WRITING;
-  return false;
+bool cmp_write_fixext1_marker(cmp_ctx_t *ctx, int8_t type) {
+  return write_marker_u8(
+    ctx, FIXEXT1_MARKER, (uint8_t)type, CMP_ERROR_EXT_TYPE_WRITING
+  );
 }
 
-bool cmp_write_ext32(cmp_ctx_t *ctx, int8_t type, uint32_t size, const void *data) {
-  if (!cmp_write_ext32_marker(ctx, type, size))
-    return false;
+bool cmp_write_fixext1(cmp_ctx_t *ctx, int8_t type, const void *data) {
+  return write_fixext(ctx, FIXEXT1_MARKER, type, data, 1);
+}
 
-  if (ctx->write(ctx, data, size) == size)
-    return true;
+bool cmp_write_fixext2_marker(cmp_ctx_t *ctx, int8_t type) {
+  return write_marker_u8(
+    ctx, FIXEXT2_MARKER, (uint8_t)type, CMP_ERROR_EXT_TYPE_WRITING
+  );
+}
 
-  ctx->error = CMP_ERROR_DATA_WRITING;
-  return false;
+bool cmp_write_fixext2(cmp_ctx_t *ctx, int8_t type, const void *data) {
+  return write_fixext(ctx, FIXEXT2_MARKER, type, data, 2);
 }
 
-bool cmp_write_ext_marker(cmp_ctx_t *ctx, int8_t type, uint32_t size) {
-  if (size == 1)
+bool cmp_write_fixext4_marker(cmp_ctx_t *ctx, int8_t type) {
+  return write_marker_u8(
+    ctx, FIXEXT4_MARKER, (uint8_t)type, CMP_ERROR_EXT_TYPE_WRITING
+  );
+}
+
+bool cmp_write_fixext4(cmp_ctx_t *ctx, int8_t type, const void *data) {
+  return write_fixext(ctx, FIXEXT4_MARKER, type, data, 4);
+}
+
+bool cmp_write_fixext8_marker(cmp_ctx_t *ctx, int8_t type) {
+  return write_marker_u8(
+    ctx, FIXEXT8_MARKER, (uint8_t)type, CMP_ERROR_EXT_TYPE_WRITING
+  );
+}
+
+bool cmp_write_fixext8(cmp_ctx_t *ctx, int8_t type, const void *data) {
+  return write_fixext(ctx, FIXEXT8_MARKER, type, data, 8);
+}
+
+bool cmp_write_fixext16_marker(cmp_ctx_t *ctx, int8_t type) {
+  return write_marker_u8(
+    ctx, FIXEXT16_MARKER, (uint8_t)type, CMP_ERROR_EXT_TYPE_WRITING
+  );
+}
+
+bool cmp_write_fixext16(cmp_ctx_t *ctx, int8_t type, const void *data) {
+  return write_fixext(ctx, FIXEXT16_MARKER, type, data, 16);
+}
+
+bool cmp_write_ext8_marker(cmp_ctx_t *ctx, int8_t type, uint8_t size) {
+  return write_ext_header(ctx, EXT8_MARKER, type, size);
+}
+
+bool cmp_write_ext8(cmp_ctx_t *ctx, int8_t type, uint8_t size, const void *data) {
+  if (!cmp_write_ext8_marker(ctx, type, size))
+    return false;
+
+  return write_payload(ctx, data, size);
+}
+
+bool cmp_write_ext16_marker(cmp_ctx_t *ctx, int8_t type, uint16_t size) {
+  return write_ext_header(ctx, EXT16_MARKER, type, size);
+}
+
+bool cmp_write_ext16(cmp_ctx_t *ctx, int8_t type, uint16_t size, const void *data) {
+  if (!cmp_write_ext16_marker(ctx, type, size))
+    return false;
+
+  return write_payload(ctx, data, size);
+}
+
+bool cmp_write_ext32_marker(cmp_ctx_t *ctx, int8_t type, uint32_t size) {
+  return write_ext_header(ctx, EXT32_MARKER, type, size);
+}
+
+bool cmp_write_ext32(cmp_ctx_t *ctx, int8_t type, uint32_t size, const void *data) {
+  if (!cmp_write_ext32_marker(ctx, type, size))
+    return false;
+
+  return write_payload(ctx, data, size);
+}
+
+bool cmp_write_ext_marker(cmp_ctx_t *ctx, int8_t type, uint32_t size) {
+  if (size == 1)
     return cmp_write_fixext1_marker(ctx, type);
   if (size == 2)
     return cmp_write_fixext2_marker(ctx, type);
@@ -1713,939 +2507,4104 @@ bool cmp_write_object_v4(cmp_ctx_t *ctx, const cmp_object_t *obj) {
     case CMP_TYPE_STR32:
       return cmp_write_str32_marker(ctx, obj->as.str_size);
     case CMP_TYPE_ARRAY16:
-      return cmp_write_array16(ctx, (uint16_t)obj->as.array_size);
+      return cmp_write_array16(ctx, (uint16_t)obj->as.array_size);
+    case CMP_TYPE_ARRAY32:
+      return cmp_write_array32(ctx, obj->as.array_size);
+    case CMP_TYPE_MAP16:
+      return cmp_write_map16(ctx, (uint16_t)obj->as.map_size);
+    case CMP_TYPE_MAP32:
+      return cmp_write_map32(ctx, obj->as.map_size);
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+      return cmp_write_nfix(ctx, obj->as.s8);
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+
+size_t cmp_sizeof_integer(int64_t d) {
+  if (d >= 0)
+    return cmp_sizeof_uinteger((uint64_t)d);
+  if (d >= -0x20)
+    return 1;
+  if (d >= -0x80)
+    return 2;
+  if (d >= -0x8000)
+    return 3;
+  if (d >= -INT64_C(0x80000000))
+    return 5;
+
+  return 9;
+}
+
+size_t cmp_sizeof_uinteger(uint64_t u) {
+  if (u <= 0x7F)
+    return 1;
+  if (u <= 0xFF)
+    return 2;
+  if (u <= 0xFFFF)
+    return 3;
+  if (u <= 0xFFFFFFFF)
+    return 5;
+
+  return 9;
+}
+
+#ifndef CMP_NO_FLOAT
+size_t cmp_sizeof_decimal(double d) {
+  float f = (float)d;
+  double df = (double)f;
+
+  if (df == d)
+    return 5;
+  else
+    return 9;
+}
+#endif /* CMP_NO_FLOAT */
+
+size_t cmp_sizeof_str_marker(uint32_t size) {
+  if (size <= FIXSTR_SIZE)
+    return 1;
+  if (size <= 0xFF)
+    return 2;
+  if (size <= 0xFFFF)
+    return 3;
+
+  return 5;
+}
+
+size_t cmp_sizeof_str_marker_v4(uint32_t size) {
+  if (size <= FIXSTR_SIZE)
+    return 1;
+  if (size <= 0xFFFF)
+    return 3;
+
+  return 5;
+}
+
+size_t cmp_sizeof_str(uint32_t size) {
+  return cmp_sizeof_str_marker(size) + size;
+}
+
+size_t cmp_sizeof_str_v4(uint32_t size) {
+  return cmp_sizeof_str_marker_v4(size) + size;
+}
+
+size_t cmp_sizeof_bin_marker(uint32_t size) {
+  if (size <= 0xFF)
+    return 2;
+  if (size <= 0xFFFF)
+    return 3;
+
+  return 5;
+}
+
+size_t cmp_sizeof_bin(uint32_t size) {
+  return cmp_sizeof_bin_marker(size) + size;
+}
+
+size_t cmp_sizeof_array(uint32_t size) {
+  if (size <= FIXARRAY_SIZE)
+    return 1;
+  if (size <= 0xFFFF)
+    return 3;
+
+  return 5;
+}
+
+size_t cmp_sizeof_map(uint32_t size) {
+  if (size <= FIXMAP_SIZE)
+    return 1;
+  if (size <= 0xFFFF)
+    return 3;
+
+  return 5;
+}
+
+size_t cmp_sizeof_ext_marker(uint32_t size) {
+  switch (size) {
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+    case 16:
+      return 2;
+  }
+
+  if (size <= 0xFF)
+    return 3;
+  if (size <= 0xFFFF)
+    return 4;
+
+  return 6;
+}
+
+size_t cmp_sizeof_ext(uint32_t size) {
+  return cmp_sizeof_ext_marker(size) + size;
+}
+
+size_t cmp_sizeof_object(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_NIL:
+    case CMP_TYPE_BOOLEAN:
+      return 1;
+    case CMP_TYPE_UINT8:
+    case CMP_TYPE_SINT8:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_FIXEXT1:
+    case CMP_TYPE_FIXEXT2:
+    case CMP_TYPE_FIXEXT4:
+    case CMP_TYPE_FIXEXT8:
+    case CMP_TYPE_FIXEXT16:
+      return 2;
+    case CMP_TYPE_UINT16:
+    case CMP_TYPE_SINT16:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_EXT8:
+      return 3;
+    case CMP_TYPE_EXT16:
+      return 4;
+    case CMP_TYPE_UINT32:
+    case CMP_TYPE_SINT32:
+    case CMP_TYPE_STR32:
+    case CMP_TYPE_BIN32:
+    case CMP_TYPE_ARRAY32:
+    case CMP_TYPE_MAP32:
+      return 5;
+    case CMP_TYPE_EXT32:
+      return 6;
+    case CMP_TYPE_UINT64:
+    case CMP_TYPE_SINT64:
+      return 9;
+#ifndef CMP_NO_FLOAT
+    case CMP_TYPE_FLOAT:
+      return 5;
+    case CMP_TYPE_DOUBLE:
+      return 9;
+#endif /* CMP_NO_FLOAT */
+    default:
+      return 0;
+  }
+}
+
+size_t cmp_sizeof_object_v4(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return 0;
+    default:
+      return cmp_sizeof_object(obj);
+  }
+}
+
+bool cmp_read_pfix(cmp_ctx_t *ctx, uint8_t *c) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker > 0x7F) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  *c = type_marker;
+  return true;
+}
+
+bool cmp_read_nfix(cmp_ctx_t *ctx, int8_t *c) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker < NEGATIVE_FIXNUM_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  *c = (int8_t)type_marker;
+  return true;
+}
+
+bool cmp_read_sfix(cmp_ctx_t *ctx, int8_t *c) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F || type_marker >= NEGATIVE_FIXNUM_MARKER) {
+    *c = (int8_t)type_marker;
+    return true;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_s8(cmp_ctx_t *ctx, int8_t *c) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != S8_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_s8_value(ctx, c);
+}
+
+bool cmp_read_s16(cmp_ctx_t *ctx, int16_t *s) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != S16_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_s16_value(ctx, s);
+}
+
+bool cmp_read_s32(cmp_ctx_t *ctx, int32_t *i) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != S32_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_s32_value(ctx, i);
+}
+
+bool cmp_read_s64(cmp_ctx_t *ctx, int64_t *l) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != S64_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_s64_value(ctx, l);
+}
+
+bool cmp_read_char(cmp_ctx_t *ctx, int8_t *c) {
+  uint8_t type_marker = 0;
+  uint8_t u8temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F || type_marker >= NEGATIVE_FIXNUM_MARKER) {
+    *c = (int8_t)type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case S8_MARKER:
+      return read_s8_value(ctx, c);
+    case U8_MARKER:
+      if (!read_u8_value(ctx, &u8temp))
+        return false;
+      if (u8temp <= 0x7F) {
+        *c = (int8_t)u8temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_short(cmp_ctx_t *ctx, int16_t *s) {
+  uint8_t type_marker = 0;
+  int8_t s8temp = 0;
+  uint8_t u8temp = 0;
+  uint16_t u16temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F || type_marker >= NEGATIVE_FIXNUM_MARKER) {
+    *s = (int8_t)type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case S8_MARKER:
+      if (!read_s8_value(ctx, &s8temp))
+        return false;
+      *s = s8temp;
+      return true;
+    case U8_MARKER:
+      if (!read_u8_value(ctx, &u8temp))
+        return false;
+      *s = u8temp;
+      return true;
+    case S16_MARKER:
+      return read_s16_value(ctx, s);
+    case U16_MARKER:
+      if (!read_u16_value(ctx, &u16temp))
+        return false;
+      if (u16temp <= 0x7FFF) {
+        *s = (int16_t)u16temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_int(cmp_ctx_t *ctx, int32_t *i) {
+  uint8_t type_marker = 0;
+  int8_t s8temp = 0;
+  uint8_t u8temp = 0;
+  int16_t s16temp = 0;
+  uint16_t u16temp = 0;
+  uint32_t u32temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F || type_marker >= NEGATIVE_FIXNUM_MARKER) {
+    *i = (int8_t)type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case S8_MARKER:
+      if (!read_s8_value(ctx, &s8temp))
+        return false;
+      *i = s8temp;
+      return true;
+    case U8_MARKER:
+      if (!read_u8_value(ctx, &u8temp))
+        return false;
+      *i = u8temp;
+      return true;
+    case S16_MARKER:
+      if (!read_s16_value(ctx, &s16temp))
+        return false;
+      *i = s16temp;
+      return true;
+    case U16_MARKER:
+      if (!read_u16_value(ctx, &u16temp))
+        return false;
+      *i = u16temp;
+      return true;
+    case S32_MARKER:
+      return read_s32_value(ctx, i);
+    case U32_MARKER:
+      if (!read_u32_value(ctx, &u32temp))
+        return false;
+      if (u32temp <= 0x7FFFFFFF) {
+        *i = (int32_t)u32temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_long(cmp_ctx_t *ctx, int64_t *d) {
+  uint8_t type_marker = 0;
+  int8_t s8temp = 0;
+  uint8_t u8temp = 0;
+  int16_t s16temp = 0;
+  uint16_t u16temp = 0;
+  int32_t s32temp = 0;
+  uint32_t u32temp = 0;
+  uint64_t u64temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F || type_marker >= NEGATIVE_FIXNUM_MARKER) {
+    *d = (int8_t)type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case S8_MARKER:
+      if (!read_s8_value(ctx, &s8temp))
+        return false;
+      *d = s8temp;
+      return true;
+    case U8_MARKER:
+      if (!read_u8_value(ctx, &u8temp))
+        return false;
+      *d = u8temp;
+      return true;
+    case S16_MARKER:
+      if (!read_s16_value(ctx, &s16temp))
+        return false;
+      *d = s16temp;
+      return true;
+    case U16_MARKER:
+      if (!read_u16_value(ctx, &u16temp))
+        return false;
+      *d = u16temp;
+      return true;
+    case S32_MARKER:
+      if (!read_s32_value(ctx, &s32temp))
+        return false;
+      *d = s32temp;
+      return true;
+    case U32_MARKER:
+      if (!read_u32_value(ctx, &u32temp))
+        return false;
+      *d = u32temp;
+      return true;
+    case S64_MARKER:
+      return read_s64_value(ctx, d);
+    case U64_MARKER:
+      if (!read_u64_value(ctx, &u64temp))
+        return false;
+      if (u64temp <= UINT64_C(0x7FFFFFFFFFFFFFFF)) {
+        *d = (int64_t)u64temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_integer(cmp_ctx_t *ctx, int64_t *d) {
+  return cmp_read_long(ctx, d);
+}
+
+bool cmp_read_ufix(cmp_ctx_t *ctx, uint8_t *c) {
+  return cmp_read_pfix(ctx, c);
+}
+
+bool cmp_read_u8(cmp_ctx_t *ctx, uint8_t *c) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != U8_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_u8_value(ctx, c);
+}
+
+bool cmp_read_u16(cmp_ctx_t *ctx, uint16_t *s) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != U16_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_u16_value(ctx, s);
+}
+
+bool cmp_read_u32(cmp_ctx_t *ctx, uint32_t *i) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != U32_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_u32_value(ctx, i);
+}
+
+bool cmp_read_u64(cmp_ctx_t *ctx, uint64_t *l) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != U64_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_u64_value(ctx, l);
+}
+
+bool cmp_read_uchar(cmp_ctx_t *ctx, uint8_t *c) {
+  uint8_t type_marker = 0;
+  int8_t s8temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F) {
+    *c = type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case U8_MARKER:
+      return read_u8_value(ctx, c);
+    case S8_MARKER:
+      if (!read_s8_value(ctx, &s8temp))
+        return false;
+      if (s8temp >= 0) {
+        *c = (uint8_t)s8temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_ushort(cmp_ctx_t *ctx, uint16_t *s) {
+  uint8_t type_marker = 0;
+  uint8_t u8temp = 0;
+  int8_t s8temp = 0;
+  int16_t s16temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F) {
+    *s = type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case U8_MARKER:
+      if (!read_u8_value(ctx, &u8temp))
+        return false;
+      *s = u8temp;
+      return true;
+    case U16_MARKER:
+      return read_u16_value(ctx, s);
+    case S8_MARKER:
+      if (!read_s8_value(ctx, &s8temp))
+        return false;
+      if (s8temp >= 0) {
+        *s = (uint8_t)s8temp;
+        return true;
+      }
+      break;
+    case S16_MARKER:
+      if (!read_s16_value(ctx, &s16temp))
+        return false;
+      if (s16temp >= 0) {
+        *s = (uint16_t)s16temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_uint(cmp_ctx_t *ctx, uint32_t *i) {
+  uint8_t type_marker = 0;
+  uint8_t u8temp = 0;
+  uint16_t u16temp = 0;
+  int8_t s8temp = 0;
+  int16_t s16temp = 0;
+  int32_t s32temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F) {
+    *i = type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case U8_MARKER:
+      if (!read_u8_value(ctx, &u8temp))
+        return false;
+      *i = u8temp;
+      return true;
+    case U16_MARKER:
+      if (!read_u16_value(ctx, &u16temp))
+        return false;
+      *i = u16temp;
+      return true;
+    case U32_MARKER:
+      return read_u32_value(ctx, i);
+    case S8_MARKER:
+      if (!read_s8_value(ctx, &s8temp))
+        return false;
+      if (s8temp >= 0) {
+        *i = (uint8_t)s8temp;
+        return true;
+      }
+      break;
+    case S16_MARKER:
+      if (!read_s16_value(ctx, &s16temp))
+        return false;
+      if (s16temp >= 0) {
+        *i = (uint16_t)s16temp;
+        return true;
+      }
+      break;
+    case S32_MARKER:
+      if (!read_s32_value(ctx, &s32temp))
+        return false;
+      if (s32temp >= 0) {
+        *i = (uint32_t)s32temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_ulong(cmp_ctx_t *ctx, uint64_t *u) {
+  uint8_t type_marker = 0;
+  uint8_t u8temp = 0;
+  uint16_t u16temp = 0;
+  uint32_t u32temp = 0;
+  int8_t s8temp = 0;
+  int16_t s16temp = 0;
+  int32_t s32temp = 0;
+  int64_t s64temp = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker <= 0x7F) {
+    *u = type_marker;
+    return true;
+  }
+
+  switch (type_marker) {
+    case U8_MARKER:
+      if (!read_u8_value(ctx, &u8temp))
+        return false;
+      *u = u8temp;
+      return true;
+    case U16_MARKER:
+      if (!read_u16_value(ctx, &u16temp))
+        return false;
+      *u = u16temp;
+      return true;
+    case U32_MARKER:
+      if (!read_u32_value(ctx, &u32temp))
+        return false;
+      *u = u32temp;
+      return true;
+    case U64_MARKER:
+      return read_u64_value(ctx, u);
+    case S8_MARKER:
+      if (!read_s8_value(ctx, &s8temp))
+        return false;
+      if (s8temp >= 0) {
+        *u = (uint8_t)s8temp;
+        return true;
+      }
+      break;
+    case S16_MARKER:
+      if (!read_s16_value(ctx, &s16temp))
+        return false;
+      if (s16temp >= 0) {
+        *u = (uint16_t)s16temp;
+        return true;
+      }
+      break;
+    case S32_MARKER:
+      if (!read_s32_value(ctx, &s32temp))
+        return false;
+      if (s32temp >= 0) {
+        *u = (uint32_t)s32temp;
+        return true;
+      }
+      break;
+    case S64_MARKER:
+      if (!read_s64_value(ctx, &s64temp))
+        return false;
+      if (s64temp >= 0) {
+        *u = (uint64_t)s64temp;
+        return true;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_uinteger(cmp_ctx_t *ctx, uint64_t *u) {
+  return cmp_read_ulong(ctx, u);
+}
+
+#ifndef CMP_NO_FLOAT
+bool cmp_read_float(cmp_ctx_t *ctx, float *f) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != FLOAT_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_float_value(ctx, f);
+}
+
+bool cmp_read_double(cmp_ctx_t *ctx, double *d) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker != DOUBLE_MARKER) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_double_value(ctx, d);
+}
+
+bool cmp_read_decimal(cmp_ctx_t *ctx, double *d) {
+  uint8_t type_marker = 0;
+  float f = 0.f;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  switch (type_marker) {
+    case FLOAT_MARKER:
+      if (!read_float_value(ctx, &f))
+        return false;
+      *d = (double)f;
+      return true;
+    case DOUBLE_MARKER:
+      return read_double_value(ctx, d);
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+#endif /* CMP_NO_FLOAT */
+
+bool cmp_read_nil(cmp_ctx_t *ctx) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (type_marker == NIL_MARKER)
+    return true;
+
+  ctx->error = CMP_ERROR_INVALID_TYPE;
+  return false;
+}
+
+bool cmp_read_bool(cmp_ctx_t *ctx, bool *b) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  switch (type_marker) {
+    case TRUE_MARKER:
+      *b = true;
+      return true;
+    case FALSE_MARKER:
+      *b = false;
+      return true;
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+
+bool cmp_read_bool_as_u8(cmp_ctx_t *ctx, uint8_t *b) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  switch (type_marker) {
+    case TRUE_MARKER:
+      *b = 1;
+      return true;
+    case FALSE_MARKER:
+      *b = 0;
+      return true;
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+
+bool cmp_read_str_size(cmp_ctx_t *ctx, uint32_t *size) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  switch (marker_info[type_marker].type) {
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      return read_type_size(ctx, type_marker, size);
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+
+bool cmp_read_str(cmp_ctx_t *ctx, char *data, uint32_t *size) {
+  uint32_t str_size = 0;
+
+  if (!cmp_read_str_size(ctx, &str_size))
+    return false;
+
+  if (str_size >= *size) {
+    *size = str_size;
+    ctx->error = CMP_ERROR_STR_DATA_LENGTH_TOO_LONG;
+    return false;
+  }
+
+  if (!read_bytes(ctx, data, str_size)) {
+    ctx->error = CMP_ERROR_DATA_READING;
+    return false;
+  }
+
+  data[str_size] = 0;
+
+  *size = str_size;
+  return true;
+}
+
+bool cmp_read_bin_size(cmp_ctx_t *ctx, uint32_t *size) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  switch (marker_info[type_marker].type) {
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return read_type_size(ctx, type_marker, size);
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+
+bool cmp_read_bin(cmp_ctx_t *ctx, void *data, uint32_t *size) {
+  uint32_t bin_size = 0;
+
+  if (!cmp_read_bin_size(ctx, &bin_size))
+    return false;
+
+  if (bin_size > *size) {
+    ctx->error = CMP_ERROR_BIN_DATA_LENGTH_TOO_LONG;
+    return false;
+  }
+
+  if (!read_bytes(ctx, data, bin_size)) {
+    ctx->error = CMP_ERROR_DATA_READING;
+    return false;
+  }
+
+  *size = bin_size;
+  return true;
+}
+
+bool cmp_read_array(cmp_ctx_t *ctx, uint32_t *size) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  switch (marker_info[type_marker].type) {
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_ARRAY32:
+      return read_type_size(ctx, type_marker, size);
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+
+bool cmp_read_map(cmp_ctx_t *ctx, uint32_t *size) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  switch (marker_info[type_marker].type) {
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_MAP32:
+      return read_type_size(ctx, type_marker, size);
+    default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+  }
+}
+
+/*
+ * Reads the header of an array that's about to be read into a caller's C
+ * array, which has room for `*size` elements.
+ */
+static bool read_array_header_into(cmp_ctx_t *ctx, uint32_t *size) {
+  uint32_t array_size = 0;
+
+  if (!cmp_read_array(ctx, &array_size))
+    return false;
+
+  if (array_size > *size) {
+    *size = array_size;
+    ctx->error = CMP_ERROR_ARRAY_LENGTH_TOO_LONG;
+    return false;
+  }
+
+  *size = array_size;
+  return true;
+}
+
+/*
+ * Decodes up to `limit` integers (no more than INTEGER_RUN_SIZE) from a memory
+ * buffer into `values`, as long as they're all fixnums or all share a marker,
+ * and returns how many it decoded.  Values are sign-extended if `*is_signed`
+ * comes back true.  The buffer position is left alone: each value took up
+ * `*stride` bytes, and the caller consumes as many as it can use.
+ *
+ * Runs like this are decoded in loops the compiler can unroll and vectorize,
+ * instead of an object at a time.
+ */
+enum {
+  INTEGER_RUN_SIZE = 64
+};
+
+static size_t mem_integer_run(cmp_ctx_t *ctx, size_t limit, uint64_t *values,
+                                                            bool *is_signed,
+                                                            size_t *stride) {
+  const uint8_t *buf;
+  size_t available;
+  size_t count = 0;
+  size_t i;
+  uint8_t type_marker;
+
+  if (ctx->read != mem_reader || ctx->buf_pos >= ctx->buf_size)
+    return 0;
+
+  buf = (const uint8_t *)ctx->buf + ctx->buf_pos;
+  available = ctx->buf_size - ctx->buf_pos;
+  type_marker = buf[0];
+
+  if (type_marker <= 0x7F || type_marker >= NEGATIVE_FIXNUM_MARKER) {
+    if (limit > available)
+      limit = available;
+
+    while (count < limit &&
+           (buf[count] <= 0x7F || buf[count] >= NEGATIVE_FIXNUM_MARKER)) {
+      values[count] = (uint64_t)(int64_t)(int8_t)buf[count];
+      count++;
+    }
+
+    *is_signed = true;
+    *stride = 1;
+    return count;
+  }
+
+  switch (type_marker) {
+    case U8_MARKER:
+    case S8_MARKER:
+      *stride = 2;
+      break;
+    case U16_MARKER:
+    case S16_MARKER:
+      *stride = 3;
+      break;
+    case U32_MARKER:
+    case S32_MARKER:
+      *stride = 5;
+      break;
+    case U64_MARKER:
+    case S64_MARKER:
+      *stride = 9;
+      break;
+    default:
+      return 0;
+  }
+
+  if (limit > available / *stride)
+    limit = available / *stride;
+
+  while (count < limit && buf[count * *stride] == type_marker)
+    count++;
+
+  buf++;
+  *is_signed = marker_info[type_marker].type >= CMP_TYPE_SINT8;
+
+  switch (type_marker) {
+    case U8_MARKER:
+      for (i = 0; i < count; i++)
+        values[i] = buf[i * 2];
+      break;
+    case S8_MARKER:
+      for (i = 0; i < count; i++)
+        values[i] = (uint64_t)(int64_t)(int8_t)buf[i * 2];
+      break;
+    case U16_MARKER:
+      for (i = 0; i < count; i++)
+        values[i] = load_be16(buf + (i * 3));
+      break;
+    case S16_MARKER:
+      for (i = 0; i < count; i++)
+        values[i] = (uint64_t)(int64_t)(int16_t)load_be16(
+          buf + (i * 3)
+        );
+      break;
+    case U32_MARKER:
+      for (i = 0; i < count; i++)
+        values[i] = load_be32(buf + (i * 5));
+      break;
+    case S32_MARKER:
+      for (i = 0; i < count; i++)
+        values[i] = (uint64_t)(int64_t)(int32_t)load_be32(
+          buf + (i * 5)
+        );
+      break;
+    default:
+      for (i = 0; i < count; i++)
+        values[i] = load_be64(buf + (i * 9));
+      break;
+  }
+
+  return count;
+}
+
+bool cmp_read_int_array(cmp_ctx_t *ctx, int32_t *data, uint32_t *size) {
+  uint64_t values[INTEGER_RUN_SIZE];
+  bool is_signed = false;
+  size_t stride = 0;
+  size_t limit;
+  size_t count;
+  size_t j;
+  uint32_t i = 0;
+
+  if (!read_array_header_into(ctx, size))
+    return false;
+
+  while (i < *size) {
+    limit = *size - i;
+
+    if (limit > INTEGER_RUN_SIZE)
+      limit = INTEGER_RUN_SIZE;
+
+    count = mem_integer_run(ctx, limit, values, &is_signed, &stride);
+
+    for (j = 0; j < count; j++) {
+      if (is_signed ? ((int64_t)values[j] < INT32_MIN ||
+                       (int64_t)values[j] > INT32_MAX)
+                    : values[j] > INT32_MAX) {
+        break;
+      }
+
+      data[i + j] = (int32_t)(int64_t)values[j];
+    }
+
+    ctx->buf_pos += j * stride;
+    i += (uint32_t)j;
+
+    if (j < limit && !cmp_read_int(ctx, &data[i++]))
+      return false;
+  }
+
+  return true;
+}
+
+bool cmp_read_long_array(cmp_ctx_t *ctx, int64_t *data, uint32_t *size) {
+  uint64_t values[INTEGER_RUN_SIZE];
+  bool is_signed = false;
+  size_t stride = 0;
+  size_t limit;
+  size_t count;
+  size_t j;
+  uint32_t i = 0;
+
+  if (!read_array_header_into(ctx, size))
+    return false;
+
+  while (i < *size) {
+    limit = *size - i;
+
+    if (limit > INTEGER_RUN_SIZE)
+      limit = INTEGER_RUN_SIZE;
+
+    count = mem_integer_run(ctx, limit, values, &is_signed, &stride);
+
+    for (j = 0; j < count; j++) {
+      if (!is_signed && values[j] > INT64_MAX)
+        break;
+
+      data[i + j] = (int64_t)values[j];
+    }
+
+    ctx->buf_pos += j * stride;
+    i += (uint32_t)j;
+
+    if (j < limit && !cmp_read_long(ctx, &data[i++]))
+      return false;
+  }
+
+  return true;
+}
+
+bool cmp_read_uint_array(cmp_ctx_t *ctx, uint32_t *data, uint32_t *size) {
+  uint64_t values[INTEGER_RUN_SIZE];
+  bool is_signed = false;
+  size_t stride = 0;
+  size_t limit;
+  size_t count;
+  size_t j;
+  uint32_t i = 0;
+
+  if (!read_array_header_into(ctx, size))
+    return false;
+
+  while (i < *size) {
+    limit = *size - i;
+
+    if (limit > INTEGER_RUN_SIZE)
+      limit = INTEGER_RUN_SIZE;
+
+    count = mem_integer_run(ctx, limit, values, &is_signed, &stride);
+
+    for (j = 0; j < count; j++) {
+      if (values[j] > UINT32_MAX)
+        break;
+
+      data[i + j] = (uint32_t)values[j];
+    }
+
+    ctx->buf_pos += j * stride;
+    i += (uint32_t)j;
+
+    if (j < limit && !cmp_read_uint(ctx, &data[i++]))
+      return false;
+  }
+
+  return true;
+}
+
+bool cmp_read_ulong_array(cmp_ctx_t *ctx, uint64_t *data, uint32_t *size) {
+  uint64_t values[INTEGER_RUN_SIZE];
+  bool is_signed = false;
+  size_t stride = 0;
+  size_t limit;
+  size_t count;
+  size_t j;
+  uint32_t i = 0;
+
+  if (!read_array_header_into(ctx, size))
+    return false;
+
+  while (i < *size) {
+    limit = *size - i;
+
+    if (limit > INTEGER_RUN_SIZE)
+      limit = INTEGER_RUN_SIZE;
+
+    count = mem_integer_run(ctx, limit, values, &is_signed, &stride);
+
+    for (j = 0; j < count; j++) {
+      if (is_signed && (int64_t)values[j] < 0)
+        break;
+
+      data[i + j] = values[j];
+    }
+
+    ctx->buf_pos += j * stride;
+    i += (uint32_t)j;
+
+    if (j < limit && !cmp_read_ulong(ctx, &data[i++]))
+      return false;
+  }
+
+  return true;
+}
+
+#ifndef CMP_NO_FLOAT
+/*
+ * Consumes as many of the next `limit` objects in a memory buffer as are
+ * `type_marker` followed by `width` bytes of data, pointing `*data` at the
+ * first one's data and returning how many there were.
+ */
+static size_t mem_run(cmp_ctx_t *ctx, uint8_t type_marker,
+                                      size_t width,
+                                      size_t limit,
+                                      const uint8_t **data) {
+  const uint8_t *buf;
+  size_t available;
+  size_t count = 0;
+
+  if (ctx->read != mem_reader)
+    return 0;
+
+  buf = (const uint8_t *)ctx->buf + ctx->buf_pos;
+  available = (ctx->buf_size - ctx->buf_pos) / (1 + width);
+
+  if (limit > available)
+    limit = available;
+
+  while (count < limit && buf[count * (1 + width)] == type_marker)
+    count++;
+
+  *data = buf + 1;
+  ctx->buf_pos += count * (1 + width);
+  return count;
+}
+
+bool cmp_read_float_array(cmp_ctx_t *ctx, float *data, uint32_t *size) {
+  const uint8_t *run = NULL;
+  size_t run_size;
+  uint32_t i = 0;
+  size_t j;
+
+  if (!read_array_header_into(ctx, size))
+    return false;
+
+  while (i < *size) {
+    run_size = mem_run(ctx, FLOAT_MARKER, sizeof(float), *size - i, &run);
+
+    for (j = 0; j < run_size; j++, i++)
+      data[i] = decode_befloat((const char *)run + (j * 5));
+
+    if (i < *size && !cmp_read_float(ctx, &data[i++]))
+      return false;
+  }
+
+  return true;
+}
+
+bool cmp_read_double_array(cmp_ctx_t *ctx, double *data, uint32_t *size) {
+  const uint8_t *run = NULL;
+  size_t run_size;
+  uint32_t i = 0;
+  size_t j;
+
+  if (!read_array_header_into(ctx, size))
+    return false;
+
+  while (i < *size) {
+    run_size = mem_run(ctx, DOUBLE_MARKER, sizeof(double), *size - i, &run);
+
+    for (j = 0; j < run_size; j++, i++)
+      data[i] = decode_bedouble((const char *)run + (j * 9));
+
+    /* `cmp_write_double_array` writes arrays of exact floats as floats */
+    run_size = mem_run(ctx, FLOAT_MARKER, sizeof(float), *size - i, &run);
+
+    for (j = 0; j < run_size; j++, i++)
+      data[i] = decode_befloat((const char *)run + (j * 5));
+
+    if (i < *size && !cmp_read_decimal(ctx, &data[i++]))
+      return false;
+  }
+
+  return true;
+}
+#endif /* CMP_NO_FLOAT */
+
+bool cmp_read_fixext1_marker(cmp_ctx_t *ctx, int8_t *type) {
+  uint32_t size = 0;
+
+  return read_ext_marker_of(ctx, FIXEXT1_MARKER, type, &size);
+}
+
+bool cmp_read_fixext1(cmp_ctx_t *ctx, int8_t *type, void *data) {
+  if (!cmp_read_fixext1_marker(ctx, type))
+    return false;
+
+  if (read_bytes(ctx, data, 1))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_fixext2_marker(cmp_ctx_t *ctx, int8_t *type) {
+  uint32_t size = 0;
+
+  return read_ext_marker_of(ctx, FIXEXT2_MARKER, type, &size);
+}
+
+bool cmp_read_fixext2(cmp_ctx_t *ctx, int8_t *type, void *data) {
+  if (!cmp_read_fixext2_marker(ctx, type))
+    return false;
+
+  if (read_bytes(ctx, data, 2))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_fixext4_marker(cmp_ctx_t *ctx, int8_t *type) {
+  uint32_t size = 0;
+
+  return read_ext_marker_of(ctx, FIXEXT4_MARKER, type, &size);
+}
+
+bool cmp_read_fixext4(cmp_ctx_t *ctx, int8_t *type, void *data) {
+  if (!cmp_read_fixext4_marker(ctx, type))
+    return false;
+
+  if (read_bytes(ctx, data, 4))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_fixext8_marker(cmp_ctx_t *ctx, int8_t *type) {
+  uint32_t size = 0;
+
+  return read_ext_marker_of(ctx, FIXEXT8_MARKER, type, &size);
+}
+
+bool cmp_read_fixext8(cmp_ctx_t *ctx, int8_t *type, void *data) {
+  if (!cmp_read_fixext8_marker(ctx, type))
+    return false;
+
+  if (read_bytes(ctx, data, 8))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_fixext16_marker(cmp_ctx_t *ctx, int8_t *type) {
+  uint32_t size = 0;
+
+  return read_ext_marker_of(ctx, FIXEXT16_MARKER, type, &size);
+}
+
+bool cmp_read_fixext16(cmp_ctx_t *ctx, int8_t *type, void *data) {
+  if (!cmp_read_fixext16_marker(ctx, type))
+    return false;
+
+  if (read_bytes(ctx, data, 16))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_ext8_marker(cmp_ctx_t *ctx, int8_t *type, uint8_t *size) {
+  uint32_t u32temp = 0;
+
+  if (!read_ext_marker_of(ctx, EXT8_MARKER, type, &u32temp))
+    return false;
+
+  *size = (uint8_t)u32temp;
+  return true;
+}
+
+bool cmp_read_ext8(cmp_ctx_t *ctx, int8_t *type, uint8_t *size, void *data) {
+  if (!cmp_read_ext8_marker(ctx, type, size))
+    return false;
+
+  if (read_bytes(ctx, data, *size))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_ext16_marker(cmp_ctx_t *ctx, int8_t *type, uint16_t *size) {
+  uint32_t u32temp = 0;
+
+  if (!read_ext_marker_of(ctx, EXT16_MARKER, type, &u32temp))
+    return false;
+
+  *size = (uint16_t)u32temp;
+  return true;
+}
+
+bool cmp_read_ext16(cmp_ctx_t *ctx, int8_t *type, uint16_t *size, void *data) {
+  if (!cmp_read_ext16_marker(ctx, type, size))
+    return false;
+
+  if (read_bytes(ctx, data, *size))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_ext32_marker(cmp_ctx_t *ctx, int8_t *type, uint32_t *size) {
+  return read_ext_marker_of(ctx, EXT32_MARKER, type, size);
+}
+
+bool cmp_read_ext32(cmp_ctx_t *ctx, int8_t *type, uint32_t *size, void *data) {
+  if (!cmp_read_ext32_marker(ctx, type, size))
+    return false;
+
+  if (read_bytes(ctx, data, *size))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_ext_marker(cmp_ctx_t *ctx, int8_t *type, uint32_t *size) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  if (!(marker_info[type_marker].flags & MARKER_EXT)) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  if (!read_type_size(ctx, type_marker, size))
+    return false;
+
+  return read_ext_type(ctx, type);
+}
+
+bool cmp_read_ext(cmp_ctx_t *ctx, int8_t *type, uint32_t *size, void *data) {
+  if (!cmp_read_ext_marker(ctx, type, size))
+    return false;
+
+  if (read_bytes(ctx, data, *size))
+    return true;
+
+  ctx->error = CMP_ERROR_DATA_READING;
+  return false;
+}
+
+bool cmp_read_str_view(cmp_ctx_t *ctx, const char **data, uint32_t *size) {
+  const void *view = NULL;
+  uint32_t str_size = 0;
+
+  if (!cmp_read_str_size(ctx, &str_size))
+    return false;
+
+  if (!acquire_bytes(ctx, &view, str_size))
+    return false;
+
+  *data = (const char *)view;
+  *size = str_size;
+  return true;
+}
+
+bool cmp_read_bin_view(cmp_ctx_t *ctx, const void **data, uint32_t *size) {
+  uint32_t bin_size = 0;
+
+  if (!cmp_read_bin_size(ctx, &bin_size))
+    return false;
+
+  if (!acquire_bytes(ctx, data, bin_size))
+    return false;
+
+  *size = bin_size;
+  return true;
+}
+
+bool cmp_read_ext_view(cmp_ctx_t *ctx, int8_t *type, uint32_t *size,
+                                                     const void **data) {
+  if (!cmp_read_ext_marker(ctx, type, size))
+    return false;
+
+  return acquire_bytes(ctx, data, *size);
+}
+
+bool cmp_read_object(cmp_ctx_t *ctx, cmp_object_t *obj) {
+  uint8_t type_marker = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
+    return false;
+
+  obj->type = marker_info[type_marker].type;
+
+  if (obj->type == INVALID_CMP_TYPE) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  return read_obj_data(ctx, type_marker, obj);
+}
+
+bool cmp_skip_object(cmp_ctx_t *ctx, cmp_object_t *obj) {
+  uint8_t type_marker = 0;
+  const marker_info_t *info;
+
+  if (!read_type_marker(ctx, &type_marker)) {
+    return false;
+  }
+
+  info = &marker_info[type_marker];
+
+  if (info->type == INVALID_CMP_TYPE) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
+
+  if (info->flags & (MARKER_ARRAY | MARKER_MAP)) {
+    obj->type = info->type;
+
+    if (!read_obj_data(ctx, type_marker, obj)) {
+      return false;
+    }
+
+    ctx->error = CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED;
+
+    return false;
+  }
+
+  return skip_obj_data(ctx, type_marker);
+}
+
+bool cmp_skip_object_flat(cmp_ctx_t *ctx, cmp_object_t *obj) {
+  size_t element_count = 1;
+  bool in_container = false;
+
+  while (element_count) {
+    uint8_t type_marker = 0;
+    const marker_info_t *info;
+
+    if (!read_type_marker(ctx, &type_marker)) {
+      return false;
+    }
+
+    info = &marker_info[type_marker];
+
+    if (info->type == INVALID_CMP_TYPE) {
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+    }
+
+    element_count--;
+
+    if (info->flags & (MARKER_ARRAY | MARKER_MAP)) {
+      if (in_container) {
+        obj->type = info->type;
+
+        if (!read_obj_data(ctx, type_marker, obj)) {
+          return false;
+        }
+
+        ctx->error = CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED;
+        return false;
+      }
+
+      in_container = true;
+
+      if (!read_element_count(ctx, type_marker, &element_count)) {
+        return false;
+      }
+    }
+    else if (!skip_obj_data(ctx, type_marker)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool cmp_skip_object_no_limit(cmp_ctx_t *ctx) {
+  size_t element_count = 1;
+
+  while (element_count) {
+    uint8_t type_marker = 0;
+    const marker_info_t *info;
+
+    if (!read_type_marker(ctx, &type_marker)) {
+      return false;
+    }
+
+    info = &marker_info[type_marker];
+
+    if (info->type == INVALID_CMP_TYPE) {
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+    }
+
+    element_count--;
+
+    if (info->flags & (MARKER_ARRAY | MARKER_MAP)) {
+      if (!read_element_count(ctx, type_marker, &element_count)) {
+        return false;
+      }
+    }
+    else if (!skip_obj_data(ctx, type_marker)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool cmp_skip_object_limit(cmp_ctx_t *ctx, cmp_object_t *obj, uint32_t limit) {
+  size_t element_count = 1;
+  uint32_t depth = 0;
+
+  while (element_count) {
+    uint8_t type_marker = 0;
+    const marker_info_t *info;
+
+    if (!read_type_marker(ctx, &type_marker)) {
+      return false;
+    }
+
+    info = &marker_info[type_marker];
+
+    if (info->type == INVALID_CMP_TYPE) {
+      ctx->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+    }
+
+    element_count--;
+
+    if (info->flags & (MARKER_ARRAY | MARKER_MAP)) {
+      ++depth;
+
+      if (depth > limit) {
+        obj->type = info->type;
+
+        if (!read_obj_data(ctx, type_marker, obj)) {
+          return false;
+        }
+
+        ctx->error = CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED;
+
+        return false;
+      }
+
+      if (!read_element_count(ctx, type_marker, &element_count)) {
+        return false;
+      }
+    }
+    else if (!skip_obj_data(ctx, type_marker)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool cmp_object_is_char(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_short(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+    case CMP_TYPE_SINT16:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_int(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+    case CMP_TYPE_SINT16:
+    case CMP_TYPE_SINT32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_long(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+    case CMP_TYPE_SINT16:
+    case CMP_TYPE_SINT32:
+    case CMP_TYPE_SINT64:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_sinteger(const cmp_object_t *obj) {
+  return cmp_object_is_long(obj);
+}
+
+bool cmp_object_is_uchar(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_ushort(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      return true;
+    case CMP_TYPE_UINT16:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_uint(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+    case CMP_TYPE_UINT16:
+    case CMP_TYPE_UINT32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_ulong(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+    case CMP_TYPE_UINT16:
+    case CMP_TYPE_UINT32:
+    case CMP_TYPE_UINT64:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_uinteger(const cmp_object_t *obj) {
+  return cmp_object_is_ulong(obj);
+}
+
+bool cmp_object_is_float(const cmp_object_t *obj) {
+  if (obj->type == CMP_TYPE_FLOAT)
+    return true;
+
+  return false;
+}
+
+bool cmp_object_is_double(const cmp_object_t *obj) {
+  if (obj->type == CMP_TYPE_DOUBLE)
+    return true;
+
+  return false;
+}
+
+bool cmp_object_is_nil(const cmp_object_t *obj) {
+  if (obj->type == CMP_TYPE_NIL)
+    return true;
+
+  return false;
+}
+
+bool cmp_object_is_bool(const cmp_object_t *obj) {
+  if (obj->type == CMP_TYPE_BOOLEAN)
+    return true;
+
+  return false;
+}
+
+bool cmp_object_is_str(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_bin(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_array(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_ARRAY32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_map(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_MAP32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_is_ext(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXEXT1:
+    case CMP_TYPE_FIXEXT2:
+    case CMP_TYPE_FIXEXT4:
+    case CMP_TYPE_FIXEXT8:
+    case CMP_TYPE_FIXEXT16:
+    case CMP_TYPE_EXT8:
+    case CMP_TYPE_EXT16:
+    case CMP_TYPE_EXT32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_as_char(const cmp_object_t *obj, int8_t *c) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+      *c = obj->as.s8;
+      return true;
+    case CMP_TYPE_UINT8:
+      if (obj->as.u8 <= 0x7F) {
+        *c = obj->as.s8;
+        return true;
+      }
+      else {
+        return false;
+      }
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_short(const cmp_object_t *obj, int16_t *s) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+      *s = obj->as.s8;
+      return true;
+    case CMP_TYPE_UINT8:
+      *s = obj->as.u8;
+      return true;
+    case CMP_TYPE_SINT16:
+      *s = obj->as.s16;
+      return true;
+    case CMP_TYPE_UINT16:
+      if (obj->as.u16 <= 0x7FFF) {
+        *s = (int16_t)obj->as.u16;
+        return true;
+      }
+      else {
+        return false;
+      }
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_int(const cmp_object_t *obj, int32_t *i) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+      *i = obj->as.s8;
+      return true;
+    case CMP_TYPE_UINT8:
+      *i = obj->as.u8;
+      return true;
+    case CMP_TYPE_SINT16:
+      *i = obj->as.s16;
+      return true;
+    case CMP_TYPE_UINT16:
+      *i = obj->as.u16;
+      return true;
+    case CMP_TYPE_SINT32:
+      *i = obj->as.s32;
+      return true;
+    case CMP_TYPE_UINT32:
+      if (obj->as.u32 <= 0x7FFFFFFF) {
+        *i = (int32_t)obj->as.u32;
+        return true;
+      }
+      else {
+        return false;
+      }
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_long(const cmp_object_t *obj, int64_t *d) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+      *d = obj->as.s8;
+      return true;
+    case CMP_TYPE_UINT8:
+      *d = obj->as.u8;
+      return true;
+    case CMP_TYPE_SINT16:
+      *d = obj->as.s16;
+      return true;
+    case CMP_TYPE_UINT16:
+      *d = obj->as.u16;
+      return true;
+    case CMP_TYPE_SINT32:
+      *d = obj->as.s32;
+      return true;
+    case CMP_TYPE_UINT32:
+      *d = obj->as.u32;
+      return true;
+    case CMP_TYPE_SINT64:
+      *d = obj->as.s64;
+      return true;
+    case CMP_TYPE_UINT64:
+      if (obj->as.u64 <= UINT64_C(0x7FFFFFFFFFFFFFFF)) {
+        *d = (int64_t)obj->as.u64;
+        return true;
+      }
+      else {
+        return false;
+      }
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_sinteger(const cmp_object_t *obj, int64_t *d) {
+  return cmp_object_as_long(obj, d);
+}
+
+bool cmp_object_as_uchar(const cmp_object_t *obj, uint8_t *c) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      *c = obj->as.u8;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_ushort(const cmp_object_t *obj, uint16_t *s) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      *s = obj->as.u8;
+      return true;
+    case CMP_TYPE_UINT16:
+      *s = obj->as.u16;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_uint(const cmp_object_t *obj, uint32_t *i) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      *i = obj->as.u8;
+      return true;
+    case CMP_TYPE_UINT16:
+      *i = obj->as.u16;
+      return true;
+    case CMP_TYPE_UINT32:
+      *i = obj->as.u32;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_ulong(const cmp_object_t *obj, uint64_t *u) {
+  switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      *u = obj->as.u8;
+      return true;
+    case CMP_TYPE_UINT16:
+      *u = obj->as.u16;
+      return true;
+    case CMP_TYPE_UINT32:
+      *u = obj->as.u32;
+      return true;
+    case CMP_TYPE_UINT64:
+      *u = obj->as.u64;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_uinteger(const cmp_object_t *obj, uint64_t *u) {
+  return cmp_object_as_ulong(obj, u);
+}
+
+#ifndef CMP_NO_FLOAT
+bool cmp_object_as_float(const cmp_object_t *obj, float *f) {
+  if (obj->type == CMP_TYPE_FLOAT) {
+    *f = obj->as.flt;
+    return true;
+  }
+
+  return false;
+}
+
+bool cmp_object_as_double(const cmp_object_t *obj, double *d) {
+  if (obj->type == CMP_TYPE_DOUBLE) {
+    *d = obj->as.dbl;
+    return true;
+  }
+
+  return false;
+}
+#endif /* CMP_NO_FLOAT */
+
+bool cmp_object_as_bool(const cmp_object_t *obj, bool *b) {
+  if (obj->type == CMP_TYPE_BOOLEAN) {
+    if (obj->as.boolean)
+      *b = true;
+    else
+      *b = false;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool cmp_object_as_str(const cmp_object_t *obj, uint32_t *size) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      *size = obj->as.str_size;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_bin(const cmp_object_t *obj, uint32_t *size) {
+  switch (obj->type) {
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      *size = obj->as.bin_size;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_array(const cmp_object_t *obj, uint32_t *size) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_ARRAY32:
+      *size = obj->as.array_size;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_map(const cmp_object_t *obj, uint32_t *size) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_MAP32:
+      *size = obj->as.map_size;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_as_ext(const cmp_object_t *obj, int8_t *type, uint32_t *size) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXEXT1:
+    case CMP_TYPE_FIXEXT2:
+    case CMP_TYPE_FIXEXT4:
+    case CMP_TYPE_FIXEXT8:
+    case CMP_TYPE_FIXEXT16:
+    case CMP_TYPE_EXT8:
+    case CMP_TYPE_EXT16:
+    case CMP_TYPE_EXT32:
+      *type = obj->as.ext.type;
+      *size = obj->as.ext.size;
+      return true;
+    default:
+        return false;
+  }
+}
+
+bool cmp_object_to_str(cmp_ctx_t *ctx, const cmp_object_t *obj, char *data,
+                                                          uint32_t buf_size) {
+  uint32_t str_size = 0;
+
+  switch (obj->type) {
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      str_size = obj->as.str_size;
+      if (str_size >= buf_size) {
+        ctx->error = CMP_ERROR_STR_DATA_LENGTH_TOO_LONG;
+        return false;
+      }
+
+      if (!read_bytes(ctx, data, str_size)) {
+        ctx->error = CMP_ERROR_DATA_READING;
+        return false;
+      }
+
+      data[str_size] = 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_to_bin(cmp_ctx_t *ctx, const cmp_object_t *obj, void *data,
+                                                          uint32_t buf_size) {
+  uint32_t bin_size = 0;
+
+  switch (obj->type) {
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      bin_size = obj->as.bin_size;
+      if (bin_size > buf_size) {
+        ctx->error = CMP_ERROR_BIN_DATA_LENGTH_TOO_LONG;
+        return false;
+      }
+
+      if (!read_bytes(ctx, data, bin_size)) {
+        ctx->error = CMP_ERROR_DATA_READING;
+        return false;
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_to_str_view(cmp_ctx_t *ctx, const cmp_object_t *obj,
+                                            const char **data) {
+  const void *view = NULL;
+
+  switch (obj->type) {
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      if (!acquire_bytes(ctx, &view, obj->as.str_size))
+        return false;
+
+      *data = (const char *)view;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool cmp_object_to_bin_view(cmp_ctx_t *ctx, const cmp_object_t *obj,
+                                            const void **data) {
+  switch (obj->type) {
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return acquire_bytes(ctx, data, obj->as.bin_size);
+    default:
+      return false;
+  }
+}
+
+/*
+ * Returns how many bytes an object starting with `type_marker` occupies before
+ * its data: the marker, any length field, an ext's type and a scalar's value.
+ */
+static uint8_t header_size(uint8_t type_marker) {
+  const marker_info_t *info = &marker_info[type_marker];
+
+  if (info->width) {
+    if (info->flags & MARKER_EXT)
+      return 2 + info->width;
+
+    return 1 + info->width;
+  }
+
+  if (info->flags & MARKER_EXT)
+    return 2;
+
+  if (info->flags & (MARKER_ARRAY | MARKER_MAP))
+    return 1;
+
+  if (info->type == CMP_TYPE_FIXSTR)
+    return 1;
+
+  return 1 + info->size;
+}
+
+static uint32_t payload_size_of(const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      return obj->as.str_size;
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return obj->as.bin_size;
+    case CMP_TYPE_FIXEXT1:
+    case CMP_TYPE_FIXEXT2:
+    case CMP_TYPE_FIXEXT4:
+    case CMP_TYPE_FIXEXT8:
+    case CMP_TYPE_FIXEXT16:
+    case CMP_TYPE_EXT8:
+    case CMP_TYPE_EXT16:
+    case CMP_TYPE_EXT32:
+      return obj->as.ext.size;
+    default:
+      return 0;
+  }
+}
+
+void cmp_decoder_init(cmp_decoder_t *decoder) {
+  decoder->error = CMP_ERROR_NONE;
+  decoder->header_size = 0;
+  decoder->header_pos = 0;
+  decoder->payload_left = 0;
+}
+
+int cmp_decoder_next(cmp_decoder_t *decoder, const void **data,
+                                             size_t *size,
+                                             cmp_object_t *obj,
+                                             const void **payload,
+                                             size_t *payload_size) {
+  const uint8_t *input = (const uint8_t *)*data;
+  cmp_ctx_t header;
+  size_t count;
+
+  if (decoder->error != CMP_ERROR_NONE)
+    return CMP_DECODER_ERROR;
+
+  if (!*size)
+    return CMP_DECODER_NEED_MORE;
+
+  if (decoder->payload_left) {
+    count = *size;
+
+    if (count > decoder->payload_left)
+      count = decoder->payload_left;
+
+    *payload = input;
+    *payload_size = count;
+    *data = input + count;
+    *size -= count;
+    decoder->payload_left -= (uint32_t)count;
+    return CMP_DECODER_PAYLOAD;
+  }
+
+  if (!decoder->header_pos) {
+    if (marker_info[*input].type == INVALID_CMP_TYPE) {
+      decoder->error = CMP_ERROR_INVALID_TYPE;
+      return CMP_DECODER_ERROR;
+    }
+
+    decoder->header_size = header_size(*input);
+  }
+
+  count = decoder->header_size - decoder->header_pos;
+
+  if (count > *size)
+    count = *size;
+
+  memcpy(decoder->header + decoder->header_pos, input, count);
+  decoder->header_pos += (uint8_t)count;
+  *data = input + count;
+  *size -= count;
+
+  if (decoder->header_pos < decoder->header_size)
+    return CMP_DECODER_NEED_MORE;
+
+  decoder->header_pos = 0;
+
+  cmp_init_mem_reader(&header, decoder->header, decoder->header_size);
+
+  if (!cmp_read_object(&header, obj)) {
+    decoder->error = header.error;
+    return CMP_DECODER_ERROR;
+  }
+
+  decoder->payload_left = payload_size_of(obj);
+  return CMP_DECODER_OBJECT;
+}
+
+bool cmp_decoder_is_idle(const cmp_decoder_t *decoder) {
+  return decoder->error == CMP_ERROR_NONE &&
+         decoder->header_pos == 0 &&
+         decoder->payload_left == 0;
+}
+
+const char* cmp_decoder_strerror(const cmp_decoder_t *decoder) {
+  if (decoder->error > CMP_ERROR_NONE && decoder->error < CMP_ERROR_MAX)
+    return cmp_error_message((cmp_error_t)decoder->error);
+
+  return "";
+}
+
+bool cmp_build_tape(cmp_ctx_t *ctx, cmp_tape_entry_t *tape, uint32_t *size) {
+  uint32_t capacity = *size;
+  uint32_t count = 0;
+  uint32_t open = UINT32_MAX; /* The innermost open container, if any */
+  uint32_t parent;
+  uint64_t elements;
+  cmp_tape_entry_t *entry;
+  cmp_object_t obj;
+
+  if (ctx->read != mem_reader) {
+    ctx->error = CMP_ERROR_MEMORY_CONTEXT_REQUIRED;
+    return false;
+  }
+
+  /* Tape offsets and lengths are 32-bit, and offsets are from the start */
+  if ((uint64_t)ctx->buf_size > UINT32_MAX) {
+    ctx->error = CMP_ERROR_BUFFER_TOO_LARGE;
+    return false;
+  }
+
+  /*
+   * While a container is open, its entry's `next` counts the elements still
+   * to come and its `length` holds the index of the container it's in.
+   */
+  do {
+    if (count == capacity) {
+      ctx->error = CMP_ERROR_TAPE_FULL;
+      return false;
+    }
+
+    entry = &tape[count];
+    entry->offset = (uint32_t)ctx->buf_pos;
+
+    if (!cmp_read_object(ctx, &obj))
+      return false;
+
+    entry->type = obj.type;
+    count++;
+
+    switch (obj.type) {
+      case CMP_TYPE_FIXARRAY:
+      case CMP_TYPE_ARRAY16:
+      case CMP_TYPE_ARRAY32:
+        entry->size = obj.as.array_size;
+        elements = obj.as.array_size;
+        break;
+      case CMP_TYPE_FIXMAP:
+      case CMP_TYPE_MAP16:
+      case CMP_TYPE_MAP32:
+        entry->size = obj.as.map_size;
+        elements = ((uint64_t)obj.as.map_size) * 2;
+        break;
+      default:
+        entry->size = payload_size_of(&obj);
+        elements = 0;
+
+        if (entry->size && !skip_bytes(ctx, entry->size)) {
+          ctx->error = CMP_ERROR_DATA_READING;
+          return false;
+        }
+
+        break;
+    }
+
+    if (elements > (uint64_t)(capacity - count)) {
+      ctx->error = CMP_ERROR_TAPE_FULL;
+      return false;
+    }
+
+    if (elements) {
+      entry->next = (uint32_t)elements;
+      entry->length = open;
+      open = count - 1;
+      continue;
+    }
+
+    entry->next = count;
+    entry->length = (uint32_t)(ctx->buf_pos - entry->offset);
+
+    /* Close every container this object was the last element of */
+    while (open != UINT32_MAX) {
+      entry = &tape[open];
+
+      if (--entry->next)
+        break;
+
+      parent = entry->length;
+      entry->next = count;
+      entry->length = (uint32_t)(ctx->buf_pos - entry->offset);
+      open = parent;
+    }
+  } while (open != UINT32_MAX);
+
+  *size = count;
+  return true;
+}
+
+bool cmp_tape_element(const cmp_tape_entry_t *tape, uint32_t container,
+                                                    uint32_t n,
+                                                    uint32_t *index) {
+  const cmp_tape_entry_t *entry = &tape[container];
+  uint32_t elements;
+  uint32_t i;
+
+  switch (entry->type) {
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
     case CMP_TYPE_ARRAY32:
-      return cmp_write_array32(ctx, obj->as.array_size);
+      elements = entry->size;
+      break;
+    case CMP_TYPE_FIXMAP:
     case CMP_TYPE_MAP16:
-      return cmp_write_map16(ctx, (uint16_t)obj->as.map_size);
     case CMP_TYPE_MAP32:
-      return cmp_write_map32(ctx, obj->as.map_size);
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-      return cmp_write_nfix(ctx, obj->as.s8);
+      elements = entry->size * 2;
+      break;
     default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
       return false;
   }
-}
 
-bool cmp_read_pfix(cmp_ctx_t *ctx, uint8_t *c) {
-  cmp_object_t obj;
-
-  if (!cmp_read_object(ctx, &obj))
+  if (n >= elements)
     return false;
 
-  if (obj.type != CMP_TYPE_POSITIVE_FIXNUM) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+  /* Containers of scalars are laid out one entry per element */
+  if (entry->next - container - 1 == elements) {
+    *index = container + 1 + n;
+    return true;
   }
 
-  *c = obj.as.u8;
+  i = container + 1;
+
+  while (n--)
+    i = tape[i].next;
+
+  *index = i;
   return true;
 }
 
-bool cmp_read_nfix(cmp_ctx_t *ctx, int8_t *c) {
-  cmp_object_t obj;
+bool cmp_tape_seek(cmp_ctx_t *ctx, const cmp_tape_entry_t *tape,
+                                   uint32_t index) {
+  return cmp_mem_seek(ctx, tape[index].offset);
+}
 
-  if (!cmp_read_object(ctx, &obj))
+/* Opens a memory reader on a node's buffer, positioned at the node */
+static void init_node_reader(cmp_ctx_t *ctx, const cmp_node_t *node) {
+  cmp_init_mem_reader(ctx, node->data, node->size);
+  ctx->buf_pos = node->offset;
+}
+
+static void set_node(cmp_node_t *node, const cmp_node_t *parent,
+                                       size_t offset) {
+  node->data = parent->data;
+  node->size = parent->size;
+  node->offset = offset;
+}
+
+/*
+ * Reads the header of the array or map at a node, and sets `*elements` to the
+ * number of objects in it.
+ */
+static bool read_node_elements(cmp_ctx_t *ctx, bool *is_map,
+                                               uint32_t *elements) {
+  uint8_t type_marker = 0;
+  uint32_t size = 0;
+
+  if (!read_type_marker(ctx, &type_marker))
     return false;
 
-  if (obj.type != CMP_TYPE_NEGATIVE_FIXNUM) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (!(marker_info[type_marker].flags & (MARKER_ARRAY | MARKER_MAP)))
+    return false;
+
+  if (!read_type_size(ctx, type_marker, &size))
     return false;
+
+  *is_map = (marker_info[type_marker].flags & MARKER_MAP) != 0;
+
+  if (*is_map) {
+    if (size > (UINT32_MAX / 2))
+      return false;
+
+    size *= 2;
   }
 
-  *c = obj.as.s8;
+  *elements = size;
   return true;
 }
 
-bool cmp_read_sfix(cmp_ctx_t *ctx, int8_t *c) {
-  cmp_object_t obj;
-
-  if (!cmp_read_object(ctx, &obj))
+bool cmp_node_root(cmp_node_t *node, const void *data, size_t size) {
+  if (!size)
     return false;
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-      *c = obj.as.s8;
-      return true;
-    default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
-      return false;
-  }
+  node->data = data;
+  node->size = size;
+  node->offset = 0;
+  return true;
 }
 
-bool cmp_read_s8(cmp_ctx_t *ctx, int8_t *c) {
-  cmp_object_t obj;
+bool cmp_node_object(const cmp_node_t *node, cmp_object_t *obj) {
+  cmp_ctx_t ctx;
 
-  if (!cmp_read_object(ctx, &obj))
+  init_node_reader(&ctx, node);
+  return cmp_read_object(&ctx, obj);
+}
+
+void cmp_node_reader(const cmp_node_t *node, cmp_ctx_t *ctx) {
+  init_node_reader(ctx, node);
+}
+
+bool cmp_node_element(const cmp_node_t *array, uint32_t index,
+                                               cmp_node_t *element) {
+  cmp_ctx_t ctx;
+  bool is_map = false;
+  uint32_t elements = 0;
+
+  init_node_reader(&ctx, array);
+
+  if (!read_node_elements(&ctx, &is_map, &elements) || is_map)
     return false;
 
-  if (obj.type != CMP_TYPE_SINT8) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (index >= elements)
     return false;
+
+  while (index--) {
+    if (!cmp_skip_object_no_limit(&ctx))
+      return false;
   }
 
-  *c = obj.as.s8;
+  set_node(element, array, ctx.buf_pos);
   return true;
 }
 
-bool cmp_read_s16(cmp_ctx_t *ctx, int16_t *s) {
+bool cmp_node_value(const cmp_node_t *map, const char *key, uint32_t key_size,
+                                                            cmp_node_t *value) {
+  cmp_ctx_t ctx;
   cmp_object_t obj;
+  const void *candidate = NULL;
+  bool is_map = false;
+  uint32_t elements = 0;
+  size_t key_pos;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  init_node_reader(&ctx, map);
 
-  if (obj.type != CMP_TYPE_SINT16) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (!read_node_elements(&ctx, &is_map, &elements) || !is_map)
     return false;
+
+  for (; elements; elements -= 2) {
+    key_pos = ctx.buf_pos;
+
+    if (!cmp_read_object(&ctx, &obj))
+      return false;
+
+    if (cmp_object_is_str(&obj) && obj.as.str_size == key_size) {
+      if (!acquire_bytes(&ctx, &candidate, key_size))
+        return false;
+
+      if (!key_size || memcmp(candidate, key, key_size) == 0) {
+        set_node(value, map, ctx.buf_pos);
+        return true;
+      }
+    }
+    else {
+      ctx.buf_pos = key_pos;
+
+      if (!cmp_skip_object_no_limit(&ctx))
+        return false;
+    }
+
+    if (!cmp_skip_object_no_limit(&ctx))
+      return false;
   }
 
-  *s = obj.as.s16;
-  return true;
+  return false;
 }
 
-bool cmp_read_s32(cmp_ctx_t *ctx, int32_t *i) {
-  cmp_object_t obj;
+bool cmp_node_iterate(const cmp_node_t *container, cmp_node_iter_t *iter) {
+  cmp_ctx_t ctx;
+  bool is_map = false;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  init_node_reader(&ctx, container);
 
-  if (obj.type != CMP_TYPE_SINT32) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (!read_node_elements(&ctx, &is_map, &iter->remaining))
     return false;
-  }
 
-  *i = obj.as.s32;
+  set_node(&iter->node, container, ctx.buf_pos);
+  iter->started = false;
   return true;
 }
 
-bool cmp_read_s64(cmp_ctx_t *ctx, int64_t *l) {
-  cmp_object_t obj;
+bool cmp_node_next(cmp_node_iter_t *iter, cmp_node_t *element) {
+  cmp_ctx_t ctx;
 
-  if (!cmp_read_object(ctx, &obj))
+  if (!iter->remaining)
     return false;
 
-  if (obj.type != CMP_TYPE_SINT64) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+  /* Skip the element handed out last time only now that it's done with */
+  if (iter->started) {
+    init_node_reader(&ctx, &iter->node);
+
+    if (!cmp_skip_object_no_limit(&ctx)) {
+      iter->remaining = 0;
+      return false;
+    }
+
+    iter->node.offset = ctx.buf_pos;
   }
 
-  *l = obj.as.s64;
+  iter->started = true;
+  iter->remaining--;
+  *element = iter->node;
   return true;
 }
 
-bool cmp_read_char(cmp_ctx_t *ctx, int8_t *c) {
-  cmp_object_t obj;
+enum {
+  PATH_KEY,
+  PATH_INDEX,
+  PATH_WILDCARD
+};
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+bool cmp_path_compile(cmp_path_step_t *steps, uint32_t *count,
+                                              const char *path) {
+  uint32_t capacity = *count;
+  uint32_t n = 0;
+  cmp_path_step_t *step;
+  const char *start;
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *c = obj.as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      if (obj.as.u8 <= 0x7F) {
-        *c = (int8_t)obj.as.u8;
-        return true;
+  while (*path) {
+    if (n == capacity)
+      return false;
+
+    step = &steps[n];
+
+    if (*path == '[') {
+      path++;
+
+      if (*path == '*') {
+        step->kind = PATH_WILDCARD;
+        path++;
       }
-      break;
-    default:
-      break;
-  }
+      else {
+        if (*path < '0' || *path > '9')
+          return false;
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
-}
+        step->kind = PATH_INDEX;
+        step->index = 0;
 
-bool cmp_read_short(cmp_ctx_t *ctx, int16_t *s) {
-  cmp_object_t obj;
+        while (*path >= '0' && *path <= '9') {
+          if (step->index > ((UINT32_MAX - 9) / 10))
+            return false;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+          step->index = (step->index * 10) + (uint32_t)(*path - '0');
+          path++;
+        }
+      }
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *s = obj.as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      *s = obj.as.u8;
-      return true;
-    case CMP_TYPE_SINT16:
-      *s = obj.as.s16;
-      return true;
-    case CMP_TYPE_UINT16:
-      if (obj.as.u16 <= 0x7FFF) {
-        *s = (int16_t)obj.as.u16;
-        return true;
+      if (*path != ']')
+        return false;
+
+      path++;
+    }
+    else {
+      if (*path == '.')
+        path++;
+      else if (n)
+        return false;
+
+      start = path;
+
+      while (*path && *path != '.' && *path != '[')
+        path++;
+
+      if (path == start)
+        return false;
+
+      if (path - start == 1 && *start == '*') {
+        step->kind = PATH_WILDCARD;
+      }
+      else {
+        step->kind = PATH_KEY;
+        step->key = start;
+        step->key_size = (uint32_t)(path - start);
       }
+    }
+
+    n++;
+  }
+
+  *count = n;
+  return true;
+}
+
+bool cmp_skip_object_rest(cmp_ctx_t *ctx, const cmp_object_t *obj) {
+  uint64_t elements;
+  uint32_t size;
+
+  switch (obj->type) {
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_ARRAY32:
+      elements = obj->as.array_size;
       break;
-    default:
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_MAP32:
+      elements = ((uint64_t)obj->as.map_size) * 2;
       break;
+    default:
+      size = payload_size_of(obj);
+
+      if (size && !skip_bytes(ctx, size)) {
+        ctx->error = CMP_ERROR_DATA_READING;
+        return false;
+      }
+
+      return true;
   }
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
+  while (elements--) {
+    if (!cmp_skip_object_no_limit(ctx))
+      return false;
+  }
+
+  return true;
 }
 
-bool cmp_read_int(cmp_ctx_t *ctx, int32_t *i) {
-  cmp_object_t obj;
+/*
+ * Reads the `size` bytes of a str and checks whether they're `key`, a chunk
+ * at a time so it works with any backend.
+ */
+static bool read_key_matches(cmp_ctx_t *ctx, uint32_t size, const char *key,
+                                                            uint32_t key_size,
+                                                            bool *matches) {
+  uint8_t chunk[32];
+  uint32_t n;
+
+  *matches = size == key_size;
+
+  if (!*matches) {
+    if (size && !skip_bytes(ctx, size)) {
+      ctx->error = CMP_ERROR_DATA_READING;
+      return false;
+    }
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+    return true;
+  }
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *i = obj.as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      *i = obj.as.u8;
-      return true;
-    case CMP_TYPE_SINT16:
-      *i = obj.as.s16;
-      return true;
-    case CMP_TYPE_UINT16:
-      *i = obj.as.u16;
-      return true;
-    case CMP_TYPE_SINT32:
-      *i = obj.as.s32;
-      return true;
-    case CMP_TYPE_UINT32:
-      if (obj.as.u32 <= 0x7FFFFFFF) {
-        *i = (int32_t)obj.as.u32;
-        return true;
-      }
-      break;
-    default:
-      break;
+  while (size) {
+    n = size < sizeof(chunk) ? size : (uint32_t)sizeof(chunk);
+
+    if (!read_bytes(ctx, chunk, n)) {
+      ctx->error = CMP_ERROR_DATA_READING;
+      return false;
+    }
+
+    if (*matches && memcmp(chunk, key, n) != 0)
+      *matches = false;
+
+    key += n;
+    size -= n;
   }
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
+  return true;
 }
 
-bool cmp_read_long(cmp_ctx_t *ctx, int64_t *d) {
+/*
+ * Runs `steps` against the next object, consuming all of it.  Sets `*stop`
+ * once the handler asks to stop.
+ */
+static bool run_path(cmp_ctx_t *ctx, const cmp_path_step_t *steps,
+                                     uint32_t count,
+                                     cmp_path_handler handler,
+                                     void *data,
+                                     bool *stop) {
   cmp_object_t obj;
+  uint32_t size;
+  uint32_t i;
+  bool matches;
 
   if (!cmp_read_object(ctx, &obj))
     return false;
 
+  if (!count) {
+    *stop = !handler(ctx, &obj, data);
+    return true;
+  }
+
   switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *d = obj.as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      *d = obj.as.u8;
-      return true;
-    case CMP_TYPE_SINT16:
-      *d = obj.as.s16;
-      return true;
-    case CMP_TYPE_UINT16:
-      *d = obj.as.u16;
-      return true;
-    case CMP_TYPE_SINT32:
-      *d = obj.as.s32;
-      return true;
-    case CMP_TYPE_UINT32:
-      *d = obj.as.u32;
-      return true;
-    case CMP_TYPE_SINT64:
-      *d = obj.as.s64;
-      return true;
-    case CMP_TYPE_UINT64:
-      if (obj.as.u64 <= UINT64_C(0x7FFFFFFFFFFFFFFF)) {
-        *d = (int64_t)obj.as.u64;
-        return true;
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_ARRAY32:
+      if (steps->kind == PATH_KEY)
+        return cmp_skip_object_rest(ctx, &obj);
+
+      for (i = 0; i < obj.as.array_size && !*stop; i++) {
+        if (steps->kind == PATH_WILDCARD || steps->index == i) {
+          if (!run_path(ctx, steps + 1, count - 1, handler, data, stop))
+            return false;
+        }
+        else if (!cmp_skip_object_no_limit(ctx)) {
+          return false;
+        }
       }
+
       break;
-    default:
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_MAP32:
+      if (steps->kind == PATH_INDEX)
+        return cmp_skip_object_rest(ctx, &obj);
+
+      size = obj.as.map_size;
+
+      for (i = 0; i < size && !*stop; i++) {
+        if (!cmp_read_object(ctx, &obj))
+          return false;
+
+        matches = steps->kind == PATH_WILDCARD;
+
+        if (matches || !cmp_object_is_str(&obj)) {
+          if (!cmp_skip_object_rest(ctx, &obj))
+            return false;
+        }
+        else if (!read_key_matches(ctx, obj.as.str_size, steps->key,
+                                                         steps->key_size,
+                                                         &matches)) {
+          return false;
+        }
+
+        if (matches) {
+          if (!run_path(ctx, steps + 1, count - 1, handler, data, stop))
+            return false;
+        }
+        else if (!cmp_skip_object_no_limit(ctx)) {
+          return false;
+        }
+      }
+
       break;
+    default:
+      return cmp_skip_object_rest(ctx, &obj);
   }
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
+  return true;
 }
 
-bool cmp_read_integer(cmp_ctx_t *ctx, int64_t *d) {
-  return cmp_read_long(ctx, d);
+bool cmp_path_execute(cmp_ctx_t *ctx, const cmp_path_step_t *steps,
+                                      uint32_t count,
+                                      cmp_path_handler handler,
+                                      void *data) {
+  bool stop = false;
+
+  return run_path(ctx, steps, count, handler, data, &stop);
 }
 
-bool cmp_read_ufix(cmp_ctx_t *ctx, uint8_t *c) {
-  return cmp_read_pfix(ctx, c);
+static uint32_t hash_key(const void *key, size_t size, uint32_t seed) {
+  const uint8_t *b = (const uint8_t *)key;
+  uint32_t h = UINT32_C(2166136261) ^ seed;
+
+  while (size--) {
+    h ^= *b++;
+    h *= UINT32_C(16777619);
+  }
+
+  return h ^ (h >> 16);
 }
 
-bool cmp_read_u8(cmp_ctx_t *ctx, uint8_t *c) {
-  cmp_object_t obj;
+static const char* key_at(const cmp_keys_t *keys, uint8_t index) {
+  return *(const char *const *)(
+    (const char *)keys->keys + (keys->stride * index)
+  );
+}
 
-  if (!cmp_read_object(ctx, &obj))
+/*
+ * Builds the dictionary over `count` key pointers laid out `stride` bytes
+ * apart, so the keys can live in an array of strings or in an array of
+ * structs alike.
+ */
+static bool init_keys(cmp_keys_t *keys, const char *const *first,
+                                        size_t stride,
+                                        uint8_t count) {
+  uint32_t seed;
+  uint8_t mask;
+  uint8_t i;
+  uint8_t slot;
+  size_t key_size;
+
+  if (count > CMP_KEYS_MAX_COUNT)
     return false;
 
-  if (obj.type != CMP_TYPE_UINT8) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+  keys->keys = first;
+  keys->stride = stride;
+  keys->count = count;
+  keys->max_key_size = 0;
+
+  for (i = 0; i < count; i++) {
+    key_size = strlen(key_at(keys, i));
+
+    if (key_size > CMP_KEYS_MAX_KEY_SIZE)
+      return false;
+
+    keys->key_sizes[i] = (uint8_t)key_size;
+
+    if (key_size > keys->max_key_size)
+      keys->max_key_size = (uint8_t)key_size;
+
+    /* Duplicate keys always collide, so don't bother looking for a seed */
+    for (slot = 0; slot < i; slot++) {
+      if (strcmp(key_at(keys, slot), key_at(keys, i)) == 0)
+        return false;
+    }
   }
 
-  *c = obj.as.u8;
-  return true;
-}
+  /* Keep the table at most a quarter full so a perfect seed turns up fast */
+  mask = 3;
 
-bool cmp_read_u16(cmp_ctx_t *ctx, uint16_t *s) {
-  cmp_object_t obj;
+  while ((mask + 1) < (count * 4))
+    mask = (uint8_t)((mask << 1) | 1);
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  keys->mask = mask;
 
-  if (obj.type != CMP_TYPE_UINT16) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+  for (seed = 0; seed < 0x10000; seed++) {
+    memset(keys->table, 0, sizeof(keys->table));
+
+    for (i = 0; i < count; i++) {
+      slot = (uint8_t)(
+        hash_key(key_at(keys, i), keys->key_sizes[i], seed) & mask
+      );
+
+      if (keys->table[slot])
+        break;
+
+      keys->table[slot] = (uint8_t)(i + 1);
+    }
+
+    if (i == count) {
+      keys->seed = seed;
+      return true;
+    }
   }
 
-  *s = obj.as.u16;
-  return true;
+  return false;
 }
 
-bool cmp_read_u32(cmp_ctx_t *ctx, uint32_t *i) {
-  cmp_object_t obj;
+bool cmp_keys_init(cmp_keys_t *keys, const char *const *names, uint8_t count) {
+  return init_keys(keys, names, sizeof(*names), count);
+}
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+/* Finds the key a string belongs to, with one hash and one comparison */
+static uint8_t find_key(const cmp_keys_t *keys, const void *key,
+                                                uint32_t key_size) {
+  uint8_t slot = keys->table[
+    hash_key(key, key_size, keys->seed) & keys->mask
+  ];
 
-  if (obj.type != CMP_TYPE_UINT32) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
-  }
+  if (!slot || keys->key_sizes[slot - 1] != key_size)
+    return CMP_KEY_UNKNOWN;
 
-  *i = obj.as.u32;
-  return true;
+  if (memcmp(key_at(keys, (uint8_t)(slot - 1)), key, key_size))
+    return CMP_KEY_UNKNOWN;
+
+  return (uint8_t)(slot - 1);
 }
 
-bool cmp_read_u64(cmp_ctx_t *ctx, uint64_t *l) {
-  cmp_object_t obj;
+bool cmp_match_key(cmp_ctx_t *ctx, const cmp_keys_t *keys,
+                                   const cmp_object_t *obj,
+                                   uint8_t *id) {
+  char key[CMP_KEYS_MAX_KEY_SIZE];
+  const void *data = key;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  *id = CMP_KEY_UNKNOWN;
 
-  if (obj.type != CMP_TYPE_UINT64) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (!cmp_object_is_str(obj) || obj->as.str_size > keys->max_key_size)
+    return cmp_skip_object_rest(ctx, obj);
+
+  /* Hash the key where it lies when the backend can lend it out */
+  if (obj->as.str_size && ctx->acquire) {
+    if (!acquire_bytes(ctx, &data, obj->as.str_size))
+      return false;
+  }
+  else if (obj->as.str_size && !read_bytes(ctx, key, obj->as.str_size)) {
+    ctx->error = CMP_ERROR_DATA_READING;
     return false;
   }
 
-  *l = obj.as.u64;
+  *id = find_key(keys, data, obj->as.str_size);
   return true;
 }
 
-bool cmp_read_uchar(cmp_ctx_t *ctx, uint8_t *c) {
+bool cmp_read_key(cmp_ctx_t *ctx, const cmp_keys_t *keys, uint8_t *id) {
   cmp_object_t obj;
 
   if (!cmp_read_object(ctx, &obj))
     return false;
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *c = obj.as.u8;
-      return true;
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      if (obj.as.s8 >= 0) {
-        *c = (uint8_t)obj.as.s8;
-        return true;
-      }
-      break;
+  return cmp_match_key(ctx, keys, &obj, id);
+}
+
+bool cmp_schema_init(cmp_schema_t *schema, const cmp_field_t *fields,
+                                           uint8_t field_count) {
+  schema->fields = fields;
+
+  return init_keys(
+    &schema->keys, &fields[0].key, sizeof(*fields), field_count
+  );
+}
+
+static bool read_field(cmp_ctx_t *ctx, const cmp_field_t *field, char *base) {
+  void *p = base + field->offset;
+  uint32_t size;
+
+  switch (field->type) {
+    case CMP_FIELD_BOOL:
+      return cmp_read_bool(ctx, (bool *)p);
+    case CMP_FIELD_CHAR:
+      return cmp_read_char(ctx, (int8_t *)p);
+    case CMP_FIELD_SHORT:
+      return cmp_read_short(ctx, (int16_t *)p);
+    case CMP_FIELD_INT:
+      return cmp_read_int(ctx, (int32_t *)p);
+    case CMP_FIELD_LONG:
+      return cmp_read_long(ctx, (int64_t *)p);
+    case CMP_FIELD_UCHAR:
+      return cmp_read_uchar(ctx, (uint8_t *)p);
+    case CMP_FIELD_USHORT:
+      return cmp_read_ushort(ctx, (uint16_t *)p);
+    case CMP_FIELD_UINT:
+      return cmp_read_uint(ctx, (uint32_t *)p);
+    case CMP_FIELD_ULONG:
+      return cmp_read_ulong(ctx, (uint64_t *)p);
+#ifndef CMP_NO_FLOAT
+    case CMP_FIELD_FLOAT:
+      return cmp_read_float(ctx, (float *)p);
+    case CMP_FIELD_DOUBLE:
+      return cmp_read_decimal(ctx, (double *)p);
+#endif /* CMP_NO_FLOAT */
+    case CMP_FIELD_STR:
+      size = field->bound;
+      return cmp_read_str(ctx, (char *)p, &size);
     default:
-      break;
+      ctx->error = CMP_ERROR_INVALID_FIELD_TYPE;
+      return false;
   }
-
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
 }
 
-bool cmp_read_ushort(cmp_ctx_t *ctx, uint16_t *s) {
-  cmp_object_t obj;
+bool cmp_read_struct(cmp_ctx_t *ctx, const cmp_schema_t *schema, void *data) {
+  uint32_t size = 0;
+  uint8_t id;
 
-  if (!cmp_read_object(ctx, &obj))
+  if (!cmp_read_map(ctx, &size))
     return false;
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *s = obj.as.u8;
-      return true;
-    case CMP_TYPE_UINT16:
-      *s = obj.as.u16;
-      return true;
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      if (obj.as.s8 >= 0) {
-        *s = (uint8_t)obj.as.s8;
-        return true;
-      }
-      break;
-    case CMP_TYPE_SINT16:
-      if (obj.as.s16 >= 0) {
-        *s = (uint16_t)obj.as.s16;
-        return true;
-      }
-      break;
-    default:
-      break;
+  while (size--) {
+    if (!cmp_read_key(ctx, &schema->keys, &id))
+      return false;
+
+    if (id != CMP_KEY_UNKNOWN) {
+      if (!read_field(ctx, &schema->fields[id], (char *)data))
+        return false;
+    }
+    else if (!cmp_skip_object_no_limit(ctx)) {
+      return false;
+    }
   }
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
+  return true;
 }
 
-bool cmp_read_uint(cmp_ctx_t *ctx, uint32_t *i) {
-  cmp_object_t obj;
+/* Gets the length of a string field, which has to be terminated in bounds */
+static bool field_str_size(const cmp_field_t *field, const char *p,
+                                                     uint32_t *size) {
+  const char *end = (const char *)memchr(p, 0, field->bound);
 
-  if (!cmp_read_object(ctx, &obj))
+  if (!end)
     return false;
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *i = obj.as.u8;
-      return true;
-    case CMP_TYPE_UINT16:
-      *i = obj.as.u16;
-      return true;
-    case CMP_TYPE_UINT32:
-      *i = obj.as.u32;
-      return true;
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      if (obj.as.s8 >= 0) {
-        *i = (uint8_t)obj.as.s8;
-        return true;
-      }
-      break;
-    case CMP_TYPE_SINT16:
-      if (obj.as.s16 >= 0) {
-        *i = (uint16_t)obj.as.s16;
-        return true;
-      }
-      break;
-    case CMP_TYPE_SINT32:
-      if (obj.as.s32 >= 0) {
-        *i = (uint32_t)obj.as.s32;
-        return true;
-      }
-      break;
+  *size = (uint32_t)(end - p);
+  return true;
+}
+
+/* Returns the encoded size of a field's value, or 0 if it can't be encoded */
+static size_t sizeof_field(const cmp_field_t *field, const char *base) {
+  const void *p = base + field->offset;
+  uint32_t size;
+
+  switch (field->type) {
+    case CMP_FIELD_BOOL:
+      return 1;
+    case CMP_FIELD_CHAR:
+      return cmp_sizeof_integer(*(const int8_t *)p);
+    case CMP_FIELD_SHORT:
+      return cmp_sizeof_integer(*(const int16_t *)p);
+    case CMP_FIELD_INT:
+      return cmp_sizeof_integer(*(const int32_t *)p);
+    case CMP_FIELD_LONG:
+      return cmp_sizeof_integer(*(const int64_t *)p);
+    case CMP_FIELD_UCHAR:
+      return cmp_sizeof_uinteger(*(const uint8_t *)p);
+    case CMP_FIELD_USHORT:
+      return cmp_sizeof_uinteger(*(const uint16_t *)p);
+    case CMP_FIELD_UINT:
+      return cmp_sizeof_uinteger(*(const uint32_t *)p);
+    case CMP_FIELD_ULONG:
+      return cmp_sizeof_uinteger(*(const uint64_t *)p);
+#ifndef CMP_NO_FLOAT
+    case CMP_FIELD_FLOAT:
+      return 5;
+    case CMP_FIELD_DOUBLE:
+      return cmp_sizeof_decimal(*(const double *)p);
+#endif /* CMP_NO_FLOAT */
+    case CMP_FIELD_STR:
+      if (!field_str_size(field, (const char *)p, &size))
+        return 0;
+      return cmp_sizeof_str(size);
     default:
-      break;
+      return 0;
   }
-
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
 }
 
-bool cmp_read_ulong(cmp_ctx_t *ctx, uint64_t *u) {
-  cmp_object_t obj;
+static size_t sizeof_struct(const cmp_schema_t *schema, const void *data,
+                                                        bool with_keys) {
+  size_t total = with_keys ? cmp_sizeof_map(schema->keys.count) :
+                             cmp_sizeof_array(schema->keys.count);
+  size_t size;
+  uint8_t i;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  for (i = 0; i < schema->keys.count; i++) {
+    size = sizeof_field(&schema->fields[i], (const char *)data);
 
-  switch (obj.type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *u = obj.as.u8;
-      return true;
-    case CMP_TYPE_UINT16:
-      *u = obj.as.u16;
-      return true;
-    case CMP_TYPE_UINT32:
-      *u = obj.as.u32;
-      return true;
-    case CMP_TYPE_UINT64:
-      *u = obj.as.u64;
-      return true;
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      if (obj.as.s8 >= 0) {
-        *u = (uint8_t)obj.as.s8;
-        return true;
-      }
-      break;
-    case CMP_TYPE_SINT16:
-      if (obj.as.s16 >= 0) {
-        *u = (uint16_t)obj.as.s16;
-        return true;
-      }
-      break;
-    case CMP_TYPE_SINT32:
-      if (obj.as.s32 >= 0) {
-        *u = (uint32_t)obj.as.s32;
-        return true;
-      }
-      break;
-    case CMP_TYPE_SINT64:
-      if (obj.as.s64 >= 0) {
-        *u = (uint64_t)obj.as.s64;
-        return true;
-      }
-      break;
-    default:
-      break;
+    if (!size)
+      return 0;
+
+    if (with_keys)
+      total += cmp_sizeof_str(schema->keys.key_sizes[i]);
+
+    total += size;
   }
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
+  return total;
 }
 
-bool cmp_read_uinteger(cmp_ctx_t *ctx, uint64_t *u) {
-  return cmp_read_ulong(ctx, u);
+size_t cmp_sizeof_struct(const cmp_schema_t *schema, const void *data) {
+  return sizeof_struct(schema, data, true);
 }
 
-#ifndef CMP_NO_FLOAT
-bool cmp_read_float(cmp_ctx_t *ctx, float *f) {
-  cmp_object_t obj;
+size_t cmp_sizeof_struct_array(const cmp_schema_t *schema, const void *data) {
+  return sizeof_struct(schema, data, false);
+}
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+static bool put_block_bytes(cmp_ctx_t *ctx, write_block_t *block,
+                                            const void *data,
+                                            size_t count) {
+  if (count > (sizeof(block->data) - block->pos)) {
+    if (!flush_block(ctx, block))
+      return false;
 
-  if (obj.type != CMP_TYPE_FLOAT) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+    if (count > sizeof(block->data))
+      return write_encoded(ctx, (const uint8_t *)data, count,
+                           CMP_ERROR_DATA_WRITING);
   }
 
-  *f = obj.as.flt;
+  memcpy(block->data + block->pos, data, count);
+  block->pos += count;
+  return true;
+}
+
+static bool put_block_str_marker(cmp_ctx_t *ctx, write_block_t *block,
+                                                 uint32_t size) {
+  uint8_t *b;
+
+  if (block->pos > (sizeof(block->data) - 5) && !flush_block(ctx, block))
+    return false;
+
+  b = block->data + block->pos;
+
+  if (size <= FIXSTR_SIZE) {
+    b[0] = (uint8_t)(FIXSTR_MARKER | size);
+    block->pos += 1;
+  }
+  else if (size <= 0xFF) {
+    b[0] = STR8_MARKER;
+    b[1] = (uint8_t)size;
+    block->pos += 2;
+  }
+  else if (size <= 0xFFFF) {
+    b[0] = STR16_MARKER;
+    store_be16(b + 1, (uint16_t)size);
+    block->pos += 3;
+  }
+  else {
+    b[0] = STR32_MARKER;
+    store_be32(b + 1, size);
+    block->pos += 5;
+  }
 
   return true;
 }
 
-bool cmp_read_double(cmp_ctx_t *ctx, double *d) {
-  cmp_object_t obj;
-
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+static bool put_block_str(cmp_ctx_t *ctx, write_block_t *block,
+                                          const char *data,
+                                          uint32_t size) {
+  return put_block_str_marker(ctx, block, size) &&
+         put_block_bytes(ctx, block, data, size);
+}
 
-  if (obj.type != CMP_TYPE_DOUBLE) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
-  }
+static bool put_block_integer(cmp_ctx_t *ctx, write_block_t *block,
+                                              int64_t d) {
+  if (d < 0)
+    return put_block_value(ctx, block, integer_array_marker(d, 0), (uint64_t)d);
 
-  *d = obj.as.dbl;
+  return put_block_value(
+    ctx, block, integer_array_marker(0, (uint64_t)d), (uint64_t)d
+  );
+}
 
-  return true;
+static bool put_block_uinteger(cmp_ctx_t *ctx, write_block_t *block,
+                                               uint64_t u) {
+  return put_block_value(ctx, block, integer_array_marker(0, u), u);
 }
 
-bool cmp_read_decimal(cmp_ctx_t *ctx, double *d) {
-  cmp_object_t obj;
+static bool put_block_field(cmp_ctx_t *ctx, write_block_t *block,
+                                            const cmp_field_t *field,
+                                            const char *base) {
+  const void *p = base + field->offset;
+  uint32_t size;
+#ifndef CMP_NO_FLOAT
+  uint32_t u32temp;
+  uint64_t u64temp;
+  float f;
+#endif /* CMP_NO_FLOAT */
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  switch (field->type) {
+    case CMP_FIELD_BOOL:
+      return put_block_value(
+        ctx, block, 0, *(const bool *)p ? TRUE_MARKER : FALSE_MARKER
+      );
+    case CMP_FIELD_CHAR:
+      return put_block_integer(ctx, block, *(const int8_t *)p);
+    case CMP_FIELD_SHORT:
+      return put_block_integer(ctx, block, *(const int16_t *)p);
+    case CMP_FIELD_INT:
+      return put_block_integer(ctx, block, *(const int32_t *)p);
+    case CMP_FIELD_LONG:
+      return put_block_integer(ctx, block, *(const int64_t *)p);
+    case CMP_FIELD_UCHAR:
+      return put_block_uinteger(ctx, block, *(const uint8_t *)p);
+    case CMP_FIELD_USHORT:
+      return put_block_uinteger(ctx, block, *(const uint16_t *)p);
+    case CMP_FIELD_UINT:
+      return put_block_uinteger(ctx, block, *(const uint32_t *)p);
+    case CMP_FIELD_ULONG:
+      return put_block_uinteger(ctx, block, *(const uint64_t *)p);
+#ifndef CMP_NO_FLOAT
+    case CMP_FIELD_FLOAT:
+      memcpy(&u32temp, p, sizeof(float));
+      return put_block_value(ctx, block, FLOAT_MARKER, u32temp);
+    case CMP_FIELD_DOUBLE:
+      f = (float)*(const double *)p;
+
+      if ((double)f == *(const double *)p) {
+        memcpy(&u32temp, &f, sizeof(float));
+        return put_block_value(ctx, block, FLOAT_MARKER, u32temp);
+      }
 
-  switch (obj.type) {
-    case CMP_TYPE_FLOAT:
-      *d = (double)obj.as.flt;
-      return true;
-    case CMP_TYPE_DOUBLE:
-      *d = obj.as.dbl;
-      return true;
+      memcpy(&u64temp, p, sizeof(double));
+      return put_block_value(ctx, block, DOUBLE_MARKER, u64temp);
+#endif /* CMP_NO_FLOAT */
+    case CMP_FIELD_STR:
+      if (!field_str_size(field, (const char *)p, &size)) {
+        ctx->error = CMP_ERROR_STR_DATA_LENGTH_TOO_LONG;
+        return false;
+      }
+      return put_block_str(ctx, block, (const char *)p, size);
     default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
+      ctx->error = CMP_ERROR_INVALID_FIELD_TYPE;
       return false;
   }
 }
-#endif /* CMP_NO_FLOAT */
 
-bool cmp_read_nil(cmp_ctx_t *ctx) {
-  cmp_object_t obj;
+/*
+ * Struct writers encode the whole struct, keys included, into one block, so
+ * small structs take a single write.
+ */
+static bool write_struct(cmp_ctx_t *ctx, const cmp_schema_t *schema,
+                                         const void *data,
+                                         bool with_keys) {
+  write_block_t block;
+  uint8_t count = schema->keys.count;
+  uint8_t i;
+
+  if (count <= FIXMAP_SIZE) {
+    block.data[0] = (uint8_t)((with_keys ? FIXMAP_MARKER : FIXARRAY_MARKER) |
+                              count);
+    block.pos = 1;
+  }
+  else {
+    block.data[0] = with_keys ? MAP16_MARKER : ARRAY16_MARKER;
+    store_be16(block.data + 1, count);
+    block.pos = 3;
+  }
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  for (i = 0; i < count; i++) {
+    if (with_keys) {
+      if (!put_block_str(ctx, &block, schema->fields[i].key,
+                                      schema->keys.key_sizes[i])) {
+        return false;
+      }
+    }
 
-  if (obj.type == CMP_TYPE_NIL)
-    return true;
+    if (!put_block_field(ctx, &block, &schema->fields[i], (const char *)data))
+      return false;
+  }
 
-  ctx->error = CMP_ERROR_INVALID_TYPE;
-  return false;
+  return flush_block(ctx, &block);
 }
 
-bool cmp_read_bool(cmp_ctx_t *ctx, bool *b) {
-  cmp_object_t obj;
+bool cmp_write_struct(cmp_ctx_t *ctx, const cmp_schema_t *schema,
+                                      const void *data) {
+  return write_struct(ctx, schema, data, true);
+}
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+bool cmp_write_struct_array(cmp_ctx_t *ctx, const cmp_schema_t *schema,
+                                            const void *data) {
+  return write_struct(ctx, schema, data, false);
+}
 
-  if (obj.type != CMP_TYPE_BOOLEAN) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+bool cmp_partition_records(cmp_ctx_t *ctx, cmp_chunk_t *chunks,
+                                           uint32_t *count) {
+  uint32_t capacity = *count;
+  uint32_t n = 0;
+  size_t target;
+  size_t start;
+
+  if (ctx->read != mem_reader) {
+    ctx->error = CMP_ERROR_MEMORY_CONTEXT_REQUIRED;
     return false;
   }
 
-  if (obj.as.boolean)
-    *b = true;
-  else
-    *b = false;
-
-  return true;
-}
+  if (!capacity) {
+    ctx->error = CMP_ERROR_NO_CHUNKS;
+    return false;
+  }
 
-bool cmp_read_bool_as_u8(cmp_ctx_t *ctx, uint8_t *b) {
-  cmp_object_t obj;
+  target = (ctx->buf_size - ctx->buf_pos) / capacity;
+  start = ctx->buf_pos;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  while (ctx->buf_pos < ctx->buf_size) {
+    if (!cmp_skip_object_no_limit(ctx))
+      return false;
 
-  if (obj.type != CMP_TYPE_BOOLEAN) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+    /* Cut a chunk once it's big enough, leaving the rest to the last one */
+    if ((ctx->buf_pos - start) >= target && n < (capacity - 1)) {
+      chunks[n].offset = start;
+      chunks[n].size = ctx->buf_pos - start;
+      n++;
+      start = ctx->buf_pos;
+    }
   }
 
-  if (obj.as.boolean)
-    *b = 1;
-  else
-    *b = 0;
+  if (ctx->buf_pos > start) {
+    chunks[n].offset = start;
+    chunks[n].size = ctx->buf_pos - start;
+    n++;
+  }
 
+  *count = n;
   return true;
 }
 
-bool cmp_read_str_size(cmp_ctx_t *ctx, uint32_t *size) {
-  cmp_object_t obj;
+bool cmp_process_records(cmp_ctx_t *ctx, const void *data,
+                                         const cmp_chunk_t *chunk,
+                                         cmp_record_handler handler,
+                                         void *handler_data) {
+  size_t start;
+  size_t end;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  cmp_init_mem_reader(ctx, (const char *)data + chunk->offset, chunk->size);
 
-  switch (obj.type) {
-    case CMP_TYPE_FIXSTR:
-    case CMP_TYPE_STR8:
-    case CMP_TYPE_STR16:
-    case CMP_TYPE_STR32:
-      *size = obj.as.str_size;
-      return true;
-    default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
-      return false;
-  }
-}
+  while (ctx->buf_pos < ctx->buf_size) {
+    start = ctx->buf_pos;
 
-bool cmp_read_str(cmp_ctx_t *ctx, char *data, uint32_t *size) {
-  uint32_t str_size = 0;
+    /* Find the record's end first, so handlers can stop reading anywhere */
+    if (!cmp_skip_object_no_limit(ctx))
+      return false;
 
-  if (!cmp_read_str_size(ctx, &str_size))
-    return false;
+    end = ctx->buf_pos;
+    ctx->buf_pos = start;
 
-  if (str_size >= *size) {
-    *size = str_size;
-    ctx->error = CMP_ERROR_STR_DATA_LENGTH_TOO_LONG;
-    return false;
-  }
+    if (!handler(ctx, handler_data))
+      return false;
 
-  if (!ctx->read(ctx, data, str_size)) {
-    ctx->error = CMP_ERROR_DATA_READING;
-    return false;
+    ctx->buf_pos = end;
   }
 
-  data[str_size] = 0;
-
-  *size = str_size;
   return true;
 }
 
-bool cmp_read_bin_size(cmp_ctx_t *ctx, uint32_t *size) {
-  cmp_object_t obj;
+bool cmp_write_array_segments(cmp_ctx_t *ctx, uint32_t size,
+                                              const cmp_segment_t *segments,
+                                              uint32_t count) {
+  uint32_t i;
 
-  if (!cmp_read_object(ctx, &obj))
+  if (!cmp_write_array(ctx, size))
     return false;
 
-  switch (obj.type) {
-    case CMP_TYPE_BIN8:
-    case CMP_TYPE_BIN16:
-    case CMP_TYPE_BIN32:
-      *size = obj.as.bin_size;
-      return true;
-    default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
+  for (i = 0; i < count; i++) {
+    if (!segments[i].size)
+      continue;
+
+    if (!write_encoded(ctx, (const uint8_t *)segments[i].data,
+                            segments[i].size,
+                            CMP_ERROR_DATA_WRITING)) {
       return false;
+    }
   }
-}
-
-bool cmp_read_bin(cmp_ctx_t *ctx, void *data, uint32_t *size) {
-  uint32_t bin_size = 0;
 
-  if (!cmp_read_bin_size(ctx, &bin_size))
-    return false;
+  return true;
+}
 
-  if (bin_size > *size) {
-    ctx->error = CMP_ERROR_BIN_DATA_LENGTH_TOO_LONG;
+/*
+ * Index headers always use the widest encodings, so that they're the same
+ * size however many records there are and can be rewritten in place.
+ */
+bool cmp_write_index_header(cmp_ctx_t *ctx, uint32_t stride,
+                                            uint64_t record_count) {
+  uint8_t header[CMP_INDEX_HEADER_SIZE];
+  uint64_t entry_count;
+
+  if (!stride) {
+    ctx->error = CMP_ERROR_INVALID_INDEX;
     return false;
   }
 
-  if (!ctx->read(ctx, data, bin_size)) {
-    ctx->error = CMP_ERROR_DATA_READING;
+  entry_count = (record_count / stride) + ((record_count % stride) != 0);
+
+  if (entry_count > (UINT32_MAX / 8)) {
+    ctx->error = CMP_ERROR_INPUT_VALUE_TOO_LARGE;
     return false;
   }
 
-  *size = bin_size;
-  return true;
+  header[0] = FIXARRAY_MARKER | 3;
+  header[1] = U32_MARKER;
+  store_be32(header + 2, stride);
+  header[6] = U64_MARKER;
+  store_be64(header + 7, record_count);
+  header[15] = BIN32_MARKER;
+  store_be32(header + 16, (uint32_t)(entry_count * 8));
+
+  return write_encoded(ctx, header, sizeof(header), CMP_ERROR_DATA_WRITING);
 }
 
-bool cmp_read_array(cmp_ctx_t *ctx, uint32_t *size) {
-  cmp_object_t obj;
+bool cmp_write_index_entry(cmp_ctx_t *ctx, uint64_t offset) {
+  uint8_t entry[8];
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  store_be64(entry, offset);
 
-  switch (obj.type) {
-    case CMP_TYPE_FIXARRAY:
-    case CMP_TYPE_ARRAY16:
-    case CMP_TYPE_ARRAY32:
-      *size = obj.as.array_size;
-      return true;
-    default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
-      return false;
-  }
+  return write_encoded(ctx, entry, sizeof(entry), CMP_ERROR_DATA_WRITING);
 }
 
-bool cmp_read_map(cmp_ctx_t *ctx, uint32_t *size) {
-  cmp_object_t obj;
+bool cmp_index_open(cmp_ctx_t *ctx, cmp_index_t *index) {
+  uint32_t size = 0;
+  const void *entries;
 
-  if (!cmp_read_object(ctx, &obj))
+  if (!cmp_read_array(ctx, &size))
     return false;
 
-  switch (obj.type) {
-    case CMP_TYPE_FIXMAP:
-    case CMP_TYPE_MAP16:
-    case CMP_TYPE_MAP32:
-      *size = obj.as.map_size;
-      return true;
-    default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
-      return false;
+  if (size != 3) {
+    ctx->error = CMP_ERROR_INVALID_INDEX;
+    return false;
   }
-}
 
-bool cmp_read_fixext1_marker(cmp_ctx_t *ctx, int8_t *type) {
-  cmp_object_t obj;
+  if (!cmp_read_uint(ctx, &index->stride))
+    return false;
 
-  if (!cmp_read_object(ctx, &obj))
+  if (!cmp_read_ulong(ctx, &index->record_count))
     return false;
 
-  if (obj.type != CMP_TYPE_FIXEXT1) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (!cmp_read_bin_size(ctx, &size))
+    return false;
+
+  index->entry_count = size / 8;
+
+  if (!index->stride || (size % 8) ||
+      index->entry_count != ((index->record_count / index->stride) +
+                             ((index->record_count % index->stride) != 0))) {
+    ctx->error = CMP_ERROR_INVALID_INDEX;
     return false;
   }
 
-  *type = obj.as.ext.type;
+  if (size && !acquire_bytes(ctx, &entries, size))
+    return false;
+
+  index->entries = size ? (const uint8_t *)entries : NULL;
   return true;
 }
 
-bool cmp_read_fixext1(cmp_ctx_t *ctx, int8_t *type, void *data) {
-  if (!cmp_read_fixext1_marker(ctx, type))
+bool cmp_index_find(const cmp_index_t *index, uint64_t n, uint64_t *offset,
+                                                          uint32_t *skip) {
+  uint64_t entry;
+
+  if (n >= index->record_count)
     return false;
 
-  if (ctx->read(ctx, data, 1))
-    return true;
+  entry = n / index->stride;
+  *offset = load_be64(index->entries + (entry * 8));
+  *skip = (uint32_t)(n % index->stride);
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
+  return true;
 }
 
-bool cmp_read_fixext2_marker(cmp_ctx_t *ctx, int8_t *type) {
-  cmp_object_t obj;
+bool cmp_index_seek(cmp_ctx_t *ctx, const cmp_index_t *index, uint64_t n) {
+  uint64_t offset;
+  uint32_t skip;
 
-  if (!cmp_read_object(ctx, &obj))
+  if (ctx->read != mem_reader) {
+    ctx->error = CMP_ERROR_MEMORY_CONTEXT_REQUIRED;
     return false;
+  }
 
-  if (obj.type != CMP_TYPE_FIXEXT2) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (!cmp_index_find(index, n, &offset, &skip) ||
+      offset > ctx->buf_size) {
+    ctx->error = CMP_ERROR_INVALID_INDEX;
     return false;
   }
 
-  *type = obj.as.ext.type;
+  ctx->buf_pos = (size_t)offset;
+
+  while (skip--) {
+    if (!cmp_skip_object_no_limit(ctx))
+      return false;
+  }
+
   return true;
 }
 
-bool cmp_read_fixext2(cmp_ctx_t *ctx, int8_t *type, void *data) {
-  if (!cmp_read_fixext2_marker(ctx, type))
+enum {
+  JSON_MAX_DEPTH    = 64,
+  JSON_CHUNK_SIZE   = 192, /* A multiple of 3, so base64 needs no carrying */
+  JSON_MAX_DIGITS   = 64,
+  JSON_MAX_EXPONENT = 100000
+};
+
+static const char json_digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static const char json_hex_digits[] = "0123456789abcdef";
+
+static const char base64_digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static bool put_block_char(cmp_ctx_t *ctx, write_block_t *block, char c) {
+  if (block->pos == sizeof(block->data) && !flush_block(ctx, block))
     return false;
 
-  if (ctx->read(ctx, data, 2))
-    return true;
+  block->data[block->pos++] = (uint8_t)c;
+  return true;
+}
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
+/* Formats `u` into the end of `buf`, two digits at a time */
+static size_t format_uint(char *buf, size_t size, uint64_t u) {
+  char *p = buf + size;
+  size_t pair;
+
+  while (u >= 100) {
+    pair = (size_t)(u % 100) * 2;
+    u /= 100;
+    *--p = json_digit_pairs[pair + 1];
+    *--p = json_digit_pairs[pair];
+  }
+
+  if (u >= 10) {
+    pair = (size_t)u * 2;
+    *--p = json_digit_pairs[pair + 1];
+    *--p = json_digit_pairs[pair];
+  }
+  else {
+    *--p = (char)('0' + u);
+  }
+
+  return (size_t)((buf + size) - p);
 }
 
-bool cmp_read_fixext4_marker(cmp_ctx_t *ctx, int8_t *type) {
-  cmp_object_t obj;
+static bool put_json_integer(cmp_ctx_t *ctx, write_block_t *block,
+                                             bool negative,
+                                             uint64_t u) {
+  char buf[21];
+  size_t size = format_uint(buf, sizeof(buf), u);
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  if (negative)
+    buf[sizeof(buf) - ++size] = '-';
 
-  if (obj.type != CMP_TYPE_FIXEXT4) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
+  if (block->pos > (sizeof(block->data) - sizeof(buf)) &&
+      !flush_block(ctx, block)) {
     return false;
   }
 
-  *type = obj.as.ext.type;
+  memcpy(block->data + block->pos, buf + sizeof(buf) - size, size);
+  block->pos += size;
   return true;
 }
 
-bool cmp_read_fixext4(cmp_ctx_t *ctx, int8_t *type, void *data) {
-  if (!cmp_read_fixext4_marker(ctx, type))
-    return false;
-
-  if (ctx->read(ctx, data, 4))
-    return true;
+static bool put_json_sinteger(cmp_ctx_t *ctx, write_block_t *block,
+                                              int64_t d) {
+  if (d < 0)
+    return put_json_integer(ctx, block, true, 0 - (uint64_t)d);
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
+  return put_json_integer(ctx, block, false, (uint64_t)d);
 }
 
-bool cmp_read_fixext8_marker(cmp_ctx_t *ctx, int8_t *type) {
-  cmp_object_t obj;
+#ifndef CMP_NO_FLOAT
+/* Returns the C locale's decimal point, which printf and strtod use */
+static const char* locale_decimal_point(size_t *size) {
+  const char *point = localeconv()->decimal_point;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  *size = strlen(point);
 
-  if (obj.type != CMP_TYPE_FIXEXT8) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+  if (*size == 0 || *size > 8) {
+    *size = 1;
+    return ".";
   }
 
-  *type = obj.as.ext.type;
-  return true;
+  return point;
 }
 
-bool cmp_read_fixext8(cmp_ctx_t *ctx, int8_t *type, void *data) {
-  if (!cmp_read_fixext8_marker(ctx, type))
-    return false;
+/*
+ * Converts the text of a JSON number to a double, whatever the C locale's
+ * decimal point is.  The number is handed to strtod as "0.<digits>e<n>", with
+ * the locale's decimal point.  Digits past the first JSON_MAX_DIGITS
+ * significant ones (far more than the 17 that tell doubles apart) are folded
+ * into a trailing 1 if any of them aren't 0, so numbers of any length fit.
+ */
+static double json_strtod(const char *p, const char *end) {
+  char buf[JSON_MAX_DIGITS + 32];
+  const char *point;
+  size_t point_size;
+  size_t pos = 0;
+  size_t digits = 0;
+  long exponent = 0;
+  long e = 0;
+  bool negative = false;
+  bool e_negative = false;
+  bool seen = false;
+  bool sticky = false;
+  bool fraction = false;
+
+  point = locale_decimal_point(&point_size);
+
+  if (*p == '-') {
+    negative = true;
+    buf[pos++] = '-';
+    p++;
+  }
 
-  if (ctx->read(ctx, data, 8))
-    return true;
+  buf[pos++] = '0';
+  memcpy(buf + pos, point, point_size);
+  pos += point_size;
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
-}
+  for (; p < end && *p != 'e' && *p != 'E'; p++) {
+    if (*p == '.') {
+      fraction = true;
+      continue;
+    }
 
-bool cmp_read_fixext16_marker(cmp_ctx_t *ctx, int8_t *type) {
-  cmp_object_t obj;
+    /* Leading zeros only move the point */
+    if (!seen && *p == '0') {
+      if (fraction && exponent > -JSON_MAX_EXPONENT)
+        exponent--;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+      continue;
+    }
 
-  if (obj.type != CMP_TYPE_FIXEXT16) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+    seen = true;
+
+    if (!fraction && exponent < JSON_MAX_EXPONENT)
+      exponent++;
+
+    if (digits < JSON_MAX_DIGITS) {
+      buf[pos++] = *p;
+      digits++;
+    }
+    else if (*p != '0') {
+      sticky = true;
+    }
   }
 
-  *type = obj.as.ext.type;
-  return true;
+  if (!seen)
+    return negative ? -0.0 : 0.0;
+
+  if (p < end) {
+    p++;
+
+    if (*p == '+' || *p == '-')
+      e_negative = *p++ == '-';
+
+    for (; p < end; p++) {
+      if (e < JSON_MAX_EXPONENT)
+        e = (e * 10) + (*p - '0');
+    }
+  }
+
+  if (sticky)
+    buf[pos++] = '1';
+
+  sprintf(buf + pos, "e%ld", e_negative ? exponent - e : exponent + e);
+
+  return strtod(buf, NULL);
 }
 
-bool cmp_read_fixext16(cmp_ctx_t *ctx, int8_t *type, void *data) {
-  if (!cmp_read_fixext16_marker(ctx, type))
-    return false;
+/* Swaps the C locale's decimal point in printf's output for a '.' */
+static int json_decimal_point(char *buf, int size) {
+  size_t point_size;
+  const char *point = locale_decimal_point(&point_size);
+  char *p;
 
-  if (ctx->read(ctx, data, 16))
-    return true;
+  if (point_size == 1 && *point == '.')
+    return size;
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
-}
+  p = strstr(buf, point);
 
-bool cmp_read_ext8_marker(cmp_ctx_t *ctx, int8_t *type, uint8_t *size) {
-  cmp_object_t obj;
+  if (!p)
+    return size;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  *p = '.';
+  memmove(p + 1, p + point_size, strlen(p + point_size) + 1);
 
-  if (obj.type != CMP_TYPE_EXT8) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+  return size - (int)(point_size - 1);
+}
+
+/*
+ * Writes the shortest of `min_precision` to 17 significant digits that reads
+ * back as the same value, with a '.' for a decimal point whatever the C
+ * locale's is.  JSON has no NaN or infinity, so they become null.
+ */
+static bool put_json_decimal(cmp_ctx_t *ctx, write_block_t *block,
+                                             double d,
+                                             bool is_float,
+                                             int min_precision) {
+  char buf[32];
+  int precision;
+  int size = 0;
+  double back;
+
+  if (d != d || d - d != 0.0)
+    return put_block_bytes(ctx, block, "null", 4);
+
+  /* Whole numbers print the same either way, and integers are much cheaper */
+  if (d != 0.0 && d > -1e15 && d < 1e15 && d == (double)(int64_t)d)
+    return put_json_sinteger(ctx, block, (int64_t)d);
+
+  for (precision = min_precision; precision <= 17; precision++) {
+    size = json_decimal_point(buf, sprintf(buf, "%.*g", precision, d));
+    back = json_strtod(buf, buf + size);
+
+    if (is_float ? (float)back == (float)d : back == d)
+      break;
   }
 
-  *type = obj.as.ext.type;
-  *size = (uint8_t)obj.as.ext.size;
+  return put_block_bytes(ctx, block, buf, (size_t)size);
+}
+#endif /* CMP_NO_FLOAT */
 
-  return true;
+/*
+ * Checks eight bytes at once for any that need escaping: control characters,
+ * quotes and backslashes.
+ */
+static bool json_word_needs_escape(const uint8_t *p) {
+  const uint64_t ones = UINT64_C(0x0101010101010101);
+  const uint64_t highs = UINT64_C(0x8080808080808080);
+  uint64_t w;
+  uint64_t quotes;
+  uint64_t backslashes;
+
+  memcpy(&w, p, sizeof(w));
+
+  quotes = w ^ (ones * '"');
+  backslashes = w ^ (ones * '\\');
+
+  return ((((w - (ones * 0x20)) & ~w) |
+           ((quotes - ones) & ~quotes) |
+           ((backslashes - ones) & ~backslashes)) & highs) != 0;
+}
+
+static bool put_json_escape(cmp_ctx_t *ctx, write_block_t *block, uint8_t c) {
+  char escape[6] = { '\\', 'u', '0', '0', 0, 0 };
+
+  switch (c) {
+    case '"':  escape[1] = '"';  return put_block_bytes(ctx, block, escape, 2);
+    case '\\': escape[1] = '\\'; return put_block_bytes(ctx, block, escape, 2);
+    case '\b': escape[1] = 'b';  return put_block_bytes(ctx, block, escape, 2);
+    case '\f': escape[1] = 'f';  return put_block_bytes(ctx, block, escape, 2);
+    case '\n': escape[1] = 'n';  return put_block_bytes(ctx, block, escape, 2);
+    case '\r': escape[1] = 'r';  return put_block_bytes(ctx, block, escape, 2);
+    case '\t': escape[1] = 't';  return put_block_bytes(ctx, block, escape, 2);
+    default:
+      escape[4] = json_hex_digits[c >> 4];
+      escape[5] = json_hex_digits[c & 0xF];
+      return put_block_bytes(ctx, block, escape, 6);
+  }
 }
 
-bool cmp_read_ext8(cmp_ctx_t *ctx, int8_t *type, uint8_t *size, void *data) {
-  if (!cmp_read_ext8_marker(ctx, type, size))
-    return false;
+/* Writes the contents of a string, copying runs that need no escaping whole */
+static bool put_json_chars(cmp_ctx_t *ctx, write_block_t *block,
+                                           const uint8_t *p,
+                                           size_t size) {
+  size_t start = 0;
+  size_t i = 0;
 
-  if (ctx->read(ctx, data, *size))
-    return true;
+  while (i < size) {
+    if ((i + 8) <= size && !json_word_needs_escape(p + i)) {
+      i += 8;
+      continue;
+    }
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
-}
+    if (p[i] >= 0x20 && p[i] != '"' && p[i] != '\\') {
+      i++;
+      continue;
+    }
 
-bool cmp_read_ext16_marker(cmp_ctx_t *ctx, int8_t *type, uint16_t *size) {
-  cmp_object_t obj;
+    if (!put_block_bytes(ctx, block, p + start, i - start))
+      return false;
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+    if (!put_json_escape(ctx, block, p[i]))
+      return false;
 
-  if (obj.type != CMP_TYPE_EXT16) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+    start = ++i;
   }
 
-  *type = obj.as.ext.type;
-  *size = (uint16_t)obj.as.ext.size;
-
-  return true;
+  return put_block_bytes(ctx, block, p + start, size - start);
 }
 
-bool cmp_read_ext16(cmp_ctx_t *ctx, int8_t *type, uint16_t *size, void *data) {
-  if (!cmp_read_ext16_marker(ctx, type, size))
-    return false;
-
-  if (ctx->read(ctx, data, *size))
-    return true;
+static bool put_base64(cmp_ctx_t *ctx, write_block_t *block,
+                                       const uint8_t *p,
+                                       size_t size) {
+  char quad[4];
+  uint32_t bits;
+  size_t i;
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
-}
+  for (i = 0; i < size; i += 3) {
+    bits = (uint32_t)p[i] << 16;
 
-bool cmp_read_ext32_marker(cmp_ctx_t *ctx, int8_t *type, uint32_t *size) {
-  cmp_object_t obj;
+    if ((i + 1) < size)
+      bits |= (uint32_t)p[i + 1] << 8;
+    if ((i + 2) < size)
+      bits |= p[i + 2];
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+    quad[0] = base64_digits[(bits >> 18) & 0x3F];
+    quad[1] = base64_digits[(bits >> 12) & 0x3F];
+    quad[2] = (i + 1) < size ? base64_digits[(bits >> 6) & 0x3F] : '=';
+    quad[3] = (i + 2) < size ? base64_digits[bits & 0x3F] : '=';
 
-  if (obj.type != CMP_TYPE_EXT32) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
+    if (!put_block_bytes(ctx, block, quad, 4))
+      return false;
   }
 
-  *type = obj.as.ext.type;
-  *size = obj.as.ext.size;
-
   return true;
 }
 
-bool cmp_read_ext32(cmp_ctx_t *ctx, int8_t *type, uint32_t *size, void *data) {
-  if (!cmp_read_ext32_marker(ctx, type, size))
+/*
+ * Writes the `size` bytes of a string, bin or ext payload as a JSON string,
+ * escaped or in base64.  Payloads in memory are used where they lie, others
+ * are read a chunk at a time.
+ */
+static bool put_json_payload(cmp_ctx_t *in, cmp_ctx_t *out,
+                                            write_block_t *block,
+                                            uint32_t size,
+                                            bool base64) {
+  uint8_t chunk[JSON_CHUNK_SIZE];
+  const void *data;
+  size_t count;
+
+  if (!put_block_char(out, block, '"'))
     return false;
 
-  if (ctx->read(ctx, data, *size))
-    return true;
+  if (in->read == mem_reader && size) {
+    if (!acquire_bytes(in, &data, size))
+      return false;
 
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
-}
+    if (base64) {
+      if (!put_base64(out, block, (const uint8_t *)data, size))
+        return false;
+    }
+    else if (!put_json_chars(out, block, (const uint8_t *)data, size)) {
+      return false;
+    }
 
-bool cmp_read_ext_marker(cmp_ctx_t *ctx, int8_t *type, uint32_t *size) {
-  cmp_object_t obj;
+    return put_block_char(out, block, '"');
+  }
 
-  if (!cmp_read_object(ctx, &obj))
-    return false;
+  while (size) {
+    count = size < sizeof(chunk) ? size : sizeof(chunk);
 
-  switch (obj.type) {
+    if (!read_bytes(in, chunk, count)) {
+      in->error = CMP_ERROR_DATA_READING;
+      return false;
+    }
+
+    if (base64) {
+      if (!put_base64(out, block, chunk, count))
+        return false;
+    }
+    else if (!put_json_chars(out, block, chunk, count)) {
+      return false;
+    }
+
+    size -= (uint32_t)count;
+  }
+
+  return put_block_char(out, block, '"');
+}
+
+/* Writes any object but an array or map */
+static bool put_json_scalar(cmp_ctx_t *in, cmp_ctx_t *out,
+                                           write_block_t *block,
+                                           const cmp_object_t *obj) {
+  switch (obj->type) {
+    case CMP_TYPE_NIL:
+      return put_block_bytes(out, block, "null", 4);
+    case CMP_TYPE_BOOLEAN:
+      if (obj->as.boolean)
+        return put_block_bytes(out, block, "true", 4);
+      return put_block_bytes(out, block, "false", 5);
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      return put_json_integer(out, block, false, obj->as.u8);
+    case CMP_TYPE_UINT16:
+      return put_json_integer(out, block, false, obj->as.u16);
+    case CMP_TYPE_UINT32:
+      return put_json_integer(out, block, false, obj->as.u32);
+    case CMP_TYPE_UINT64:
+      return put_json_integer(out, block, false, obj->as.u64);
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+      return put_json_sinteger(out, block, obj->as.s8);
+    case CMP_TYPE_SINT16:
+      return put_json_sinteger(out, block, obj->as.s16);
+    case CMP_TYPE_SINT32:
+      return put_json_sinteger(out, block, obj->as.s32);
+    case CMP_TYPE_SINT64:
+      return put_json_sinteger(out, block, obj->as.s64);
+#ifndef CMP_NO_FLOAT
+    case CMP_TYPE_FLOAT:
+      return put_json_decimal(out, block, obj->as.flt, true, 6);
+    case CMP_TYPE_DOUBLE:
+      return put_json_decimal(out, block, obj->as.dbl, false, 15);
+#else
+    case CMP_TYPE_FLOAT:
+    case CMP_TYPE_DOUBLE:
+      in->error = CMP_ERROR_DISABLED_FLOATING_POINT;
+      return false;
+#endif /* CMP_NO_FLOAT */
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      return put_json_payload(in, out, block, obj->as.str_size, false);
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return put_json_payload(in, out, block, obj->as.bin_size, true);
     case CMP_TYPE_FIXEXT1:
     case CMP_TYPE_FIXEXT2:
     case CMP_TYPE_FIXEXT4:
@@ -2654,534 +6613,807 @@ bool cmp_read_ext_marker(cmp_ctx_t *ctx, int8_t *type, uint32_t *size) {
     case CMP_TYPE_EXT8:
     case CMP_TYPE_EXT16:
     case CMP_TYPE_EXT32:
-      *type = obj.as.ext.type;
-      *size = obj.as.ext.size;
-      return true;
+      if (!put_block_bytes(out, block, "{\"type\":", 8))
+        return false;
+      if (!put_json_sinteger(out, block, obj->as.ext.type))
+        return false;
+      if (!put_block_bytes(out, block, ",\"data\":", 8))
+        return false;
+      if (!put_json_payload(in, out, block, obj->as.ext.size, true))
+        return false;
+      return put_block_char(out, block, '}');
     default:
-      ctx->error = CMP_ERROR_INVALID_TYPE;
+      in->error = CMP_ERROR_INVALID_TYPE;
       return false;
   }
 }
 
-bool cmp_read_ext(cmp_ctx_t *ctx, int8_t *type, uint32_t *size, void *data) {
-  if (!cmp_read_ext_marker(ctx, type, size))
+/*
+ * Writes a map key.  JSON keys are strings, so other scalars are written as
+ * strings of their JSON text.
+ */
+static bool put_json_key(cmp_ctx_t *in, cmp_ctx_t *out,
+                                        write_block_t *block,
+                                        const cmp_object_t *obj) {
+  if (cmp_object_is_str(obj))
+    return put_json_scalar(in, out, block, obj);
+
+  if (cmp_object_is_array(obj) || cmp_object_is_map(obj) ||
+      cmp_object_is_bin(obj) || cmp_object_is_ext(obj)) {
+    in->error = CMP_ERROR_INVALID_TYPE;
     return false;
+  }
 
-  if (ctx->read(ctx, data, *size))
-    return true;
-
-  ctx->error = CMP_ERROR_DATA_READING;
-  return false;
+  return put_block_char(out, block, '"') &&
+         put_json_scalar(in, out, block, obj) &&
+         put_block_char(out, block, '"');
 }
 
-bool cmp_read_object(cmp_ctx_t *ctx, cmp_object_t *obj) {
-  uint8_t type_marker = 0;
+bool cmp_write_json(cmp_ctx_t *in, cmp_ctx_t *out) {
+  write_block_t block;
+  uint32_t left[JSON_MAX_DEPTH];
+  bool is_map[JSON_MAX_DEPTH];
+  bool first[JSON_MAX_DEPTH];
+  size_t depth = 0;
+  bool want_value = false;
+  cmp_object_t obj;
 
-  if (!read_type_marker(ctx, &type_marker))
-    return false;
+  block.pos = 0;
 
-  if (!type_marker_to_cmp_type(type_marker, &obj->type)) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
-  }
+  /*
+   * Containers are tracked on a stack rather than by recursing.  `left`
+   * counts the elements (or pairs) still to come in each open container, and
+   * `want_value` is set between a map key and its value.
+   */
+  for (;;) {
+    if (depth && !want_value) {
+      if (!left[depth - 1]) {
+        if (!put_block_char(out, &block, is_map[depth - 1] ? '}' : ']'))
+          return false;
 
-  return read_obj_data(ctx, type_marker, obj);
-}
+        if (!--depth)
+          break;
 
-bool cmp_skip_object(cmp_ctx_t *ctx, cmp_object_t *obj) {
-  uint8_t type_marker = 0;
-  uint8_t cmp_type;
-  uint32_t size = 0;
+        continue;
+      }
 
-  if (!read_type_marker(ctx, &type_marker)) {
-    return false;
-  }
+      left[depth - 1]--;
 
-  if (!type_marker_to_cmp_type(type_marker, &cmp_type)) {
-    ctx->error = CMP_ERROR_INVALID_TYPE;
-    return false;
-  }
+      if (!first[depth - 1] && !put_block_char(out, &block, ','))
+        return false;
 
-  switch (cmp_type) {
-    case CMP_TYPE_FIXARRAY:
-    case CMP_TYPE_ARRAY16:
-    case CMP_TYPE_ARRAY32:
-    case CMP_TYPE_FIXMAP:
-    case CMP_TYPE_MAP16:
-    case CMP_TYPE_MAP32:
-      obj->type = cmp_type;
+      first[depth - 1] = false;
 
-      if (!read_obj_data(ctx, type_marker, obj)) {
-        return false;
+      if (is_map[depth - 1]) {
+        if (!cmp_read_object(in, &obj))
+          return false;
+
+        if (!put_json_key(in, out, &block, &obj))
+          return false;
+
+        if (!put_block_char(out, &block, ':'))
+          return false;
+
+        want_value = true;
+        continue;
       }
+    }
 
-      ctx->error = CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED;
+    want_value = false;
 
+    if (!cmp_read_object(in, &obj))
       return false;
-    default:
-      if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
+
+    if (cmp_object_is_array(&obj) || cmp_object_is_map(&obj)) {
+      if (depth == JSON_MAX_DEPTH) {
+        in->error = CMP_ERROR_JSON_DEPTH_LIMIT_EXCEEDED;
         return false;
       }
 
-      if (size) {
-        switch (cmp_type) {
-          case CMP_TYPE_FIXEXT1:
-          case CMP_TYPE_FIXEXT2:
-          case CMP_TYPE_FIXEXT4:
-          case CMP_TYPE_FIXEXT8:
-          case CMP_TYPE_FIXEXT16:
-          case CMP_TYPE_EXT8:
-          case CMP_TYPE_EXT16:
-          case CMP_TYPE_EXT32:
-            ++size;
-            break;
-          default:
+      is_map[depth] = cmp_object_is_map(&obj);
+      left[depth] = is_map[depth] ? obj.as.map_size : obj.as.array_size;
+      first[depth] = true;
+      depth++;
+
+      if (!put_block_char(out, &block, is_map[depth - 1] ? '{' : '['))
+        return false;
+
+      continue;
+    }
+
+    if (!put_json_scalar(in, out, &block, &obj))
+      return false;
+
+    if (!depth)
+      break;
+  }
+
+  return flush_block(out, &block);
+}
+
+/* Sets the high bit of each byte of `w` that equals `c` */
+static uint64_t word_bytes_equal(uint64_t w, uint8_t c) {
+  const uint64_t ones = UINT64_C(0x0101010101010101);
+  uint64_t x = w ^ (ones * c);
+
+  return (x - ones) & ~x & (ones * 0x80);
+}
+
+typedef struct json_parser_s {
+  cmp_ctx_t      *ctx;
+  const uint8_t  *p;
+  const uint8_t  *end;
+  const uint32_t *sizes;
+  uint32_t        size_count;
+  uint32_t        next_size;
+  size_t          depth;
+  uint32_t        left[JSON_MAX_DEPTH];
+  bool            is_map[JSON_MAX_DEPTH];
+  write_block_t   block;
+} json_parser_t;
+
+static bool json_error(json_parser_t *parser) {
+  parser->ctx->error = CMP_ERROR_INVALID_JSON;
+  return false;
+}
+
+static bool is_json_space(uint8_t c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static void skip_json_space(json_parser_t *parser) {
+  while (parser->p < parser->end && is_json_space(*parser->p))
+    parser->p++;
+}
+
+/*
+ * The first pass: finds the size of every array and map, in the order they
+ * open, so that the second pass can write their headers up front.  Only
+ * strings and structural characters are looked at; everything else is left
+ * for the second pass to check.
+ */
+static bool size_json_containers(cmp_ctx_t *ctx, const uint8_t *p,
+                                                 const uint8_t *end,
+                                                 uint32_t *sizes,
+                                                 uint32_t *count) {
+  uint32_t open[JSON_MAX_DEPTH];
+  size_t depth = 0;
+  uint32_t n = 0;
+  const uint8_t *q;
+  uint64_t w;
+
+  while (p < end) {
+    switch (*p) {
+      case '"':
+        p++;
+
+        for (;;) {
+          /* Skip eight bytes at a time until a quote or backslash turns up */
+          while ((p + 8) <= end) {
+            memcpy(&w, p, sizeof(w));
+
+            if (word_bytes_equal(w, '"') | word_bytes_equal(w, '\\'))
+              break;
+
+            p += 8;
+          }
+
+          while (p < end && *p != '"' && *p != '\\')
+            p++;
+
+          if (p >= end) {
+            ctx->error = CMP_ERROR_INVALID_JSON;
+            return false;
+          }
+
+          if (*p == '"')
             break;
+
+          p += 2;
         }
 
-        skip_bytes(ctx, size);
-      }
+        p++;
+        break;
+      case '[':
+      case '{':
+        if (n == *count) {
+          ctx->error = CMP_ERROR_JSON_SIZES_FULL;
+          return false;
+        }
+
+        if (depth == JSON_MAX_DEPTH) {
+          ctx->error = CMP_ERROR_JSON_DEPTH_LIMIT_EXCEEDED;
+          return false;
+        }
+
+        q = p + 1;
+
+        while (q < end && is_json_space(*q))
+          q++;
+
+        sizes[n] = (q < end && *q != ']' && *q != '}') ? 1 : 0;
+        open[depth++] = n++;
+        p++;
+        break;
+      case ']':
+      case '}':
+        if (!depth) {
+          ctx->error = CMP_ERROR_INVALID_JSON;
+          return false;
+        }
+
+        depth--;
+        p++;
+        break;
+      case ',':
+        if (depth)
+          sizes[open[depth - 1]]++;
+
+        p++;
+        break;
+      default:
+        p++;
+        break;
+    }
   }
 
+  *count = n;
   return true;
 }
 
-bool cmp_skip_object_flat(cmp_ctx_t *ctx, cmp_object_t *obj) {
-  size_t element_count = 1;
-  bool in_container = false;
+static int json_hex_value(uint8_t c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
 
-  while (element_count) {
-    uint8_t type_marker = 0;
-    uint8_t cmp_type;
-    uint32_t size = 0;
+  return -1;
+}
 
-    if (!read_type_marker(ctx, &type_marker)) {
-      return false;
-    }
+static bool read_json_hex4(const uint8_t *p, const uint8_t *end,
+                                             uint32_t *cp) {
+  int digit;
+  int i;
 
-    if (!type_marker_to_cmp_type(type_marker, &cmp_type)) {
-      ctx->error = CMP_ERROR_INVALID_TYPE;
+  if ((end - p) < 4)
+    return false;
+
+  *cp = 0;
+
+  for (i = 0; i < 4; i++) {
+    digit = json_hex_value(p[i]);
+
+    if (digit < 0)
       return false;
-    }
 
-    switch (cmp_type) {
-      case CMP_TYPE_FIXARRAY:
-      case CMP_TYPE_ARRAY16:
-      case CMP_TYPE_ARRAY32:
-      case CMP_TYPE_FIXMAP:
-      case CMP_TYPE_MAP16:
-      case CMP_TYPE_MAP32:
-        if (in_container) {
-          obj->type = cmp_type;
+    *cp = (*cp << 4) | (uint32_t)digit;
+  }
+
+  return true;
+}
+
+/*
+ * Decodes the escape sequence at `*pp` (just past its backslash) into `out`
+ * as UTF-8, advancing past it.  Returns its length, or 0 if it's invalid.
+ */
+static size_t decode_json_escape(const uint8_t **pp, const uint8_t *end,
+                                                     uint8_t out[4]) {
+  const uint8_t *p = *pp;
+  uint32_t cp;
+  uint32_t low;
+
+  if (p >= end)
+    return 0;
+
+  switch (*p) {
+    case '"':
+    case '\\':
+    case '/':
+      out[0] = *p;
+      break;
+    case 'b':
+      out[0] = '\b';
+      break;
+    case 'f':
+      out[0] = '\f';
+      break;
+    case 'n':
+      out[0] = '\n';
+      break;
+    case 'r':
+      out[0] = '\r';
+      break;
+    case 't':
+      out[0] = '\t';
+      break;
+    case 'u':
+      if (!read_json_hex4(p + 1, end, &cp))
+        return 0;
 
-          if (!read_obj_data(ctx, type_marker, obj)) {
-            return false;
-          }
+      p += 5;
 
-          ctx->error = CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED;
-          return false;
+      if (cp >= 0xDC00 && cp <= 0xDFFF)
+        return 0;
+
+      if (cp >= 0xD800 && cp <= 0xDBFF) {
+        if ((end - p) < 6 || p[0] != '\\' || p[1] != 'u' ||
+            !read_json_hex4(p + 2, end, &low) ||
+            low < 0xDC00 || low > 0xDFFF) {
+          return 0;
         }
 
-        in_container = true;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        p += 6;
+      }
 
-        break;
-      default:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
+      *pp = p;
 
-        if (size) {
-          switch (cmp_type) {
-            case CMP_TYPE_FIXEXT1:
-            case CMP_TYPE_FIXEXT2:
-            case CMP_TYPE_FIXEXT4:
-            case CMP_TYPE_FIXEXT8:
-            case CMP_TYPE_FIXEXT16:
-            case CMP_TYPE_EXT8:
-            case CMP_TYPE_EXT16:
-            case CMP_TYPE_EXT32:
-              ++size;
-              break;
-            default:
-              break;
-          }
+      if (cp < 0x80) {
+        out[0] = (uint8_t)cp;
+        return 1;
+      }
 
-          skip_bytes(ctx, size);
-        }
-    }
+      if (cp < 0x800) {
+        out[0] = (uint8_t)(0xC0 | (cp >> 6));
+        out[1] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 2;
+      }
 
-    element_count--;
+      if (cp < 0x10000) {
+        out[0] = (uint8_t)(0xE0 | (cp >> 12));
+        out[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 3;
+      }
 
-    switch (cmp_type) {
-      case CMP_TYPE_FIXARRAY:
-      case CMP_TYPE_ARRAY16:
-      case CMP_TYPE_ARRAY32:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
-        element_count += size;
-        break;
-      case CMP_TYPE_FIXMAP:
-      case CMP_TYPE_MAP16:
-      case CMP_TYPE_MAP32:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
-        element_count += ((size_t)size) * 2;
-        break;
-      default:
-        break;
-    }
+      out[0] = (uint8_t)(0xF0 | (cp >> 18));
+      out[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+      out[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+      out[3] = (uint8_t)(0x80 | (cp & 0x3F));
+      return 4;
+    default:
+      return 0;
   }
 
-  return true;
+  *pp = p + 1;
+  return 1;
 }
 
-bool cmp_skip_object_no_limit(cmp_ctx_t *ctx) {
-  size_t element_count = 1;
+/*
+ * Unescapes the string starting at the parser's position (just past its
+ * opening quote), writing its contents if `write` is set and counting them
+ * either way.  The parser is left past the closing quote.
+ */
+static bool unescape_json_string(json_parser_t *parser, bool write,
+                                                        uint32_t *size) {
+  const uint8_t *p = parser->p;
+  const uint8_t *start = p;
+  uint8_t decoded[4];
+  size_t decoded_size;
+  uint64_t w;
+
+  *size = 0;
+
+  for (;;) {
+    while ((p + 8) <= parser->end) {
+      memcpy(&w, p, sizeof(w));
+
+      if (word_bytes_equal(w, '"') | word_bytes_equal(w, '\\') |
+          ((w - UINT64_C(0x2020202020202020)) & ~w &
+           UINT64_C(0x8080808080808080))) {
+        break;
+      }
 
-  while (element_count) {
-    uint8_t type_marker = 0;
-    uint8_t cmp_type = 0;
-    uint32_t size = 0;
+      p += 8;
+    }
 
-    if (!read_type_marker(ctx, &type_marker)) {
-      return false;
+    if (p >= parser->end || *p < 0x20)
+      return json_error(parser);
+
+    if (*p != '"' && *p != '\\') {
+      p++;
+      continue;
     }
 
-    if (!type_marker_to_cmp_type(type_marker, &cmp_type)) {
-      ctx->error = CMP_ERROR_INVALID_TYPE;
+    if ((size_t)(p - start) > (UINT32_MAX - *size))
+      return json_error(parser);
+
+    *size += (uint32_t)(p - start);
+
+    if (write && !put_block_bytes(parser->ctx, &parser->block,
+                                  start, (size_t)(p - start))) {
       return false;
     }
 
-    switch (cmp_type) {
-      case CMP_TYPE_FIXARRAY:
-      case CMP_TYPE_ARRAY16:
-      case CMP_TYPE_ARRAY32:
-      case CMP_TYPE_FIXMAP:
-      case CMP_TYPE_MAP16:
-      case CMP_TYPE_MAP32:
-        break;
-      default:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
+    if (*p == '"')
+      break;
 
-        if (size) {
-          switch (cmp_type) {
-            case CMP_TYPE_FIXEXT1:
-            case CMP_TYPE_FIXEXT2:
-            case CMP_TYPE_FIXEXT4:
-            case CMP_TYPE_FIXEXT8:
-            case CMP_TYPE_FIXEXT16:
-            case CMP_TYPE_EXT8:
-            case CMP_TYPE_EXT16:
-            case CMP_TYPE_EXT32:
-              ++size;
-              break;
-            default:
-              break;
-          }
+    p++;
+    decoded_size = decode_json_escape(&p, parser->end, decoded);
 
-          skip_bytes(ctx, size);
-        }
-    }
+    if (!decoded_size)
+      return json_error(parser);
 
-    element_count--;
+    *size += (uint32_t)decoded_size;
 
-    switch (cmp_type) {
-      case CMP_TYPE_FIXARRAY:
-      case CMP_TYPE_ARRAY16:
-      case CMP_TYPE_ARRAY32:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
-        element_count += size;
-        break;
-      case CMP_TYPE_FIXMAP:
-      case CMP_TYPE_MAP16:
-      case CMP_TYPE_MAP32:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
-        element_count += ((size_t)size) * 2;
-        break;
-      default:
-        break;
+    if (write && !put_block_bytes(parser->ctx, &parser->block,
+                                  decoded, decoded_size)) {
+      return false;
     }
+
+    start = p;
   }
 
+  parser->p = p + 1;
   return true;
 }
 
-bool cmp_skip_object_limit(cmp_ctx_t *ctx, cmp_object_t *obj, uint32_t limit) {
-  size_t element_count = 1;
-  uint32_t depth = 0;
+static bool parse_json_string(json_parser_t *parser) {
+  const uint8_t *start;
+  uint32_t size;
 
-  while (element_count) {
-    uint8_t type_marker = 0;
-    uint8_t cmp_type;
-    uint32_t size = 0;
+  parser->p++;
+  start = parser->p;
 
-    if (!read_type_marker(ctx, &type_marker)) {
-      return false;
-    }
+  if (!unescape_json_string(parser, false, &size))
+    return false;
 
-    if (!type_marker_to_cmp_type(type_marker, &cmp_type)) {
-      ctx->error = CMP_ERROR_INVALID_TYPE;
-      return false;
-    }
+  /* Strings without escapes are copied as they are */
+  if (size == (uint32_t)(parser->p - start - 1)) {
+    return put_block_str(parser->ctx, &parser->block, (const char *)start,
+                                                      size);
+  }
 
-    switch (cmp_type) {
-      case CMP_TYPE_FIXARRAY:
-      case CMP_TYPE_ARRAY16:
-      case CMP_TYPE_ARRAY32:
-      case CMP_TYPE_FIXMAP:
-      case CMP_TYPE_MAP16:
-      case CMP_TYPE_MAP32:
-        ++depth;
+  if (!put_block_str_marker(parser->ctx, &parser->block, size))
+    return false;
 
-        if (depth > limit) {
-          obj->type = cmp_type;
+  parser->p = start;
 
-          if (!read_obj_data(ctx, type_marker, obj)) {
-            return false;
-          }
+  return unescape_json_string(parser, true, &size);
+}
 
-          ctx->error = CMP_ERROR_SKIP_DEPTH_LIMIT_EXCEEDED;
+static bool parse_json_number(json_parser_t *parser) {
+  const uint8_t *start = parser->p;
+  const uint8_t *p = parser->p;
+  const uint8_t *end = parser->end;
+  bool negative = false;
+  bool overflow = false;
+  bool is_integer = true;
+  uint64_t u = 0;
+#ifndef CMP_NO_FLOAT
+  double d;
+  float f;
+  uint32_t u32temp;
+  uint64_t u64temp;
+#endif /* CMP_NO_FLOAT */
 
-          return false;
-        }
+  if (*p == '-') {
+    negative = true;
+    p++;
+  }
 
-        break;
-      default:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
+  if (p >= end || *p < '0' || *p > '9')
+    return json_error(parser);
 
-        if (size) {
-          switch (cmp_type) {
-            case CMP_TYPE_FIXEXT1:
-            case CMP_TYPE_FIXEXT2:
-            case CMP_TYPE_FIXEXT4:
-            case CMP_TYPE_FIXEXT8:
-            case CMP_TYPE_FIXEXT16:
-            case CMP_TYPE_EXT8:
-            case CMP_TYPE_EXT16:
-            case CMP_TYPE_EXT32:
-              ++size;
-              break;
-            default:
-              break;
-          }
+  if (*p == '0') {
+    p++;
+  }
+  else {
+    while (p < end && *p >= '0' && *p <= '9') {
+      if (u > (UINT64_MAX / 10) || (u * 10) > (UINT64_MAX - (*p - '0')))
+        overflow = true;
 
-          skip_bytes(ctx, size);
-        }
+      u = (u * 10) + (uint64_t)(*p - '0');
+      p++;
     }
+  }
 
-    element_count--;
+  if (p < end && *p == '.') {
+    is_integer = false;
+    p++;
 
-    switch (cmp_type) {
-      case CMP_TYPE_FIXARRAY:
-      case CMP_TYPE_ARRAY16:
-      case CMP_TYPE_ARRAY32:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
-        element_count += size;
-        break;
-      case CMP_TYPE_FIXMAP:
-      case CMP_TYPE_MAP16:
-      case CMP_TYPE_MAP32:
-        if (!read_type_size(ctx, type_marker, cmp_type, &size)) {
-          return false;
-        }
-        element_count += ((size_t)size) * 2;
-        break;
-      default:
-        break;
-    }
+    if (p >= end || *p < '0' || *p > '9')
+      return json_error(parser);
+
+    while (p < end && *p >= '0' && *p <= '9')
+      p++;
   }
 
-  return true;
-}
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    is_integer = false;
+    p++;
 
-bool cmp_object_is_char(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      return true;
-    default:
-      return false;
+    if (p < end && (*p == '+' || *p == '-'))
+      p++;
+
+    if (p >= end || *p < '0' || *p > '9')
+      return json_error(parser);
+
+    while (p < end && *p >= '0' && *p <= '9')
+      p++;
   }
-}
 
-bool cmp_object_is_short(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-    case CMP_TYPE_SINT16:
-      return true;
-    default:
-      return false;
+  parser->p = p;
+
+  if (is_integer && !overflow) {
+    if (!negative)
+      return put_block_uinteger(parser->ctx, &parser->block, u);
+
+    if (u <= (UINT64_C(1) << 63)) {
+      return put_block_integer(
+        parser->ctx, &parser->block, (int64_t)(0 - u)
+      );
+    }
   }
-}
 
-bool cmp_object_is_int(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-    case CMP_TYPE_SINT16:
-    case CMP_TYPE_SINT32:
-      return true;
-    default:
-      return false;
+#ifndef CMP_NO_FLOAT
+  d = json_strtod((const char *)start, (const char *)p);
+
+  /* Numbers too small for a double are 0, but too large ones are errors */
+  if (d - d != 0.0) {
+    parser->ctx->error = CMP_ERROR_JSON_NUMBER_OUT_OF_RANGE;
+    return false;
   }
-}
 
-bool cmp_object_is_long(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-    case CMP_TYPE_SINT16:
-    case CMP_TYPE_SINT32:
-    case CMP_TYPE_SINT64:
-      return true;
-    default:
-      return false;
+  f = (float)d;
+
+  if ((double)f == d) {
+    memcpy(&u32temp, &f, sizeof(float));
+    return put_block_value(parser->ctx, &parser->block, FLOAT_MARKER, u32temp);
   }
-}
 
-bool cmp_object_is_sinteger(const cmp_object_t *obj) {
-  return cmp_object_is_long(obj);
+  memcpy(&u64temp, &d, sizeof(double));
+  return put_block_value(parser->ctx, &parser->block, DOUBLE_MARKER, u64temp);
+#else
+  (void)start;
+  parser->ctx->error = CMP_ERROR_DISABLED_FLOATING_POINT;
+  return false;
+#endif /* CMP_NO_FLOAT */
 }
 
-bool cmp_object_is_uchar(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      return true;
-    default:
-      return false;
+static bool parse_json_literal(json_parser_t *parser, const char *literal,
+                                                      size_t size,
+                                                      uint8_t marker) {
+  if ((size_t)(parser->end - parser->p) < size ||
+      memcmp(parser->p, literal, size)) {
+    return json_error(parser);
   }
+
+  parser->p += size;
+
+  return put_block_value(parser->ctx, &parser->block, 0, marker);
 }
 
-bool cmp_object_is_ushort(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      return true;
-    case CMP_TYPE_UINT16:
-      return true;
-    default:
-      return false;
-  }
+static bool parse_json_key(json_parser_t *parser) {
+  skip_json_space(parser);
+
+  if (parser->p >= parser->end || *parser->p != '"')
+    return json_error(parser);
+
+  if (!parse_json_string(parser))
+    return false;
+
+  skip_json_space(parser);
+
+  if (parser->p >= parser->end || *parser->p != ':')
+    return json_error(parser);
+
+  parser->p++;
+  return true;
 }
 
-bool cmp_object_is_uint(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-    case CMP_TYPE_UINT16:
-    case CMP_TYPE_UINT32:
-      return true;
-    default:
-      return false;
+static bool put_block_container(cmp_ctx_t *ctx, write_block_t *block,
+                                                bool is_map,
+                                                uint32_t size) {
+  uint8_t *b;
+
+  if (block->pos > (sizeof(block->data) - 5) && !flush_block(ctx, block))
+    return false;
+
+  b = block->data + block->pos;
+
+  if (size <= FIXMAP_SIZE) {
+    b[0] = (uint8_t)((is_map ? FIXMAP_MARKER : FIXARRAY_MARKER) | size);
+    block->pos += 1;
+  }
+  else if (size <= 0xFFFF) {
+    b[0] = is_map ? MAP16_MARKER : ARRAY16_MARKER;
+    store_be16(b + 1, (uint16_t)size);
+    block->pos += 3;
   }
+  else {
+    b[0] = is_map ? MAP32_MARKER : ARRAY32_MARKER;
+    store_be32(b + 1, size);
+    block->pos += 5;
+  }
+
+  return true;
 }
 
-bool cmp_object_is_ulong(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-    case CMP_TYPE_UINT16:
-    case CMP_TYPE_UINT32:
-    case CMP_TYPE_UINT64:
-      return true;
+/*
+ * Parses a value.  Scalars are written whole; containers get their header
+ * written and are pushed, and `opened` is set unless they're empty.
+ */
+static bool parse_json_value(json_parser_t *parser, bool *opened) {
+  bool is_map;
+  uint32_t size;
+
+  *opened = false;
+  skip_json_space(parser);
+
+  if (parser->p >= parser->end)
+    return json_error(parser);
+
+  switch (*parser->p) {
+    case '{':
+    case '[':
+      is_map = *parser->p == '{';
+      parser->p++;
+
+      if (parser->next_size == parser->size_count)
+        return json_error(parser);
+
+      size = parser->sizes[parser->next_size++];
+
+      if (!put_block_container(parser->ctx, &parser->block, is_map, size))
+        return false;
+
+      skip_json_space(parser);
+
+      if (parser->p < parser->end && *parser->p == (is_map ? '}' : ']')) {
+        if (size)
+          return json_error(parser);
+
+        parser->p++;
+        return true;
+      }
+
+      if (!size || parser->depth == JSON_MAX_DEPTH)
+        return json_error(parser);
+
+      parser->is_map[parser->depth] = is_map;
+      parser->left[parser->depth] = size;
+      parser->depth++;
+      *opened = true;
+
+      return !is_map || parse_json_key(parser);
+    case '"':
+      return parse_json_string(parser);
+    case 't':
+      return parse_json_literal(parser, "true", 4, TRUE_MARKER);
+    case 'f':
+      return parse_json_literal(parser, "false", 5, FALSE_MARKER);
+    case 'n':
+      return parse_json_literal(parser, "null", 4, NIL_MARKER);
     default:
-      return false;
+      return parse_json_number(parser);
   }
 }
 
-bool cmp_object_is_uinteger(const cmp_object_t *obj) {
-  return cmp_object_is_ulong(obj);
-}
-
-bool cmp_object_is_float(const cmp_object_t *obj) {
-  if (obj->type == CMP_TYPE_FLOAT)
-    return true;
+/*
+ * Called after each value: moves on to the next element of the innermost open
+ * container, closing containers as they end.  Sets `done` once the top-level
+ * value is complete.
+ */
+static bool next_json_value(json_parser_t *parser, bool *done) {
+  size_t top;
 
-  return false;
-}
+  *done = false;
 
-bool cmp_object_is_double(const cmp_object_t *obj) {
-  if (obj->type == CMP_TYPE_DOUBLE)
-    return true;
+  while (parser->depth) {
+    top = parser->depth - 1;
+    parser->left[top]--;
+    skip_json_space(parser);
 
-  return false;
-}
+    if (parser->p >= parser->end)
+      return json_error(parser);
 
-bool cmp_object_is_nil(const cmp_object_t *obj) {
-  if (obj->type == CMP_TYPE_NIL)
-    return true;
+    if (*parser->p == ',') {
+      if (!parser->left[top])
+        return json_error(parser);
 
-  return false;
-}
+      parser->p++;
 
-bool cmp_object_is_bool(const cmp_object_t *obj) {
-  if (obj->type == CMP_TYPE_BOOLEAN)
-    return true;
+      return !parser->is_map[top] || parse_json_key(parser);
+    }
 
-  return false;
-}
+    if (*parser->p != (parser->is_map[top] ? '}' : ']') || parser->left[top])
+      return json_error(parser);
 
-bool cmp_object_is_str(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_FIXSTR:
-    case CMP_TYPE_STR8:
-    case CMP_TYPE_STR16:
-    case CMP_TYPE_STR32:
-      return true;
-    default:
-      return false;
+    parser->p++;
+    parser->depth--;
   }
+
+  *done = true;
+  return true;
 }
 
-bool cmp_object_is_bin(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_BIN8:
-    case CMP_TYPE_BIN16:
-    case CMP_TYPE_BIN32:
-      return true;
-    default:
-      return false;
+bool cmp_write_from_json(cmp_ctx_t *ctx, const char *json, size_t size,
+                                                           uint32_t *sizes,
+                                                           uint32_t count) {
+  json_parser_t parser;
+  bool opened;
+  bool done = false;
+
+  parser.ctx = ctx;
+  parser.p = (const uint8_t *)json;
+  parser.end = parser.p + size;
+  parser.sizes = sizes;
+  parser.size_count = count;
+  parser.next_size = 0;
+  parser.depth = 0;
+  parser.block.pos = 0;
+
+  if (!size_json_containers(ctx, parser.p, parser.end, sizes,
+                                                       &parser.size_count)) {
+    return false;
   }
-}
 
-bool cmp_object_is_array(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_FIXARRAY:
-    case CMP_TYPE_ARRAY16:
-    case CMP_TYPE_ARRAY32:
-      return true;
-    default:
+  while (!done) {
+    if (!parse_json_value(&parser, &opened))
       return false;
-  }
-}
 
-bool cmp_object_is_map(const cmp_object_t *obj) {
-  switch (obj->type) {
-    case CMP_TYPE_FIXMAP:
-    case CMP_TYPE_MAP16:
-    case CMP_TYPE_MAP32:
-      return true;
-    default:
+    if (!opened && !next_json_value(&parser, &done))
       return false;
   }
+
+  skip_json_space(&parser);
+
+  if (parser.p != parser.end)
+    return json_error(&parser);
+
+  return flush_block(ctx, &parser.block);
 }
 
-bool cmp_object_is_ext(const cmp_object_t *obj) {
+enum {
+  CANONICAL_MAX_DEPTH = 64
+};
+
+/*
+ * Writes an object's marker and size (or its whole value, for scalars) in
+ * the narrowest form, whatever form it was read in.
+ */
+static bool write_minimal(cmp_ctx_t *ctx, const cmp_object_t *obj) {
   switch (obj->type) {
+    case CMP_TYPE_POSITIVE_FIXNUM:
+    case CMP_TYPE_UINT8:
+      return cmp_write_uinteger(ctx, obj->as.u8);
+    case CMP_TYPE_UINT16:
+      return cmp_write_uinteger(ctx, obj->as.u16);
+    case CMP_TYPE_UINT32:
+      return cmp_write_uinteger(ctx, obj->as.u32);
+    case CMP_TYPE_UINT64:
+      return cmp_write_uinteger(ctx, obj->as.u64);
+    case CMP_TYPE_NEGATIVE_FIXNUM:
+    case CMP_TYPE_SINT8:
+      return cmp_write_integer(ctx, obj->as.s8);
+    case CMP_TYPE_SINT16:
+      return cmp_write_integer(ctx, obj->as.s16);
+    case CMP_TYPE_SINT32:
+      return cmp_write_integer(ctx, obj->as.s32);
+    case CMP_TYPE_SINT64:
+      return cmp_write_integer(ctx, obj->as.s64);
+#ifndef CMP_NO_FLOAT
+    case CMP_TYPE_FLOAT:
+      return cmp_write_float(ctx, obj->as.flt);
+    case CMP_TYPE_DOUBLE:
+      return cmp_write_decimal(ctx, obj->as.dbl);
+#endif /* CMP_NO_FLOAT */
+    case CMP_TYPE_NIL:
+      return cmp_write_nil(ctx);
+    case CMP_TYPE_BOOLEAN:
+      return cmp_write_bool(ctx, obj->as.boolean);
+    case CMP_TYPE_FIXSTR:
+    case CMP_TYPE_STR8:
+    case CMP_TYPE_STR16:
+    case CMP_TYPE_STR32:
+      return cmp_write_str_marker(ctx, obj->as.str_size);
+    case CMP_TYPE_BIN8:
+    case CMP_TYPE_BIN16:
+    case CMP_TYPE_BIN32:
+      return cmp_write_bin_marker(ctx, obj->as.bin_size);
     case CMP_TYPE_FIXEXT1:
     case CMP_TYPE_FIXEXT2:
     case CMP_TYPE_FIXEXT4:
@@ -3190,348 +7422,452 @@ bool cmp_object_is_ext(const cmp_object_t *obj) {
     case CMP_TYPE_EXT8:
     case CMP_TYPE_EXT16:
     case CMP_TYPE_EXT32:
-      return true;
+      return cmp_write_ext_marker(ctx, obj->as.ext.type, obj->as.ext.size);
+    case CMP_TYPE_FIXARRAY:
+    case CMP_TYPE_ARRAY16:
+    case CMP_TYPE_ARRAY32:
+      return cmp_write_array(ctx, obj->as.array_size);
+    case CMP_TYPE_FIXMAP:
+    case CMP_TYPE_MAP16:
+    case CMP_TYPE_MAP32:
+      return cmp_write_map(ctx, obj->as.map_size);
     default:
+      ctx->error = CMP_ERROR_INVALID_TYPE;
       return false;
   }
 }
 
-bool cmp_object_as_char(const cmp_object_t *obj, int8_t *c) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *c = obj->as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      if (obj->as.u8 <= 0x7F) {
-        *c = obj->as.s8;
-        return true;
-      }
-      else {
-        return false;
-      }
-    default:
-        return false;
+/* A byte of an entry's canonical key: its header, then its payload */
+static uint8_t entry_key_byte(const cmp_map_entry_t *entry, size_t i) {
+  if (i < entry->header_size)
+    return entry->header[i];
+
+  return entry->payload[i - entry->header_size];
+}
+
+static int compare_entries(const cmp_map_entry_t *a,
+                           const cmp_map_entry_t *b) {
+  size_t a_size = a->header_size + (size_t)a->payload_size;
+  size_t b_size = b->header_size + (size_t)b->payload_size;
+  size_t i;
+  uint8_t x;
+  uint8_t y;
+
+  for (i = 0; i < a_size && i < b_size; i++) {
+    x = entry_key_byte(a, i);
+    y = entry_key_byte(b, i);
+
+    if (x != y)
+      return x < y ? -1 : 1;
   }
+
+  if (a_size == b_size)
+    return 0;
+
+  return a_size < b_size ? -1 : 1;
 }
 
-bool cmp_object_as_short(const cmp_object_t *obj, int16_t *s) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *s = obj->as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      *s = obj->as.u8;
-      return true;
-    case CMP_TYPE_SINT16:
-      *s = obj->as.s16;
-      return true;
-    case CMP_TYPE_UINT16:
-      if (obj->as.u16 <= 0x7FFF) {
-        *s = (int16_t)obj->as.u16;
-        return true;
-      }
-      else {
-        return false;
-      }
-    default:
-        return false;
+static void sift_entry_down(cmp_map_entry_t *entries, uint32_t root,
+                                                      uint32_t count) {
+  cmp_map_entry_t temp;
+  uint32_t child;
+
+  while ((child = (root * 2) + 1) < count) {
+    if ((child + 1) < count &&
+        compare_entries(&entries[child], &entries[child + 1]) < 0) {
+      child++;
+    }
+
+    if (compare_entries(&entries[root], &entries[child]) >= 0)
+      return;
+
+    temp = entries[root];
+    entries[root] = entries[child];
+    entries[child] = temp;
+    root = child;
   }
 }
 
-bool cmp_object_as_int(const cmp_object_t *obj, int32_t *i) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *i = obj->as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      *i = obj->as.u8;
-      return true;
-    case CMP_TYPE_SINT16:
-      *i = obj->as.s16;
-      return true;
-    case CMP_TYPE_UINT16:
-      *i = obj->as.u16;
-      return true;
-    case CMP_TYPE_SINT32:
-      *i = obj->as.s32;
-      return true;
-    case CMP_TYPE_UINT32:
-      if (obj->as.u32 <= 0x7FFFFFFF) {
-        *i = (int32_t)obj->as.u32;
-        return true;
-      }
-      else {
-        return false;
-      }
-    default:
-        return false;
+/* Heapsorts entries by key, which takes no memory beyond the entries */
+static void sort_entries(cmp_map_entry_t *entries, uint32_t count) {
+  cmp_map_entry_t temp;
+  uint32_t i;
+
+  for (i = count / 2; i > 0; i--)
+    sift_entry_down(entries, i - 1, count);
+
+  for (i = count; i > 1; i--) {
+    temp = entries[0];
+    entries[0] = entries[i - 1];
+    entries[i - 1] = temp;
+    sift_entry_down(entries, 0, i - 1);
   }
 }
 
-bool cmp_object_as_long(const cmp_object_t *obj, int64_t *d) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_NEGATIVE_FIXNUM:
-    case CMP_TYPE_SINT8:
-      *d = obj->as.s8;
-      return true;
-    case CMP_TYPE_UINT8:
-      *d = obj->as.u8;
-      return true;
-    case CMP_TYPE_SINT16:
-      *d = obj->as.s16;
-      return true;
-    case CMP_TYPE_UINT16:
-      *d = obj->as.u16;
-      return true;
-    case CMP_TYPE_SINT32:
-      *d = obj->as.s32;
-      return true;
-    case CMP_TYPE_UINT32:
-      *d = obj->as.u32;
-      return true;
-    case CMP_TYPE_SINT64:
-      *d = obj->as.s64;
-      return true;
-    case CMP_TYPE_UINT64:
-      if (obj->as.u64 <= UINT64_C(0x7FFFFFFFFFFFFFFF)) {
-        *d = (int64_t)obj->as.u64;
-        return true;
-      }
-      else {
+static bool write_canonical(cmp_ctx_t *in, cmp_ctx_t *out,
+                                           cmp_map_entry_t *entries,
+                                           uint32_t count,
+                                           size_t depth) {
+  cmp_map_entry_t *entry;
+  cmp_object_t obj;
+  cmp_ctx_t header;
+  const void *payload;
+  size_t end;
+  uint32_t size;
+  uint32_t i;
+
+  if (depth > CANONICAL_MAX_DEPTH) {
+    in->error = CMP_ERROR_DEPTH_LIMIT_EXCEEDED;
+    return false;
+  }
+
+  if (!cmp_read_object(in, &obj))
+    return false;
+
+  if (!write_minimal(out, &obj))
+    return false;
+
+  if (cmp_object_is_array(&obj)) {
+    for (i = 0; i < obj.as.array_size; i++) {
+      if (!write_canonical(in, out, entries, count, depth + 1))
         return false;
-      }
-    default:
+    }
+
+    return true;
+  }
+
+  if (!cmp_object_is_map(&obj)) {
+    size = payload_size_of(&obj);
+
+    if (!size)
+      return true;
+
+    if (!acquire_bytes(in, &payload, size))
+      return false;
+
+    return write_encoded(
+      out, (const uint8_t *)payload, size, CMP_ERROR_DATA_WRITING
+    );
+  }
+
+  size = obj.as.map_size;
+
+  if (size > count) {
+    in->error = CMP_ERROR_MAP_ENTRIES_FULL;
+    return false;
+  }
+
+  /* Note where each value is, and what its key looks like canonically */
+  for (i = 0; i < size; i++) {
+    entry = &entries[i];
+
+    if (!cmp_read_object(in, &obj))
+      return false;
+
+    if (cmp_object_is_array(&obj) || cmp_object_is_map(&obj)) {
+      in->error = CMP_ERROR_INVALID_TYPE;
+      return false;
+    }
+
+    cmp_init_mem(&header, entry->header, sizeof(entry->header));
+
+    if (!write_minimal(&header, &obj)) {
+      in->error = header.error;
+      return false;
+    }
+
+    entry->header_size = (uint8_t)cmp_mem_tell(&header);
+    entry->payload_size = payload_size_of(&obj);
+    entry->payload = NULL;
+
+    if (entry->payload_size) {
+      if (!acquire_bytes(in, &payload, entry->payload_size))
         return false;
+
+      entry->payload = (const uint8_t *)payload;
+    }
+
+    entry->value_pos = in->buf_pos;
+
+    if (!cmp_skip_object_no_limit(in))
+      return false;
   }
-}
 
-bool cmp_object_as_sinteger(const cmp_object_t *obj, int64_t *d) {
-  return cmp_object_as_long(obj, d);
-}
+  end = in->buf_pos;
+  sort_entries(entries, size);
 
-bool cmp_object_as_uchar(const cmp_object_t *obj, uint8_t *c) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *c = obj->as.u8;
-      return true;
-    default:
-        return false;
+  for (i = 0; i < size; i++) {
+    entry = &entries[i];
+
+    if (i && compare_entries(&entries[i - 1], entry) == 0) {
+      in->error = CMP_ERROR_DUPLICATE_MAP_KEY;
+      return false;
+    }
+
+    if (!write_encoded(out, entry->header, entry->header_size,
+                                           CMP_ERROR_DATA_WRITING)) {
+      return false;
+    }
+
+    if (entry->payload_size &&
+        !write_encoded(out, entry->payload, entry->payload_size,
+                                            CMP_ERROR_DATA_WRITING)) {
+      return false;
+    }
+
+    /* Values get the entries past this map's for any maps of their own */
+    in->buf_pos = entry->value_pos;
+
+    if (!write_canonical(in, out, entries + size, count - size, depth + 1))
+      return false;
   }
+
+  in->buf_pos = end;
+  return true;
 }
 
-bool cmp_object_as_ushort(const cmp_object_t *obj, uint16_t *s) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *s = obj->as.u8;
-      return true;
-    case CMP_TYPE_UINT16:
-      *s = obj->as.u16;
-      return true;
-    default:
-        return false;
+bool cmp_write_canonical(cmp_ctx_t *in, cmp_ctx_t *out,
+                                        cmp_map_entry_t *entries,
+                                        uint32_t count) {
+  if (in->read != mem_reader) {
+    in->error = CMP_ERROR_MEMORY_CONTEXT_REQUIRED;
+    return false;
   }
+
+  return write_canonical(in, out, entries, count, 0);
 }
 
-bool cmp_object_as_uint(const cmp_object_t *obj, uint32_t *i) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *i = obj->as.u8;
-      return true;
-    case CMP_TYPE_UINT16:
-      *i = obj->as.u16;
-      return true;
-    case CMP_TYPE_UINT32:
-      *i = obj->as.u32;
-      return true;
-    default:
-        return false;
-  }
+void cmp_strings_init(cmp_strings_t *strings, int8_t ext_type) {
+  strings->count = 0;
+  strings->ext_type = ext_type;
+  memset(strings->table, 0, sizeof(strings->table));
 }
 
-bool cmp_object_as_ulong(const cmp_object_t *obj, uint64_t *u) {
-  switch (obj->type) {
-    case CMP_TYPE_POSITIVE_FIXNUM:
-    case CMP_TYPE_UINT8:
-      *u = obj->as.u8;
-      return true;
-    case CMP_TYPE_UINT16:
-      *u = obj->as.u16;
-      return true;
-    case CMP_TYPE_UINT32:
-      *u = obj->as.u32;
-      return true;
-    case CMP_TYPE_UINT64:
-      *u = obj->as.u64;
-      return true;
-    default:
-        return false;
+/*
+ * Adds a string to the table if there's room and it's long enough to be worth
+ * a reference.  Writers and readers both follow this rule, so they always
+ * agree on every string's index.
+ */
+static void add_table_str(cmp_strings_t *strings, const char *data,
+                                                  uint32_t size,
+                                                  uint32_t slot) {
+  if (size < CMP_STRINGS_MIN_SIZE || strings->count >= CMP_STRINGS_MAX_COUNT)
+    return;
+
+  strings->strings[strings->count] = data;
+  strings->sizes[strings->count] = size;
+  strings->count++;
+  strings->table[slot] = (uint16_t)strings->count;
+}
+
+/* Finds a string's table slot: either the one holding it or an empty one */
+static uint32_t find_table_slot(const cmp_strings_t *strings,
+                                const char *data,
+                                uint32_t size) {
+  uint32_t mask = (sizeof(strings->table) / sizeof(strings->table[0])) - 1;
+  uint32_t slot = hash_key(data, size, 0) & mask;
+  uint16_t index;
+
+  /* The table is never more than half full, so there's always an empty slot */
+  while ((index = strings->table[slot]) != 0) {
+    if (strings->sizes[index - 1] == size &&
+        memcmp(strings->strings[index - 1], data, size) == 0) {
+      break;
+    }
+
+    slot = (slot + 1) & mask;
   }
-}
 
-bool cmp_object_as_uinteger(const cmp_object_t *obj, uint64_t *u) {
-  return cmp_object_as_ulong(obj, u);
+  return slot;
 }
 
-#ifndef CMP_NO_FLOAT
-bool cmp_object_as_float(const cmp_object_t *obj, float *f) {
-  if (obj->type == CMP_TYPE_FLOAT) {
-    *f = obj->as.flt;
-    return true;
+bool cmp_write_table_str(cmp_ctx_t *ctx, cmp_strings_t *strings,
+                                         const char *data,
+                                         uint32_t size) {
+  uint8_t ref;
+  uint32_t slot;
+  uint16_t index;
+
+  if (size < CMP_STRINGS_MIN_SIZE)
+    return cmp_write_str(ctx, data, size);
+
+  slot = find_table_slot(strings, data, size);
+  index = strings->table[slot];
+
+  if (index) {
+    ref = (uint8_t)(index - 1);
+    return cmp_write_fixext1(ctx, strings->ext_type, &ref);
   }
 
-  return false;
+  if (!cmp_write_str(ctx, data, size))
+    return false;
+
+  add_table_str(strings, data, size, slot);
+  return true;
 }
 
-bool cmp_object_as_double(const cmp_object_t *obj, double *d) {
-  if (obj->type == CMP_TYPE_DOUBLE) {
-    *d = obj->as.dbl;
-    return true;
+bool cmp_match_table_str(cmp_ctx_t *ctx, cmp_strings_t *strings,
+                                         const cmp_object_t *obj,
+                                         const char **data,
+                                         uint32_t *size) {
+  const void *view = NULL;
+  uint8_t ref;
+
+  /* Only a memory context's bytes stay put for as long as the table is used */
+  if (ctx->read != mem_reader) {
+    ctx->error = CMP_ERROR_MEMORY_CONTEXT_REQUIRED;
+    return false;
   }
 
-  return false;
-}
-#endif /* CMP_NO_FLOAT */
+  if (cmp_object_is_str(obj)) {
+    if (!acquire_bytes(ctx, &view, obj->as.str_size))
+      return false;
 
-bool cmp_object_as_bool(const cmp_object_t *obj, bool *b) {
-  if (obj->type == CMP_TYPE_BOOLEAN) {
-    if (obj->as.boolean)
-      *b = true;
-    else
-      *b = false;
+    *data = (const char *)view;
+    *size = obj->as.str_size;
+
+    /* Inline strings are new to the table, unless it's full or they're short */
+    if (*size >= CMP_STRINGS_MIN_SIZE &&
+        strings->count < CMP_STRINGS_MAX_COUNT) {
+      add_table_str(
+        strings, *data, *size, find_table_slot(strings, *data, *size)
+      );
+    }
 
     return true;
   }
 
-  return false;
-}
+  if (obj->type != CMP_TYPE_FIXEXT1 ||
+      obj->as.ext.type != strings->ext_type) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
 
-bool cmp_object_as_str(const cmp_object_t *obj, uint32_t *size) {
-  switch (obj->type) {
-    case CMP_TYPE_FIXSTR:
-    case CMP_TYPE_STR8:
-    case CMP_TYPE_STR16:
-    case CMP_TYPE_STR32:
-      *size = obj->as.str_size;
-      return true;
-    default:
-        return false;
+  if (!read_byte(ctx, &ref)) {
+    ctx->error = CMP_ERROR_DATA_READING;
+    return false;
   }
-}
 
-bool cmp_object_as_bin(const cmp_object_t *obj, uint32_t *size) {
-  switch (obj->type) {
-    case CMP_TYPE_BIN8:
-    case CMP_TYPE_BIN16:
-    case CMP_TYPE_BIN32:
-      *size = obj->as.bin_size;
-      return true;
-    default:
-        return false;
+  if (ref >= strings->count) {
+    ctx->error = CMP_ERROR_INVALID_STRING_REF;
+    return false;
   }
+
+  *data = strings->strings[ref];
+  *size = strings->sizes[ref];
+  return true;
 }
 
-bool cmp_object_as_array(const cmp_object_t *obj, uint32_t *size) {
-  switch (obj->type) {
-    case CMP_TYPE_FIXARRAY:
-    case CMP_TYPE_ARRAY16:
-    case CMP_TYPE_ARRAY32:
-      *size = obj->as.array_size;
-      return true;
-    default:
-        return false;
-  }
+bool cmp_read_table_str(cmp_ctx_t *ctx, cmp_strings_t *strings,
+                                        const char **data,
+                                        uint32_t *size) {
+  cmp_object_t obj;
+
+  if (!cmp_read_object(ctx, &obj))
+    return false;
+
+  return cmp_match_table_str(ctx, strings, &obj, data, size);
 }
 
-bool cmp_object_as_map(const cmp_object_t *obj, uint32_t *size) {
-  switch (obj->type) {
-    case CMP_TYPE_FIXMAP:
-    case CMP_TYPE_MAP16:
-    case CMP_TYPE_MAP32:
-      *size = obj->as.map_size;
-      return true;
-    default:
-        return false;
+bool cmp_write_timestamp(cmp_ctx_t *ctx, int64_t seconds,
+                                        uint32_t nanoseconds) {
+  uint8_t buf[3 + 12];
+  uint64_t data64;
+
+  if (nanoseconds > CMP_TIMESTAMP_MAX_NANOSECONDS) {
+    ctx->error = CMP_ERROR_INVALID_TIMESTAMP;
+    return false;
+  }
+
+  /* Negative seconds have their top bits set, so they fall through to 96 */
+  if (((uint64_t)seconds >> 34) == 0) {
+    data64 = ((uint64_t)nanoseconds << 34) | (uint64_t)seconds;
+
+    if ((data64 >> 32) == 0) {
+      buf[0] = FIXEXT4_MARKER;
+      buf[1] = (uint8_t)CMP_TIMESTAMP_EXT_TYPE;
+      store_be32(buf + 2, (uint32_t)data64);
+      return write_encoded(ctx, buf, 2 + 4, CMP_ERROR_EXT_TYPE_WRITING);
+    }
+
+    buf[0] = FIXEXT8_MARKER;
+    buf[1] = (uint8_t)CMP_TIMESTAMP_EXT_TYPE;
+    store_be64(buf + 2, data64);
+    return write_encoded(ctx, buf, 2 + 8, CMP_ERROR_EXT_TYPE_WRITING);
   }
+
+  buf[0] = EXT8_MARKER;
+  buf[1] = 12;
+  buf[2] = (uint8_t)CMP_TIMESTAMP_EXT_TYPE;
+  store_be32(buf + 3, nanoseconds);
+  store_be64(buf + 7, (uint64_t)seconds);
+  return write_encoded(ctx, buf, 3 + 12, CMP_ERROR_EXT_TYPE_WRITING);
 }
 
-bool cmp_object_as_ext(const cmp_object_t *obj, int8_t *type, uint32_t *size) {
-  switch (obj->type) {
-    case CMP_TYPE_FIXEXT1:
-    case CMP_TYPE_FIXEXT2:
-    case CMP_TYPE_FIXEXT4:
-    case CMP_TYPE_FIXEXT8:
-    case CMP_TYPE_FIXEXT16:
-    case CMP_TYPE_EXT8:
-    case CMP_TYPE_EXT16:
-    case CMP_TYPE_EXT32:
-      *type = obj->as.ext.type;
-      *size = obj->as.ext.size;
+bool cmp_object_is_timestamp(const cmp_object_t *obj) {
+  if (!cmp_object_is_ext(obj) || obj->as.ext.type != CMP_TIMESTAMP_EXT_TYPE)
+    return false;
+
+  switch (obj->as.ext.size) {
+    case 4:
+    case 8:
+    case 12:
       return true;
     default:
-        return false;
+      return false;
   }
 }
 
-bool cmp_object_to_str(cmp_ctx_t *ctx, const cmp_object_t *obj, char *data,
-                                                          uint32_t buf_size) {
-  uint32_t str_size = 0;
+bool cmp_object_to_timestamp(cmp_ctx_t *ctx, const cmp_object_t *obj,
+                                             int64_t *seconds,
+                                             uint32_t *nanoseconds) {
+  uint8_t data[12];
+  uint64_t data64;
+  uint32_t nsec;
 
-  switch (obj->type) {
-    case CMP_TYPE_FIXSTR:
-    case CMP_TYPE_STR8:
-    case CMP_TYPE_STR16:
-    case CMP_TYPE_STR32:
-      str_size = obj->as.str_size;
-      if (str_size >= buf_size) {
-        ctx->error = CMP_ERROR_STR_DATA_LENGTH_TOO_LONG;
-        return false;
-      }
+  if (!cmp_object_is_timestamp(obj)) {
+    ctx->error = CMP_ERROR_INVALID_TYPE;
+    return false;
+  }
 
-      if (!ctx->read(ctx, data, str_size)) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
+  if (!read_bytes(ctx, data, obj->as.ext.size)) {
+    ctx->error = CMP_ERROR_DATA_READING;
+    return false;
+  }
 
-      data[str_size] = 0;
-      return true;
-    default:
-      return false;
+  if (obj->as.ext.size == 4) {
+    *seconds = (int64_t)load_be32(data);
+    *nanoseconds = 0;
+    return true;
   }
+
+  if (obj->as.ext.size == 8) {
+    data64 = load_be64(data);
+    nsec = (uint32_t)(data64 >> 34);
+    *seconds = (int64_t)(data64 & UINT64_C(0x3FFFFFFFF));
+  }
+  else {
+    nsec = load_be32(data);
+    *seconds = (int64_t)load_be64(data + 4);
+  }
+
+  if (nsec > CMP_TIMESTAMP_MAX_NANOSECONDS) {
+    ctx->error = CMP_ERROR_INVALID_TIMESTAMP;
+    return false;
+  }
+
+  *nanoseconds = nsec;
+  return true;
 }
 
-bool cmp_object_to_bin(cmp_ctx_t *ctx, const cmp_object_t *obj, void *data,
-                                                          uint32_t buf_size) {
-  uint32_t bin_size = 0;
+bool cmp_read_timestamp(cmp_ctx_t *ctx, int64_t *seconds,
+                                       uint32_t *nanoseconds) {
+  cmp_object_t obj;
 
-  switch (obj->type) {
-    case CMP_TYPE_BIN8:
-    case CMP_TYPE_BIN16:
-    case CMP_TYPE_BIN32:
-      bin_size = obj->as.bin_size;
-      if (bin_size > buf_size) {
-        ctx->error = CMP_ERROR_BIN_DATA_LENGTH_TOO_LONG;
-        return false;
-      }
+  if (!cmp_read_object(ctx, &obj))
+    return false;
 
-      if (!ctx->read(ctx, data, bin_size)) {
-        ctx->error = CMP_ERROR_DATA_READING;
-        return false;
-      }
-      return true;
-    default:
-      return false;
-  }
+  return cmp_object_to_timestamp(ctx, &obj, seconds, nanoseconds);
 }
 
 /* vi: set et ts=2 sw=2: */
-
@@ -30,11 +30,20 @@ THE SOFTWARE.
 #include <stdint.h>
 
 struct cmp_ctx_s;
+struct cmp_object_s;
 
 typedef bool   (*cmp_reader)(struct cmp_ctx_s *ctx, void *data, size_t limit);
 typedef bool   (*cmp_skipper)(struct cmp_ctx_s *ctx, size_t count);
 typedef size_t (*cmp_writer)(struct cmp_ctx_s *ctx, const void *data,
                                                     size_t count);
+typedef bool   (*cmp_acquirer)(struct cmp_ctx_s *ctx, const void **data,
+                                                      size_t count);
+typedef size_t (*cmp_filler)(struct cmp_ctx_s *ctx, void *data,
+                                                    size_t limit);
+typedef bool   (*cmp_record_handler)(struct cmp_ctx_s *ctx, void *data);
+typedef bool   (*cmp_path_handler)(struct cmp_ctx_s *ctx,
+                                   const struct cmp_object_s *obj,
+                                   void *data);
 
 enum {
   CMP_TYPE_POSITIVE_FIXNUM, /*  0 */
@@ -106,6 +115,9 @@ typedef struct cmp_ctx_s {
   cmp_reader   read;
   cmp_skipper  skip;
   cmp_writer   write;
+  cmp_acquirer acquire;
+  size_t       buf_size; /* Only used by the memory backend */
+  size_t       buf_pos;  /* Only used by the memory backend */
 } cmp_ctx_t;
 
 typedef struct cmp_object_s {
@@ -113,6 +125,195 @@ typedef struct cmp_object_s {
   union cmp_object_data_u as;
 } cmp_object_t;
 
+/* State for a buffered context; its members are private */
+typedef struct cmp_buffered_s {
+  cmp_ctx_t   backend;
+  cmp_filler  fill;
+  uint8_t    *data;
+  size_t      capacity;
+  size_t      pos;
+  size_t      end;
+} cmp_buffered_t;
+
+/*
+ * One object in a tape (see `cmp_build_tape`):
+ * - type:   the object's CMP type
+ * - offset: where the object's marker is in the buffer
+ * - length: how many bytes the object takes up, including everything in it
+ * - size:   the length of a str, bin or ext, or the size of an array or map
+ * - next:   the index of the first entry after the object and everything in
+ *           it, i.e. of its next sibling
+ */
+typedef struct cmp_tape_entry_s {
+  uint8_t  type;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t size;
+  uint32_t next;
+} cmp_tape_entry_t;
+
+/* A handle to an object in an encoded buffer; its members are private */
+typedef struct cmp_node_s {
+  const void *data;
+  size_t      size;
+  size_t      offset;
+} cmp_node_t;
+
+/* State for iterating over an array or map; its members are private */
+typedef struct cmp_node_iter_s {
+  cmp_node_t node;
+  uint32_t   remaining;
+  bool       started;
+} cmp_node_iter_t;
+
+/* A run of whole records in a memory buffer (see `cmp_partition_records`) */
+typedef struct cmp_chunk_s {
+  size_t offset;
+  size_t size;
+} cmp_chunk_t;
+
+enum {
+  CMP_INDEX_HEADER_SIZE = 20
+};
+
+/* An opened record index; its members are private */
+typedef struct cmp_index_s {
+  const uint8_t *entries;
+  uint64_t       record_count;
+  uint64_t       entry_count;
+  uint32_t       stride;
+} cmp_index_t;
+
+enum {
+  CMP_STRINGS_MAX_COUNT = 256,
+  CMP_STRINGS_MIN_SIZE  = 3
+};
+
+/* A per-stream table of repeated strings; its members are private */
+typedef struct cmp_strings_s {
+  const char *strings[CMP_STRINGS_MAX_COUNT];
+  uint32_t    sizes[CMP_STRINGS_MAX_COUNT];
+  uint16_t    table[CMP_STRINGS_MAX_COUNT * 2];
+  uint16_t    count;
+  int8_t      ext_type;
+} cmp_strings_t;
+
+/* Scratch space for sorting map keys; its members are private */
+typedef struct cmp_map_entry_s {
+  const uint8_t *payload;
+  size_t         value_pos;
+  uint32_t       payload_size;
+  uint8_t        header[9];
+  uint8_t        header_size;
+} cmp_map_entry_t;
+
+/* Encoded elements of an array (see `cmp_write_array_segments`) */
+typedef struct cmp_segment_s {
+  const void *data;
+  size_t      size;
+} cmp_segment_t;
+
+enum {
+  CMP_KEYS_MAX_COUNT    = 32,
+  CMP_KEYS_MAX_KEY_SIZE = 64,
+  CMP_KEY_UNKNOWN       = 0xFF
+};
+
+/* A compiled set of map keys; its members are private */
+typedef struct cmp_keys_s {
+  const char *const *keys;
+  size_t             stride;
+  uint8_t            count;
+  uint8_t            max_key_size;
+  uint8_t            mask;
+  uint32_t           seed;
+  uint8_t            key_sizes[CMP_KEYS_MAX_COUNT];
+  uint8_t            table[CMP_KEYS_MAX_COUNT * 4];
+} cmp_keys_t;
+
+enum {
+  CMP_FIELD_BOOL,
+  CMP_FIELD_CHAR,
+  CMP_FIELD_SHORT,
+  CMP_FIELD_INT,
+  CMP_FIELD_LONG,
+  CMP_FIELD_UCHAR,
+  CMP_FIELD_USHORT,
+  CMP_FIELD_UINT,
+  CMP_FIELD_ULONG,
+  CMP_FIELD_FLOAT,
+  CMP_FIELD_DOUBLE,
+  CMP_FIELD_STR
+};
+
+enum {
+  CMP_SCHEMA_MAX_FIELDS   = CMP_KEYS_MAX_COUNT,
+  CMP_SCHEMA_MAX_KEY_SIZE = CMP_KEYS_MAX_KEY_SIZE
+};
+
+/*
+ * Describes a member of a C struct (see `cmp_schema_init`):
+ * - key:    the map key it's stored under
+ * - offset: its `offsetof` in the struct
+ * - type:   one of the CMP_FIELD_* types
+ * - bound:  for CMP_FIELD_STR, the size of its char array
+ */
+typedef struct cmp_field_s {
+  const char *key;
+  size_t      offset;
+  uint8_t     type;
+  uint32_t    bound;
+} cmp_field_t;
+
+/* A compiled set of fields; its members are private */
+typedef struct cmp_schema_s {
+  const cmp_field_t *fields;
+  cmp_keys_t         keys;
+} cmp_schema_t;
+
+/* A step of a compiled path; its members are private */
+typedef struct cmp_path_step_s {
+  uint8_t     kind;
+  const char *key;
+  uint32_t    key_size;
+  uint32_t    index;
+} cmp_path_step_t;
+
+/*
+ * An encoder stages up to CMP_ENCODER_STASH_SIZE bytes of plain writes the
+ * backend didn't take, plus one CMP_ENCODER_BLOCK_SIZE block of array elements
+ */
+enum {
+  CMP_ENCODER_STASH_SIZE = 40,
+  CMP_ENCODER_BLOCK_SIZE = 256
+};
+
+/* State for a resumable encoder; its members are private */
+typedef struct cmp_encoder_s {
+  cmp_ctx_t      backend;
+  uint8_t        staged[CMP_ENCODER_STASH_SIZE + CMP_ENCODER_BLOCK_SIZE];
+  size_t         staged_pos;
+  size_t         staged_end;
+  const uint8_t *payload;
+  size_t         payload_size;
+} cmp_encoder_t;
+
+enum {
+  CMP_DECODER_NEED_MORE,
+  CMP_DECODER_OBJECT,
+  CMP_DECODER_PAYLOAD,
+  CMP_DECODER_ERROR
+};
+
+/* State for an incremental decoder; its members are private */
+typedef struct cmp_decoder_s {
+  uint8_t  error;
+  uint8_t  header[9];
+  uint8_t  header_size;
+  uint8_t  header_pos;
+  uint32_t payload_left;
+} cmp_decoder_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -138,6 +339,128 @@ void cmp_init(cmp_ctx_t *ctx, void *buf, cmp_reader read,
                                          cmp_skipper skip,
                                          cmp_writer write);
 
+/*
+ * Zero-copy reads
+ *
+ * Backends that hold their data in contiguous memory can let CMP hand out
+ * pointers into that memory instead of copying it.  To do so, set
+ * `ctx->acquire` after calling `cmp_init`.  An acquirer must point `*data` at
+ * the next `count` bytes, advance past them and return true, or return false
+ * if `count` contiguous bytes aren't available.  The pointer must stay valid
+ * at least until the next read from the context.
+ *
+ * Memory contexts (see `cmp_init_mem`) always support zero-copy reads, and
+ * their pointers stay valid as long as the buffer does.
+ */
+
+/*
+ * Initializes a CMP context that reads from and writes to the `size` bytes of
+ * memory at `buf`.  Reads and writes start at the beginning of the buffer and
+ * advance a cursor; reading or writing past the end of the buffer fails.
+ *
+ * All reads and writes on a memory context work directly on the buffer rather
+ * than calling through `read`/`write` function pointers, so this is the
+ * fastest backend CMP offers.  Use it whenever your data is already in memory.
+ */
+void cmp_init_mem(cmp_ctx_t *ctx, void *buf, size_t size);
+
+/*
+ * Like `cmp_init_mem`, but for read-only data.  All `*write*` functions will
+ * fail on a context initialized this way.
+ */
+void cmp_init_mem_reader(cmp_ctx_t *ctx, const void *buf, size_t size);
+
+/*
+ * Returns the position of a memory context's cursor, i.e. the number of bytes
+ * read or written so far
+ */
+size_t cmp_mem_tell(const cmp_ctx_t *ctx);
+
+/*
+ * Moves a memory context's cursor to `pos`.  Fails if `pos` is past the end of
+ * the buffer.
+ */
+bool cmp_mem_seek(cmp_ctx_t *ctx, size_t pos);
+
+/*
+ * Buffered contexts
+ *
+ * Callback backends are called once for every marker and field CMP reads or
+ * writes, which is slow when each call costs a system call or a lock.  A
+ * buffered context sits between CMP and such a backend and stages reads and
+ * writes in the `capacity` bytes at `data`, so the backend only sees a few
+ * large calls.  `buffered` holds the context's state; it and `data` must
+ * outlive the context.  In both cases `buf` is passed to the backend as its
+ * context's `buf`, just as with `cmp_init`.
+ */
+
+/*
+ * Initializes a buffered context for reading.  To read ahead, CMP needs to be
+ * able to ask for more bytes than it wants right now, so instead of a
+ * `cmp_reader` this takes a `fill` function that works like `fread`: it reads
+ * at most `limit` bytes into `data` and returns how many it read, returning 0
+ * only at the end of the input or on error.  `skip` may be NULL, in which case
+ * skipped data is read and discarded.
+ *
+ * Buffered readers support zero-copy reads of data up to `capacity` bytes
+ * long.
+ */
+void cmp_init_buffered_reader(cmp_ctx_t *ctx, cmp_buffered_t *buffered,
+                                              void *buf,
+                                              cmp_filler fill,
+                                              cmp_skipper skip,
+                                              void *data,
+                                              size_t capacity);
+
+/*
+ * Initializes a buffered context for writing.  Writes are staged until the
+ * buffer fills up, and then passed to `write` all at once; writes larger than
+ * the buffer go straight through.  Call `cmp_buffered_flush` once you've
+ * finished writing.
+ */
+void cmp_init_buffered_writer(cmp_ctx_t *ctx, cmp_buffered_t *buffered,
+                                              void *buf,
+                                              cmp_writer write,
+                                              void *data,
+                                              size_t capacity);
+
+/*
+ * Passes everything a buffered writer has staged to its backend.  Does
+ * nothing on other contexts.
+ */
+bool cmp_buffered_flush(cmp_ctx_t *ctx);
+
+/*
+ * Resumable encoders
+ *
+ * A resumable encoder lets you write to a backend that can't always take
+ * everything it's given, like a non-blocking socket.  Its `write` may write
+ * fewer bytes than it was asked to (including none at all); rather than
+ * failing, the writing function succeeds and the encoder holds on to the rest.
+ * Check `cmp_encoder_pending` after each write, and while it isn't 0, wait
+ * until the backend is ready and call `cmp_encoder_resume`.  Writing another
+ * value while data is pending may fail.
+ *
+ * Pending data is copied into the encoder, except for the data of strings,
+ * binary data and extensions larger than 32 bytes, which is written straight
+ * from your buffer: keep it around until nothing is pending.
+ *
+ * Functions that write many values at once (typed arrays, structs, JSON) keep
+ * writing for as long as the backend takes some of what it's given, and fail
+ * if it stops taking anything with more pending than the encoder can copy.
+ */
+void cmp_init_encoder(cmp_ctx_t *ctx, cmp_encoder_t *encoder, void *buf,
+                                                            cmp_writer write);
+
+/* Returns the number of bytes an encoder hasn't passed to its backend yet */
+size_t cmp_encoder_pending(const cmp_ctx_t *ctx);
+
+/*
+ * Passes as much pending data as the backend will take to it, and returns the
+ * number of bytes still pending.  Does nothing on other contexts.
+ */
+size_t cmp_encoder_resume(cmp_ctx_t *ctx);
+
 /* Returns CMP's version */
 uint32_t cmp_version(void);
 
@@ -223,6 +546,24 @@ bool cmp_write_array(cmp_ctx_t *ctx, uint32_t size);
 /* Writes a map to the backend. */
 bool cmp_write_map(cmp_ctx_t *ctx, uint32_t size);
 
+/*
+ * Writes an array of numbers from a C array.  Every element is written with
+ * the narrowest encoding that fits all of them, so the array can be read back
+ * in bulk; `cmp_write_double_array` writes floats if every element is exactly
+ * representable as one.
+ */
+bool cmp_write_int_array(cmp_ctx_t *ctx, const int32_t *data, uint32_t size);
+bool cmp_write_long_array(cmp_ctx_t *ctx, const int64_t *data, uint32_t size);
+bool cmp_write_uint_array(cmp_ctx_t *ctx, const uint32_t *data,
+                                          uint32_t size);
+bool cmp_write_ulong_array(cmp_ctx_t *ctx, const uint64_t *data,
+                                           uint32_t size);
+#ifndef CMP_NO_FLOAT
+bool cmp_write_float_array(cmp_ctx_t *ctx, const float *data, uint32_t size);
+bool cmp_write_double_array(cmp_ctx_t *ctx, const double *data,
+                                            uint32_t size);
+#endif /* CMP_NO_FLOAT */
+
 /* Writes an extended type to the backend */
 bool cmp_write_ext(cmp_ctx_t *ctx, int8_t type, uint32_t size,
                                    const void *data);
@@ -243,6 +584,45 @@ bool cmp_write_object(cmp_ctx_t *ctx, const cmp_object_t *obj);
  */
 bool cmp_write_object_v4(cmp_ctx_t *ctx, const cmp_object_t *obj);
 
+/*
+ * Encoded sizes
+ *
+ * These return the number of bytes the matching writing function would write,
+ * without writing anything, so you can size an output buffer exactly before
+ * you start.  The `_marker` variants only count the marker and size fields;
+ * the others include `size` bytes of data as well.
+ */
+size_t cmp_sizeof_integer(int64_t d);
+size_t cmp_sizeof_uinteger(uint64_t u);
+#ifndef CMP_NO_FLOAT
+size_t cmp_sizeof_decimal(double d);
+#endif /* CMP_NO_FLOAT */
+size_t cmp_sizeof_str(uint32_t size);
+size_t cmp_sizeof_str_v4(uint32_t size);
+size_t cmp_sizeof_str_marker(uint32_t size);
+size_t cmp_sizeof_str_marker_v4(uint32_t size);
+size_t cmp_sizeof_bin(uint32_t size);
+size_t cmp_sizeof_bin_marker(uint32_t size);
+size_t cmp_sizeof_array(uint32_t size);
+size_t cmp_sizeof_map(uint32_t size);
+size_t cmp_sizeof_ext(uint32_t size);
+size_t cmp_sizeof_ext_marker(uint32_t size);
+
+/*
+ * Returns the number of bytes `cmp_write_object` (or `cmp_write_object_v4`)
+ * would write for `obj`, or 0 if it would fail.  Like those functions, this
+ * doesn't count the data following a string, binary or extension marker.
+ */
+size_t cmp_sizeof_object(const cmp_object_t *obj);
+size_t cmp_sizeof_object_v4(const cmp_object_t *obj);
+
+/*
+ * Reading functions decode straight into their output arguments.  If a call
+ * fails, the contents of its output arguments are undefined (they may have
+ * been partially written), as is the position of the backend; check the
+ * return value before using them, and don't assume you can retry the read.
+ */
+
 /* Reads a signed integer that fits inside a signed char */
 bool cmp_read_char(cmp_ctx_t *ctx, int8_t *c);
 
@@ -314,12 +694,49 @@ bool cmp_read_array(cmp_ctx_t *ctx, uint32_t *size);
 /* Reads a map from the backend */
 bool cmp_read_map(cmp_ctx_t *ctx, uint32_t *size);
 
+/*
+ * Reads an array of numbers into a C array with room for `*size` elements,
+ * and sets `*size` to the number of elements read.  Each element is read as
+ * it would be by the matching single-value reader (`cmp_read_double_array`
+ * accepts floats, like `cmp_read_decimal`).  On memory contexts, runs of
+ * elements that share an encoding are decoded in bulk.
+ */
+bool cmp_read_int_array(cmp_ctx_t *ctx, int32_t *data, uint32_t *size);
+bool cmp_read_long_array(cmp_ctx_t *ctx, int64_t *data, uint32_t *size);
+bool cmp_read_uint_array(cmp_ctx_t *ctx, uint32_t *data, uint32_t *size);
+bool cmp_read_ulong_array(cmp_ctx_t *ctx, uint64_t *data, uint32_t *size);
+#ifndef CMP_NO_FLOAT
+bool cmp_read_float_array(cmp_ctx_t *ctx, float *data, uint32_t *size);
+bool cmp_read_double_array(cmp_ctx_t *ctx, double *data, uint32_t *size);
+#endif /* CMP_NO_FLOAT */
+
 /* Reads the extended type's marker from the backend */
 bool cmp_read_ext_marker(cmp_ctx_t *ctx, int8_t *type, uint32_t *size);
 
 /* Reads an extended type from the backend */
 bool cmp_read_ext(cmp_ctx_t *ctx, int8_t *type, uint32_t *size, void *data);
 
+/*
+ * Reads a string from the backend without copying it.  `*data` is pointed at
+ * the string's bytes inside the backend and `*size` is set to their length.
+ * The string is NOT null-terminated.  This requires a backend that supports
+ * zero-copy reads.
+ */
+bool cmp_read_str_view(cmp_ctx_t *ctx, const char **data, uint32_t *size);
+
+/*
+ * Reads packed binary data from the backend without copying it.  This
+ * requires a backend that supports zero-copy reads.
+ */
+bool cmp_read_bin_view(cmp_ctx_t *ctx, const void **data, uint32_t *size);
+
+/*
+ * Reads an extended type from the backend without copying its data.  This
+ * requires a backend that supports zero-copy reads.
+ */
+bool cmp_read_ext_view(cmp_ctx_t *ctx, int8_t *type, uint32_t *size,
+                                                     const void **data);
+
 /* Reads an object from the backend */
 bool cmp_read_object(cmp_ctx_t *ctx, cmp_object_t *obj);
 
@@ -335,6 +752,13 @@ bool cmp_read_object(cmp_ctx_t *ctx, cmp_object_t *obj);
  */
 bool cmp_skip_object(cmp_ctx_t *ctx, cmp_object_t *obj);
 
+/*
+ * Skips the rest of an object that has just been read with `cmp_read_object`:
+ * the data of a str, bin or ext, or the elements of an array or map.  Does
+ * nothing for other objects.
+ */
+bool cmp_skip_object_rest(cmp_ctx_t *ctx, const cmp_object_t *obj);
+
 /*
  * This is similar to `cmp_skip_object`, except it tolerates flat arrays and
  * maps.  If when skipping such an array or map this function encounters
@@ -550,6 +974,602 @@ bool cmp_object_as_ext(const cmp_object_t *obj, int8_t *type, uint32_t *size);
 bool cmp_object_to_str(cmp_ctx_t *ctx, const cmp_object_t *obj, char *data, uint32_t buf_size);
 bool cmp_object_to_bin(cmp_ctx_t *ctx, const cmp_object_t *obj, void *data, uint32_t buf_size);
 
+/*
+ * Like `cmp_object_to_str` and `cmp_object_to_bin`, but they point `*data` at
+ * the object's data inside the backend instead of copying it.  Strings are
+ * NOT null-terminated; their length is in the object.  These require a
+ * backend that supports zero-copy reads.
+ */
+bool cmp_object_to_str_view(cmp_ctx_t *ctx, const cmp_object_t *obj,
+                                            const char **data);
+bool cmp_object_to_bin_view(cmp_ctx_t *ctx, const cmp_object_t *obj,
+                                            const void **data);
+
+/*
+ * ============================================================================
+ * === Incremental Decoding API
+ * ============================================================================
+ */
+
+/*
+ * The decoder parses data as it arrives, instead of needing whole messages up
+ * front: feed it whatever bytes you have, and when it runs out in the middle
+ * of an object it remembers where it was and asks for more.  It needs no
+ * backend and no buffer beyond the decoder itself.
+ */
+
+/* Initializes (or resets) a decoder */
+void cmp_decoder_init(cmp_decoder_t *decoder);
+
+/*
+ * Decodes from the `*size` bytes at `*data`, advancing both past whatever it
+ * consumes, and returns one of:
+ *
+ * - CMP_DECODER_OBJECT:    an object was decoded into `*obj`, exactly as
+ *                          `cmp_read_object` would have decoded it
+ * - CMP_DECODER_PAYLOAD:   `*payload` and `*payload_size` point at the next
+ *                          chunk of the data of the last str, bin or ext
+ *                          object; they point into the input, and the chunks
+ *                          add up to the size in the object
+ * - CMP_DECODER_NEED_MORE: all the input was consumed; call again with more
+ * - CMP_DECODER_ERROR:     the input isn't valid MessagePack; see
+ *                          `cmp_decoder_strerror`.  The decoder stays in this
+ *                          state until it's reinitialized.
+ *
+ * Call this in a loop until it returns CMP_DECODER_NEED_MORE.
+ */
+int cmp_decoder_next(cmp_decoder_t *decoder, const void **data,
+                                             size_t *size,
+                                             cmp_object_t *obj,
+                                             const void **payload,
+                                             size_t *payload_size);
+
+/*
+ * Returns true if the decoder is between objects, i.e. if the input so far
+ * ended on an object boundary
+ */
+bool cmp_decoder_is_idle(const cmp_decoder_t *decoder);
+
+/* Returns a string description of a decoder's error */
+const char* cmp_decoder_strerror(const cmp_decoder_t *decoder);
+
+/*
+ * ============================================================================
+ * === Tape API
+ * ============================================================================
+ */
+
+/*
+ * A tape is an index of an encoded buffer: one fixed-size entry per object,
+ * in the order they appear, with each container followed by its elements.
+ * Once it's built, any object in the buffer can be reached without parsing
+ * what comes before it.
+ */
+
+/*
+ * Indexes the next object in a memory context (and everything in it) into
+ * `tape`, which has room for `*size` entries, and sets `*size` to the number
+ * of entries used.  The context is left after the object.  Offsets are
+ * relative to the start of the buffer, which can't be larger than 4 GiB;
+ * larger buffers are rejected.
+ */
+bool cmp_build_tape(cmp_ctx_t *ctx, cmp_tape_entry_t *tape, uint32_t *size);
+
+/*
+ * Sets `*index` to the index of element `n` of the array or map at
+ * `container` (for maps, keys are even elements and values odd ones).  This
+ * takes constant time if the container holds no other containers, and
+ * otherwise skips one sibling per step.  Returns false if the entry isn't an
+ * array or map or `n` is out of range.
+ */
+bool cmp_tape_element(const cmp_tape_entry_t *tape, uint32_t container,
+                                                    uint32_t n,
+                                                    uint32_t *index);
+
+/*
+ * Moves a memory context to the object at `index`, so that it can be read
+ * with the usual reading functions
+ */
+bool cmp_tape_seek(cmp_ctx_t *ctx, const cmp_tape_entry_t *tape,
+                                   uint32_t index);
+
+/*
+ * ============================================================================
+ * === Document API
+ * ============================================================================
+ */
+
+/*
+ * Nodes let you navigate an encoded document in memory without decoding all
+ * of it: looking something up only decodes the headers on the way there, and
+ * skips over everything else.  Nodes point into your buffer, which has to
+ * outlive them.
+ *
+ * Functions that return a node return false if it doesn't exist or if the
+ * data on the way to it is malformed.
+ */
+
+/* Sets `*node` to the first object in `data` */
+bool cmp_node_root(cmp_node_t *node, const void *data, size_t size);
+
+/* Reads the object at a node, as `cmp_read_object` would */
+bool cmp_node_object(const cmp_node_t *node, cmp_object_t *obj);
+
+/*
+ * Initializes `ctx` as a memory reader positioned at a node, so that it can
+ * be read with the usual reading functions (including zero-copy ones)
+ */
+void cmp_node_reader(const cmp_node_t *node, cmp_ctx_t *ctx);
+
+/* Sets `*element` to element `index` of the array at `array` */
+bool cmp_node_element(const cmp_node_t *array, uint32_t index,
+                                               cmp_node_t *element);
+
+/*
+ * Sets `*value` to the value stored under the string key `key` in the map at
+ * `map`.  Keys that aren't strings are skipped.
+ */
+bool cmp_node_value(const cmp_node_t *map, const char *key, uint32_t key_size,
+                                                            cmp_node_t *value);
+
+/*
+ * Starts iterating over the elements of the array or map at `container`.
+ * Map elements alternate between keys and values.
+ */
+bool cmp_node_iterate(const cmp_node_t *container, cmp_node_iter_t *iter);
+
+/* Sets `*element` to the next element, or returns false if there are none */
+bool cmp_node_next(cmp_node_iter_t *iter, cmp_node_t *element);
+
+/*
+ * ============================================================================
+ * === Path API
+ * ============================================================================
+ */
+
+/*
+ * Paths pick values out of objects as they stream past, e.g.
+ * "users[*].address.city".  A path is a series of steps:
+ *
+ * - `key` or `.key`: the value under a string key in a map
+ * - `[N]`:           element N of an array
+ * - `[*]` or `.*`:   every element of an array, or every value in a map
+ *
+ * Keys can't contain '.' or '['.
+ */
+
+/*
+ * Compiles `path` into `steps`, which has room for `*count` steps, and sets
+ * `*count` to the number of steps used.  Returns false if the path is
+ * malformed or too long.  Steps point into `path`, which has to outlive them.
+ */
+bool cmp_path_compile(cmp_path_step_t *steps, uint32_t *count,
+                                              const char *path);
+
+/*
+ * Runs a compiled path against the next object in `ctx`, reading each match
+ * into an object and calling `handler` with it.  The handler has to consume
+ * the rest of the match (the data of a str, bin or ext, or the elements of an
+ * array or map), for instance with `cmp_object_to_str` or
+ * `cmp_skip_object_rest`, and returns false to stop early.  Everything that
+ * can't match is skipped without being decoded.
+ *
+ * Unless it's stopped early, this consumes the whole object, so it can be run
+ * on one record after another.  Returns false on a read error.
+ */
+bool cmp_path_execute(cmp_ctx_t *ctx, const cmp_path_step_t *steps,
+                                      uint32_t count,
+                                      cmp_path_handler handler,
+                                      void *data);
+
+/*
+ * ============================================================================
+ * === Key API
+ * ============================================================================
+ */
+
+/*
+ * Key dictionaries resolve the keys of a MessagePack map to small integer IDs
+ * without copying them out with `cmp_read_str` and comparing them one by one:
+ *
+ *   static const char *const names[] = { "id", "name", "email" };
+ *   cmp_keys_t keys;
+ *   uint8_t id;
+ *
+ *   cmp_keys_init(&keys, names, 3);
+ *
+ *   while (size--) {
+ *     if (!cmp_read_key(ctx, &keys, &id))
+ *       return false;
+ *
+ *     switch (id) {
+ *       case 0: ...read the ID...; break;
+ *       case 1: ...read the name...; break;
+ *       case 2: ...read the email...; break;
+ *       default: cmp_skip_object_no_limit(ctx); break;
+ *     }
+ *   }
+ */
+
+/*
+ * Compiles `count` keys (at most CMP_KEYS_MAX_COUNT, each no longer than
+ * CMP_KEYS_MAX_KEY_SIZE) into a dictionary.  This builds a perfect hash of the
+ * keys, so that looking a key up takes one hash and one comparison.  `names`
+ * has to outlive the dictionary.  Returns false if the keys are out of bounds
+ * or two of them are the same.
+ */
+bool cmp_keys_init(cmp_keys_t *keys, const char *const *names, uint8_t count);
+
+/*
+ * Reads a map key and sets `id` to its index in the dictionary, or to
+ * CMP_KEY_UNKNOWN if it isn't a string in the dictionary.  Either way the key
+ * is consumed, and the value that follows it is next.  When the backend can
+ * lend its data out (see "Zero-copy reads"), the key is hashed in place.
+ */
+bool cmp_read_key(cmp_ctx_t *ctx, const cmp_keys_t *keys, uint8_t *id);
+
+/*
+ * Like `cmp_read_key`, for a key whose object has already been read.
+ */
+bool cmp_match_key(cmp_ctx_t *ctx, const cmp_keys_t *keys,
+                                   const cmp_object_t *obj,
+                                   uint8_t *id);
+
+/*
+ * ============================================================================
+ * === Struct API
+ * ============================================================================
+ */
+
+/*
+ * Schemas map the keys of a MessagePack map to the members of a C struct, so
+ * the map can be read straight into the struct.  Each field's type picks the
+ * reading function used for it: CMP_FIELD_INT is read with `cmp_read_int`,
+ * CMP_FIELD_DOUBLE with `cmp_read_decimal`, CMP_FIELD_STR with `cmp_read_str`
+ * and so on.
+ */
+
+/*
+ * Compiles `field_count` fields (at most CMP_SCHEMA_MAX_FIELDS, with keys no
+ * longer than CMP_SCHEMA_MAX_KEY_SIZE) into a schema, building a key
+ * dictionary over their keys (see `cmp_keys_init`).  `fields` has to outlive
+ * the schema.  Returns false if the fields are out of bounds or two keys are
+ * the same.
+ */
+bool cmp_schema_init(cmp_schema_t *schema, const cmp_field_t *fields,
+                                           uint8_t field_count);
+
+/*
+ * Reads a map into the struct at `data`.  Keys that aren't in the schema are
+ * skipped, and members whose keys aren't in the map are left alone.
+ */
+bool cmp_read_struct(cmp_ctx_t *ctx, const cmp_schema_t *schema, void *data);
+
+/*
+ * Writes the struct at `data` as a map of every field in the schema, in the
+ * order they were given.  Integers take the narrowest encoding that holds
+ * them, as with `cmp_write_integer` and `cmp_write_uinteger`, doubles are
+ * written as floats when that loses nothing, and strings have to be
+ * terminated within their bound.  Fields are encoded into a block on the stack
+ * with their keys, so a small struct takes a single call to the writer.
+ */
+bool cmp_write_struct(cmp_ctx_t *ctx, const cmp_schema_t *schema,
+                                      const void *data);
+
+/*
+ * Writes the struct at `data` as an array of its field values, without keys.
+ */
+bool cmp_write_struct_array(cmp_ctx_t *ctx, const cmp_schema_t *schema,
+                                            const void *data);
+
+/*
+ * Returns how many bytes `cmp_write_struct` and `cmp_write_struct_array` would
+ * write for the struct at `data`, or 0 if it can't be written.
+ */
+size_t cmp_sizeof_struct(const cmp_schema_t *schema, const void *data);
+size_t cmp_sizeof_struct_array(const cmp_schema_t *schema, const void *data);
+
+/*
+ * ============================================================================
+ * === Record API
+ * ============================================================================
+ */
+
+/*
+ * Logs and other streams of back-to-back top-level objects ("records") can be
+ * processed in parallel once they're in memory.  Finding where records start
+ * takes one pass over the data that skips through them without decoding
+ * anything, and splits them into chunks.  Each chunk can then be handed to a
+ * thread of its own:
+ *
+ *   cmp_chunk_t chunks[THREAD_COUNT];
+ *   uint32_t chunk_count = THREAD_COUNT;
+ *
+ *   cmp_init_mem_reader(&cmp, data, size);
+ *   cmp_partition_records(&cmp, chunks, &chunk_count);
+ *
+ *   ...then on thread i, with a context of its own:
+ *
+ *   cmp_process_records(&thread_cmp, data, &chunks[i], handle_record, NULL);
+ *
+ * CMP doesn't start threads itself; use whatever your platform provides.
+ */
+
+/*
+ * Splits the records from a memory context's position to the end of its
+ * buffer into at most `count` (at least 1) chunks of about the same size,
+ * setting `count` to how many chunks there are.  Chunk offsets are from the
+ * start of the buffer.  Returns false if the context isn't a memory context or
+ * the buffer doesn't hold whole records.
+ */
+bool cmp_partition_records(cmp_ctx_t *ctx, cmp_chunk_t *chunks,
+                                           uint32_t *count);
+
+/*
+ * Calls `handler` once for each record in a chunk of `data`, with `ctx` set
+ * up as a read-only memory context over the chunk.  Handlers may read as much
+ * or as little of their record as they like (even none of it); the next call
+ * always starts at the next record.  Stops and returns false as soon as a
+ * handler does.
+ */
+bool cmp_process_records(cmp_ctx_t *ctx, const void *data,
+                                         const cmp_chunk_t *chunk,
+                                         cmp_record_handler handler,
+                                         void *handler_data);
+
+/*
+ * Large arrays can be encoded in parallel the other way around: split the
+ * elements into ranges, have each thread encode its range into a buffer of
+ * its own with a memory context (see `cmp_init_mem`), then stitch the
+ * segments together behind one array header.  The result is the same as
+ * writing every element through one context.
+ */
+
+/*
+ * Writes an array header for `size` elements, followed by the `count`
+ * segments holding them, in order.  Segments are handed to the writer as
+ * they are, one call each, without copying.  To gather them with `writev` or
+ * the like instead, write the header alone into a small memory context with
+ * `cmp_write_array` and send it as the first buffer.
+ */
+bool cmp_write_array_segments(cmp_ctx_t *ctx, uint32_t size,
+                                              const cmp_segment_t *segments,
+                                              uint32_t count);
+
+/*
+ * ============================================================================
+ * === Index API
+ * ============================================================================
+ */
+
+/*
+ * Record indexes save finding records over and over: scan a file of records
+ * once, write the offset of every record (or of every `stride`th record) to a
+ * sidecar file, and later map that file into memory to find record N, or the
+ * boundaries to split the file at, without skipping through what comes before
+ * it.  `examples/cmpindex.c` builds one for a file of records.
+ *
+ * An index is a MessagePack array: the stride, the number of records, and a
+ * bin of the offsets as big-endian 64-bit integers, one per `stride` records.
+ */
+
+/*
+ * Writes the CMP_INDEX_HEADER_SIZE-byte header of an index over
+ * `record_count` records, which must be followed by one entry (see
+ * `cmp_write_index_entry`) for each `stride` records.  Headers are always the
+ * same size, so when the count isn't known up front the header can be written
+ * with a count of 0 and rewritten once the entries are.
+ */
+bool cmp_write_index_header(cmp_ctx_t *ctx, uint32_t stride,
+                                            uint64_t record_count);
+
+/* Writes the offset of a record to an index */
+bool cmp_write_index_entry(cmp_ctx_t *ctx, uint64_t offset);
+
+/*
+ * Reads an index's header and points `index` at its entries, which have to
+ * stay where they are for as long as `index` is used.  The context has to
+ * support zero-copy reads (see "Zero-copy reads"); use a memory context over
+ * the index file's contents, or over a mapping of it.
+ */
+bool cmp_index_open(cmp_ctx_t *ctx, cmp_index_t *index);
+
+/*
+ * Finds record `n` (counting from 0): sets `offset` to where the last indexed
+ * record before it is, and `skip` to how many records lie between the two.
+ * Returns false if there's no record `n`.
+ */
+bool cmp_index_find(const cmp_index_t *index, uint64_t n, uint64_t *offset,
+                                                          uint32_t *skip);
+
+/*
+ * Moves a memory context over the indexed records to the start of record `n`.
+ */
+bool cmp_index_seek(cmp_ctx_t *ctx, const cmp_index_t *index, uint64_t n);
+
+/*
+ * ============================================================================
+ * === JSON API
+ * ============================================================================
+ */
+
+/*
+ * Reads one object from `in` and writes it to `out` as JSON text, without
+ * building it up in memory first.  Output goes through a block on the stack,
+ * so the writer sees a few large writes rather than one per token.
+ *
+ * - nil, booleans, integers and strings map to their JSON counterparts
+ * - floats and doubles are written with the fewest significant digits (of 6
+ *   to 9 and 15 to 17 respectively) that read back as the same value, and
+ *   NaN and infinity, which JSON lacks, as null
+ * - bin data is written as a base64 string, and ext data as an object:
+ *   {"type":1,"data":"<base64>"}
+ * - map keys that aren't strings are written as strings of their JSON text;
+ *   keys that are containers, bin or ext data are invalid
+ *
+ * Strings are passed through as they are, so they should hold valid UTF-8.
+ * Objects can be nested at most 64 deep.  On failure, the error is set on
+ * whichever context it happened on.
+ */
+bool cmp_write_json(cmp_ctx_t *in, cmp_ctx_t *out);
+
+/*
+ * Parses the `size` bytes of JSON text at `json` and writes the value they
+ * hold, without building it up in memory first.  Integers take the narrowest
+ * encoding that holds them, as with `cmp_write_integer` and
+ * `cmp_write_uinteger`; other numbers are written as with
+ * `cmp_write_decimal`, however long they are and whatever the C locale's
+ * decimal point is.  Numbers too large for a double are an error, and ones too
+ * small for one become 0.  Strings are unescaped, but otherwise passed through
+ * as they are.
+ *
+ * MessagePack headers hold the size of arrays and maps, so a quick first pass
+ * over the text finds them.  They're stored in `sizes`, which needs room for
+ * `count` of them, one for each array and map in the text.  Objects can be
+ * nested at most 64 deep, and on failure what was written so far is
+ * incomplete.
+ */
+bool cmp_write_from_json(cmp_ctx_t *ctx, const char *json, size_t size,
+                                                           uint32_t *sizes,
+                                                           uint32_t count);
+
+/*
+ * ============================================================================
+ * === Canonical API
+ * ============================================================================
+ */
+
+/*
+ * Re-encodes one object from a memory context canonically, so that equal
+ * values always come out as the same bytes, however they were encoded:
+ *
+ * - integers, strings, bin and ext data, arrays and maps take the narrowest
+ *   encodings that hold them, as `cmp_write_integer`, `cmp_write_str_marker`
+ *   and friends would pick
+ * - doubles that fit in a float without losing anything become floats
+ * - map entries are sorted by the bytes of their canonical keys
+ *
+ * Map keys can't be arrays or maps, and duplicate keys are an error.  Sorting
+ * takes one entry of scratch space per key: enough for the largest map, plus
+ * the largest map nested within each of its values, and so on.  Objects can
+ * be nested at most 64 deep.
+ */
+bool cmp_write_canonical(cmp_ctx_t *in, cmp_ctx_t *out,
+                                        cmp_map_entry_t *entries,
+                                        uint32_t count);
+
+/*
+ * ============================================================================
+ * === String Table API
+ * ============================================================================
+ */
+
+/*
+ * String tables shrink streams that repeat the same strings (map keys, say)
+ * over and over.  The first time a string is written it's written inline and
+ * added to the table; every time after that it's written as a reference to
+ * its place in the table, a 3-byte FIXEXT1 of the table's ext type.  Readers
+ * build the same table as they go, so writer and reader need one table each,
+ * initialized with the same ext type, for the whole stream:
+ *
+ *   cmp_strings_t strings;
+ *
+ *   cmp_strings_init(&strings, 1);
+ *
+ *   for (i = 0; i < record_count; i++) {
+ *     cmp_write_map(ctx, 2);
+ *     cmp_write_table_str(ctx, &strings, "timestamp", 9);
+ *     cmp_write_uinteger(ctx, records[i].timestamp);
+ *     cmp_write_table_str(ctx, &strings, "message", 7);
+ *     cmp_write_str(ctx, records[i].message, records[i].message_size);
+ *   }
+ *
+ * Every string written or read through the table counts, so both sides have
+ * to use it for the same strings in the same order.  The table holds the first
+ * CMP_STRINGS_MAX_COUNT strings of at least CMP_STRINGS_MIN_SIZE bytes; later
+ * ones are always written inline.  Shorter strings are always written inline
+ * too, because a reference wouldn't be any smaller.
+ */
+
+/*
+ * Empties a string table, and sets the ext type its references are written
+ * with.
+ */
+void cmp_strings_init(cmp_strings_t *strings, int8_t ext_type);
+
+/*
+ * Writes a string, as a reference if it's already in the table.  The table
+ * keeps pointers to the strings added to it rather than copies, so `data` has
+ * to outlive the table.
+ */
+bool cmp_write_table_str(cmp_ctx_t *ctx, cmp_strings_t *strings,
+                                         const char *data,
+                                         uint32_t size);
+
+/*
+ * Reads a string written with `cmp_write_table_str` without copying it,
+ * whether it was written inline or as a reference.  `*data` is pointed at the
+ * string's bytes inside the buffer and isn't null-terminated, so this only
+ * works with memory contexts, whose data stays put for as long as the table is
+ * in use.
+ */
+bool cmp_read_table_str(cmp_ctx_t *ctx, cmp_strings_t *strings,
+                                        const char **data,
+                                        uint32_t *size);
+
+/*
+ * Like `cmp_read_table_str`, for a string whose object has already been read.
+ */
+bool cmp_match_table_str(cmp_ctx_t *ctx, cmp_strings_t *strings,
+                                         const cmp_object_t *obj,
+                                         const char **data,
+                                         uint32_t *size);
+
+/*
+ * ============================================================================
+ * === Timestamp API
+ * ============================================================================
+ */
+
+enum {
+  CMP_TIMESTAMP_EXT_TYPE        = -1,
+  CMP_TIMESTAMP_MAX_NANOSECONDS = 999999999
+};
+
+/*
+ * Timestamps are MessagePack's predefined extension type -1: seconds since the
+ * Unix epoch, plus nanoseconds.
+ */
+
+/*
+ * Writes a timestamp in the smallest of its three forms that holds it: 32-bit
+ * seconds alone (FIXEXT4), 30-bit nanoseconds and 34-bit seconds (FIXEXT8),
+ * or 32-bit nanoseconds and signed 64-bit seconds (EXT8).  Nanoseconds must
+ * be below one billion.
+ */
+bool cmp_write_timestamp(cmp_ctx_t *ctx, int64_t seconds,
+                                        uint32_t nanoseconds);
+
+/*
+ * Reads a timestamp in any of its three forms.
+ */
+bool cmp_read_timestamp(cmp_ctx_t *ctx, int64_t *seconds,
+                                       uint32_t *nanoseconds);
+
+/*
+ * Returns true if an object is a timestamp, that is, an ext of type -1 with 4,
+ * 8 or 12 bytes of data.
+ */
+bool cmp_object_is_timestamp(const cmp_object_t *obj);
+
+/*
+ * Like `cmp_read_timestamp`, for a timestamp whose object has already been
+ * read.  This reads the ext's data, which is why it needs the context.
+ */
+bool cmp_object_to_timestamp(cmp_ctx_t *ctx, const cmp_object_t *obj,
+                                             int64_t *seconds,
+                                             uint32_t *nanoseconds);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
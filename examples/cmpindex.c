@@ -0,0 +1,162 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2020 Charles Gunyon
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/*
+ * Builds a sidecar index of the records in a file of back-to-back MessagePack
+ * objects:
+ *
+ *   cmpindex records.dat records.idx [stride]
+ *
+ * With a stride of N, only every Nth record's offset is written, making the
+ * index N times smaller at the cost of skipping up to N - 1 records to find
+ * one.  See the Index API in cmp.h for reading it back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmp.h"
+
+/*
+ * The records file, and how far into it the reader is.  Offsets are counted
+ * here rather than asked of ftell, whose long can't hold them all everywhere.
+ */
+typedef struct records_s {
+    FILE *fh;
+    uint64_t offset;
+} records_t;
+
+static bool records_reader(cmp_ctx_t *ctx, void *data, size_t limit) {
+    records_t *records = (records_t *)ctx->buf;
+
+    if (fread(data, sizeof(uint8_t), limit, records->fh) != limit) {
+        return false;
+    }
+
+    records->offset += limit;
+    return true;
+}
+
+static bool records_skipper(cmp_ctx_t *ctx, size_t count) {
+    records_t *records = (records_t *)ctx->buf;
+
+    if (fseek(records->fh, (long)count, SEEK_CUR) != 0) {
+        return false;
+    }
+
+    records->offset += count;
+    return true;
+}
+
+static size_t file_writer(cmp_ctx_t *ctx, const void *data, size_t count) {
+    return fwrite(data, sizeof(uint8_t), count, (FILE *)ctx->buf);
+}
+
+static void error_and_exit(const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static bool at_end(FILE *fh) {
+    int c = getc(fh);
+
+    if (c == EOF) {
+        return true;
+    }
+
+    ungetc(c, fh);
+    return false;
+}
+
+int main(int argc, char **argv) {
+    records_t records;
+    FILE *index = NULL;
+    cmp_ctx_t reader;
+    cmp_ctx_t writer;
+    uint64_t record_count = 0;
+    uint32_t stride = 1;
+
+    if (argc < 3 || argc > 4) {
+        error_and_exit("Usage: cmpindex <records> <index> [stride]");
+    }
+
+    if (argc == 4) {
+        stride = (uint32_t)strtoul(argv[3], NULL, 10);
+
+        if (stride == 0) {
+            error_and_exit("Stride must be a positive number");
+        }
+    }
+
+    records.fh = fopen(argv[1], "rb");
+    records.offset = 0;
+
+    if (records.fh == NULL) {
+        error_and_exit("Error opening records");
+    }
+
+    index = fopen(argv[2], "wb");
+
+    if (index == NULL) {
+        error_and_exit("Error opening index");
+    }
+
+    cmp_init(&reader, &records, records_reader, records_skipper, NULL);
+    cmp_init(&writer, index, NULL, NULL, file_writer);
+
+    /* The record count isn't known yet, so the header is rewritten below */
+    if (!cmp_write_index_header(&writer, stride, 0)) {
+        error_and_exit(cmp_strerror(&writer));
+    }
+
+    while (!at_end(records.fh)) {
+        if ((record_count % stride) == 0) {
+            if (!cmp_write_index_entry(&writer, records.offset)) {
+                error_and_exit(cmp_strerror(&writer));
+            }
+        }
+
+        if (!cmp_skip_object_no_limit(&reader)) {
+            error_and_exit(cmp_strerror(&reader));
+        }
+
+        record_count++;
+    }
+
+    rewind(index);
+
+    if (!cmp_write_index_header(&writer, stride, record_count)) {
+        error_and_exit(cmp_strerror(&writer));
+    }
+
+    if (fclose(index) != 0) {
+        error_and_exit("Error writing index");
+    }
+
+    fclose(records.fh);
+
+    printf("Indexed %lu records.\n", (unsigned long)record_count);
+
+    return EXIT_SUCCESS;
+}
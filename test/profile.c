@@ -22,11 +22,260 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
+#include "cmp.h"
 #include "tests.h"
 
+#define BENCH_VALUE_COUNT 4096
+#define BENCH_ROUND_COUNT 2000
+
+static volatile int64_t bench_sink;
+
+static double ns_per_call(clock_t start) {
+  double calls = (double)BENCH_VALUE_COUNT * BENCH_ROUND_COUNT;
+
+  return ((double)(clock() - start) / CLOCKS_PER_SEC) * 1e9 / calls;
+}
+
+/*
+ * Compares the typed readers against decoding through cmp_read_object and
+ * converting the object afterwards, which is what the typed readers used to
+ * do internally.
+ */
+static void bench_typed_readers(void) {
+  static char data[BENCH_VALUE_COUNT * 9];
+  cmp_ctx_t cmp;
+  cmp_object_t obj;
+  clock_t start;
+  double object_ns;
+  double typed_ns;
+  int64_t l = 0;
+  uint32_t size = 0;
+  int64_t sum = 0;
+  int i;
+  int round;
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+  for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+    cmp_write_integer(&cmp, ((int64_t)i * i * i) - 100000);
+  }
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+      cmp_read_object(&cmp, &obj);
+      cmp_object_as_long(&obj, &l);
+      sum += l;
+    }
+  }
+  object_ns = ns_per_call(start);
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+      cmp_read_long(&cmp, &l);
+      sum += l;
+    }
+  }
+  typed_ns = ns_per_call(start);
+
+  printf("cmp_read_long:     %6.2f ns/call (object path: %6.2f ns/call)\n",
+    typed_ns, object_ns
+  );
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+  for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+    cmp_write_str_marker(&cmp, (uint32_t)(i * 17));
+  }
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+      cmp_read_object(&cmp, &obj);
+      cmp_object_as_str(&obj, &size);
+      sum += size;
+    }
+  }
+  object_ns = ns_per_call(start);
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+      cmp_read_str_size(&cmp, &size);
+      sum += size;
+    }
+  }
+  typed_ns = ns_per_call(start);
+
+  printf("cmp_read_str_size: %6.2f ns/call (object path: %6.2f ns/call)\n",
+    typed_ns, object_ns
+  );
+
+  bench_sink = sum;
+}
+
+#ifndef CMP_NO_FLOAT
+/*
+ * Compares reading an array of doubles an element at a time against reading
+ * it in bulk.
+ */
+static void bench_typed_arrays(void) {
+  static char data[5 + (BENCH_VALUE_COUNT * 9)];
+  static double values[BENCH_VALUE_COUNT];
+  cmp_ctx_t cmp;
+  clock_t start;
+  double element_ns;
+  double bulk_ns;
+  uint32_t size = 0;
+  double sum = 0.;
+  int i;
+  int round;
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+  cmp_write_array(&cmp, BENCH_VALUE_COUNT);
+  for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+    cmp_write_double(&cmp, i * 1.1);
+  }
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    cmp_read_array(&cmp, &size);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+      cmp_read_double(&cmp, &values[i]);
+    }
+    sum += values[round % BENCH_VALUE_COUNT];
+  }
+  element_ns = ns_per_call(start);
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    size = BENCH_VALUE_COUNT;
+    cmp_read_double_array(&cmp, values, &size);
+    sum += values[round % BENCH_VALUE_COUNT];
+  }
+  bulk_ns = ns_per_call(start);
+
+  printf("cmp_read_double_array: %6.2f ns/element (one at a time: %6.2f)\n",
+    bulk_ns, element_ns
+  );
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    cmp_write_array(&cmp, BENCH_VALUE_COUNT);
+    for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+      cmp_write_double(&cmp, values[i]);
+    }
+  }
+  element_ns = ns_per_call(start);
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT; round++) {
+    cmp_mem_seek(&cmp, 0);
+    cmp_write_double_array(&cmp, values, BENCH_VALUE_COUNT);
+  }
+  bulk_ns = ns_per_call(start);
+
+  printf("cmp_write_double_array: %5.2f ns/element (one at a time: %6.2f)\n",
+    bulk_ns, element_ns
+  );
+
+  bench_sink += (int64_t)sum;
+}
+
+/*
+ * Measures transcoding log-like records to JSON and back, in megabytes of
+ * input per second.
+ */
+static void bench_json(void) {
+  static char data[BENCH_VALUE_COUNT * 96];
+  static char json[BENCH_VALUE_COUNT * 192];
+  static uint32_t sizes[(BENCH_VALUE_COUNT * 2) + 1];
+  cmp_ctx_t cmp;
+  cmp_ctx_t out;
+  clock_t start;
+  double seconds;
+  size_t size;
+  size_t json_size;
+  int i;
+  int round;
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+  for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+    cmp_write_map(&cmp, 4);
+    cmp_write_str(&cmp, "id", 2);
+    cmp_write_uinteger(&cmp, (uint64_t)i * 7919);
+    cmp_write_str(&cmp, "message", 7);
+    cmp_write_str(&cmp, "request served from \"cache\" in time", 36);
+    cmp_write_str(&cmp, "latency", 7);
+    cmp_write_double(&cmp, i * 0.25);
+    cmp_write_str(&cmp, "tags", 4);
+    cmp_write_array(&cmp, 2);
+    cmp_write_str(&cmp, "http", 4);
+    cmp_write_integer(&cmp, -i);
+  }
+  size = cmp_mem_tell(&cmp);
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT / 10; round++) {
+    cmp_init_mem_reader(&cmp, data, size);
+    cmp_init_mem(&out, json, sizeof(json));
+    for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+      cmp_write_json(&cmp, &out);
+    }
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("cmp_write_json:    %6.1f MB/s of MessagePack (%.1f MB/s of JSON)\n",
+    ((double)size * (BENCH_ROUND_COUNT / 10)) / seconds / 1e6,
+    ((double)cmp_mem_tell(&out) * (BENCH_ROUND_COUNT / 10)) / seconds / 1e6
+  );
+
+  /* The same records, as one JSON array */
+  cmp_init_mem_reader(&cmp, data, size);
+  json_size = 0;
+  json[json_size++] = '[';
+  for (i = 0; i < BENCH_VALUE_COUNT; i++) {
+    cmp_init_mem(&out, json + json_size, sizeof(json) - json_size - 1);
+    cmp_write_json(&cmp, &out);
+    json_size += cmp_mem_tell(&out);
+    json[json_size++] = ',';
+  }
+  json[json_size - 1] = ']';
+
+  start = clock();
+  for (round = 0; round < BENCH_ROUND_COUNT / 10; round++) {
+    cmp_init_mem(&cmp, data, sizeof(data));
+    cmp_write_from_json(&cmp, json, json_size, sizes,
+      (BENCH_VALUE_COUNT * 2) + 1
+    );
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("cmp_write_from_json: %4.1f MB/s of JSON\n",
+    ((double)json_size * (BENCH_ROUND_COUNT / 10)) / seconds / 1e6
+  );
+
+  bench_sink += (int64_t)cmp_mem_tell(&cmp);
+}
+#endif /* CMP_NO_FLOAT */
+
 int main(void) {
+  bench_typed_readers();
+#ifndef CMP_NO_FLOAT
+  bench_typed_arrays();
+  bench_json();
+#endif
+
   test_msgpack(NULL);
   test_fixedint(NULL);
   test_numbers(NULL);
@@ -48,6 +297,28 @@ int main(void) {
   test_errors(NULL);
   test_version(NULL);
   test_conversions(NULL);
+  test_mem(NULL);
+  test_views(NULL);
+  test_buffered(NULL);
+  test_sizeof(NULL);
+  test_decoder(NULL);
+  test_encoder(NULL);
+  test_typed_arrays(NULL);
+  test_tape(NULL);
+  test_nodes(NULL);
+  test_paths(NULL);
+  test_keys(NULL);
+  test_struct(NULL);
+  test_struct_writer(NULL);
+  test_records(NULL);
+  test_segments(NULL);
+  test_index(NULL);
+  test_json(NULL);
+  test_from_json(NULL);
+  test_canonical(NULL);
+  test_string_table(NULL);
+  test_timestamp(NULL);
+  test_encoder_blocks(NULL);
 
   return EXIT_SUCCESS;
 }
@@ -33,7 +33,7 @@ THE SOFTWARE.
 
 int main(void) {
   /* Use the old CMocka API because Travis' latest Ubuntu is Trusty */
-  const UnitTest tests[17] = {
+  const UnitTest tests[39] = {
     unit_test(test_msgpack),
     unit_test(test_fixedint),
     unit_test(test_numbers),
@@ -55,6 +55,28 @@ int main(void) {
     unit_test(test_errors),
     unit_test(test_version),
     unit_test(test_conversions),
+    unit_test(test_mem),
+    unit_test(test_views),
+    unit_test(test_buffered),
+    unit_test(test_sizeof),
+    unit_test(test_decoder),
+    unit_test(test_encoder),
+    unit_test(test_typed_arrays),
+    unit_test(test_tape),
+    unit_test(test_nodes),
+    unit_test(test_paths),
+    unit_test(test_keys),
+    unit_test(test_struct),
+    unit_test(test_struct_writer),
+    unit_test(test_records),
+    unit_test(test_segments),
+    unit_test(test_index),
+    unit_test(test_json),
+    unit_test(test_from_json),
+    unit_test(test_canonical),
+    unit_test(test_string_table),
+    unit_test(test_timestamp),
+    unit_test(test_encoder_blocks),
   };
 
   if (run_tests(tests)) {
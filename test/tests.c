@@ -30,6 +30,7 @@ THE SOFTWARE.
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <locale.h>
 
 #include <cmocka.h>
 
@@ -39,6 +40,9 @@ THE SOFTWARE.
 static int reader_successes = -1;
 static int writer_successes = -1;
 static int skipper_successes = -1;
+static int backend_calls = 0;
+static size_t writer_budget = 0;
+static size_t writer_chunk = 0;
 
 #ifndef CMP_NO_FLOAT
 
@@ -316,6 +320,18 @@ static size_t buf_writer(cmp_ctx_t *ctx, const void *data, size_t sz) {
   return M_BufferGetCursor(buf) - pos;
 }
 
+static bool buf_acquirer(cmp_ctx_t *ctx, const void **data, size_t count) {
+  buf_t *buf = (buf_t *)ctx->buf;
+
+  if (count > (M_BufferGetSize(buf) - M_BufferGetCursor(buf))) {
+    return false;
+  }
+
+  *data = M_BufferGetDataAtCursor(buf);
+
+  return M_BufferSeekForward(buf, count);
+}
+
 static bool buf_skipper(cmp_ctx_t *ctx, size_t count) {
   if (!skipper_successes) {
     return false;
@@ -330,6 +346,62 @@ static bool buf_skipper(cmp_ctx_t *ctx, size_t count) {
   return M_BufferSeekForward(buf, count);
 }
 
+/* Hands out at most 7 bytes at a time, like a slow socket */
+static size_t buf_filler(cmp_ctx_t *ctx, void *data, size_t limit) {
+  buf_t *buf = (buf_t *)ctx->buf;
+  size_t available = M_BufferGetSize(buf) - M_BufferGetCursor(buf);
+
+  backend_calls++;
+
+  if (limit > 7) {
+    limit = 7;
+  }
+
+  if (limit > available) {
+    limit = available;
+  }
+
+  if (!M_BufferRead(buf, data, limit)) {
+    return 0;
+  }
+
+  return limit;
+}
+
+static size_t counting_writer(cmp_ctx_t *ctx, const void *data, size_t sz) {
+  backend_calls++;
+
+  return buf_writer(ctx, data, sz);
+}
+
+/* Writes at most `writer_budget` bytes, like a non-blocking socket */
+static size_t budget_writer(cmp_ctx_t *ctx, const void *data, size_t sz) {
+  if (sz > writer_budget) {
+    sz = writer_budget;
+  }
+
+  writer_budget -= sz;
+
+  if (!sz) {
+    return 0;
+  }
+
+  return buf_writer(ctx, data, sz);
+}
+
+/* Writes at most `writer_chunk` bytes per call, however many calls it gets */
+static size_t chunk_writer(cmp_ctx_t *ctx, const void *data, size_t sz) {
+  if (sz > writer_chunk) {
+    sz = writer_chunk;
+  }
+
+  if (!sz) {
+    return 0;
+  }
+
+  return buf_writer(ctx, data, sz);
+}
+
 void setup_cmp_and_buf(cmp_ctx_t *cmp, buf_t *buf) {
   reader_successes = -1;
   writer_successes = -1;
@@ -348,6 +420,7 @@ void teardown_cmp_and_buf(cmp_ctx_t *cmp, buf_t *buf) {
   cmp->read = NULL;
   cmp->skip = NULL;
   cmp->write = NULL;
+  cmp->acquire = NULL;
 }
 
 void test_msgpack(void **state) {
@@ -3195,14 +3268,6 @@ void test_ext(void **state) {
 
   M_BufferSeek(&buf, 0);
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 7, 0x7F, buf8));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 3;
-  assert_false(cmp_write_ext(&cmp, 7, 0x7F, buf8));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 4;
   assert_true(cmp_write_ext(&cmp, 7, 0x7F, buf8));
 
   M_BufferSeek(&buf, 0);
@@ -3215,14 +3280,6 @@ void test_ext(void **state) {
 
   M_BufferSeek(&buf, 0);
   writer_successes = 2;
-  assert_false(cmp_write_ext8(&cmp, 7, 0x7F, buf8));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 3;
-  assert_false(cmp_write_ext8(&cmp, 7, 0x7F, buf8));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 4;
   assert_true(cmp_write_ext8(&cmp, 7, 0x7F, buf8));
 
   M_BufferSeek(&buf, 0);
@@ -3235,14 +3292,6 @@ void test_ext(void **state) {
 
   M_BufferSeek(&buf, 0);
   writer_successes = 2;
-  assert_false(cmp_write_ext16(&cmp, 7, 0x7FFF, buf16));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 3;
-  assert_false(cmp_write_ext16(&cmp, 7, 0x7FFF, buf16));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 4;
   assert_true(cmp_write_ext16(&cmp, 7, 0x7FFF, buf16));
 
   M_BufferSeek(&buf, 0);
@@ -3255,14 +3304,6 @@ void test_ext(void **state) {
 
   M_BufferSeek(&buf, 0);
   writer_successes = 2;
-  assert_false(cmp_write_ext32(&cmp, 7, 0x10000, buf32));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 3;
-  assert_false(cmp_write_ext32(&cmp, 7, 0x10000, buf32));
-
-  M_BufferSeek(&buf, 0);
-  writer_successes = 4;
   assert_true(cmp_write_ext32(&cmp, 7, 0x10000, buf32));
 
   writer_successes = -1;
@@ -4693,6 +4734,23 @@ void test_skipping(void **state) {
   assert_true(cmp_read_object(&cmp, &obj));
   assert_int_equal(obj.type, CMP_TYPE_ARRAY32);
 
+  /* Empty extended types still have a type byte to skip */
+  M_BufferClear(&buf);
+  assert_true(cmp_write_ext8(&cmp, 1, 0, ""));
+  assert_true(cmp_write_ext16(&cmp, 2, 0, ""));
+  assert_true(cmp_write_nil(&cmp));
+  M_BufferSeek(&buf, 0);
+  assert_true(cmp_skip_object(&cmp, &obj));
+  assert_true(cmp_skip_object_no_limit(&cmp));
+  assert_true(cmp_read_nil(&cmp));
+
+  /* Skipping data that isn't there fails */
+  M_BufferClear(&buf);
+  assert_true(cmp_write_str_marker(&cmp, 10));
+  assert_true(cmp_write_nil(&cmp));
+  M_BufferSeek(&buf, 0);
+  assert_false(cmp_skip_object_no_limit(&cmp));
+
   teardown_cmp_and_buf(&cmp, &buf);
 }
 
@@ -5178,44 +5236,49 @@ void test_errors(void **state) {
 
   M_BufferClear(&buf);
 
+  /*
+   * Scalars, fixstrs, fixexts and container headers are written with a
+   * single call; anything else takes two: one for the header and one for
+   * the data.
+   */
   writer_successes = 1;
-  assert_false(cmp_write_uinteger(&cmp, 200));
+  assert_true(cmp_write_uinteger(&cmp, 200));
   writer_successes = 1;
-  assert_false(cmp_write_uinteger(&cmp, 300));
+  assert_true(cmp_write_uinteger(&cmp, 300));
   writer_successes = 1;
-  assert_false(cmp_write_uinteger(&cmp, 70000));
+  assert_true(cmp_write_uinteger(&cmp, 70000));
   writer_successes = 1;
-  assert_false(cmp_write_uinteger(&cmp, 0x100000002));
+  assert_true(cmp_write_uinteger(&cmp, 0x100000002));
   writer_successes = 1;
-  assert_false(cmp_write_integer(&cmp, -100));
+  assert_true(cmp_write_integer(&cmp, -100));
   writer_successes = 1;
-  assert_false(cmp_write_integer(&cmp, -200));
+  assert_true(cmp_write_integer(&cmp, -200));
   writer_successes = 1;
-  assert_false(cmp_write_integer(&cmp, -33000));
+  assert_true(cmp_write_integer(&cmp, -33000));
   writer_successes = 1;
-  assert_false(cmp_write_integer(&cmp, 0xFFFFFFFF2));
+  assert_true(cmp_write_integer(&cmp, 0xFFFFFFFF2));
 #ifndef CMP_NO_FLOAT
   writer_successes = 1;
-  assert_false(cmp_write_float(&cmp, 1.1f));
+  assert_true(cmp_write_float(&cmp, 1.1f));
   writer_successes = 1;
-  assert_false(cmp_write_double(&cmp, 1.1));
+  assert_true(cmp_write_double(&cmp, 1.1));
 #endif
   writer_successes = 1;
-  assert_false(cmp_write_str(&cmp, "a", 1));
+  assert_true(cmp_write_str(&cmp, "a", 1));
   writer_successes = 1;
-  assert_false(cmp_write_str(&cmp, "apple", 5));
+  assert_true(cmp_write_str(&cmp, "apple", 5));
   writer_successes = 1;
-  assert_false(cmp_write_map(&cmp, 0x100));
+  assert_true(cmp_write_map(&cmp, 0x100));
   writer_successes = 1;
-  assert_false(cmp_write_map(&cmp, 0x10000));
+  assert_true(cmp_write_map(&cmp, 0x10000));
   writer_successes = 1;
-  assert_false(cmp_write_str(&cmp, "banana", 6));
+  assert_true(cmp_write_str(&cmp, "banana", 6));
   writer_successes = 1;
-  assert_false(cmp_write_str(&cmp, "blackberry", 10));
+  assert_true(cmp_write_str(&cmp, "blackberry", 10));
   writer_successes = 1;
-  assert_false(cmp_write_array(&cmp, 0x100));
+  assert_true(cmp_write_array(&cmp, 0x100));
   writer_successes = 1;
-  assert_false(cmp_write_array(&cmp, 0x10000));
+  assert_true(cmp_write_array(&cmp, 0x10000));
   writer_successes = 1;
   assert_false(cmp_write_bin(&cmp, bin8, 200));
   writer_successes = 1;
@@ -5229,15 +5292,15 @@ void test_errors(void **state) {
   writer_successes = 1;
   assert_false(cmp_write_str(&cmp, str32, 70000));
   writer_successes = 1;
-  assert_false(cmp_write_ext(&cmp, 2, 1, "C"));
+  assert_true(cmp_write_ext(&cmp, 2, 1, "C"));
   writer_successes = 1;
-  assert_false(cmp_write_ext(&cmp, 3, 2, "CC"));
+  assert_true(cmp_write_ext(&cmp, 3, 2, "CC"));
   writer_successes = 1;
-  assert_false(cmp_write_ext(&cmp, 4, 4, "CCCC"));
+  assert_true(cmp_write_ext(&cmp, 4, 4, "CCCC"));
   writer_successes = 1;
-  assert_false(cmp_write_ext(&cmp, 5, 8, "CCCCCCCC"));
+  assert_true(cmp_write_ext(&cmp, 5, 8, "CCCCCCCC"));
   writer_successes = 1;
-  assert_false(cmp_write_ext(&cmp, 6, 16, "CCCCCCCCCCCCCCCC"));
+  assert_true(cmp_write_ext(&cmp, 6, 16, "CCCCCCCCCCCCCCCC"));
   writer_successes = 1;
   assert_false(cmp_write_ext(&cmp, 7, 0x7F, ext8));
   writer_successes = 1;
@@ -5248,33 +5311,33 @@ void test_errors(void **state) {
   M_BufferClear(&buf);
 
   writer_successes = 2;
-  assert_false(cmp_write_bin(&cmp, bin8, 200));
+  assert_true(cmp_write_bin(&cmp, bin8, 200));
   writer_successes = 2;
-  assert_false(cmp_write_bin(&cmp, bin16, 300));
+  assert_true(cmp_write_bin(&cmp, bin16, 300));
   writer_successes = 2;
-  assert_false(cmp_write_bin(&cmp, bin32, 70000));
+  assert_true(cmp_write_bin(&cmp, bin32, 70000));
   writer_successes = 2;
-  assert_false(cmp_write_str(&cmp, str8, 200));
+  assert_true(cmp_write_str(&cmp, str8, 200));
   writer_successes = 2;
-  assert_false(cmp_write_str(&cmp, str16, 300));
+  assert_true(cmp_write_str(&cmp, str16, 300));
   writer_successes = 2;
-  assert_false(cmp_write_str(&cmp, str32, 70000));
+  assert_true(cmp_write_str(&cmp, str32, 70000));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 2, 1, "C"));
+  assert_true(cmp_write_ext(&cmp, 2, 1, "C"));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 3, 2, "CC"));
+  assert_true(cmp_write_ext(&cmp, 3, 2, "CC"));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 4, 4, "CCCC"));
+  assert_true(cmp_write_ext(&cmp, 4, 4, "CCCC"));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 5, 8, "CCCCCCCC"));
+  assert_true(cmp_write_ext(&cmp, 5, 8, "CCCCCCCC"));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 6, 16, "CCCCCCCCCCCCCCCC"));
+  assert_true(cmp_write_ext(&cmp, 6, 16, "CCCCCCCCCCCCCCCC"));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 7, 0x7F, ext8));
+  assert_true(cmp_write_ext(&cmp, 7, 0x7F, ext8));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 8, 0x7FFF, ext16));
+  assert_true(cmp_write_ext(&cmp, 8, 0x7FFF, ext16));
   writer_successes = 2;
-  assert_false(cmp_write_ext(&cmp, 9, 0x10000, ext32));
+  assert_true(cmp_write_ext(&cmp, 9, 0x10000, ext32));
 
   writer_successes = -1;
   reader_successes = 0;
@@ -5730,8 +5793,9 @@ void test_errors(void **state) {
 
   writer_successes = 1;
 
+  /* The marker and the value go out in one write */
   M_BufferSeek(&buf, 0);
-  assert_false(cmp_write_u8(&cmp, 200));
+  assert_true(cmp_write_u8(&cmp, 200));
 
   M_BufferSeek(&buf, 0);
   assert_false(cmp_write_u16(&cmp, 300));
@@ -5768,62 +5832,62 @@ void test_errors(void **state) {
   reader_successes = -1;
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_u8(&cmp, 200));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_u8(&cmp, &u8));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_u16(&cmp, 300));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_u16(&cmp, &u16));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_u32(&cmp, 70000));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_u32(&cmp, &u32));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_u64(&cmp, 0x100000002));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_u64(&cmp, &u64));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_s8(&cmp, -100));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_s8(&cmp, &s8));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_s16(&cmp, -200));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_s16(&cmp, &s16));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_s32(&cmp, -33000));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_s32(&cmp, &s32));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_s64(&cmp, 0x80000002));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_s64(&cmp, &s64));
 
 #ifndef CMP_NO_FLOAT
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_float(&cmp, 1.1f));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_float(&cmp, &f));
 
   M_BufferClear(&buf);
-  writer_successes = 1;
+  writer_successes = 0;
   assert_false(cmp_write_double(&cmp, 1.1));
   M_BufferSeek(&buf, 0);
   assert_false(cmp_read_double(&cmp, &d));
@@ -5939,13 +6003,2617 @@ void test_errors(void **state) {
   teardown_cmp_and_buf(&cmp, &buf);
 }
 
-void test_version(void **state) {
-  uint32_t version = cmp_version();
-  uint32_t mp_version = cmp_mp_version();
+void test_mem(void **state) {
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_ctx_t mem;
+  cmp_object_t obj;
+  char data[128];
+  char small[3];
+  char str[16];
+  const char ro_data[] = "\x93\x01\xa2hi\xc3";
+  uint32_t size;
+  uint64_t u64;
+  int64_t s64;
+  bool b;
 
   (void)state;
-  (void)version;
-  (void)mp_version;
+
+  memset(data, 0, sizeof(data));
+  setup_cmp_and_buf(&cmp, &buf);
+  cmp_init_mem(&mem, data, sizeof(data));
+
+  assert_int_equal(cmp_mem_tell(&mem), 0);
+
+  assert_true(cmp_write_array(&cmp, 6));
+  assert_true(cmp_write_uinteger(&cmp, 70000));
+  assert_true(cmp_write_integer(&cmp, -33000));
+  assert_true(cmp_write_str(&cmp, "hello", 5));
+  assert_true(cmp_write_bin(&cmp, "\x01\x02\x03", 3));
+  assert_true(cmp_write_ext(&cmp, 4, 2, "ab"));
+  assert_true(cmp_write_true(&cmp));
+
+  assert_true(cmp_write_array(&mem, 6));
+  assert_true(cmp_write_uinteger(&mem, 70000));
+  assert_true(cmp_write_integer(&mem, -33000));
+  assert_true(cmp_write_str(&mem, "hello", 5));
+  assert_true(cmp_write_bin(&mem, "\x01\x02\x03", 3));
+  assert_true(cmp_write_ext(&mem, 4, 2, "ab"));
+  assert_true(cmp_write_true(&mem));
+
+  assert_int_equal(cmp_mem_tell(&mem), M_BufferGetSize(&buf));
+  assert_memory_equal(data, buf.data, M_BufferGetSize(&buf));
+
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_array(&mem, &size));
+  assert_int_equal(size, 6);
+  assert_true(cmp_read_uinteger(&mem, &u64));
+  assert_true(u64 == 70000);
+  assert_true(cmp_read_integer(&mem, &s64));
+  assert_true(s64 == -33000);
+  size = sizeof(str);
+  assert_true(cmp_read_str(&mem, str, &size));
+  assert_int_equal(size, 5);
+  assert_string_equal(str, "hello");
+  assert_true(cmp_skip_object(&mem, &obj));
+  assert_true(cmp_skip_object_no_limit(&mem));
+  assert_true(cmp_read_bool(&mem, &b));
+  assert_true(b);
+  assert_int_equal(cmp_mem_tell(&mem), M_BufferGetSize(&buf));
+
+  /* Reading past the end of the written data reads zeroed memory */
+  assert_true(cmp_mem_seek(&mem, sizeof(data) - 1));
+  assert_true(cmp_read_object(&mem, &obj));
+  assert_false(cmp_read_object(&mem, &obj));
+  assert_false(cmp_mem_seek(&mem, sizeof(data) + 1));
+  assert_true(cmp_mem_seek(&mem, sizeof(data)));
+
+  cmp_init_mem(&mem, small, sizeof(small));
+  assert_true(cmp_write_u16(&mem, 1));
+  assert_false(cmp_write_nil(&mem));
+  cmp_init_mem(&mem, small, sizeof(small));
+  assert_false(cmp_write_str(&mem, "abc", 3));
+  cmp_init_mem(&mem, small, sizeof(small));
+  assert_false(cmp_write_u32(&mem, 1));
+
+  cmp_init_mem(&mem, small, sizeof(small));
+  assert_true(cmp_write_u16(&mem, 0x1234));
+  assert_true(cmp_mem_seek(&mem, 1));
+  assert_false(cmp_read_u16(&mem, &obj.as.u16));
+  assert_true(cmp_mem_seek(&mem, 3));
+  assert_false(cmp_skip_object_no_limit(&mem));
+
+  cmp_init_mem_reader(&mem, ro_data, sizeof(ro_data) - 1);
+  assert_false(cmp_write_nil(&mem));
+  assert_true(cmp_read_array(&mem, &size));
+  assert_int_equal(size, 3);
+  assert_true(cmp_read_uinteger(&mem, &u64));
+  assert_true(u64 == 1);
+  size = sizeof(str);
+  assert_true(cmp_read_str(&mem, str, &size));
+  assert_string_equal(str, "hi");
+  assert_true(cmp_read_bool(&mem, &b));
+  assert_true(b);
+  assert_false(cmp_read_nil(&mem));
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_views(void **state) {
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_ctx_t mem;
+  cmp_object_t obj;
+  char data[64];
+  const char *str = NULL;
+  const void *bin = NULL;
+  const void *ext = NULL;
+  uint32_t size = 0;
+  int8_t type = 0;
+
+  (void)state;
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_str(&mem, "hello", 5));
+  assert_true(cmp_write_bin(&mem, "\x01\x02\x03", 3));
+  assert_true(cmp_write_ext(&mem, 4, 2, "ab"));
+  assert_true(cmp_write_str(&mem, "bye", 3));
+  assert_true(cmp_write_bin(&mem, "\x04", 1));
+  assert_true(cmp_write_nil(&mem));
+
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_str_view(&mem, &str, &size));
+  assert_int_equal(size, 5);
+  assert_true(str == data + 1);
+  assert_memory_equal(str, "hello", 5);
+  assert_true(cmp_read_bin_view(&mem, &bin, &size));
+  assert_int_equal(size, 3);
+  assert_memory_equal(bin, "\x01\x02\x03", 3);
+  assert_true(cmp_read_ext_view(&mem, &type, &size, &ext));
+  assert_int_equal(type, 4);
+  assert_int_equal(size, 2);
+  assert_memory_equal(ext, "ab", 2);
+
+  assert_true(cmp_read_object(&mem, &obj));
+  assert_true(cmp_object_to_str_view(&mem, &obj, &str));
+  assert_memory_equal(str, "bye", 3);
+  assert_true(cmp_read_object(&mem, &obj));
+  assert_false(cmp_object_to_str_view(&mem, &obj, &str));
+  assert_true(cmp_object_to_bin_view(&mem, &obj, &bin));
+  assert_memory_equal(bin, "\x04", 1);
+
+  assert_false(cmp_read_str_view(&mem, &str, &size));
+  assert_false(cmp_read_bin_view(&mem, &bin, &size));
+
+  /* Views can't run past the end of the buffer */
+  cmp_init_mem_reader(&mem, "\xa5hel", 4);
+  assert_false(cmp_read_str_view(&mem, &str, &size));
+  assert_string_equal(cmp_strerror(&mem), "Error reading packed data");
+
+  setup_cmp_and_buf(&cmp, &buf);
+  assert_true(cmp_write_str(&cmp, "hello", 5));
+  assert_true(cmp_write_str(&cmp, "world", 5));
+  M_BufferSeek(&buf, 0);
+
+  /* Backends without an acquirer can't hand out views */
+  assert_false(cmp_read_str_view(&cmp, &str, &size));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Backend does not support zero-copy reads"
+  );
+
+  cmp.acquire = buf_acquirer;
+  M_BufferSeek(&buf, 0);
+  assert_true(cmp_read_str_view(&cmp, &str, &size));
+  assert_int_equal(size, 5);
+  assert_memory_equal(str, "hello", 5);
+  assert_true(cmp_read_str_view(&cmp, &str, &size));
+  assert_memory_equal(str, "world", 5);
+  assert_false(cmp_read_str_view(&cmp, &str, &size));
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_buffered(void **state) {
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_ctx_t mem;
+  cmp_buffered_t buffered;
+  cmp_object_t obj;
+  char staging[16];
+  char expected[256];
+  char big[100];
+  char out[101];
+  const char *str = NULL;
+  uint32_t size = 0;
+  uint64_t u = 0;
+  size_t i;
+
+  (void)state;
+
+  memset(big, 'x', sizeof(big));
+
+  cmp_init_mem(&mem, expected, sizeof(expected));
+  for (i = 0; i < 40; i++) {
+    assert_true(cmp_write_uinteger(&mem, i * 1000));
+  }
+  assert_true(cmp_write_str(&mem, "hello", 5));
+  assert_true(cmp_write_str(&mem, big, sizeof(big)));
+  assert_true(cmp_write_array(&mem, 2));
+  assert_true(cmp_write_true(&mem));
+  assert_true(cmp_write_str(&mem, "skipped", 7));
+  assert_true(cmp_write_nil(&mem));
+
+  setup_cmp_and_buf(&cmp, &buf);
+  backend_calls = 0;
+  cmp_init_buffered_writer(
+    &cmp, &buffered, &buf, counting_writer, staging, sizeof(staging)
+  );
+  for (i = 0; i < 40; i++) {
+    assert_true(cmp_write_uinteger(&cmp, i * 1000));
+  }
+  assert_true(cmp_write_str(&cmp, "hello", 5));
+  assert_true(cmp_write_str(&cmp, big, sizeof(big)));
+  assert_true(cmp_write_array(&cmp, 2));
+  assert_true(cmp_write_true(&cmp));
+  assert_true(cmp_write_str(&cmp, "skipped", 7));
+  assert_true(cmp_write_nil(&cmp));
+
+  /* Nothing past the last flush reaches the backend until asked */
+  assert_true(M_BufferGetCursor(&buf) < cmp_mem_tell(&mem));
+  assert_true(cmp_buffered_flush(&cmp));
+  assert_true(cmp_buffered_flush(&cmp));
+  assert_int_equal(M_BufferGetCursor(&buf), cmp_mem_tell(&mem));
+  assert_memory_equal(buf.data, expected, cmp_mem_tell(&mem));
+  assert_true(backend_calls < 20);
+
+  /* Flushing a context that isn't buffered does nothing */
+  assert_true(cmp_buffered_flush(&mem));
+
+  M_BufferSeek(&buf, 0);
+  backend_calls = 0;
+  cmp_init_buffered_reader(
+    &cmp, &buffered, &buf, buf_filler, NULL, staging, sizeof(staging)
+  );
+  for (i = 0; i < 40; i++) {
+    assert_true(cmp_read_ulong(&cmp, &u));
+    assert_int_equal(u, i * 1000);
+  }
+  assert_true(cmp_read_str_view(&cmp, &str, &size));
+  assert_int_equal(size, 5);
+  assert_memory_equal(str, "hello", 5);
+
+  /* Views can't be larger than the staging buffer */
+  assert_false(cmp_read_str_view(&cmp, &str, &size));
+
+  M_BufferSeek(&buf, 0);
+  cmp_init_buffered_reader(
+    &cmp, &buffered, &buf, buf_filler, buf_skipper, staging, sizeof(staging)
+  );
+  for (i = 0; i < 40; i++) {
+    assert_true(cmp_skip_object_no_limit(&cmp));
+  }
+  assert_true(cmp_skip_object_no_limit(&cmp));
+  size = sizeof(out);
+  assert_true(cmp_read_str(&cmp, out, &size));
+  assert_int_equal(size, sizeof(big));
+  assert_memory_equal(out, big, sizeof(big));
+  assert_true(cmp_skip_object_no_limit(&cmp));
+  assert_true(cmp_read_object(&cmp, &obj));
+  assert_int_equal(obj.type, CMP_TYPE_NIL);
+  assert_false(cmp_read_object(&cmp, &obj));
+
+  /* Without a skipper, skipped data is read and discarded */
+  M_BufferSeek(&buf, 0);
+  cmp_init_buffered_reader(
+    &cmp, &buffered, &buf, buf_filler, NULL, staging, sizeof(staging)
+  );
+  for (i = 0; i < 42; i++) {
+    assert_true(cmp_skip_object_no_limit(&cmp));
+  }
+  assert_true(cmp_read_array(&cmp, &size));
+  assert_int_equal(size, 2);
+  assert_true(cmp_skip_object_no_limit(&cmp));
+  assert_true(cmp_skip_object_no_limit(&cmp));
+  assert_true(cmp_read_nil(&cmp));
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+/*
+ * Runs `write`, then checks how much it wrote against `expected` and against
+ * what `cmp_sizeof_object` reports for the object it wrote
+ */
+#define check_sizeof(write, expected) do {                                    \
+    cmp_object_t obj_;                                                        \
+    cmp_init_mem(&mem, data, sizeof(data));                                   \
+    assert_true(write);                                                       \
+    assert_int_equal(cmp_mem_tell(&mem), (expected));                         \
+    assert_true(cmp_mem_seek(&mem, 0));                                       \
+    assert_true(cmp_read_object(&mem, &obj_));                                \
+    assert_int_equal(cmp_sizeof_object(&obj_), (expected));                   \
+  } while (0)
+
+void test_sizeof(void **state) {
+  static const int64_t sints[] = {
+    0, 1, 127, 128, 255, 256, 65535, 65536, INT64_C(4294967295),
+    INT64_C(4294967296), INT64_MAX, -1, -32, -33, -128, -129, -32768, -32769,
+    -INT64_C(2147483648), -INT64_C(2147483649), INT64_MIN
+  };
+  static const uint32_t sizes[] = {
+    0, 1, 2, 3, 4, 8, 15, 16, 17, 31, 32, 255, 256, 65535, 65536, 0xFFFFFFFF
+  };
+  cmp_ctx_t mem;
+  cmp_object_t obj;
+  char data[64];
+  size_t i;
+
+  (void)state;
+
+  for (i = 0; i < sizeof(sints) / sizeof(sints[0]); i++) {
+    check_sizeof(
+      cmp_write_integer(&mem, sints[i]), cmp_sizeof_integer(sints[i])
+    );
+
+    if (sints[i] >= 0) {
+      check_sizeof(
+        cmp_write_uinteger(&mem, (uint64_t)sints[i]),
+        cmp_sizeof_uinteger((uint64_t)sints[i])
+      );
+    }
+  }
+
+  check_sizeof(
+    cmp_write_uinteger(&mem, UINT64_MAX), cmp_sizeof_uinteger(UINT64_MAX)
+  );
+
+#ifndef CMP_NO_FLOAT
+  check_sizeof(cmp_write_decimal(&mem, 1.5), cmp_sizeof_decimal(1.5));
+  check_sizeof(cmp_write_decimal(&mem, 1.1), cmp_sizeof_decimal(1.1));
+#endif
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    check_sizeof(
+      cmp_write_str_marker(&mem, sizes[i]), cmp_sizeof_str_marker(sizes[i])
+    );
+    check_sizeof(
+      cmp_write_str_marker_v4(&mem, sizes[i]),
+      cmp_sizeof_str_marker_v4(sizes[i])
+    );
+    check_sizeof(
+      cmp_write_bin_marker(&mem, sizes[i]), cmp_sizeof_bin_marker(sizes[i])
+    );
+    check_sizeof(cmp_write_array(&mem, sizes[i]), cmp_sizeof_array(sizes[i]));
+    check_sizeof(cmp_write_map(&mem, sizes[i]), cmp_sizeof_map(sizes[i]));
+
+    if (sizes[i]) {
+      check_sizeof(
+        cmp_write_ext_marker(&mem, 1, sizes[i]),
+        cmp_sizeof_ext_marker(sizes[i])
+      );
+      assert_int_equal(
+        cmp_sizeof_ext(sizes[i]), cmp_sizeof_ext_marker(sizes[i]) + sizes[i]
+      );
+    }
+
+    assert_int_equal(
+      cmp_sizeof_str(sizes[i]), cmp_sizeof_str_marker(sizes[i]) + sizes[i]
+    );
+    assert_int_equal(
+      cmp_sizeof_str_v4(sizes[i]),
+      cmp_sizeof_str_marker_v4(sizes[i]) + sizes[i]
+    );
+    assert_int_equal(
+      cmp_sizeof_bin(sizes[i]), cmp_sizeof_bin_marker(sizes[i]) + sizes[i]
+    );
+  }
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_str(&mem, "hello", 5));
+  assert_int_equal(cmp_mem_tell(&mem), cmp_sizeof_str(5));
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_bin(&mem, "hello", 5));
+  assert_int_equal(cmp_mem_tell(&mem), cmp_sizeof_bin(5));
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_ext(&mem, 1, 4, "abcd"));
+  assert_int_equal(cmp_mem_tell(&mem), cmp_sizeof_ext(4));
+
+  check_sizeof(cmp_write_nil(&mem), 1);
+  check_sizeof(cmp_write_true(&mem), 1);
+
+  obj.type = CMP_TYPE_STR8;
+  obj.as.str_size = 3;
+  assert_int_equal(cmp_sizeof_object(&obj), 2);
+  assert_int_equal(cmp_sizeof_object_v4(&obj), 0);
+  obj.type = CMP_TYPE_STR16;
+  assert_int_equal(cmp_sizeof_object_v4(&obj), 3);
+  obj.type = 0xFF;
+  assert_int_equal(cmp_sizeof_object(&obj), 0);
+}
+
+void test_decoder(void **state) {
+  static const size_t chunk_sizes[] = { 1, 2, 3, 7, 1000 };
+  cmp_ctx_t in;
+  cmp_ctx_t out;
+  cmp_decoder_t decoder;
+  cmp_object_t obj;
+  char input[256];
+  char output[256];
+  char bin[40];
+  const void *data = NULL;
+  const void *payload = NULL;
+  size_t size = 0;
+  size_t payload_size = 0;
+  size_t input_size;
+  size_t fed;
+  size_t chunk;
+  size_t i;
+  int result;
+
+  (void)state;
+
+  memset(bin, 'b', sizeof(bin));
+
+  cmp_init_mem(&in, input, sizeof(input));
+  assert_true(cmp_write_map(&in, 2));
+  assert_true(cmp_write_str(&in, "id", 2));
+  assert_true(cmp_write_u64(&in, UINT64_C(0x0102030405060708)));
+  assert_true(cmp_write_str(&in, "data", 4));
+  assert_true(cmp_write_array(&in, 6));
+  assert_true(cmp_write_integer(&in, -5000));
+  assert_true(cmp_write_bin(&in, bin, sizeof(bin)));
+  assert_true(cmp_write_ext(&in, 9, 3, "xyz"));
+  assert_true(cmp_write_str(&in, "", 0));
+  assert_true(cmp_write_nil(&in));
+#ifndef CMP_NO_FLOAT
+  assert_true(cmp_write_double(&in, 1.1));
+#else
+  assert_true(cmp_write_true(&in));
+#endif
+  input_size = cmp_mem_tell(&in);
+
+  /* However the input is split up, re-encoding the events gives it back */
+  for (i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+    cmp_decoder_init(&decoder);
+    cmp_init_mem(&out, output, sizeof(output));
+    fed = 0;
+
+    while (fed < input_size) {
+      chunk = chunk_sizes[i];
+
+      if (chunk > input_size - fed) {
+        chunk = input_size - fed;
+      }
+
+      data = input + fed;
+      size = chunk;
+      fed += chunk;
+
+      for (;;) {
+        result = cmp_decoder_next(
+          &decoder, &data, &size, &obj, &payload, &payload_size
+        );
+
+        if (result == CMP_DECODER_NEED_MORE) {
+          break;
+        }
+
+        if (result == CMP_DECODER_OBJECT) {
+          assert_true(cmp_write_object(&out, &obj));
+        }
+        else {
+          assert_int_equal(result, CMP_DECODER_PAYLOAD);
+          assert_int_equal(
+            out.write(&out, payload, payload_size), payload_size
+          );
+        }
+      }
+
+      assert_int_equal(size, 0);
+    }
+
+    assert_true(cmp_decoder_is_idle(&decoder));
+    assert_int_equal(cmp_mem_tell(&out), input_size);
+    assert_memory_equal(output, input, input_size);
+  }
+
+  /* Stopping mid-object leaves the decoder busy until the rest arrives */
+  cmp_decoder_init(&decoder);
+  data = input + 4;
+  size = 3;
+  assert_int_equal(
+    cmp_decoder_next(&decoder, &data, &size, &obj, &payload, &payload_size),
+    CMP_DECODER_NEED_MORE
+  );
+  assert_false(cmp_decoder_is_idle(&decoder));
+  data = input + 7;
+  size = 6;
+  assert_int_equal(
+    cmp_decoder_next(&decoder, &data, &size, &obj, &payload, &payload_size),
+    CMP_DECODER_OBJECT
+  );
+  assert_int_equal(obj.type, CMP_TYPE_UINT64);
+  assert_true(obj.as.u64 == UINT64_C(0x0102030405060708));
+  assert_true(cmp_decoder_is_idle(&decoder));
+
+  cmp_decoder_init(&decoder);
+  data = "\xc1";
+  size = 1;
+  assert_int_equal(
+    cmp_decoder_next(&decoder, &data, &size, &obj, &payload, &payload_size),
+    CMP_DECODER_ERROR
+  );
+  assert_string_equal(cmp_decoder_strerror(&decoder), "Invalid type");
+  data = "\xc0";
+  size = 1;
+  assert_int_equal(
+    cmp_decoder_next(&decoder, &data, &size, &obj, &payload, &payload_size),
+    CMP_DECODER_ERROR
+  );
+  assert_false(cmp_decoder_is_idle(&decoder));
+}
+
+void test_encoder(void **state) {
+  static const size_t budgets[] = { 0, 1, 2, 5, 1000 };
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_ctx_t mem;
+  cmp_encoder_t encoder;
+  char expected[512];
+  char big[100];
+  size_t i;
+
+  (void)state;
+
+  memset(big, 'x', sizeof(big));
+
+  cmp_init_mem(&mem, expected, sizeof(expected));
+  assert_true(cmp_write_array(&mem, 7));
+  assert_true(cmp_write_u64(&mem, UINT64_C(0x0102030405060708)));
+  assert_true(cmp_write_str(&mem, "hello", 5));
+  assert_true(cmp_write_str(&mem, big, 20));
+  assert_true(cmp_write_str(&mem, big, sizeof(big)));
+  assert_true(cmp_write_bin(&mem, big, 40));
+  assert_true(cmp_write_ext(&mem, 3, 16, big));
+  assert_true(cmp_write_ext(&mem, 3, 70, big));
+
+  for (i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+    setup_cmp_and_buf(&cmp, &buf);
+    cmp_init_encoder(&cmp, &encoder, &buf, budget_writer);
+
+    /* The backend takes `budgets[i]` bytes whenever it's written to */
+#define write_resumably(write) do {                                           \
+      writer_budget = budgets[i];                                             \
+      assert_true(write);                                                     \
+      while (cmp_encoder_pending(&cmp)) {                                     \
+        size_t pending_ = cmp_encoder_pending(&cmp);                          \
+        writer_budget = budgets[i] ? budgets[i] : 3;                          \
+        assert_true(cmp_encoder_resume(&cmp) < pending_);                     \
+      }                                                                       \
+    } while (0)
+
+    write_resumably(cmp_write_array(&cmp, 7));
+    write_resumably(cmp_write_u64(&cmp, UINT64_C(0x0102030405060708)));
+    write_resumably(cmp_write_str(&cmp, "hello", 5));
+    write_resumably(cmp_write_str(&cmp, big, 20));
+    write_resumably(cmp_write_str(&cmp, big, sizeof(big)));
+    write_resumably(cmp_write_bin(&cmp, big, 40));
+    write_resumably(cmp_write_ext(&cmp, 3, 16, big));
+    write_resumably(cmp_write_ext(&cmp, 3, 70, big));
+
+#undef write_resumably
+
+    assert_int_equal(M_BufferGetCursor(&buf), cmp_mem_tell(&mem));
+    assert_memory_equal(buf.data, expected, cmp_mem_tell(&mem));
+    teardown_cmp_and_buf(&cmp, &buf);
+  }
+
+  /* Nothing can be queued behind a large payload */
+  setup_cmp_and_buf(&cmp, &buf);
+  cmp_init_encoder(&cmp, &encoder, &buf, budget_writer);
+  writer_budget = 4;
+  assert_true(cmp_write_str(&cmp, big, sizeof(big)));
+  assert_int_equal(cmp_encoder_pending(&cmp), 2 + sizeof(big) - 4);
+  assert_false(cmp_write_nil(&cmp));
+  writer_budget = 1000;
+  assert_int_equal(cmp_encoder_resume(&cmp), 0);
+  assert_true(cmp_write_nil(&cmp));
+  assert_int_equal(M_BufferGetCursor(&buf), 2 + sizeof(big) + 1);
+
+  /* Other contexts never have anything pending */
+  assert_int_equal(cmp_encoder_pending(&mem), 0);
+  assert_int_equal(cmp_encoder_resume(&mem), 0);
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_typed_arrays(void **state) {
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_ctx_t mem;
+  char data[256];
+  int32_t ints[8];
+  int64_t longs[8];
+  uint32_t uints[8];
+  uint64_t ulongs[8];
+#ifndef CMP_NO_FLOAT
+  float floats[8];
+  double doubles[8];
+#endif
+  uint32_t size = 0;
+  uint32_t i;
+
+  (void)state;
+
+  /* Full-width runs broken up by compactly encoded elements */
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_array(&mem, 5));
+  assert_true(cmp_write_s32(&mem, -100000));
+  assert_true(cmp_write_s32(&mem, 7));
+  assert_true(cmp_write_integer(&mem, -3));
+  assert_true(cmp_write_s32(&mem, INT32_MIN));
+  assert_true(cmp_write_u16(&mem, 500));
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 8;
+  assert_true(cmp_read_int_array(&mem, ints, &size));
+  assert_int_equal(size, 5);
+  assert_int_equal(ints[0], -100000);
+  assert_int_equal(ints[1], 7);
+  assert_int_equal(ints[2], -3);
+  assert_int_equal(ints[3], INT32_MIN);
+  assert_int_equal(ints[4], 500);
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_long_array(&mem, longs, &size));
+  assert_true(longs[3] == INT32_MIN);
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_array(&mem, 4));
+  assert_true(cmp_write_u64(&mem, UINT64_MAX));
+  assert_true(cmp_write_u64(&mem, 2));
+  assert_true(cmp_write_u32(&mem, 3));
+  assert_true(cmp_write_uinteger(&mem, 9));
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 8;
+  assert_true(cmp_read_ulong_array(&mem, ulongs, &size));
+  assert_int_equal(size, 4);
+  assert_true(ulongs[0] == UINT64_MAX);
+  assert_true(ulongs[1] == 2);
+  assert_true(ulongs[2] == 3);
+  assert_true(ulongs[3] == 9);
+
+  /* Elements that don't fit the C type fail */
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 8;
+  assert_false(cmp_read_long_array(&mem, longs, &size));
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_array(&mem, 2));
+  assert_true(cmp_write_u64(&mem, 1));
+  assert_true(cmp_write_s64(&mem, INT64_MIN));
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 8;
+  assert_false(cmp_read_ulong_array(&mem, ulongs, &size));
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_long_array(&mem, longs, &size));
+  assert_true(longs[0] == 1);
+  assert_true(longs[1] == INT64_MIN);
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_array(&mem, 3));
+  for (i = 0; i < 3; i++) {
+    assert_true(cmp_write_u32(&mem, 0xFFFFFF00 + i));
+  }
+
+  /* The C array has to be big enough */
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 2;
+  assert_false(cmp_read_uint_array(&mem, uints, &size));
+  assert_int_equal(size, 3);
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_uint_array(&mem, uints, &size));
+  assert_true(uints[2] == 0xFFFFFF02);
+
+  /* Truncated arrays fail */
+  cmp_init_mem_reader(&mem, data, 1 + 5 + 3);
+  size = 8;
+  assert_false(cmp_read_uint_array(&mem, uints, &size));
+
+#ifndef CMP_NO_FLOAT
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_array(&mem, 4));
+  assert_true(cmp_write_double(&mem, 1.1));
+  assert_true(cmp_write_double(&mem, -2.5));
+  assert_true(cmp_write_float(&mem, 0.5f));
+  assert_true(cmp_write_double(&mem, 1e300));
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 8;
+  assert_true(cmp_read_double_array(&mem, doubles, &size));
+  assert_int_equal(size, 4);
+  assert_true(doubles[0] == 1.1);
+  assert_true(doubles[1] == -2.5);
+  assert_true(doubles[2] == 0.5);
+  assert_true(doubles[3] == 1e300);
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_false(cmp_read_float_array(&mem, floats, &size));
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_array(&mem, 2));
+  assert_true(cmp_write_float(&mem, 1.5f));
+  assert_true(cmp_write_float(&mem, -3.25f));
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 8;
+  assert_true(cmp_read_float_array(&mem, floats, &size));
+  assert_true(floats[0] == 1.5f);
+  assert_true(floats[1] == -3.25f);
+#endif
+
+  /* Writers pick one width for every element */
+  ints[0] = -3;
+  ints[1] = 100;
+  ints[2] = 0;
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_int_array(&mem, ints, 3));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + 3);
+  ints[1] = 1000;
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_int_array(&mem, ints, 3));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + (3 * 3));
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 8;
+  assert_true(cmp_read_int_array(&mem, ints, &size));
+  assert_int_equal(size, 3);
+  assert_int_equal(ints[0], -3);
+  assert_int_equal(ints[1], 1000);
+  assert_int_equal(ints[2], 0);
+
+  longs[0] = INT64_MIN;
+  longs[1] = INT64_MAX;
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_long_array(&mem, longs, 2));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + (2 * 9));
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_long_array(&mem, longs, &size));
+  assert_true(longs[0] == INT64_MIN);
+  assert_true(longs[1] == INT64_MAX);
+
+  uints[0] = 200;
+  uints[1] = 255;
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_uint_array(&mem, uints, 2));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + (2 * 2));
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_uint_array(&mem, uints, &size));
+  assert_true(uints[0] == 200);
+  assert_true(uints[1] == 255);
+
+  ulongs[0] = 1;
+  ulongs[1] = UINT64_C(0x100000000);
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_ulong_array(&mem, ulongs, 2));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + (2 * 9));
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_ulong_array(&mem, ulongs, &size));
+  assert_true(ulongs[0] == 1);
+  assert_true(ulongs[1] == UINT64_C(0x100000000));
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_ulong_array(&mem, ulongs, 0));
+  assert_int_equal(cmp_mem_tell(&mem), 1);
+
+#ifndef CMP_NO_FLOAT
+  doubles[0] = 0.5;
+  doubles[1] = -2.0;
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_double_array(&mem, doubles, 2));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + (2 * 5));
+  doubles[1] = 1.1;
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_double_array(&mem, doubles, 2));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + (2 * 9));
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_double_array(&mem, doubles, &size));
+  assert_true(doubles[0] == 0.5);
+  assert_true(doubles[1] == 1.1);
+
+  /* Narrowed arrays read back as runs of floats */
+  for (i = 0; i < 8; i++)
+    doubles[i] = (double)i - 3.25;
+
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_double_array(&mem, doubles, 8));
+  assert_int_equal(cmp_mem_tell(&mem), 1 + (8 * 5));
+  assert_true(cmp_write_array(&mem, 3));
+  assert_true(cmp_write_float(&mem, 0.25f));
+  assert_true(cmp_write_double(&mem, 1.1));
+  assert_true(cmp_write_float(&mem, -8.0f));
+  assert_true(cmp_mem_seek(&mem, 0));
+  memset(doubles, 0, sizeof(doubles));
+  size = 8;
+  assert_true(cmp_read_double_array(&mem, doubles, &size));
+  assert_int_equal(size, 8);
+
+  for (i = 0; i < 8; i++)
+    assert_true(doubles[i] == (double)i - 3.25);
+
+  size = 8;
+  assert_true(cmp_read_double_array(&mem, doubles, &size));
+  assert_int_equal(size, 3);
+  assert_true(doubles[0] == 0.25);
+  assert_true(doubles[1] == 1.1);
+  assert_true(doubles[2] == -8.0);
+
+  floats[0] = 1.5f;
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_float_array(&mem, floats, 1));
+  assert_true(cmp_mem_seek(&mem, 0));
+  assert_true(cmp_read_float_array(&mem, floats, &size));
+  assert_int_equal(size, 1);
+  assert_true(floats[0] == 1.5f);
+#endif
+
+  /* Other backends read an element at a time */
+  setup_cmp_and_buf(&cmp, &buf);
+  assert_true(cmp_write_array(&cmp, 2));
+  assert_true(cmp_write_s32(&cmp, -1));
+  assert_true(cmp_write_s32(&cmp, 2));
+  M_BufferSeek(&buf, 0);
+  size = 8;
+  assert_true(cmp_read_int_array(&cmp, ints, &size));
+  assert_int_equal(size, 2);
+  assert_int_equal(ints[0], -1);
+  assert_int_equal(ints[1], 2);
+  teardown_cmp_and_buf(&cmp, &buf);
+
+  /* and are written to in blocks */
+  setup_cmp_and_buf(&cmp, &buf);
+  writer_successes = 2;
+  for (i = 0; i < 8; i++) {
+    ulongs[i] = UINT64_MAX - i;
+  }
+  assert_true(cmp_write_ulong_array(&cmp, ulongs, 8));
+  writer_successes = 1;
+  assert_false(cmp_write_ulong_array(&cmp, ulongs, 8));
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_tape(void **state) {
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_ctx_t mem;
+  cmp_tape_entry_t tape[32];
+  char data[128];
+  char str[8];
+  uint32_t size = 0;
+  uint32_t index = 0;
+  uint32_t u32 = 0;
+  size_t total;
+
+  (void)state;
+
+  /* {"a": [1, 2, 300], "b": {"x": "str", "y": [[1], bin]}, "c": nil} */
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_map(&mem, 3));
+  assert_true(cmp_write_str(&mem, "a", 1));   /*  1 */
+  assert_true(cmp_write_array(&mem, 3));      /*  2 */
+  assert_true(cmp_write_uinteger(&mem, 1));   /*  3 */
+  assert_true(cmp_write_uinteger(&mem, 2));   /*  4 */
+  assert_true(cmp_write_uinteger(&mem, 300)); /*  5 */
+  assert_true(cmp_write_str(&mem, "b", 1));   /*  6 */
+  assert_true(cmp_write_map(&mem, 2));        /*  7 */
+  assert_true(cmp_write_str(&mem, "x", 1));   /*  8 */
+  assert_true(cmp_write_str(&mem, "str", 3)); /*  9 */
+  assert_true(cmp_write_str(&mem, "y", 1));   /* 10 */
+  assert_true(cmp_write_array(&mem, 2));      /* 11 */
+  assert_true(cmp_write_array(&mem, 1));      /* 12 */
+  assert_true(cmp_write_uinteger(&mem, 1));   /* 13 */
+  assert_true(cmp_write_bin(&mem, "12", 2));  /* 14 */
+  assert_true(cmp_write_str(&mem, "c", 1));   /* 15 */
+  assert_true(cmp_write_nil(&mem));           /* 16 */
+  assert_true(cmp_write_nil(&mem));
+  total = cmp_mem_tell(&mem) - 1;
+
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 32;
+  assert_true(cmp_build_tape(&mem, tape, &size));
+  assert_int_equal(size, 17);
+  assert_int_equal(cmp_mem_tell(&mem), total);
+
+  assert_int_equal(tape[0].type, CMP_TYPE_FIXMAP);
+  assert_int_equal(tape[0].size, 3);
+  assert_int_equal(tape[0].offset, 0);
+  assert_int_equal(tape[0].length, total);
+  assert_int_equal(tape[0].next, 17);
+  assert_int_equal(tape[2].type, CMP_TYPE_FIXARRAY);
+  assert_int_equal(tape[2].next, 6);
+  assert_int_equal(tape[2].length, 1 + 1 + 1 + 3);
+  assert_int_equal(tape[5].type, CMP_TYPE_UINT16);
+  assert_int_equal(tape[5].length, 3);
+  assert_int_equal(tape[7].next, 15);
+  assert_int_equal(tape[9].size, 3);
+  assert_int_equal(tape[9].length, 4);
+  assert_int_equal(tape[11].next, 15);
+  assert_int_equal(tape[12].next, 14);
+  assert_int_equal(tape[14].type, CMP_TYPE_BIN8);
+  assert_int_equal(tape[14].size, 2);
+  assert_int_equal(tape[16].type, CMP_TYPE_NIL);
+
+  /* Elements of flat and nested containers */
+  assert_true(cmp_tape_element(tape, 2, 2, &index));
+  assert_int_equal(index, 5);
+  assert_true(cmp_tape_seek(&mem, tape, index));
+  assert_true(cmp_read_uint(&mem, &u32));
+  assert_int_equal(u32, 300);
+  assert_true(cmp_tape_element(tape, 0, 4, &index));
+  assert_int_equal(index, 15);
+  assert_true(cmp_tape_seek(&mem, tape, index));
+  size = sizeof(str);
+  assert_true(cmp_read_str(&mem, str, &size));
+  assert_string_equal(str, "c");
+  assert_true(cmp_tape_element(tape, 7, 3, &index));
+  assert_int_equal(index, 11);
+  assert_true(cmp_tape_element(tape, 11, 1, &index));
+  assert_int_equal(index, 14);
+  assert_false(cmp_tape_element(tape, 11, 2, &index));
+  assert_false(cmp_tape_element(tape, 0, 6, &index));
+  assert_false(cmp_tape_element(tape, 1, 0, &index));
+
+  /* Scalars take one entry, and there has to be room for everything */
+  assert_true(cmp_mem_seek(&mem, total));
+  size = 1;
+  assert_true(cmp_build_tape(&mem, tape, &size));
+  assert_int_equal(size, 1);
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 16;
+  assert_false(cmp_build_tape(&mem, tape, &size));
+  assert_string_equal(cmp_strerror(&mem), "Tape is too small");
+  assert_true(cmp_mem_seek(&mem, 0));
+  size = 6;
+  assert_false(cmp_build_tape(&mem, tape, &size));
+
+  /* Truncated containers fail */
+  cmp_init_mem_reader(&mem, data, 10);
+  size = 32;
+  assert_false(cmp_build_tape(&mem, tape, &size));
+
+  /* Buffers too large for 32-bit offsets are rejected, not misindexed */
+  if (sizeof(size_t) > sizeof(uint32_t)) {
+    cmp_init_mem_reader(&mem, data, 10);
+    mem.buf_size = (size_t)UINT32_MAX;
+    mem.buf_size++;
+    size = 32;
+    assert_false(cmp_build_tape(&mem, tape, &size));
+    assert_string_equal(cmp_strerror(&mem), "Buffer too large (> 4 GiB)");
+  }
+
+  setup_cmp_and_buf(&cmp, &buf);
+  assert_true(cmp_write_nil(&cmp));
+  M_BufferSeek(&buf, 0);
+  size = 32;
+  assert_false(cmp_build_tape(&cmp, tape, &size));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Operation requires a memory context"
+  );
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_nodes(void **state) {
+  cmp_ctx_t mem;
+  cmp_ctx_t reader;
+  cmp_node_t root;
+  cmp_node_t node;
+  cmp_node_t element;
+  cmp_node_iter_t iter;
+  cmp_object_t obj;
+  char data[128];
+  const char *str = NULL;
+  uint32_t size = 0;
+  uint32_t u32 = 0;
+  int count = 0;
+
+  (void)state;
+
+  /* {1: "skip", "routes": [{"path": "/a"}, {"path": "/b"}], "port": 80} */
+  cmp_init_mem(&mem, data, sizeof(data));
+  assert_true(cmp_write_map(&mem, 3));
+  assert_true(cmp_write_uinteger(&mem, 1));
+  assert_true(cmp_write_str(&mem, "skip", 4));
+  assert_true(cmp_write_str(&mem, "routes", 6));
+  assert_true(cmp_write_array(&mem, 2));
+  assert_true(cmp_write_map(&mem, 1));
+  assert_true(cmp_write_str(&mem, "path", 4));
+  assert_true(cmp_write_str(&mem, "/a", 2));
+  assert_true(cmp_write_map(&mem, 1));
+  assert_true(cmp_write_str(&mem, "path", 4));
+  assert_true(cmp_write_str(&mem, "/b", 2));
+  assert_true(cmp_write_str(&mem, "port", 4));
+  assert_true(cmp_write_uinteger(&mem, 80));
+
+  assert_false(cmp_node_root(&root, data, 0));
+  assert_true(cmp_node_root(&root, data, cmp_mem_tell(&mem)));
+  assert_true(cmp_node_object(&root, &obj));
+  assert_int_equal(obj.type, CMP_TYPE_FIXMAP);
+
+  assert_true(cmp_node_value(&root, "port", 4, &node));
+  cmp_node_reader(&node, &reader);
+  assert_true(cmp_read_uint(&reader, &u32));
+  assert_int_equal(u32, 80);
+
+  assert_true(cmp_node_value(&root, "routes", 6, &node));
+  assert_true(cmp_node_element(&node, 1, &element));
+  assert_true(cmp_node_value(&element, "path", 4, &element));
+  cmp_node_reader(&element, &reader);
+  assert_true(cmp_read_str_view(&reader, &str, &size));
+  assert_int_equal(size, 2);
+  assert_memory_equal(str, "/b", 2);
+
+  assert_false(cmp_node_element(&node, 2, &element));
+  assert_false(cmp_node_value(&root, "missing", 7, &element));
+  assert_false(cmp_node_value(&root, "rout", 4, &element));
+  assert_false(cmp_node_value(&node, "path", 4, &element));
+  assert_false(cmp_node_element(&root, 0, &element));
+
+  assert_true(cmp_node_iterate(&node, &iter));
+  while (cmp_node_next(&iter, &element)) {
+    assert_true(cmp_node_object(&element, &obj));
+    assert_int_equal(obj.type, CMP_TYPE_FIXMAP);
+    count++;
+  }
+  assert_int_equal(count, 2);
+
+  count = 0;
+  assert_true(cmp_node_iterate(&root, &iter));
+  while (cmp_node_next(&iter, &element)) {
+    count++;
+  }
+  assert_int_equal(count, 6);
+
+  assert_true(cmp_node_value(&root, "port", 4, &node));
+  assert_false(cmp_node_iterate(&node, &iter));
+
+  /* Truncated documents fail instead of running off the end */
+  assert_true(cmp_node_root(&root, data, 20));
+  assert_false(cmp_node_value(&root, "port", 4, &node));
+}
+
+/* Appends each matched string to the buffer in `data`, separated by spaces */
+static bool collect_str(cmp_ctx_t *ctx, const cmp_object_t *obj, void *data) {
+  char *out = (char *)data;
+  char str[16];
+
+  if (!cmp_object_to_str(ctx, obj, str, sizeof(str))) {
+    assert_true(cmp_skip_object_rest(ctx, obj));
+    return true;
+  }
+
+  if (*out) {
+    strcat(out, " ");
+  }
+
+  strcat(out, str);
+
+  return strlen(out) < 20;
+}
+
+static void write_user(cmp_ctx_t *cmp, const char *name, const char *city) {
+  assert_true(cmp_write_map(cmp, 3));
+  assert_true(cmp_write_str(cmp, "name", 4));
+  assert_true(cmp_write_str(cmp, name, (uint32_t)strlen(name)));
+  assert_true(cmp_write_str(cmp, "tags", 4));
+  assert_true(cmp_write_array(cmp, 2));
+  assert_true(cmp_write_str(cmp, "x", 1));
+  assert_true(cmp_write_map(cmp, 1));
+  assert_true(cmp_write_str(cmp, "city", 4));
+  assert_true(cmp_write_str(cmp, "decoy", 5));
+  assert_true(cmp_write_str(cmp, "address", 7));
+  assert_true(cmp_write_map(cmp, 2));
+  assert_true(cmp_write_uinteger(cmp, 7));
+  assert_true(cmp_write_nil(cmp));
+  assert_true(cmp_write_str(cmp, "city", 4));
+  assert_true(cmp_write_str(cmp, city, (uint32_t)strlen(city)));
+}
+
+void test_paths(void **state) {
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_path_step_t steps[8];
+  char out[64];
+  uint32_t count = 0;
+
+  (void)state;
+
+  count = 8;
+  assert_true(cmp_path_compile(steps, &count, "users[*].address.city"));
+  assert_int_equal(count, 4);
+  count = 8;
+  assert_true(cmp_path_compile(steps, &count, ".a[12].*[0]"));
+  assert_int_equal(count, 4);
+  count = 8;
+  assert_true(cmp_path_compile(steps, &count, ""));
+  assert_int_equal(count, 0);
+  count = 8;
+  assert_false(cmp_path_compile(steps, &count, "a..b"));
+  count = 8;
+  assert_false(cmp_path_compile(steps, &count, "a[x]"));
+  count = 8;
+  assert_false(cmp_path_compile(steps, &count, "a[1"));
+  count = 8;
+  assert_false(cmp_path_compile(steps, &count, "a[]"));
+  count = 8;
+  assert_false(cmp_path_compile(steps, &count, "a[1]b"));
+  count = 8;
+  assert_false(cmp_path_compile(steps, &count, "a[99999999999]"));
+  count = 2;
+  assert_false(cmp_path_compile(steps, &count, "a.b.c"));
+
+  /* Two records, read from a streaming backend one after the other */
+  setup_cmp_and_buf(&cmp, &buf);
+  assert_true(cmp_write_map(&cmp, 2));
+  assert_true(cmp_write_str(&cmp, "count", 5));
+  assert_true(cmp_write_uinteger(&cmp, 2));
+  assert_true(cmp_write_str(&cmp, "users", 5));
+  assert_true(cmp_write_array(&cmp, 2));
+  write_user(&cmp, "ann", "Oslo");
+  write_user(&cmp, "bob", "Rome");
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_str(&cmp, "users", 5));
+  assert_true(cmp_write_array(&cmp, 1));
+  write_user(&cmp, "cy", "Lima");
+  assert_true(cmp_write_nil(&cmp));
+
+  count = 8;
+  assert_true(cmp_path_compile(steps, &count, "users[*].address.city"));
+  M_BufferSeek(&buf, 0);
+  out[0] = 0;
+  assert_true(cmp_path_execute(&cmp, steps, count, collect_str, out));
+  assert_string_equal(out, "Oslo Rome");
+  assert_true(cmp_path_execute(&cmp, steps, count, collect_str, out));
+  assert_string_equal(out, "Oslo Rome Lima");
+  assert_true(cmp_read_nil(&cmp));
+
+  count = 8;
+  assert_true(cmp_path_compile(steps, &count, "users[1].*"));
+  M_BufferSeek(&buf, 0);
+  out[0] = 0;
+  assert_true(cmp_path_execute(&cmp, steps, count, collect_str, out));
+  assert_string_equal(out, "bob");
+  assert_true(cmp_path_execute(&cmp, steps, count, collect_str, out));
+  assert_string_equal(out, "bob");
+  assert_true(cmp_read_nil(&cmp));
+
+  /* Mismatched steps skip the object */
+  count = 8;
+  assert_true(cmp_path_compile(steps, &count, "[0].users"));
+  M_BufferSeek(&buf, 0);
+  out[0] = 0;
+  assert_true(cmp_path_execute(&cmp, steps, count, collect_str, out));
+  assert_true(cmp_path_execute(&cmp, steps, count, collect_str, out));
+  assert_string_equal(out, "");
+  assert_true(cmp_read_nil(&cmp));
+
+  /* Handlers can stop early */
+  count = 8;
+  assert_true(cmp_path_compile(steps, &count, "users[*].tags[1].city"));
+  M_BufferSeek(&buf, 0);
+  strcpy(out, "0123456789012345678");
+  assert_true(cmp_path_execute(&cmp, steps, count, collect_str, out));
+  assert_string_equal(out, "0123456789012345678 decoy");
+
+  /* Truncated records fail */
+  M_BufferSeek(&buf, 0);
+  buf.size = 30;
+  assert_false(cmp_path_execute(&cmp, steps, count, collect_str, out));
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_segments(void **state) {
+  char serial[2048];
+  char parallel[2048];
+  char buffers[4][512];
+  cmp_segment_t segments[4];
+  cmp_ctx_t cmp;
+  cmp_ctx_t worker;
+  uint32_t i;
+  uint32_t j;
+  size_t size;
+
+  (void)state;
+
+  cmp_init_mem(&cmp, serial, sizeof(serial));
+  assert_true(cmp_write_array(&cmp, 200));
+
+  for (i = 0; i < 200; i++)
+    assert_true(cmp_write_integer(&cmp, (int64_t)i * i - 1000));
+
+  size = cmp_mem_tell(&cmp);
+
+  /* Each worker encodes a quarter of the elements, the last one none */
+  for (i = 0; i < 4; i++) {
+    cmp_init_mem(&worker, buffers[i], sizeof(buffers[i]));
+
+    for (j = i * 67; j < 200 && j < (i + 1) * 67; j++)
+      assert_true(cmp_write_integer(&worker, (int64_t)j * j - 1000));
+
+    segments[i].data = buffers[i];
+    segments[i].size = cmp_mem_tell(&worker);
+  }
+
+  assert_int_equal(segments[3].size, 0);
+
+  cmp_init_mem(&cmp, parallel, sizeof(parallel));
+  assert_true(cmp_write_array_segments(&cmp, 200, segments, 4));
+  assert_int_equal(cmp_mem_tell(&cmp), size);
+  assert_memory_equal(parallel, serial, size);
+
+  /* Running out of room fails */
+  cmp_init_mem(&cmp, parallel, size - 1);
+  assert_false(cmp_write_array_segments(&cmp, 200, segments, 4));
+}
+
+void test_index(void **state) {
+  char records[1024];
+  char index_data[512];
+  cmp_index_t index;
+  cmp_ctx_t cmp;
+  cmp_ctx_t writer;
+  uint64_t offsets[50];
+  uint64_t offset;
+  uint32_t stride;
+  uint32_t skip;
+  uint32_t i;
+  size_t size;
+
+  (void)state;
+
+  cmp_init_mem(&cmp, records, sizeof(records));
+
+  for (i = 0; i < 50; i++) {
+    offsets[i] = cmp_mem_tell(&cmp);
+    assert_true(cmp_write_array(&cmp, 2));
+    assert_true(cmp_write_uinteger(&cmp, (uint64_t)i * 1000));
+    assert_true(cmp_write_str(&cmp, "record", (i % 7) + 1));
+  }
+
+  size = cmp_mem_tell(&cmp);
+
+  for (stride = 1; stride <= 8; stride++) {
+    cmp_init_mem(&writer, index_data, sizeof(index_data));
+    assert_true(cmp_write_index_header(&writer, stride, 50));
+    assert_int_equal(cmp_mem_tell(&writer), CMP_INDEX_HEADER_SIZE);
+
+    for (i = 0; i < 50; i += stride)
+      assert_true(cmp_write_index_entry(&writer, offsets[i]));
+
+    cmp_init_mem_reader(&writer, index_data, cmp_mem_tell(&writer));
+    assert_true(cmp_index_open(&writer, &index));
+
+    /* Every record can be found, and read from where the index says */
+    cmp_init_mem_reader(&cmp, records, size);
+
+    for (i = 0; i < 50; i++) {
+      assert_true(cmp_index_find(&index, i, &offset, &skip));
+      assert_true(offset == offsets[i - (i % stride)]);
+      assert_int_equal(skip, i % stride);
+      assert_true(cmp_index_seek(&cmp, &index, i));
+      assert_true(cmp_mem_tell(&cmp) == offsets[i]);
+    }
+
+    assert_false(cmp_index_find(&index, 50, &offset, &skip));
+    assert_false(cmp_index_seek(&cmp, &index, 50));
+  }
+
+  /* Indexes have to hold one entry per stride records */
+  cmp_init_mem(&writer, index_data, sizeof(index_data));
+  assert_true(cmp_write_array(&writer, 3));
+  assert_true(cmp_write_uinteger(&writer, 4));
+  assert_true(cmp_write_uinteger(&writer, 50));
+  assert_true(cmp_write_bin(&writer, records, 8));
+  cmp_init_mem_reader(&writer, index_data, cmp_mem_tell(&writer));
+  assert_false(cmp_index_open(&writer, &index));
+  assert_string_equal(cmp_strerror(&writer), "Invalid record index");
+
+  /* ...and all of them have to be there */
+  cmp_init_mem(&writer, index_data, sizeof(index_data));
+  assert_true(cmp_write_index_header(&writer, 4, 50));
+  assert_true(cmp_write_index_entry(&writer, 0));
+  cmp_init_mem_reader(&writer, index_data, cmp_mem_tell(&writer));
+  assert_false(cmp_index_open(&writer, &index));
+
+  cmp_init_mem(&writer, index_data, sizeof(index_data));
+  assert_false(cmp_write_index_header(&writer, 0, 50));
+  assert_false(cmp_write_index_header(&writer, 1, UINT64_C(0x100000000)));
+
+  /* Empty files have empty indexes */
+  cmp_init_mem(&writer, index_data, sizeof(index_data));
+  assert_true(cmp_write_index_header(&writer, 1, 0));
+  cmp_init_mem_reader(&writer, index_data, CMP_INDEX_HEADER_SIZE);
+  assert_true(cmp_index_open(&writer, &index));
+  assert_false(cmp_index_find(&index, 0, &offset, &skip));
+
+  /* Seeking needs the records in memory */
+  cmp_init(&cmp, NULL, buf_reader, buf_skipper, buf_writer);
+  assert_false(cmp_index_seek(&cmp, &index, 0));
+}
+
+static void check_json(cmp_ctx_t *in, const char *expected) {
+  char json[1024];
+  cmp_ctx_t out;
+
+  cmp_init_mem(&out, json, sizeof(json) - 1);
+  assert_true(cmp_write_json(in, &out));
+  json[cmp_mem_tell(&out)] = 0;
+  assert_string_equal(json, expected);
+}
+
+#ifndef CMP_NO_FLOAT
+/* Switches to a locale whose decimal point is a comma, if there is one */
+static bool set_comma_locale(void) {
+  static const char *const names[] = {
+    "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8",
+    "fr_FR", "German", "French"
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (setlocale(LC_NUMERIC, names[i]) &&
+        localeconv()->decimal_point[0] == ',') {
+      return true;
+    }
+  }
+
+  setlocale(LC_NUMERIC, "C");
+  return false;
+}
+#endif
+
+void test_json(void **state) {
+  static const uint8_t bytes[] = { 0xFB, 0xFF, 0x00, 'c', 'm' };
+  char long_str[301];
+  char long_json[320];
+  char data[1024];
+  char json[32];
+  cmp_ctx_t cmp;
+  cmp_ctx_t out;
+  buf_t buf;
+  size_t size;
+  int i;
+
+  (void)state;
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 7));
+  assert_true(cmp_write_str(&cmp, "ints", 4));
+  assert_true(cmp_write_array(&cmp, 6));
+  assert_true(cmp_write_integer(&cmp, 0));
+  assert_true(cmp_write_integer(&cmp, -1));
+  assert_true(cmp_write_integer(&cmp, 1234567));
+  assert_true(cmp_write_integer(&cmp, -300));
+  assert_true(cmp_write_integer(&cmp, INT64_MIN));
+  assert_true(cmp_write_uinteger(&cmp, UINT64_MAX));
+  assert_true(cmp_write_str(&cmp, "text", 4));
+  assert_true(cmp_write_str(&cmp, "a \"quoted\"\\path\n\ttab\x01", 21));
+  assert_true(cmp_write_str(&cmp, "bin", 3));
+  assert_true(cmp_write_array(&cmp, 3));
+  assert_true(cmp_write_bin(&cmp, bytes, 3));
+  assert_true(cmp_write_bin(&cmp, bytes, 4));
+  assert_true(cmp_write_bin(&cmp, bytes, 5));
+  assert_true(cmp_write_str(&cmp, "ext", 3));
+  assert_true(cmp_write_fixext1(&cmp, -2, bytes));
+  assert_true(cmp_write_uinteger(&cmp, 42));
+  assert_true(cmp_write_array(&cmp, 0));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_map(&cmp, 0));
+  assert_true(cmp_write_true(&cmp));
+  assert_true(cmp_write_array(&cmp, 2));
+  assert_true(cmp_write_false(&cmp));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_str(&cmp, "after", 5));
+  size = cmp_mem_tell(&cmp);
+
+#define DOCUMENT_JSON                                                         \
+  "{\"ints\":[0,-1,1234567,-300,-9223372036854775808,18446744073709551615],"  \
+  "\"text\":\"a \\\"quoted\\\"\\\\path\\n\\ttab\\u0001\","                   \
+  "\"bin\":[\"+/8A\",\"+/8AYw==\",\"+/8AY20=\"],"                               \
+  "\"ext\":{\"type\":-2,\"data\":\"+w==\"},"                                    \
+  "\"42\":[],\"null\":{},\"true\":[false,null]}"
+
+  /* From memory, where strings are escaped where they lie... */
+  cmp_init_mem_reader(&cmp, data, size);
+  check_json(&cmp, DOCUMENT_JSON);
+  check_json(&cmp, "\"after\"");
+
+  /* ...and from a stream */
+  setup_cmp_and_buf(&cmp, &buf);
+  M_BufferWrite(&buf, data, size);
+  M_BufferSeek(&buf, 0);
+  check_json(&cmp, DOCUMENT_JSON);
+  check_json(&cmp, "\"after\"");
+
+#undef DOCUMENT_JSON
+
+  /* Long strings don't fit in a block or a chunk */
+  for (i = 0; i < 300; i++)
+    long_str[i] = (i % 50) == 49 ? '\n' : 'x';
+  long_str[300] = 0;
+
+  strcpy(long_json, "\"");
+  for (i = 0; i < 6; i++) {
+    strncat(long_json, long_str, 49);
+    strcat(long_json, "\\n");
+  }
+  strcat(long_json, "\"");
+
+  M_BufferClear(&buf);
+  assert_true(cmp_write_str(&cmp, long_str, 300));
+  assert_true(cmp_write_str(&cmp, long_str, 300));
+  M_BufferSeek(&buf, 0);
+  check_json(&cmp, long_json);
+  cmp_init_mem_reader(&cmp, buf.data, buf.size);
+  check_json(&cmp, long_json);
+  cmp_init_mem_reader(&cmp, buf.data, buf.size);
+  assert_true(cmp_skip_object_no_limit(&cmp));
+  cmp_init_mem(&out, json, sizeof(json));
+  assert_false(cmp_write_json(&cmp, &out));
+
+#ifndef CMP_NO_FLOAT
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_array(&cmp, 6));
+  assert_true(cmp_write_double(&cmp, 0.1));
+  assert_true(cmp_write_float(&cmp, 0.1f));
+  assert_true(cmp_write_double(&cmp, -1.5e300));
+  assert_true(cmp_write_double(&cmp, 1. / 3.));
+  assert_true(cmp_write_float(&cmp, 3.0f));
+  assert_true(cmp_write_double(&cmp, 0. / 0.));
+  cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+  check_json(&cmp, "[0.1,0.1,-1.5e+300,0.3333333333333333,3,null]");
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_float(&cmp, 2.5f));
+  assert_true(cmp_write_nil(&cmp));
+  cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+  check_json(&cmp, "{\"2.5\":null}");
+
+  /* Decimal points are always '.', whatever the locale's is */
+  if (set_comma_locale()) {
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_array(&cmp, 4));
+    assert_true(cmp_write_double(&cmp, 1.5));
+    assert_true(cmp_write_double(&cmp, 0.1));
+    assert_true(cmp_write_float(&cmp, 0.1f));
+    assert_true(cmp_write_double(&cmp, -2.5e-300));
+    cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+    check_json(&cmp, "[1.5,0.1,0.1,-2.5e-300]");
+    setlocale(LC_NUMERIC, "C");
+  }
+#endif
+
+  /* Keys can't be containers */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_array(&cmp, 0));
+  assert_true(cmp_write_nil(&cmp));
+  cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+  cmp_init_mem(&out, json, sizeof(json));
+  assert_false(cmp_write_json(&cmp, &out));
+  assert_string_equal(cmp_strerror(&cmp), "Invalid type");
+
+  /* Nesting is limited */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  for (i = 0; i < 65; i++)
+    assert_true(cmp_write_array(&cmp, 1));
+  assert_true(cmp_write_nil(&cmp));
+  cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+  cmp_init_mem(&out, json, sizeof(json));
+  assert_false(cmp_write_json(&cmp, &out));
+  assert_string_equal(
+    cmp_strerror(&cmp), "JSON nested too deeply"
+  );
+
+  /* Truncated input fails */
+  cmp_init_mem_reader(&cmp, data, 10);
+  cmp_init_mem(&out, json, sizeof(json));
+  assert_false(cmp_write_json(&cmp, &out));
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+static bool from_json(cmp_ctx_t *cmp, char *data, size_t size,
+                                     const char *json) {
+  uint32_t sizes[8];
+
+  cmp_init_mem(cmp, data, size);
+
+  return cmp_write_from_json(cmp, json, strlen(json), sizes, 8);
+}
+
+void test_from_json(void **state) {
+  static const char *const invalid[] = {
+    "", " ", "[1,]", "[1 2]", "[,1]", "{\"a\" 1}", "{\"a\":}", "{1:2}",
+    "{\"a\":1,}", "[}", "[", "[]]", "01", "-", "1.", "1.e5", "1e", "+1",
+    "tru", "nul", "\"abc", "\"a\x01\"", "\"\\x\"", "\"\\u12\"",
+    "\"\\ud800\"", "\"\\udc00\"", "\"\\ud800\\u0041\"", "1 2", "[] x"
+  };
+  char data[1024];
+  char json[1024];
+  char str[64];
+  uint32_t sizes[4];
+  cmp_ctx_t cmp;
+  cmp_ctx_t out;
+  cmp_object_t obj;
+  uint32_t size;
+  size_t i;
+
+  (void)state;
+
+  /* Round trips come out the same, less the whitespace */
+  assert_true(from_json(&cmp, data, sizeof(data),
+    " {\"ints\" : [0, -1, 127, 128, -33, 70000, -9223372036854775808,\n"
+    "  18446744073709551615], \"t\": true, \"f\": false,\r\n\t"
+    "\"n\": null, \"empty\": [{}, [], \"\"], \"nested\": [[[1]]]} "
+  ));
+  cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+  cmp_init_mem(&out, json, sizeof(json) - 1);
+  assert_true(cmp_write_json(&cmp, &out));
+  json[cmp_mem_tell(&out)] = 0;
+  assert_string_equal(json,
+    "{\"ints\":[0,-1,127,128,-33,70000,-9223372036854775808,"
+    "18446744073709551615],\"t\":true,\"f\":false,"
+    "\"n\":null,\"empty\":[{},[],\"\"],\"nested\":[[[1]]]}"
+  );
+
+  /* Integers take their narrowest encodings */
+  assert_true(from_json(&cmp, data, sizeof(data), "[-33, 128, 70000]"));
+  assert_int_equal(cmp_mem_tell(&cmp), 1 + 2 + 2 + 5);
+
+  /* Large containers get larger headers */
+  assert_true(from_json(&cmp, data, sizeof(data),
+    "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16]"
+  ));
+  cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+  assert_true(cmp_read_object(&cmp, &obj));
+  assert_int_equal(obj.type, CMP_TYPE_ARRAY16);
+  assert_int_equal(obj.as.array_size, 17);
+
+  /* Escapes are decoded, to UTF-8 for \u escapes */
+  assert_true(from_json(&cmp, data, sizeof(data),
+    "\"q\\\"b\\\\s\\/\\b\\f\\n\\r\\t\\u00e9\\u20AC\\ud83d\\ude00 plain text\""
+  ));
+  cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+  size = sizeof(str);
+  assert_true(cmp_read_str(&cmp, str, &size));
+  assert_string_equal(str,
+    "q\"b\\s/\b\f\n\r\t\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80 plain text"
+  );
+
+#ifndef CMP_NO_FLOAT
+  {
+    float f = 0.f;
+    double d = 0.;
+
+    /* Other numbers are floats when that loses nothing, or doubles */
+    assert_true(from_json(&cmp, data, sizeof(data),
+      "[1.5, 0.1, -2.5e-3, 1e10, 18446744073709551616]"
+    ));
+    cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+    assert_true(cmp_read_array(&cmp, &size));
+    assert_true(cmp_read_float(&cmp, &f));
+    assert_true(f == 1.5f);
+    assert_true(cmp_read_double(&cmp, &d));
+    assert_true(d == 0.1);
+    assert_true(cmp_read_double(&cmp, &d));
+    assert_true(d == -2.5e-3);
+    assert_true(cmp_read_float(&cmp, &f));
+    assert_true(f == 1e10f);
+    assert_true(cmp_read_float(&cmp, &f));
+    assert_true(f == 18446744073709551616.f);
+
+    /* Numbers can be any length */
+    memset(json, '0', 300);
+    memcpy(json, "[0.", 3);
+    memcpy(json + 299, "1, 1", 4);
+    memset(json + 303, '0', 100);
+    memcpy(json + 403, ".5e-100, 1e-400]", 17);
+    assert_true(from_json(&cmp, data, sizeof(data), json));
+    cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+    assert_true(cmp_read_array(&cmp, &size));
+    assert_int_equal(size, 3);
+    assert_true(cmp_read_double(&cmp, &d));
+    assert_true(d == 1e-297);
+    assert_true(cmp_read_float(&cmp, &f));
+    assert_true(f == 1.f);
+
+    /* Numbers too small for a double are 0 */
+    assert_true(cmp_read_float(&cmp, &f));
+    assert_true(f == 0.f);
+
+    /* But ones too large for a double are errors */
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_false(cmp_write_from_json(&cmp, "[1e400]", 7, sizes, 4));
+    assert_string_equal(cmp_strerror(&cmp), "JSON number out of range");
+    assert_false(from_json(&cmp, data, sizeof(data), "-1e309"));
+
+    /* The locale's decimal point doesn't matter */
+    if (set_comma_locale()) {
+      assert_true(from_json(&cmp, data, sizeof(data), "[1.5, 0.1]"));
+      setlocale(LC_NUMERIC, "C");
+      cmp_init_mem_reader(&cmp, data, cmp_mem_tell(&cmp));
+      assert_true(cmp_read_array(&cmp, &size));
+      assert_true(cmp_read_float(&cmp, &f));
+      assert_true(f == 1.5f);
+      assert_true(cmp_read_double(&cmp, &d));
+      assert_true(d == 0.1);
+    }
+  }
+#else
+  assert_false(from_json(&cmp, data, sizeof(data), "1.5"));
+#endif
+
+  for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    assert_false(from_json(&cmp, data, sizeof(data), invalid[i]));
+
+  /* The sizes have to fit */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_false(cmp_write_from_json(&cmp, "[[], {}]", 8, sizes, 2));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Too many JSON containers for the sizes given"
+  );
+  assert_true(cmp_write_from_json(&cmp, "[[], {}]", 8, sizes, 3));
+
+  /* Nesting is limited */
+  memset(json, '[', 65);
+  memset(json + 65, ']', 65);
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_false(cmp_write_from_json(&cmp, json, 130, sizes, 4));
+
+  /* So is the output */
+  cmp_init_mem(&cmp, data, 3);
+  assert_false(cmp_write_from_json(&cmp, "[1, 2, 3]", 9, sizes, 4));
+}
+
+/* Adds up the "n" of every map record, leaving nil records unread */
+static bool sum_record(cmp_ctx_t *ctx, void *data) {
+  const uint8_t *marker = (const uint8_t *)ctx->buf + cmp_mem_tell(ctx);
+  uint32_t size = 0;
+  uint32_t n;
+  char key[8];
+
+  if (*marker == 0xC0)
+    return true;
+
+  if (!cmp_read_map(ctx, &size))
+    return false;
+
+  while (size--) {
+    n = sizeof(key);
+
+    if (!cmp_read_str(ctx, key, &n))
+      return false;
+
+    if (strcmp(key, "n") != 0) {
+      if (!cmp_skip_object_no_limit(ctx))
+        return false;
+    }
+    else if (!cmp_read_uint(ctx, &n)) {
+      return false;
+    }
+    else {
+      *(uint32_t *)data += n;
+    }
+  }
+
+  return true;
+}
+
+/* Counts maps whose first key is "pad", reading nothing past that key */
+static bool count_padded_record(cmp_ctx_t *ctx, void *data) {
+  cmp_object_t obj;
+  uint32_t n;
+  char key[8];
+
+  if (!cmp_read_object(ctx, &obj))
+    return false;
+
+  if (!cmp_object_is_map(&obj))
+    return true;
+
+  n = sizeof(key);
+
+  if (!cmp_read_str(ctx, key, &n))
+    return false;
+
+  if (strcmp(key, "pad") == 0)
+    (*(uint32_t *)data)++;
+
+  return true;
+}
+
+void test_records(void **state) {
+  static const char padding[] = "0123456789";
+  cmp_chunk_t chunks[8];
+  char data[4096];
+  cmp_ctx_t cmp;
+  cmp_ctx_t worker;
+  uint32_t count;
+  uint32_t sum;
+  uint32_t i;
+  size_t size;
+
+  (void)state;
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+
+  for (i = 0; i < 100; i++) {
+    if (i % 10 == 9) {
+      assert_true(cmp_write_nil(&cmp));
+      continue;
+    }
+
+    assert_true(cmp_write_map(&cmp, 2));
+    assert_true(cmp_write_str(&cmp, "pad", 3));
+    assert_true(cmp_write_str(&cmp, padding, i % 10));
+    assert_true(cmp_write_str(&cmp, "n", 1));
+    assert_true(cmp_write_uinteger(&cmp, i));
+  }
+
+  size = cmp_mem_tell(&cmp);
+
+  /* Chunks are about the same size and cover every record */
+  cmp_init_mem_reader(&cmp, data, size);
+  count = 4;
+  assert_true(cmp_partition_records(&cmp, chunks, &count));
+  assert_int_equal(count, 4);
+  assert_int_equal(chunks[0].offset, 0);
+
+  for (i = 1; i < count; i++) {
+    assert_int_equal(
+      chunks[i].offset, chunks[i - 1].offset + chunks[i - 1].size
+    );
+    assert_true(chunks[i - 1].size >= size / 4);
+  }
+
+  assert_int_equal(chunks[3].offset + chunks[3].size, size);
+
+  /* Each chunk is processed on its own */
+  sum = 0;
+
+  for (i = 0; i < count; i++) {
+    assert_true(
+      cmp_process_records(&worker, data, &chunks[i], sum_record, &sum)
+    );
+  }
+
+  /* 0 through 99, less the nils in place of 9, 19, ... 99 */
+  assert_int_equal(sum, 4950 - 540);
+
+  /* Handlers can read just part of a record */
+  sum = 0;
+
+  for (i = 0; i < count; i++) {
+    assert_true(cmp_process_records(
+      &worker, data, &chunks[i], count_padded_record, &sum
+    ));
+  }
+
+  assert_int_equal(sum, 90);
+
+  /* There are never more chunks than records */
+  cmp_init_mem_reader(&cmp, data, 19);
+  count = 8;
+  assert_true(cmp_partition_records(&cmp, chunks, &count));
+  assert_int_equal(count, 2);
+  count = 0;
+  assert_false(cmp_partition_records(&cmp, chunks, &count));
+  assert_string_equal(cmp_strerror(&cmp), "No room for any chunks");
+
+  /* Records can't be cut short */
+  cmp_init_mem_reader(&cmp, data, size - 2);
+  count = 4;
+  assert_false(cmp_partition_records(&cmp, chunks, &count));
+
+  /* Handlers can stop processing, and can't read past their chunk */
+  chunks[0].offset = 0;
+  chunks[0].size = 10;
+  assert_false(
+    cmp_process_records(&worker, data, &chunks[0], sum_record, &sum)
+  );
+
+  /* Partitioning needs the data in memory */
+  cmp_init(&cmp, NULL, buf_reader, buf_skipper, buf_writer);
+  count = 4;
+  assert_false(cmp_partition_records(&cmp, chunks, &count));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Operation requires a memory context"
+  );
+}
+
+static void check_keys(cmp_ctx_t *cmp, const cmp_keys_t *keys) {
+  uint32_t size = 0;
+  uint8_t id;
+
+  assert_true(cmp_read_map(cmp, &size));
+  assert_int_equal(size, 6);
+  assert_true(cmp_read_key(cmp, keys, &id));
+  assert_int_equal(id, 2);
+  assert_true(cmp_skip_object_no_limit(cmp));
+  assert_true(cmp_read_key(cmp, keys, &id));
+  assert_int_equal(id, CMP_KEY_UNKNOWN);
+  assert_true(cmp_skip_object_no_limit(cmp));
+  assert_true(cmp_read_key(cmp, keys, &id));
+  assert_int_equal(id, CMP_KEY_UNKNOWN);
+  assert_true(cmp_read_uint(cmp, &size));
+  assert_int_equal(size, 7);
+  assert_true(cmp_read_key(cmp, keys, &id));
+  assert_int_equal(id, CMP_KEY_UNKNOWN);
+  assert_true(cmp_skip_object_no_limit(cmp));
+  assert_true(cmp_read_key(cmp, keys, &id));
+  assert_int_equal(id, 3);
+  assert_true(cmp_skip_object_no_limit(cmp));
+  assert_true(cmp_read_key(cmp, keys, &id));
+  assert_int_equal(id, 0);
+  assert_true(cmp_read_nil(cmp));
+  assert_false(cmp_read_key(cmp, keys, &id));
+}
+
+void test_keys(void **state) {
+  static const char *const names[] = {
+    "id", "name", "email", "", "created_at"
+  };
+  static const char *const duplicates[] = { "id", "name", "id" };
+  char long_key[CMP_KEYS_MAX_KEY_SIZE + 2];
+  const char *too_long[1];
+  cmp_keys_t keys;
+  cmp_ctx_t cmp;
+  cmp_ctx_t mem;
+  buf_t buf;
+  uint8_t i;
+  uint8_t id;
+
+  (void)state;
+
+  memset(long_key, 'k', sizeof(long_key) - 1);
+  long_key[sizeof(long_key) - 1] = 0;
+
+  too_long[0] = long_key;
+
+  assert_false(cmp_keys_init(&keys, duplicates, 3));
+  assert_false(cmp_keys_init(&keys, too_long, 1));
+  assert_true(cmp_keys_init(&keys, names, 5));
+
+  setup_cmp_and_buf(&cmp, &buf);
+
+  /* Every key resolves to its own index */
+  for (i = 0; i < 5; i++) {
+    assert_true(cmp_write_str(&cmp, names[i], (uint32_t)strlen(names[i])));
+    M_BufferSeek(&buf, 0);
+    assert_true(cmp_read_key(&cmp, &keys, &id));
+    assert_int_equal(id, i);
+    M_BufferClear(&buf);
+  }
+
+  assert_true(cmp_write_map(&cmp, 6));
+  assert_true(cmp_write_str(&cmp, "email", 5));
+  assert_true(cmp_write_str(&cmp, "a@b.c", 5));
+  assert_true(cmp_write_str(&cmp, "emai", 4));
+  assert_true(cmp_write_true(&cmp));
+  assert_true(cmp_write_array(&cmp, 2));
+  assert_true(cmp_write_uinteger(&cmp, 1));
+  assert_true(cmp_write_uinteger(&cmp, 2));
+  assert_true(cmp_write_uinteger(&cmp, 7));
+  assert_true(cmp_write_str(&cmp, long_key, (uint32_t)strlen(long_key)));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_str(&cmp, "", 0));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_str(&cmp, "id", 2));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_str(&cmp, "na", 2));
+
+  /* Keys are copied out of streams... */
+  M_BufferSeek(&buf, 0);
+  buf.size--;
+  check_keys(&cmp, &keys);
+
+  /* ...and hashed in place in memory */
+  cmp_init_mem(&mem, buf.data, buf.size);
+  check_keys(&mem, &keys);
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+typedef struct {
+  bool active;
+  int16_t level;
+  uint32_t id;
+  int64_t balance;
+  char name[8];
+#ifndef CMP_NO_FLOAT
+  double score;
+#endif
+} account_t;
+
+static const cmp_field_t account_fields[] = {
+  { "active",  offsetof(account_t, active),  CMP_FIELD_BOOL,   0 },
+  { "level",   offsetof(account_t, level),   CMP_FIELD_SHORT,  0 },
+  { "id",      offsetof(account_t, id),      CMP_FIELD_UINT,   0 },
+  { "balance", offsetof(account_t, balance), CMP_FIELD_LONG,   0 },
+  { "name",    offsetof(account_t, name),    CMP_FIELD_STR,    8 },
+#ifndef CMP_NO_FLOAT
+  { "score",   offsetof(account_t, score),   CMP_FIELD_DOUBLE, 0 },
+#endif
+};
+
+void test_struct(void **state) {
+  const cmp_field_t *fields = account_fields;
+  static const cmp_field_t duplicates[] = {
+    { "id", 0, CMP_FIELD_INT, 0 },
+    { "id", 0, CMP_FIELD_INT, 0 },
+  };
+  static const cmp_field_t bad_type[] = {
+    { "id", 0, 99, 0 },
+  };
+  uint8_t field_count =
+    (uint8_t)(sizeof(account_fields) / sizeof(account_fields[0]));
+  cmp_schema_t schema;
+  account_t account;
+  buf_t buf;
+  cmp_ctx_t cmp;
+  uint8_t i;
+
+  (void)state;
+
+  assert_false(cmp_schema_init(&schema, duplicates, 2));
+  assert_true(cmp_schema_init(&schema, fields, field_count));
+
+  /* Every key finds its own field, so reading nil into it fails */
+  for (i = 0; i < field_count; i++) {
+    setup_cmp_and_buf(&cmp, &buf);
+    assert_true(cmp_write_map(&cmp, 1));
+    assert_true(cmp_write_str(&cmp, fields[i].key,
+                              (uint32_t)strlen(fields[i].key)));
+    assert_true(cmp_write_nil(&cmp));
+    M_BufferSeek(&buf, 0);
+    memset(&account, 0, sizeof(account));
+    assert_false(cmp_read_struct(&cmp, &schema, &account));
+    teardown_cmp_and_buf(&cmp, &buf);
+  }
+
+  setup_cmp_and_buf(&cmp, &buf);
+  assert_true(cmp_write_map(&cmp, 9));
+  assert_true(cmp_write_str(&cmp, "name", 4));
+  assert_true(cmp_write_str(&cmp, "carol", 5));
+  assert_true(cmp_write_str(&cmp, "nam", 3));
+  assert_true(cmp_write_str(&cmp, "ignored", 7));
+  assert_true(cmp_write_str(&cmp, "id", 2));
+  assert_true(cmp_write_uinteger(&cmp, 70000));
+  assert_true(cmp_write_uinteger(&cmp, 5));
+  assert_true(cmp_write_array(&cmp, 2));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_str(&cmp, "id", 2));
+  assert_true(cmp_write_uinteger(&cmp, 3));
+  assert_true(cmp_write_str(&cmp, "level", 5));
+  assert_true(cmp_write_integer(&cmp, -3));
+  assert_true(cmp_write_str(&cmp, "balance", 7));
+  assert_true(cmp_write_integer(&cmp, -5000000000LL));
+  assert_true(cmp_write_str(&cmp, "active", 6));
+  assert_true(cmp_write_true(&cmp));
+  assert_true(cmp_write_str(&cmp,
+    "a key that is longer than any of the keys in the schema", 55));
+  assert_true(cmp_write_true(&cmp));
+#ifndef CMP_NO_FLOAT
+  assert_true(cmp_write_str(&cmp, "score", 5));
+  assert_true(cmp_write_float(&cmp, 2.5f));
+#else
+  assert_true(cmp_write_str(&cmp, "score", 5));
+  assert_true(cmp_write_uinteger(&cmp, 2));
+#endif
+  assert_true(cmp_write_nil(&cmp));
+  M_BufferSeek(&buf, 0);
+  memset(&account, 0, sizeof(account));
+  assert_true(cmp_read_struct(&cmp, &schema, &account));
+  assert_true(account.active);
+  assert_int_equal(account.level, -3);
+  assert_int_equal(account.id, 70000);
+  assert_true(account.balance == -5000000000LL);
+  assert_string_equal(account.name, "carol");
+#ifndef CMP_NO_FLOAT
+  assert_true(account.score == 2.5);
+#endif
+  assert_true(cmp_read_nil(&cmp));
+
+  /* Strings that don't fit fail */
+  M_BufferClear(&buf);
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_str(&cmp, "name", 4));
+  assert_true(cmp_write_str(&cmp, "caroline", 8));
+  M_BufferSeek(&buf, 0);
+  assert_false(cmp_read_struct(&cmp, &schema, &account));
+  assert_string_equal(cmp_strerror(&cmp),
+    "Specified string data length is too long (> 0xFFFFFFFF)");
+
+  /* So do values of the wrong type, and fields of an unknown type */
+  M_BufferClear(&buf);
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_str(&cmp, "id", 2));
+  assert_true(cmp_write_integer(&cmp, -1));
+  M_BufferSeek(&buf, 0);
+  assert_false(cmp_read_struct(&cmp, &schema, &account));
+  assert_true(cmp_schema_init(&schema, bad_type, 1));
+  M_BufferSeek(&buf, 0);
+  assert_false(cmp_read_struct(&cmp, &schema, &account));
+  assert_string_equal(cmp_strerror(&cmp), "Invalid struct field type");
+
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_struct_writer(void **state) {
+  static const cmp_field_t note_fields[] = {
+    { "c", 0, CMP_FIELD_STR, 300 },
+  };
+  uint8_t field_count =
+    (uint8_t)(sizeof(account_fields) / sizeof(account_fields[0]));
+  cmp_schema_t schema;
+  account_t account;
+  account_t copy;
+  char note[300];
+  buf_t buf;
+  buf_t expected;
+  cmp_ctx_t cmp;
+  cmp_ctx_t reference;
+
+  (void)state;
+
+  memset(&account, 0, sizeof(account));
+  account.active = true;
+  account.level = -300;
+  account.id = 200;
+  account.balance = -5000000000LL;
+  strcpy(account.name, "dave");
+#ifndef CMP_NO_FLOAT
+  account.score = 0.1;
+#endif
+
+  assert_true(cmp_schema_init(&schema, account_fields, field_count));
+
+  /* Maps match what writing each key and value by hand gives */
+  M_BufferInit(&expected);
+  cmp_init(&reference, &expected, buf_reader, buf_skipper, buf_writer);
+  assert_true(cmp_write_map(&reference, field_count));
+  assert_true(cmp_write_str(&reference, "active", 6));
+  assert_true(cmp_write_bool(&reference, true));
+  assert_true(cmp_write_str(&reference, "level", 5));
+  assert_true(cmp_write_integer(&reference, -300));
+  assert_true(cmp_write_str(&reference, "id", 2));
+  assert_true(cmp_write_uinteger(&reference, 200));
+  assert_true(cmp_write_str(&reference, "balance", 7));
+  assert_true(cmp_write_integer(&reference, -5000000000LL));
+  assert_true(cmp_write_str(&reference, "name", 4));
+  assert_true(cmp_write_str(&reference, "dave", 4));
+#ifndef CMP_NO_FLOAT
+  assert_true(cmp_write_str(&reference, "score", 5));
+  assert_true(cmp_write_decimal(&reference, 0.1));
+#endif
+
+  setup_cmp_and_buf(&cmp, &buf);
+  cmp.write = counting_writer;
+  backend_calls = 0;
+  assert_true(cmp_write_struct(&cmp, &schema, &account));
+  assert_int_equal(backend_calls, 1);
+  assert_int_equal(buf.size, expected.size);
+  assert_memory_equal(buf.data, expected.data, expected.size);
+  assert_int_equal(cmp_sizeof_struct(&schema, &account), buf.size);
+
+  M_BufferSeek(&buf, 0);
+  memset(&copy, 0, sizeof(copy));
+  assert_true(cmp_read_struct(&cmp, &schema, &copy));
+  assert_memory_equal(&copy, &account, sizeof(account));
+
+  /* Arrays hold just the values */
+  M_BufferClear(&buf);
+  M_BufferClear(&expected);
+  assert_true(cmp_write_array(&reference, field_count));
+  assert_true(cmp_write_bool(&reference, true));
+  assert_true(cmp_write_integer(&reference, -300));
+  assert_true(cmp_write_uinteger(&reference, 200));
+  assert_true(cmp_write_integer(&reference, -5000000000LL));
+  assert_true(cmp_write_str(&reference, "dave", 4));
+#ifndef CMP_NO_FLOAT
+  assert_true(cmp_write_decimal(&reference, 0.1));
+#endif
+  assert_true(cmp_write_struct_array(&cmp, &schema, &account));
+  assert_int_equal(buf.size, expected.size);
+  assert_memory_equal(buf.data, expected.data, expected.size);
+  assert_int_equal(cmp_sizeof_struct_array(&schema, &account), buf.size);
+
+  /* Strings have to be terminated within their bound */
+  memset(account.name, 'x', sizeof(account.name));
+  assert_int_equal(cmp_sizeof_struct(&schema, &account), 0);
+  assert_false(cmp_write_struct(&cmp, &schema, &account));
+
+  /* Strings larger than the block are written straight through */
+  memset(note, 'n', sizeof(note) - 1);
+  note[sizeof(note) - 1] = 0;
+  assert_true(cmp_schema_init(&schema, note_fields, 1));
+  M_BufferClear(&buf);
+  assert_true(cmp_write_struct(&cmp, &schema, note));
+  assert_int_equal(cmp_sizeof_struct(&schema, note), buf.size);
+  assert_int_equal(buf.size, 1 + 2 + 3 + 299);
+  M_BufferSeek(&buf, 0);
+  memset(note, 0, sizeof(note));
+  assert_true(cmp_read_struct(&cmp, &schema, note));
+  assert_int_equal(strlen(note), 299);
+
+  M_BufferFree(&expected);
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_version(void **state) {
+  uint32_t version = cmp_version();
+  uint32_t mp_version = cmp_mp_version();
+
+  (void)state;
+  (void)version;
+  (void)mp_version;
+}
+
+static bool canonicalize(char *data, size_t size, char *out_data,
+                                                  size_t out_size,
+                                                  cmp_ctx_t *out) {
+  cmp_map_entry_t entries[8];
+  cmp_ctx_t in;
+
+  cmp_init_mem_reader(&in, data, size);
+  cmp_init_mem(out, out_data, out_size);
+
+  if (!cmp_write_canonical(&in, out, entries, 8)) {
+    out->error = in.error ? in.error : out->error;
+    return false;
+  }
+
+  return true;
+}
+
+void test_canonical(void **state) {
+  char data[256];
+  char expected[256];
+  char out_data[256];
+  char other_data[256];
+  cmp_map_entry_t entries[1];
+  cmp_ctx_t cmp;
+  cmp_ctx_t out;
+  cmp_ctx_t other;
+  size_t size;
+
+  (void)state;
+
+  /* Wide encodings are narrowed and map keys sorted, inside and out */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map32(&cmp, 4));
+  assert_true(cmp_write_str16(&cmp, "aa", 2));
+  assert_true(cmp_write_array32(&cmp, 3));
+  assert_true(cmp_write_u32(&cmp, 5));
+  assert_true(cmp_write_s64(&cmp, -1));
+  assert_true(cmp_write_s16(&cmp, 300));
+  assert_true(cmp_write_str8(&cmp, "b", 1));
+  assert_true(cmp_write_map16(&cmp, 2));
+  assert_true(cmp_write_str32(&cmp, "z", 1));
+  assert_true(cmp_write_bin16(&cmp, "xy", 2));
+  assert_true(cmp_write_str(&cmp, "y", 1));
+  assert_true(cmp_write_ext32(&cmp, 1, 4, "abcd"));
+  assert_true(cmp_write_u64(&cmp, 1));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_s8(&cmp, -2));
+  assert_true(cmp_write_true(&cmp));
+  size = cmp_mem_tell(&cmp);
+
+  cmp_init_mem(&cmp, expected, sizeof(expected));
+  assert_true(cmp_write_map(&cmp, 4));
+  assert_true(cmp_write_uinteger(&cmp, 1));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_str(&cmp, "b", 1));
+  assert_true(cmp_write_map(&cmp, 2));
+  assert_true(cmp_write_str(&cmp, "y", 1));
+  assert_true(cmp_write_fixext4(&cmp, 1, "abcd"));
+  assert_true(cmp_write_str(&cmp, "z", 1));
+  assert_true(cmp_write_bin(&cmp, "xy", 2));
+  assert_true(cmp_write_str(&cmp, "aa", 2));
+  assert_true(cmp_write_array(&cmp, 3));
+  assert_true(cmp_write_uinteger(&cmp, 5));
+  assert_true(cmp_write_integer(&cmp, -1));
+  assert_true(cmp_write_uinteger(&cmp, 300));
+  assert_true(cmp_write_integer(&cmp, -2));
+  assert_true(cmp_write_true(&cmp));
+
+  assert_true(canonicalize(data, size, out_data, sizeof(out_data), &out));
+  assert_int_equal(cmp_mem_tell(&out), cmp_mem_tell(&cmp));
+  assert_memory_equal(out_data, expected, cmp_mem_tell(&cmp));
+
+  /* Canonical output is its own canonical form */
+  assert_true(canonicalize(
+    out_data, cmp_mem_tell(&out), other_data, sizeof(other_data), &other
+  ));
+  assert_int_equal(cmp_mem_tell(&other), cmp_mem_tell(&out));
+  assert_memory_equal(other_data, out_data, cmp_mem_tell(&out));
+
+  /* Equal maps come out the same whatever order their keys were in */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 3));
+  assert_true(cmp_write_str(&cmp, "c", 1));
+  assert_true(cmp_write_u8(&cmp, 3));
+  assert_true(cmp_write_str(&cmp, "a", 1));
+  assert_true(cmp_write_u8(&cmp, 1));
+  assert_true(cmp_write_str(&cmp, "b", 1));
+  assert_true(cmp_write_u8(&cmp, 2));
+  assert_true(canonicalize(
+    data, cmp_mem_tell(&cmp), out_data, sizeof(out_data), &out
+  ));
+
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 3));
+  assert_true(cmp_write_str(&cmp, "b", 1));
+  assert_true(cmp_write_uinteger(&cmp, 2));
+  assert_true(cmp_write_str(&cmp, "c", 1));
+  assert_true(cmp_write_uinteger(&cmp, 3));
+  assert_true(cmp_write_str(&cmp, "a", 1));
+  assert_true(cmp_write_uinteger(&cmp, 1));
+  assert_true(canonicalize(
+    data, cmp_mem_tell(&cmp), other_data, sizeof(other_data), &other
+  ));
+  assert_int_equal(cmp_mem_tell(&other), cmp_mem_tell(&out));
+  assert_memory_equal(other_data, out_data, cmp_mem_tell(&out));
+
+#ifndef CMP_NO_FLOAT
+  /* Doubles that fit in floats become floats */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_array(&cmp, 2));
+  assert_true(cmp_write_double(&cmp, 1.5));
+  assert_true(cmp_write_double(&cmp, 0.1));
+  assert_true(canonicalize(
+    data, cmp_mem_tell(&cmp), out_data, sizeof(out_data), &out
+  ));
+  assert_int_equal(cmp_mem_tell(&out), 1 + 5 + 9);
+#endif
+
+  /* Keys that differ only in encoding are duplicates */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 2));
+  assert_true(cmp_write_u16(&cmp, 7));
+  assert_true(cmp_write_nil(&cmp));
+  assert_true(cmp_write_s32(&cmp, 7));
+  assert_true(cmp_write_nil(&cmp));
+  assert_false(canonicalize(
+    data, cmp_mem_tell(&cmp), out_data, sizeof(out_data), &out
+  ));
+  assert_string_equal(cmp_strerror(&out), "Duplicate map key");
+
+  /* Keys can't be containers */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_array(&cmp, 0));
+  assert_true(cmp_write_nil(&cmp));
+  assert_false(canonicalize(
+    data, cmp_mem_tell(&cmp), out_data, sizeof(out_data), &out
+  ));
+  assert_string_equal(cmp_strerror(&out), "Invalid type");
+
+  /* Nested maps need entries of their own */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_str(&cmp, "a", 1));
+  assert_true(cmp_write_map(&cmp, 1));
+  assert_true(cmp_write_str(&cmp, "b", 1));
+  assert_true(cmp_write_nil(&cmp));
+  size = cmp_mem_tell(&cmp);
+  cmp_init_mem_reader(&cmp, data, size);
+  cmp_init_mem(&out, out_data, sizeof(out_data));
+  assert_false(cmp_write_canonical(&cmp, &out, entries, 1));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Too many map entries for the entries given"
+  );
+
+  /* Input has to be in memory */
+  cmp_init(&cmp, NULL, buf_reader, buf_skipper, buf_writer);
+  assert_false(cmp_write_canonical(&cmp, &out, entries, 1));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Operation requires a memory context"
+  );
+}
+
+void test_string_table(void **state) {
+  static const char *const keys[] = { "timestamp", "message", "id" };
+  char data[1024];
+  char plain[1024];
+  buf_t buf;
+  cmp_buffered_t buffered;
+  cmp_strings_t writer;
+  cmp_strings_t reader;
+  cmp_ctx_t cmp;
+  cmp_ctx_t other;
+  const char *view;
+  uint32_t size;
+  uint64_t u64;
+  uint8_t ref;
+  size_t i;
+  size_t j;
+
+  (void)state;
+
+  cmp_strings_init(&writer, 5);
+  cmp_init_mem(&cmp, data, sizeof(data));
+  cmp_init_mem(&other, plain, sizeof(plain));
+
+  for (i = 0; i < 10; i++) {
+    assert_true(cmp_write_map(&cmp, 3));
+    assert_true(cmp_write_map(&other, 3));
+
+    for (j = 0; j < 3; j++) {
+      size = (uint32_t)strlen(keys[j]);
+      assert_true(cmp_write_table_str(&cmp, &writer, keys[j], size));
+      assert_true(cmp_write_str(&other, keys[j], size));
+      assert_true(cmp_write_uinteger(&cmp, i));
+      assert_true(cmp_write_uinteger(&other, i));
+    }
+  }
+
+  /* Only the first of each key is inline; short keys always are */
+  assert_int_equal(
+    cmp_mem_tell(&cmp),
+    cmp_mem_tell(&other) - (9 * ((1 + 9 - 3) + (1 + 7 - 3)))
+  );
+
+  /* Reading builds the same table and resolves references into the data */
+  cmp_strings_init(&reader, 5);
+  cmp_init_mem_reader(&other, data, cmp_mem_tell(&cmp));
+
+  for (i = 0; i < 10; i++) {
+    assert_true(cmp_read_map(&other, &size));
+    assert_int_equal(size, 3);
+
+    for (j = 0; j < 3; j++) {
+      assert_true(cmp_read_table_str(&other, &reader, &view, &size));
+      assert_int_equal(size, strlen(keys[j]));
+      assert_memory_equal(view, keys[j], size);
+      assert_true(view >= data && view < data + sizeof(data));
+      assert_true(cmp_read_uinteger(&other, &u64));
+      assert_int_equal(u64, i);
+    }
+  }
+
+  assert_int_equal(cmp_mem_tell(&other), cmp_mem_tell(&cmp));
+
+  /* Plain strings read through a table too */
+  cmp_strings_init(&reader, 5);
+  cmp_init_mem_reader(&other, plain, sizeof(plain));
+  assert_true(cmp_read_map(&other, &size));
+  assert_true(cmp_read_table_str(&other, &reader, &view, &size));
+  assert_int_equal(size, 9);
+  assert_memory_equal(view, "timestamp", 9);
+
+  /* Once the table is full, new strings stay inline */
+  cmp_strings_init(&writer, 5);
+  {
+    static char names[CMP_STRINGS_MAX_COUNT + 1][8];
+
+    for (i = 0; i <= CMP_STRINGS_MAX_COUNT; i++) {
+      sprintf(names[i], "key%03u", (unsigned)i);
+      cmp_init_mem(&cmp, data, sizeof(data));
+      assert_true(cmp_write_table_str(&cmp, &writer, names[i], 6));
+    }
+
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_table_str(
+      &cmp, &writer, names[CMP_STRINGS_MAX_COUNT - 1], 6
+    ));
+    assert_int_equal(cmp_mem_tell(&cmp), 3);
+
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_table_str(
+      &cmp, &writer, names[CMP_STRINGS_MAX_COUNT], 6
+    ));
+    assert_int_equal(cmp_mem_tell(&cmp), 7);
+  }
+
+  /* References have to be to strings already in the table */
+  cmp_strings_init(&reader, 5);
+  ref = 0;
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_fixext1(&cmp, 5, &ref));
+  cmp_init_mem_reader(&cmp, data, sizeof(data));
+  assert_false(cmp_read_table_str(&cmp, &reader, &view, &size));
+  assert_string_equal(cmp_strerror(&cmp), "Invalid string table reference");
+
+  /* ...and of the table's ext type */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_fixext1(&cmp, 6, &ref));
+  cmp_init_mem_reader(&cmp, data, sizeof(data));
+  assert_false(cmp_read_table_str(&cmp, &reader, &view, &size));
+  assert_string_equal(cmp_strerror(&cmp), "Invalid type");
+
+  /* Reading needs a memory context, whose data stays put */
+  setup_cmp_and_buf(&cmp, &buf);
+  assert_true(cmp_write_str(&cmp, "timestamp", 9));
+  M_BufferSeek(&buf, 0);
+  assert_false(cmp_read_table_str(&cmp, &reader, &view, &size));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Operation requires a memory context"
+  );
+  M_BufferSeek(&buf, 0);
+  cmp_init_buffered_reader(
+    &cmp, &buffered, &buf, buf_filler, NULL, plain, sizeof(plain)
+  );
+  assert_false(cmp_read_table_str(&cmp, &reader, &view, &size));
+  assert_string_equal(
+    cmp_strerror(&cmp), "Operation requires a memory context"
+  );
+  teardown_cmp_and_buf(&cmp, &buf);
+}
+
+void test_timestamp(void **state) {
+  static const struct {
+    int64_t seconds;
+    uint32_t nanoseconds;
+    size_t size;
+  } cases[] = {
+    { 0,                          0,         6  },
+    { INT64_C(0xFFFFFFFF),        0,         6  },
+    { INT64_C(0x100000000),       0,         10 },
+    { 1,                          1,         10 },
+    { INT64_C(0x3FFFFFFFF),       999999999, 10 },
+    { INT64_C(0x400000000),       0,         15 },
+    { -1,                         0,         15 },
+    { INT64_MIN,                  999999999, 15 },
+    { INT64_MAX,                  123,       15 }
+  };
+  uint8_t data[32];
+  uint8_t ext[12];
+  cmp_ctx_t cmp;
+  cmp_object_t obj;
+  int64_t seconds;
+  uint32_t nanoseconds;
+  int8_t type;
+  uint32_t size;
+  size_t i;
+
+  (void)state;
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(
+      cmp_write_timestamp(&cmp, cases[i].seconds, cases[i].nanoseconds)
+    );
+    assert_int_equal(cmp_mem_tell(&cmp), cases[i].size);
+
+    cmp_init_mem_reader(&cmp, data, cases[i].size);
+    assert_true(cmp_read_timestamp(&cmp, &seconds, &nanoseconds));
+    assert_true(seconds == cases[i].seconds);
+    assert_int_equal(nanoseconds, cases[i].nanoseconds);
+
+    /* They're ordinary exts of type -1 to everything else */
+    cmp_init_mem_reader(&cmp, data, cases[i].size);
+    assert_true(cmp_read_ext(&cmp, &type, &size, ext));
+    assert_int_equal(type, -1);
+    assert_int_equal(size, cases[i].size - (cases[i].size == 15 ? 3 : 2));
+
+    cmp_init_mem_reader(&cmp, data, cases[i].size);
+    assert_true(cmp_read_object(&cmp, &obj));
+    assert_true(cmp_object_is_timestamp(&obj));
+    assert_true(cmp_object_to_timestamp(&cmp, &obj, &seconds, &nanoseconds));
+    assert_true(seconds == cases[i].seconds);
+    assert_int_equal(nanoseconds, cases[i].nanoseconds);
+  }
+
+  /* Nanoseconds have to be below a second */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_false(cmp_write_timestamp(&cmp, 0, 1000000000));
+  assert_string_equal(cmp_strerror(&cmp), "Invalid timestamp");
+
+  memset(ext, 0xFF, sizeof(ext));
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_ext(&cmp, -1, 12, ext));
+  cmp_init_mem_reader(&cmp, data, sizeof(data));
+  assert_false(cmp_read_timestamp(&cmp, &seconds, &nanoseconds));
+  assert_string_equal(cmp_strerror(&cmp), "Invalid timestamp");
+
+  /* Other exts aren't timestamps */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_fixext4(&cmp, 1, ext));
+  assert_true(cmp_write_ext(&cmp, -1, 5, ext));
+  cmp_init_mem_reader(&cmp, data, sizeof(data));
+  assert_true(cmp_read_object(&cmp, &obj));
+  assert_false(cmp_object_is_timestamp(&obj));
+  assert_true(cmp_skip_object_rest(&cmp, &obj));
+  assert_false(cmp_read_timestamp(&cmp, &seconds, &nanoseconds));
+  assert_string_equal(cmp_strerror(&cmp), "Invalid type");
+}
+
+/* Writes what `write` writes through an encoder, checking it against `cmp` */
+#define check_encoded(write) do {                                             \
+    setup_cmp_and_buf(&enc, &buf);                                            \
+    cmp_init_encoder(&enc, &encoder, &buf, chunk_writer);                     \
+    assert_true(write(&enc));                                                 \
+    while (cmp_encoder_pending(&enc)) {                                       \
+      size_t pending_ = cmp_encoder_pending(&enc);                            \
+      assert_true(cmp_encoder_resume(&enc) < pending_);                       \
+    }                                                                         \
+    assert_int_equal(M_BufferGetCursor(&buf), cmp_mem_tell(&cmp));            \
+    assert_memory_equal(buf.data, data, cmp_mem_tell(&cmp));                  \
+    teardown_cmp_and_buf(&enc, &buf);                                         \
+  } while (0)
+
+void test_encoder_blocks(void **state) {
+  static const size_t chunks[] = { 1, 7, 10, 1000 };
+  int32_t ints[100];
+  account_t account;
+  cmp_schema_t schema;
+  char data[1024];
+  char packed[1024];
+  char json[1024];
+  uint32_t sizes[4];
+  size_t packed_size;
+  size_t json_size;
+  buf_t buf;
+  cmp_ctx_t cmp;
+  cmp_ctx_t in;
+  cmp_ctx_t enc;
+  cmp_encoder_t encoder;
+  size_t i;
+
+  (void)state;
+
+  for (i = 0; i < 100; i++)
+    ints[i] = (int32_t)(i * 100000) - 3000000;
+
+  memset(&account, 0, sizeof(account));
+  account.active = true;
+  account.level = -300;
+  account.id = 70000;
+  account.balance = INT64_MIN;
+  strcpy(account.name, "someone");
+  assert_true(cmp_schema_init(
+    &schema, account_fields,
+    (uint8_t)(sizeof(account_fields) / sizeof(account_fields[0]))
+  ));
+
+  cmp_init_mem(&cmp, packed, sizeof(packed));
+  assert_true(cmp_write_map(&cmp, 2));
+  assert_true(cmp_write_str(&cmp, "ints", 4));
+  assert_true(cmp_write_int_array(&cmp, ints, 60));
+  assert_true(cmp_write_str(&cmp, "text", 4));
+  assert_true(cmp_write_str(&cmp, "a \"quoted\"\nline", 15));
+  packed_size = cmp_mem_tell(&cmp);
+
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    writer_chunk = chunks[i];
+
+    /* Blocks the backend only takes some of are kept until resumed */
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_int_array(&cmp, ints, 40));
+#define write_ints(ctx) cmp_write_int_array(ctx, ints, 40)
+    check_encoded(write_ints);
+#undef write_ints
+
+    /* ...and a backend that keeps taking some gets every block */
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_int_array(&cmp, ints, 100));
+    assert_true(cmp_mem_tell(&cmp) > 256);
+#define write_ints(ctx) cmp_write_int_array(ctx, ints, 100)
+    check_encoded(write_ints);
+#undef write_ints
+
+    /* Structs are written in blocks too */
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_struct(&cmp, &schema, &account));
+    assert_true(cmp_mem_tell(&cmp) > 40);
+#define write_account(ctx) cmp_write_struct(ctx, &schema, &account)
+    check_encoded(write_account);
+#undef write_account
+
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_struct_array(&cmp, &schema, &account));
+#define write_account(ctx) cmp_write_struct_array(ctx, &schema, &account)
+    check_encoded(write_account);
+#undef write_account
+
+    /* So is JSON */
+    cmp_init_mem_reader(&in, packed, packed_size);
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_json(&in, &cmp));
+    assert_true(cmp_mem_tell(&cmp) > 256);
+#define write_json(ctx) \
+    (cmp_init_mem_reader(&in, packed, packed_size), cmp_write_json(&in, ctx))
+    check_encoded(write_json);
+#undef write_json
+
+    /* ...and JSON input */
+    json_size = cmp_mem_tell(&cmp);
+    memcpy(json, data, json_size);
+    cmp_init_mem(&cmp, data, sizeof(data));
+    assert_true(cmp_write_from_json(&cmp, json, json_size, sizes, 4));
+    assert_true(cmp_mem_tell(&cmp) > 256);
+#define write_from_json(ctx) cmp_write_from_json(ctx, json, json_size, sizes, 4)
+    check_encoded(write_from_json);
+#undef write_from_json
+  }
+
+  /* A backend that takes nothing leaves a block pending */
+  cmp_init_mem(&cmp, data, sizeof(data));
+  assert_true(cmp_write_int_array(&cmp, ints, 40));
+  setup_cmp_and_buf(&enc, &buf);
+  cmp_init_encoder(&enc, &encoder, &buf, budget_writer);
+  writer_budget = 0;
+  assert_true(cmp_write_int_array(&enc, ints, 40));
+  assert_int_equal(cmp_encoder_pending(&enc), cmp_mem_tell(&cmp));
+  writer_budget = 1000;
+  assert_int_equal(cmp_encoder_resume(&enc), 0);
+  assert_memory_equal(buf.data, data, cmp_mem_tell(&cmp));
+  teardown_cmp_and_buf(&enc, &buf);
+
+  /* ...but not more than the encoder can copy */
+  setup_cmp_and_buf(&enc, &buf);
+  cmp_init_encoder(&enc, &encoder, &buf, budget_writer);
+  writer_budget = 0;
+  assert_false(cmp_write_int_array(&enc, ints, 100));
+  assert_string_equal(cmp_strerror(&enc), "Error writing packed data");
+  teardown_cmp_and_buf(&enc, &buf);
 }
 
 /* vi: set et ts=2 sw=2: */
@@ -40,6 +40,28 @@ void test_float_flip(void **state);
 void test_skipping(void **state);
 void test_deprecated_limited_skipping(void **state);
 void test_errors(void **state);
+void test_mem(void **state);
+void test_views(void **state);
+void test_buffered(void **state);
+void test_sizeof(void **state);
+void test_decoder(void **state);
+void test_encoder(void **state);
+void test_typed_arrays(void **state);
+void test_tape(void **state);
+void test_nodes(void **state);
+void test_paths(void **state);
+void test_keys(void **state);
+void test_struct(void **state);
+void test_struct_writer(void **state);
+void test_records(void **state);
+void test_segments(void **state);
+void test_index(void **state);
+void test_json(void **state);
+void test_from_json(void **state);
+void test_canonical(void **state);
+void test_string_table(void **state);
+void test_timestamp(void **state);
+void test_encoder_blocks(void **state);
 void test_version(void **state);
 
 /* vi: set et ts=2 sw=2: */